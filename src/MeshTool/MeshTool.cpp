@@ -34,6 +34,7 @@
 #include "GISUtils.h"
 #include "FileUtils.h"
 #include "PlatformUtils.h"
+#include "PerfUtils.h"
 #if LIN
 #include <execinfo.h>
 #include <stdarg.h>
@@ -108,11 +109,12 @@ int	main(int argc, char * argv[])
 		XESInit(region,false);			// no forests
 		MakeDirectRules();
 
-		if(argc != 6)
+		if(argc != 6 && argc != 7)
 		{
-			fprintf(stderr, "USAGE: MeshTool <script.txt> <file.xes> <file.hgt> <dir_base> <file.dsf>\n");
+			fprintf(stderr, "USAGE: MeshTool <script.txt> <file.xes> <file.hgt> <dir_base> <file.dsf> [<profile.json>]\n");
 			exit(1);
 		}
+		perf_profile_enable(argc == 7);
 
 		DEMGeo	dem_elev;
 
@@ -188,7 +190,10 @@ int	main(int argc, char * argv[])
 		int				is_layer = 0;
 		int				param1;
 		float			param2;
-		MT_StartCreate(argv[2], dem_elev, die_parse2);
+		{
+			StPerfScope	profile("MT_StartCreate");
+			MT_StartCreate(argv[2], dem_elev, die_parse2);
+		}
 
 		line_num=0;
 		while (fgets(buf, sizeof(buf), script))
@@ -400,9 +405,17 @@ int	main(int argc, char * argv[])
 		}
 		fclose(script);
 
-		MT_FinishCreate();
+		{
+			StPerfScope	profile("MT_FinishCreate");
+			MT_FinishCreate();
+		}
+		{
+			StPerfScope	profile("MT_MakeDSF");
+			MT_MakeDSF(region, argv[4], argv[5]);
+		}
 
-		MT_MakeDSF(region, argv[4], argv[5]);
+		if (argc == 7 && !perf_profile_write(argv[6], "MeshTool"))
+			fprintf(stderr, "Could not write profile %s\n", argv[6]);
 
 
 	} catch (std::exception& e) {
@@ -714,25 +714,16 @@ void	TextScanner_TokenizeLine(MFTextScanner * inScanner, const char * inDelim, c
 {
 	int n;
 	int tokens_so_far = 0;
-	static	char	lastDelim[256] = { 0 };
-	static	char	lastTerm[256] = { 0 };
-	static	char	delimLookup[256] = { 0 };
-	static	char	termLookup[256] = { 0 };
-	if (strcmp(lastDelim, inDelim))
-	{
-		memset(delimLookup, 0, sizeof(delimLookup));
-		n = 0;
-		while (inDelim[n])
-			delimLookup[(unsigned char) inDelim[n++]] = 1;
-	}
-	if (strcmp(lastTerm, inTerm))
-	{
-		memset(termLookup, 0, sizeof(termLookup));
-		n = 0;
-		while (inTerm[n])
-			termLookup[(unsigned char) inTerm[n++]] = 1;
-		termLookup[0] = 1;	// Null is always a terminator, not that we should ever hit this!
-	}
+	// Lookups are per call (not static) so that scanners can be run on several threads at once.
+	char	delimLookup[256] = { 0 };
+	char	termLookup[256] = { 0 };
+	n = 0;
+	while (inDelim[n])
+		delimLookup[(unsigned char) inDelim[n++]] = 1;
+	n = 0;
+	while (inTerm[n])
+		termLookup[(unsigned char) inTerm[n++]] = 1;
+	termLookup[0] = 1;	// Null is always a terminator, not that we should ever hit this!
 
 	const unsigned char * begin = (const unsigned char *) inScanner->mRunBegin;
 	const unsigned char * end = (const unsigned char *) inScanner->mRunEnd;
@@ -743,7 +734,7 @@ void	TextScanner_TokenizeLine(MFTextScanner * inScanner, const char * inDelim, c
 			++begin;
 
 		// If the token starts with a # or we hit the newline, we're done, bail.
-		if (termLookup[*begin]) return;
+		if (begin == end || termLookup[*begin]) return;
 
 		// Mark the token start.
 		const unsigned char * tokenStart = begin;
@@ -762,21 +753,39 @@ void	TextScanner_TokenizeLine(MFTextScanner * inScanner, const char * inDelim, c
 	}
 }
 
-static 	bool TokenizeToVector(const char * inBegin, const char * inEnd, void * inRef)
+// Format scanning is the inner loop of every big text file we read (apt.dat has millions of lines), so
+// tokens are converted straight out of the line with no per-token strings.  Same tokenizing rules as
+// TextScanner_TokenizeLine with " \t" delimiters and "\r\n" terminators; numbers convert like atoi/atof.
+inline bool	scan_is_delim(char c) { return c == ' ' || c == '\t'; }
+inline bool	scan_is_term(char c) { return c == '\r' || c == '\n' || c == 0; }
+
+static int	scan_int(const char * b, const char * e)
 {
-	pair<vector<string>,int> * v = (pair<vector<string>,int> *) inRef;
+	bool neg = false;
+	if (b < e && (*b == '-' || *b == '+'))
+		neg = (*b++ == '-');
+	int v = 0;
+	while (b < e && *b >= '0' && *b <= '9')
+		v = v * 10 + (*b++ - '0');
+	return neg ? -v : v;
+}
 
-	v->first.push_back(string(inBegin, inEnd));
-	return v->first.size() < v->second;
+static double	scan_double(const char * b, const char * e)
+{
+	char	buf[64];
+	size_t	len = min<size_t>(e - b, sizeof(buf) - 1);
+	memcpy(buf, b, len);
+	buf[len] = 0;
+	return atof(buf);
 }
 
 int				TextScanner_FormatScan(MFTextScanner * inScanner, const char * fmt, ...)
 {
-	pair<vector<string>, int>	tokens;
 	const  char * stop_pt = strstr(fmt, "|");
 	int inMax = (stop_pt ? (stop_pt - fmt - 1) : -1);
-	tokens.second = strlen(fmt);
-	TextScanner_TokenizeLine(inScanner, " \t", "\r\n", inMax, TokenizeToVector,&tokens);
+	const char * p = inScanner->mRunBegin;
+	const char * e = inScanner->mRunEnd;
+
 	va_list	arg;
 	va_start(arg, fmt);
 	int n = 0;
@@ -787,15 +796,27 @@ int				TextScanner_FormatScan(MFTextScanner * inScanner, const char * fmt, ...)
 	char * tptr;
 	string *	Tptr;
 
-	while (*fmt && n < tokens.first.size())
+	while (*fmt)
 	{
+		while (p < e && scan_is_delim(*p))
+			++p;
+		if (p == e || scan_is_term(*p))
+			break;
+
+		// The token after inMax runs to the end of the line, white space and all.
+		const char * t = p;
+		if (n == inMax)
+			while (p < e && !scan_is_term(*p)) ++p;
+		else
+			while (p < e && !scan_is_delim(*p) && !scan_is_term(*p)) ++p;
+
 		switch(*fmt) {
-		case 'f':	fptr = va_arg(arg, float*);			*fptr = atof(tokens.first[n].c_str());			break;
-		case 'd':	dptr = va_arg(arg, double*);		*dptr = atof(tokens.first[n].c_str());			break;
-		case 'i':	iptr = va_arg(arg, int*);			*iptr = atoi(tokens.first[n].c_str());			break;
-		case 's':	sptr = va_arg(arg, short*);			*sptr = atoi(tokens.first[n].c_str());			break;
-		case 't':	tptr = va_arg(arg, char*);			strcpy(tptr,tokens.first[n].c_str());				break;
-		case 'T':	Tptr = va_arg(arg, string*);		*Tptr = tokens.first[n];							break;
+		case 'f':	fptr = va_arg(arg, float*);			*fptr = scan_double(t, p);						break;
+		case 'd':	dptr = va_arg(arg, double*);		*dptr = scan_double(t, p);						break;
+		case 'i':	iptr = va_arg(arg, int*);			*iptr = scan_int(t, p);							break;
+		case 's':	sptr = va_arg(arg, short*);			*sptr = scan_int(t, p);							break;
+		case 't':	tptr = va_arg(arg, char*);			memcpy(tptr, t, p - t); tptr[p - t] = 0;		break;
+		case 'T':	Tptr = va_arg(arg, string*);		Tptr->assign(t, p);								break;
 		}
 		++fmt;
 		++n;
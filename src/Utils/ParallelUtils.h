@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2004, Laminar Research.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef PARALLELUTILS_H
+#define PARALLELUTILS_H
+
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <vector>
+
+/*
+
+	PARALLEL UTILS - THEORY OF OPERATION
+
+	These are the simplest possible fork-join helpers: a range of integer indices
+	(usually raster rows, faces or chains) is handed out in blocks of 'grain' indices
+	to a set of std::threads that live only for the duration of the call.  The calling
+	thread works too, so with one thread there is no thread creation at all and the
+	work runs in index order, exactly as a plain for loop would.
+
+	Each callback also gets a worker index in [0, parallel_thread_count()) so that
+	callers can keep per-thread scratch buffers or partial results without locking.
+
+	Exceptions (CGAL failures are thrown as exceptions in the tools) are caught on
+	the worker and the first one is rethrown on the calling thread after the join.
+
+ */
+
+// Number of threads to use; 0 (the default) means one per hardware thread.  Tools
+// set this from the command line (e.g. -threads in GISTool).
+inline int&	parallel_thread_override(void) { static int n = 0; return n; }
+
+inline int	parallel_thread_count(void)
+{
+	int n = parallel_thread_override();
+	if (n > 0) return n;
+	n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+// Call func(lo, hi, worker) for consecutive blocks [lo,hi) covering [begin,end).
+template <typename F>
+void	parallel_for_blocks(int begin, int end, int grain, F func)
+{
+	if (end <= begin) return;
+	if (grain < 1) grain = 1;
+	int blocks = (end - begin + grain - 1) / grain;
+	int threads = parallel_thread_count();
+	if (threads > blocks) threads = blocks;
+
+	if (threads <= 1)
+	{
+		func(begin, end, 0);
+		return;
+	}
+
+	std::atomic<int>	next(begin);
+	std::exception_ptr	err;
+	std::atomic<bool>	failed(false);
+
+	auto worker = [&](int w) {
+		try {
+			while (!failed)
+			{
+				int lo = next.fetch_add(grain);
+				if (lo >= end) break;
+				int hi = (lo + grain < end) ? lo + grain : end;
+				func(lo, hi, w);
+			}
+		} catch (...) {
+			bool was = false;
+			if (failed.compare_exchange_strong(was, true))
+				err = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread>	pool;
+	pool.reserve(threads - 1);
+	for (int t = 1; t < threads; ++t)
+		pool.push_back(std::thread(worker, t));
+	worker(0);
+	for (auto& t : pool)
+		t.join();
+
+	if (err)
+		std::rethrow_exception(err);
+}
+
+// Call func(i, worker) for every i in [begin,end).
+template <typename F>
+void	parallel_for(int begin, int end, int grain, F func)
+{
+	parallel_for_blocks(begin, end, grain, [&func](int lo, int hi, int w) {
+		for (int i = lo; i < hi; ++i)
+			func(i, w);
+	});
+}
+
+#endif /* PARALLELUTILS_H */
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2004, Laminar Research.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#include "PerfUtils.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <stdio.h>
+
+#if LIN
+	#include <unistd.h>
+	#include <sys/resource.h>
+#elif APL
+	#include <mach/mach.h>
+	#include <sys/resource.h>
+#elif IBM
+	#include <psapi.h>
+	#if _MSC_VER
+		#pragma comment(lib, "psapi.lib")
+	#endif
+#endif
+
+void	perf_memory_kb(unsigned long long& outCurrent, unsigned long long& outPeak)
+{
+	outCurrent = outPeak = 0;
+	#if LIN
+		FILE * fi = fopen("/proc/self/statm", "r");
+		if (fi)
+		{
+			unsigned long long pages_total, pages_resident;
+			if (fscanf(fi, "%llu %llu", &pages_total, &pages_resident) == 2)
+				outCurrent = pages_resident * (unsigned long long) sysconf(_SC_PAGESIZE) / 1024ULL;
+			fclose(fi);
+		}
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF, &ru) == 0)
+			outPeak = ru.ru_maxrss;						// KB on Linux
+	#elif APL
+		mach_task_basic_info_data_t	info;
+		mach_msg_type_number_t		count = MACH_TASK_BASIC_INFO_COUNT;
+		if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS)
+			outCurrent = info.resident_size / 1024ULL;
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF, &ru) == 0)
+			outPeak = ru.ru_maxrss / 1024ULL;			// Bytes on OS X
+	#elif IBM
+		PROCESS_MEMORY_COUNTERS	pmc;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		{
+			outCurrent = pmc.WorkingSetSize / 1024ULL;
+			outPeak = pmc.PeakWorkingSetSize / 1024ULL;
+		}
+	#endif
+	if (outPeak < outCurrent) outPeak = outCurrent;
+}
+
+struct	perf_scope_rec_t {
+	std::string			name;
+	int					depth;
+	int					thread;
+	unsigned long long	start;			// microseconds since the profile started
+	unsigned long long	duration;		// microseconds
+	unsigned long long	rss_kb;			// at scope end
+	unsigned long long	peak_rss_kb;	// at scope end
+};
+
+struct	perf_profile_t {
+	std::mutex								lock;
+	std::atomic<bool>						enabled;
+	unsigned long long						origin;
+	std::vector<perf_scope_rec_t>			scopes;
+	std::map<std::string, long long>		counters;
+	std::atomic<int>						next_thread;
+
+	perf_profile_t() : enabled(false), origin(query_hpc()), next_thread(0) { }
+};
+
+static perf_profile_t&	perf_profile(void) { static perf_profile_t p; return p; }
+bool					perf_profile_enabled(void) { return perf_profile().enabled; }
+void					perf_profile_enable(bool e) { perf_profile().enabled = e; }
+
+// Small stable thread numbers for the report, main thread (first to profile) is 0.
+static int				perf_thread_index(void) { static thread_local int idx = perf_profile().next_thread++; return idx; }
+static int&				perf_thread_depth(void) { static thread_local int depth = 0; return depth; }
+
+void	perf_count(const char * inName, long long inDelta)
+{
+	perf_profile_t& p(perf_profile());
+	if (!p.enabled) return;
+	std::lock_guard<std::mutex> guard(p.lock);
+	p.counters[inName] += inDelta;
+}
+
+StPerfScope::StPerfScope(const char * inName) : mName(inName), mStart(0), mThread(0), mActive(perf_profile_enabled())
+{
+	if (!mActive) return;
+	mThread = perf_thread_index();
+	++perf_thread_depth();
+	mStart = query_hpc();
+}
+
+StPerfScope::~StPerfScope()
+{
+	if (!mActive) return;
+	unsigned long long stop = query_hpc();
+	perf_profile_t& p(perf_profile());
+	perf_scope_rec_t	r;
+	r.name = mName;
+	r.depth = --perf_thread_depth();
+	r.thread = mThread;
+	r.start = mStart > p.origin ? hpc_to_microseconds(mStart - p.origin) : 0;
+	r.duration = hpc_to_microseconds(stop - mStart);
+	perf_memory_kb(r.rss_kb, r.peak_rss_kb);
+	std::lock_guard<std::mutex> guard(p.lock);
+	p.scopes.push_back(r);
+}
+
+static void	perf_json_string(FILE * fi, const std::string& s)
+{
+	fputc('"', fi);
+	for (std::string::const_iterator c = s.begin(); c != s.end(); ++c)
+	{
+		if (*c == '"' || *c == '\\')	fprintf(fi, "\\%c", *c);
+		else if ((unsigned char) *c < 0x20)	fprintf(fi, "\\u%04x", (unsigned char) *c);
+		else							fputc(*c, fi);
+	}
+	fputc('"', fi);
+}
+
+bool	perf_profile_write(const char * inPath, const char * inTool)
+{
+	perf_profile_t& p(perf_profile());
+	std::lock_guard<std::mutex> guard(p.lock);
+
+	FILE * fi = fopen(inPath, "w");
+	if (fi == NULL) return false;
+
+	unsigned long long	rss, peak;
+	perf_memory_kb(rss, peak);
+
+	std::string path(inPath);
+	bool trace = path.size() >= 6 && path.compare(path.size() - 6, 6, ".trace") == 0;
+	if (trace)
+	{
+		fprintf(fi, "{\"traceEvents\":[\n");
+		bool first = true;
+		for (std::vector<perf_scope_rec_t>::iterator s = p.scopes.begin(); s != p.scopes.end(); ++s)
+		{
+			fprintf(fi, "%s{\"name\":", first ? "" : ",\n");
+			perf_json_string(fi, s->name);
+			fprintf(fi, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"rss_kb\":%llu,\"peak_rss_kb\":%llu}}",
+				s->thread, s->start, s->duration, s->rss_kb, s->peak_rss_kb);
+			// A counter track so memory shows up as a graph under the scopes.
+			fprintf(fi, ",\n{\"name\":\"rss_kb\",\"ph\":\"C\",\"pid\":1,\"ts\":%llu,\"args\":{\"rss_kb\":%llu}}",
+				s->start + s->duration, s->rss_kb);
+			first = false;
+		}
+		fprintf(fi, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":", first ? "" : ",\n");
+		perf_json_string(fi, inTool);
+		fprintf(fi, "}}\n],\n\"otherData\":{\"peak_rss_kb\":%llu", peak);
+		for (std::map<std::string, long long>::iterator c = p.counters.begin(); c != p.counters.end(); ++c)
+		{
+			fprintf(fi, ",");
+			perf_json_string(fi, c->first);
+			fprintf(fi, ":%lld", c->second);
+		}
+		fprintf(fi, "}}\n");
+	}
+	else
+	{
+		fprintf(fi, "{\n\"tool\":");
+		perf_json_string(fi, inTool);
+		fprintf(fi, ",\n\"total_us\":%llu,\n\"rss_kb\":%llu,\n\"peak_rss_kb\":%llu,\n\"counters\":{",
+			(unsigned long long) hpc_to_microseconds(query_hpc() - p.origin), rss, peak);
+		for (std::map<std::string, long long>::iterator c = p.counters.begin(); c != p.counters.end(); ++c)
+		{
+			fprintf(fi, "%s\n\t", c == p.counters.begin() ? "" : ",");
+			perf_json_string(fi, c->first);
+			fprintf(fi, ":%lld", c->second);
+		}
+		fprintf(fi, "\n},\n\"scopes\":[");
+		for (std::vector<perf_scope_rec_t>::iterator s = p.scopes.begin(); s != p.scopes.end(); ++s)
+		{
+			fprintf(fi, "%s\n\t{\"name\":", s == p.scopes.begin() ? "" : ",");
+			perf_json_string(fi, s->name);
+			fprintf(fi, ",\"depth\":%d,\"thread\":%d,\"start_us\":%llu,\"dur_us\":%llu,\"rss_kb\":%llu,\"peak_rss_kb\":%llu}",
+				s->depth, s->thread, s->start, s->duration, s->rss_kb, s->peak_rss_kb);
+		}
+		fprintf(fi, "\n]\n}\n");
+	}
+	fclose(fi);
+	return true;
+}
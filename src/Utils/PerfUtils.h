@@ -158,4 +158,40 @@ public:
 	}
 };
 
+/*
+	PROFILE REPORTS
+
+	StElapsedTime just logs; for farm-wide tracking we want something a script can read.  When
+	perf_profile_enabled() is set, StPerfScope records each scope's start, duration, nesting depth, thread
+	and process memory (current and peak resident set) as it closes, and perf_count() accumulates named
+	counters.  perf_profile_write() then dumps everything either as plain JSON or, for a path ending in
+	".trace", in the Chrome trace-event format (load it in chrome://tracing or Perfetto).
+
+	Scopes are meant for phases (a command, TriangulateMesh, BuildDSF) - each one costs a lock and an RSS
+	read, so don't put them in inner loops.  When profiling is off a scope costs one atomic load.  The
+	storage and the OS memory calls live in PerfUtils.cpp.
+*/
+
+// Current and peak resident set size of the process in KB; 0 when the OS won't tell us.
+void	perf_memory_kb(unsigned long long& outCurrent, unsigned long long& outPeak);
+
+bool	perf_profile_enabled(void);
+void	perf_profile_enable(bool e);
+
+// Adds inDelta to the named counter.  Thread safe; a no-op when profiling is off.
+void	perf_count(const char * inName, long long inDelta);
+
+// Writes the profile so far; a path ending in .trace gets the Chrome trace-event format, anything else plain JSON.
+bool	perf_profile_write(const char * inPath, const char * inTool);
+
+class	StPerfScope {
+	const char *		mName;
+	unsigned long long	mStart;
+	int					mThread;
+	bool				mActive;
+public:
+	StPerfScope(const char * inName);
+	~StPerfScope();
+};
+
 #endif
@@ -37,6 +37,7 @@
 #include "MapAlgs.h"
 #include "CompGeomUtils.h"
 #include "MapBuffer.h"
+#include "ParallelUtils.h"
 #include <CGAL/convex_hull_2.h>
 #include <CGAL/Sweep_line_2_algorithms.h>
 #include <CGAL/Boolean_set_operations_2/Gps_polygon_validation.h>
@@ -59,6 +60,14 @@
 #include "GISTool_Globals.h"
 #endif
 
+// Airports are burned in and simplified on all threads, then splatted into the map one at a time.  The DEV map
+// build draws debug lines from the bezier code and scribbles on gDem, so it stays serial.
+#if DEV && OPENGL_MAP
+#define APT_PARALLEL_PREP 0
+#else
+#define APT_PARALLEL_PREP 1
+#endif
+
 #define AIRPORT_BEZIER_TESS	(25.0 / (DEG_TO_NM_LAT * NM_TO_MTR))
 
 
@@ -401,22 +410,25 @@ void BurnInAirport(
 // Given a destination map and faces from a DIFFERENT map, we produce a NEW set of SIMPLER faces that are made
 // by reducing the polygon complexity.  THEN dump the results into our inDstMap map, and return the actual 
 // faces that we made...clients need that.
-void	SimplifyAirportAreasAndSplat(Pmwx& inDstMap, Polygon_set_2& in_area, bool do_simplify, set<Face_handle>& outDstFaces, apt_fill_mode inFillWater, Locator * loc)
+//
+// The simplify half only touches the airport's own polygon set, so it can run off the main thread; the splat half
+// edits the destination map and must be serialized.
+static void	SimplifyAirportArea(Polygon_set_2& area, apt_fill_mode inFillWater)
 {
-	Polygon_set_2	area(in_area);
-	if(do_simplify)
+	FillPolygonGaps(area, inFillWater != fill_dirt2apt ? AIRPORT_INNER_FILLGAPS : AIRPORT_OUTER_FILLGAPS);
+	SafeMakeMoreConvex(area, inFillWater != fill_dirt2apt ? AIRPORT_INNER_FILL_AREA : AIRPORT_OUTER_FILL_AREA);
+	SimplifyPolygonMaxMove(area, inFillWater != fill_dirt2apt ? AIRPORT_INNER_SIMPLIFY : AIRPORT_OUTER_SIMPLIFY);//, true, false);
+	DebugAssert(area.arrangement().unbounded_face()->contained() == false);
+	#if DEV
+	for(Pmwx::Edge_iterator e = area.arrangement().edges_begin(); e != area.arrangement().edges_end(); ++e)
 	{
-		FillPolygonGaps(area, inFillWater != fill_dirt2apt ? AIRPORT_INNER_FILLGAPS : AIRPORT_OUTER_FILLGAPS);
-		SafeMakeMoreConvex(area, inFillWater != fill_dirt2apt ? AIRPORT_INNER_FILL_AREA : AIRPORT_OUTER_FILL_AREA);
-		SimplifyPolygonMaxMove(area, inFillWater != fill_dirt2apt ? AIRPORT_INNER_SIMPLIFY : AIRPORT_OUTER_SIMPLIFY);//, true, false);
-		DebugAssert(area.arrangement().unbounded_face()->contained() == false);
-		#if DEV
-		for(Pmwx::Edge_iterator e = area.arrangement().edges_begin(); e != area.arrangement().edges_end(); ++e)
-		{
-			DebugAssert(e->face() != e->twin()->face());
-		}
-		#endif
+		DebugAssert(e->face() != e->twin()->face());
 	}
+	#endif
+}
+
+static void	SplatAirportArea(Pmwx& inDstMap, Polygon_set_2& area, bool do_simplify, set<Face_handle>& outDstFaces, apt_fill_mode inFillWater, Locator * loc)
+{
 	if (inFillWater == fill_dirt2apt 
 		#if WANT_NEW_BORDER_RULES
 		|| (inFillWater != fill_nukeroads && !do_simplify)
@@ -466,6 +478,21 @@ void	SimplifyAirportAreasAndSplat(Pmwx& inDstMap, Polygon_set_2& in_area, bool d
 	}
 }
 
+// Burn in (and, for airports without a user boundary, simplify) the area of every airport in 'which' for one fill mode.
+// Airports don't share anything until they hit the map, so this is done on all threads; out[i] goes with apts[which[i]].
+static void	PrepAirportAreas(const AptVector& apts, const vector<int>& which, apt_fill_mode inFillWater, vector<Polygon_set_2>& out)
+{
+	out.clear();
+	out.resize(which.size());
+	parallel_for(0, which.size(), APT_PARALLEL_PREP ? 1 : max((int) which.size(), 1), [&](int i, int) {
+		const AptInfo_t& apt(apts[which[i]]);
+		BurnInAirport(&apt, out[i], inFillWater);
+		DebugAssert(out[i].arrangement().unbounded_face()->contained() == false);
+		if(!out[i].is_empty() && apt.boundaries.empty())
+			SimplifyAirportArea(out[i], inFillWater);
+	});
+}
+
 bool NeighborsWater(Face_handle f)
 {
 	Pmwx::Ccb_halfedge_circulator circ,stop;
@@ -533,41 +560,48 @@ void ProcessAirports(const AptVector& apts, Pmwx& ioMap, DEMGeo& elevation, DEMG
 	// First we will burn in airport landuse onto the big map for every airport.
 	// Pass 1 - water-fill...a tight boundary to ensure land under everyone...only do this
 	// if we do NOT have a user-specified boundary.
+	// The burn-in and simplification for each pass is done up front on all threads (PrepAirportAreas); only the
+	// splat into ioMap is done airport by airport, in the same order as always.
+	vector<int>				which;
+	vector<Polygon_set_2>	areas;
+
 	for (int n = 0; n < apts.size(); ++n)
 	if (apts[n].kind_code == apt_airport)
 	if (apts[n].icao != "36CA")
+		which.push_back(n);
+
+	PrepAirportAreas(apts, which, fill_water2dirt, areas);					// Produce a map that is the airport boundary.
+	for (int i = 0; i < which.size(); ++i)
 	{
+		int n = which[i];
 		PROGRESS_SHOW(prog, 0, 1, "Burning in airports...", n, apts.size()*2);
-		Polygon_set_2	foo;
-		BurnInAirport(&apts[n], foo, fill_water2dirt);					// Produce a map that is the airport boundary.
-		DebugAssert(foo.arrangement().unbounded_face()->contained() == false);
-		if(!foo.is_empty())																// Check for empty airport (e.g. all sea plane lanes or somthing.)
-			SimplifyAirportAreasAndSplat(ioMap, foo, apts[n].boundaries.empty(), simple_faces, fill_water2dirt, NULL);		// Simplify the airport surface area a bit.
+		if(!areas[i].is_empty())																// Check for empty airport (e.g. all sea plane lanes or somthing.)
+			SplatAirportArea(ioMap, areas[i], apts[n].boundaries.empty(), simple_faces, fill_water2dirt, NULL);
 	}
 
-	for (int n = 0; n < apts.size(); ++n)
-	if (apts[n].kind_code == apt_airport)
-	if (apts[n].icao != "36CA")
+	PrepAirportAreas(apts, which, fill_water2apt, areas);
+	for (int i = 0; i < which.size(); ++i)
 	{
+		int n = which[i];
 		PROGRESS_SHOW(prog, 0, 1, "Burning in airports...", n, apts.size()*2);
-		Polygon_set_2	foo;
-		BurnInAirport(&apts[n], foo, fill_water2apt);					// Produce a map that is the airport boundary.
-		DebugAssert(foo.arrangement().unbounded_face()->contained() == false);
-		if(!foo.is_empty())																// Check for empty airport (e.g. all sea plane lanes or somthing.)
-			SimplifyAirportAreasAndSplat(ioMap, foo, apts[n].boundaries.empty(), simple_faces, fill_water2apt, NULL);		// Simplify the airport surface area a bit.
+		if(!areas[i].is_empty())
+			SplatAirportArea(ioMap, areas[i], apts[n].boundaries.empty(), simple_faces, fill_water2apt, NULL);
 	}
 
 #if WANT_NEW_BORDER_RULES
+	which.clear();
 	for (int n = 0; n < apts.size(); ++n)
 	if (apts[n].kind_code == apt_airport)
 	if(!apts[n].boundaries.empty())
+		which.push_back(n);
+
+	PrepAirportAreas(apts, which, fill_nukeroads, areas);
+	for (int i = 0; i < which.size(); ++i)
 	{
+		int n = which[i];
 		PROGRESS_SHOW(prog, 0, 1, "Burning in airports...", n, apts.size()*2);
-		Polygon_set_2	foo;
-		BurnInAirport(&apts[n], foo, fill_nukeroads);					// Produce a map that is the airport boundary.
-		DebugAssert(foo.arrangement().unbounded_face()->contained() == false);
-		if(!foo.is_empty())																// Check for empty airport (e.g. all sea plane lanes or somthing.)
-			SimplifyAirportAreasAndSplat(ioMap, foo, apts[n].boundaries.empty(), simple_faces, fill_nukeroads, NULL);		// Simplify the airport surface area a bit.
+		if(!areas[i].is_empty())
+			SplatAirportArea(ioMap, areas[i], apts[n].boundaries.empty(), simple_faces, fill_nukeroads, NULL);
 	}
 #endif
 
@@ -585,16 +619,19 @@ void ProcessAirports(const AptVector& apts, Pmwx& ioMap, DEMGeo& elevation, DEMG
 	gDem[dem_Wizard6] = gDem[dem_Wizard];
 #endif
 	
+	which.clear();
 	for (int n = 0; n < apts.size(); ++n)
 	if (apts[n].kind_code == apt_airport)
+		which.push_back(n);
+
+	PrepAirportAreas(apts, which, fill_dirt2apt, areas);
+	for (int i = 0; i < which.size(); ++i)
 	{
+		int n = which[i];
 		PROGRESS_SHOW(prog, 0, 1, "Burning in airports...", n+apts.size(), apts.size()*2);
-		Polygon_set_2	foo;
-		BurnInAirport(&apts[n], foo, fill_dirt2apt);
-		DebugAssert(foo.arrangement().unbounded_face()->contained() == false);
-		if(!foo.is_empty())																// Check for empty airport (e.g. all sea plane lanes or somthing.)
+		if(!areas[i].is_empty())																// Check for empty airport (e.g. all sea plane lanes or somthing.)
 		{
-			SimplifyAirportAreasAndSplat(ioMap, foo, apts[n].boundaries.empty(), simple_faces, fill_dirt2apt, NULL);
+			SplatAirportArea(ioMap, areas[i], apts[n].boundaries.empty(), simple_faces, fill_dirt2apt, NULL);
 			if (dems)
 			{
 				working = DEM_NO_DATA;
@@ -108,37 +108,108 @@ static void CenterToCorners(Point2 location, double heading, double len, double
  ************************************************************************************************************************************************************************/
 #pragma mark -
 
+// IndexAirports packs the R-tree bottom up, sort-tile-recursive style: sort the boxes into vertical slices by
+// center x, sort each slice by center y, and cut the result into runs of kAptNodeSize.  The same is then done
+// to those nodes, and so on until there is one root.  Nodes come out full and square-ish, which is about as
+// good as an R-tree gets for a static set, and with ~35k airports the whole thing is a few ms.
+static const int kAptNodeSize = 16;
+
+template <typename T, typename B>
+static void	str_order(vector<T>& v, B bounds_of)
+{
+	auto by_x = [&](const T& a, const T& b) { return bounds_of(a).xmin() + bounds_of(a).xmax() < bounds_of(b).xmin() + bounds_of(b).xmax(); };
+	auto by_y = [&](const T& a, const T& b) { return bounds_of(a).ymin() + bounds_of(a).ymax() < bounds_of(b).ymin() + bounds_of(b).ymax(); };
+
+	int groups = (v.size() + kAptNodeSize - 1) / kAptNodeSize;
+	int per_slice = kAptNodeSize * (int) ceil(sqrt((double) groups));
+	sort(v.begin(), v.end(), by_x);
+	for (int s = 0; s < v.size(); s += per_slice)
+		sort(v.begin() + s, v.begin() + min<int>(s + per_slice, v.size()), by_y);
+}
+
 void	IndexAirports(const AptVector& apts, AptIndex& index)
 {
 	index.clear();
-	for (int a = 0; a < apts.size(); ++ a)
+
+	// Airports with no geometry have null bounds and can never be found - leave them out.
+	vector<int>	ids;
+	for (int a = 0; a < apts.size(); ++a)
+	if (!apts[a].bounds.is_null())
+		ids.push_back(a);
+	if (ids.empty())
+		return;
+
+	str_order(ids, [&](int a) -> const Bbox2& { return apts[a].bounds; });
+	index.items = ids;
+	for (vector<int>::iterator i = ids.begin(); i != ids.end(); ++i)
+		index.item_bounds.push_back(apts[*i].bounds);
+
+	// Build each level from the one below it; a level's children are contiguous in the level below.
+	vector<vector<AptIndex::node_t> >	levels(1);
+	for (int i = 0; i < index.items.size(); i += kAptNodeSize)
 	{
-		POINT2 ctr(
-			(apts[a].bounds.xmin()+apts[a].bounds.xmax())*0.5,
-			(apts[a].bounds.ymin()+apts[a].bounds.ymax())*0.5);
-
-		int lon = floor(CGAL2DOUBLE(ctr.x()));
-		int lat = floor(CGAL2DOUBLE(ctr.y()));
-		index.insert(AptIndex::value_type(hash_ll(lon, lat), a));
-//		printf("LL hash for %s is %d,%d\n", apts[a].icao.c_str(), lon, lat);
+		AptIndex::node_t n;
+		n.first = i;
+		n.count = min<int>(kAptNodeSize, index.items.size() - i);
+		n.leaf = true;
+		for (int k = 0; k < n.count; ++k)
+			n.bounds += index.item_bounds[i + k];
+		levels.back().push_back(n);
+	}
+
+	while (levels.back().size() > 1)
+	{
+		vector<AptIndex::node_t>& kids(levels.back());
+		str_order(kids, [](const AptIndex::node_t& n) -> const Bbox2& { return n.bounds; });
+		vector<AptIndex::node_t> parents;
+		for (int i = 0; i < kids.size(); i += kAptNodeSize)
+		{
+			AptIndex::node_t n;
+			n.first = i;
+			n.count = min<int>(kAptNodeSize, kids.size() - i);
+			n.leaf = false;
+			for (int k = 0; k < n.count; ++k)
+				n.bounds += kids[i + k].bounds;
+			parents.push_back(n);
+		}
+		levels.push_back(parents);
+	}
+
+	// Lay the levels out root first; child offsets become absolute node indices.
+	for (int l = levels.size() - 1; l >= 0; --l)
+	{
+		int base = index.nodes.size() + levels[l].size();
+		for (vector<AptIndex::node_t>::iterator n = levels[l].begin(); n != levels[l].end(); ++n)
+		{
+			if (!n->leaf)
+				n->first += base;
+			index.nodes.push_back(*n);
+		}
 	}
 }
 
+// Returns every airport whose bounds overlap the box (edges touching counts).
 void	FindAirports(const Bbox2& bounds, const AptIndex& index, set<int>& apts)
 {
 	apts.clear();
-	int x1 = floor(bounds.xmin() - 0.5);
-	int x2 =  ceil(bounds.xmax() + 0.5);
-	int y1 = floor(bounds.ymin() - 0.5);
-	int y2 =  ceil(bounds.ymax() + 0.5);
-	for (int x = x1; x <= x2; ++x)
-	for (int y = y1; y <= y2; ++y)
+	if (index.empty())
+		return;
+
+	vector<int>	todo(1, 0);
+	while (!todo.empty())
 	{
-		pair<AptIndex::const_iterator,AptIndex::const_iterator>	range = index.equal_range(hash_ll(x,y));
-		for (AptIndex::const_iterator i = range.first; i != range.second; ++i)
+		const AptIndex::node_t& n(index.nodes[todo.back()]);
+		todo.pop_back();
+		if (!n.bounds.overlap(bounds))
+			continue;
+		for (int k = n.first; k < n.first + n.count; ++k)
+		if (n.leaf)
 		{
-			apts.insert(i->second);
+			if (index.item_bounds[k].overlap(bounds))
+				apts.insert(index.items[k]);
 		}
+		else
+			todo.push_back(k);
 	}
 }
 
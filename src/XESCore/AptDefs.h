@@ -692,6 +692,21 @@ struct AptInfo_t {
 
 typedef vector<AptInfo_t>	AptVector;
 
-typedef hash_multimap<int,int>	AptIndex;
+// Spatial index over airport bounds - a static R-tree packed by IndexAirports and queried by FindAirports (AptAlgs.h).
+// Entries are indices into the AptVector it was built from, so rebuild it whenever that vector changes.
+struct	AptIndex {
+	struct node_t {
+		Bbox2	bounds;
+		int		first;			// First child in nodes, or first entry in items for a leaf.
+		int		count;
+		bool	leaf;
+	};
+	vector<node_t>	nodes;		// nodes[0] is the root.
+	vector<int>		items;		// Airport indices, grouped by leaf.
+	vector<Bbox2>	item_bounds;
+
+	void	clear(void) { nodes.clear(); items.clear(); item_bounds.clear(); }
+	bool	empty(void) const { return nodes.empty(); }
+};
 
 #endif
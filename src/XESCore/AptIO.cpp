@@ -29,6 +29,7 @@
 #include "AssertUtils.h"
 #include "CompGeomUtils.h"
 #include "STLUtils.h"
+#include "ParallelUtils.h"
 
 #include "WED_Version.h"
 // for now
@@ -282,48 +283,75 @@ string	ReadAptFile(const char * inFileName, AptVector& outApts)
 	return err;
 }
 
-string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outApts)
+static void	calc_apt_bounds(AptInfo_t& a)
 {
-	outApts.clear();
-
-	MFTextScanner * s = TextScanner_OpenMem(inBegin, inEnd);
-	string ok;
-
-	int ln = 0;
-
-	// Versioning:
-	// 703 (base)
-	// 715 - addded vis flag to tower
-	// 810 - added vasi slope to towers
-	// 850 - added next-gen stuff
-
-		int vers = 0;
+	a.bounds = Bbox2();
+	if (a.tower.draw_obj != -1)
+		a.bounds = Bbox2(a.tower.location);
+	if(a.beacon.color_code != apt_beacon_none)
+		a.bounds += a.beacon.location;
+	for (int w = 0; w < a.windsocks.size(); ++w)
+		a.bounds += a.windsocks[w].location;
+	for (int r = 0; r < a.gates.size(); ++r)
+		a.bounds += a.gates[r].location;
+	for (AptPavementVector::iterator p = a.pavements.begin(); p != a.pavements.end(); ++p)
+	{
+		a.bounds += p->ends.source();
+		a.bounds += p->ends.target();
+	}
+	for (AptRunwayVector::iterator r = a.runways.begin(); r != a.runways.end(); ++r)
+	{
+		a.bounds += r->ends.source();
+		a.bounds += r->ends.target();
+	}
+	for(AptSealaneVector::iterator s = a.sealanes.begin(); s != a.sealanes.end(); ++s)
+	{
+		a.bounds += s->ends.source();
+		a.bounds += s->ends.target();
+	}
+	for(AptHelipadVector::iterator h = a.helipads.begin(); h != a.helipads.end(); ++h)
+		a.bounds += h->location;
 
-	if (TextScanner_IsDone(s))
-		ok = string("File is empty.");
-	if (ok.empty())
+	for(AptTaxiwayVector::iterator t = a.taxiways.begin(); t != a.taxiways.end(); ++t)
+	for(AptPolygon_t::iterator pt = t->area.begin(); pt != t->area.end(); ++pt)
 	{
-		string app_win;
-		if (TextScanner_FormatScan(s, "T", &app_win) != 1) ok = "Invalid header";
-		if (app_win != "a" && app_win != "A" && app_win != "i" && app_win != "I") ok = string("Invalid header:") + app_win;
-		TextScanner_Next(s);
-		++ln;
+		a.bounds += pt->pt;
+		if(pt->code == apt_lin_crv || pt->code == apt_rng_crv || pt-> code == apt_end_crv)
+			a.bounds += pt->ctrl;
 	}
-	if (ok.empty())
+
+	for(AptBoundaryVector::iterator b = a.boundaries.begin(); b != a.boundaries.end(); ++b)
+	for(AptPolygon_t::iterator pt = b->area.begin(); pt != b->area.end(); ++pt)
 	{
-		if (TextScanner_FormatScan(s, "i", &vers) != 1) ok = "Invalid version";
-		if (vers != 703 && vers != 715 && vers != 810 && vers != 850 && vers != 1000 && vers != 1050 &&
-		    vers != 1100 && vers != 1130 && vers != 1200)
-		{
-		  if (vers > LATEST_APT_VERSION)
-			ok = "Format is newer than supported by this version of WED";
-		  else
-			ok = "Unsupported version";
-		}
-		TextScanner_Next(s);
-		++ln;
+		a.bounds += pt->pt;
+		if(pt->code == apt_lin_crv || pt->code == apt_rng_crv || pt-> code == apt_end_crv)
+			a.bounds += pt->ctrl;
 	}
 
+	//a.bounds.expand(0.001);
+}
+
+static bool	is_apt_header_line(const char * b, const char * e)
+{
+	while (b < e && (*b == ' ' || *b == '\t')) ++b;
+	int code = 0;
+	while (b < e && *b >= '0' && *b <= '9')
+		code = code * 10 + (*b++ - '0');
+	if (b < e && *b != ' ' && *b != '\t')
+		return false;
+	return code == apt_airport || code == apt_seaport || code == apt_heliport;
+}
+
+// Parse the records that follow the apt.dat header into outApts.  Every piece of parse state here belongs
+// to the current airport and is reset at its header row (1/16/17), so the file can be cut at header rows
+// and the pieces parsed on their own.  ioLine counts lines consumed, so on failure it is the bad line;
+// outDone is set if we hit the 99 record.
+static string	ReadAptRecords(const char * inBegin, const char * inEnd, int vers, AptVector& outApts, int& ioLine, bool& outDone)
+{
+	MFTextScanner * s = TextScanner_OpenMem(inBegin, inEnd);
+	string ok;
+	int& ln(ioLine);
+
 	set<string>		centers;
 	string codez;
 	string			lat_str, lon_str, rot_str, len_str, wid_str;
@@ -357,6 +385,7 @@ string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outAp
 		case apt_heliport:
 			centers.clear();
 			hit_prob = false;
+			open_poly = NULL;
 			last_edge = NULL;
 			outApts.push_back(AptInfo_t());
 			if (TextScanner_FormatScan(s, "iiiiTT|",
@@ -648,6 +677,7 @@ string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outAp
 		case apt_lin_seg:
 		case apt_rng_seg:
 			if (vers < 850) ok = "Error: new linear segments allowed before 850";
+			if (open_poly == NULL) { ok = "Error: linear segment without a taxiway, line or boundary."; break; }
 			codez.clear();
 			open_poly->push_back(AptLinearSegment_t());
 			if (TextScanner_FormatScan(s,"iddT|",
@@ -661,6 +691,7 @@ string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outAp
 		case apt_lin_crv:
 		case apt_rng_crv:
 			if (vers < 850) ok = "Error: new curved segments allowed before 850";
+			if (open_poly == NULL) { ok = "Error: linear segment without a taxiway, line or boundary."; break; }
 			codez.clear();
 			open_poly->push_back(AptLinearSegment_t());
 			if (TextScanner_FormatScan(s,"iddddT|",
@@ -676,6 +707,7 @@ string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outAp
 			break;
 		case apt_end_seg:
 			if (vers < 850) ok = "Error: new end segments allowed before 850";
+			if (open_poly == NULL) { ok = "Error: linear segment without a taxiway, line or boundary."; break; }
 			open_poly->push_back(AptLinearSegment_t());
 			if (TextScanner_FormatScan(s,"idd",
 				&open_poly->back().code,
@@ -685,6 +717,7 @@ string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outAp
 			break;
 		case apt_end_crv:
 			if (vers < 850) ok = "Error: new end curves allowed before 850";
+			if (open_poly == NULL) { ok = "Error: linear segment without a taxiway, line or boundary."; break; }
 			codez.clear();
 			open_poly->push_back(AptLinearSegment_t());
 			if (TextScanner_FormatScan(s,"idddd",
@@ -1215,67 +1248,235 @@ string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outAp
 	}
 	TextScanner_Close(s);
 
-	if (!ok.empty())
+	for (AptVector::iterator a = outApts.begin(); a != outApts.end(); ++a)
+		calc_apt_bounds(*a);
+
+	outDone = forceDone;
+	return ok;
+}
+
+string	ReadAptFileMem(const char * inBegin, const char * inEnd, AptVector& outApts)
+{
+	outApts.clear();
+
+	MFTextScanner * s = TextScanner_OpenMem(inBegin, inEnd);
+	string ok;
+
+	int ln = 0;
+
+	// Versioning:
+	// 703 (base)
+	// 715 - addded vis flag to tower
+	// 810 - added vasi slope to towers
+	// 850 - added next-gen stuff
+
+		int vers = 0;
+
+	if (TextScanner_IsDone(s))
+		ok = string("File is empty.");
+	if (ok.empty())
 	{
-		char buf[50];
-		sprintf(buf," (Line %d)",ln);
-		ok += buf;
+		string app_win;
+		if (TextScanner_FormatScan(s, "T", &app_win) != 1) ok = "Invalid header";
+		if (app_win != "a" && app_win != "A" && app_win != "i" && app_win != "I") ok = string("Invalid header:") + app_win;
+		TextScanner_Next(s);
+		++ln;
 	}
-
-	for (AptVector::iterator a = outApts.begin(); a != outApts.end(); ++a)
+	if (ok.empty())
 	{
-		a->bounds = Bbox2();
-		if (a->tower.draw_obj != -1)
-			a->bounds = Bbox2(a->tower.location);
-		if(a->beacon.color_code != apt_beacon_none)
-			a->bounds += a->beacon.location;
-		for (int w = 0; w < a->windsocks.size(); ++w)
-			a->bounds += a->windsocks[w].location;
-		for (int r = 0; r < a->gates.size(); ++r)
-			a->bounds += a->gates[r].location;
-		for (AptPavementVector::iterator p = a->pavements.begin(); p != a->pavements.end(); ++p)
-		{
-			a->bounds +=  p->ends.source();
-			a->bounds +=  p->ends.target();
-		}
-		for (AptRunwayVector::iterator r = a->runways.begin(); r != a->runways.end(); ++r)
-		{
-			a->bounds +=  r->ends.source();
-			a->bounds +=  r->ends.target();
-		}
-		for(AptSealaneVector::iterator s = a->sealanes.begin(); s != a->sealanes.end(); ++s)
+		if (TextScanner_FormatScan(s, "i", &vers) != 1) ok = "Invalid version";
+		if (vers != 703 && vers != 715 && vers != 810 && vers != 850 && vers != 1000 && vers != 1050 &&
+		    vers != 1100 && vers != 1130 && vers != 1200)
 		{
-			a->bounds +=  s->ends.source();
-			a->bounds +=  s->ends.target();
+		  if (vers > LATEST_APT_VERSION)
+			ok = "Format is newer than supported by this version of WED";
+		  else
+			ok = "Unsupported version";
 		}
-		for(AptHelipadVector::iterator h = a->helipads.begin(); h != a->helipads.end(); ++h)
-			a->bounds +=  h->location;
+		TextScanner_Next(s);
+		++ln;
+	}
+
+	// Airports are independent, so cut the records into chunks at airport header rows and parse the chunks
+	// on all threads.  Chunks are concatenated in file order and we stop at the first chunk that fails or
+	// hits the 99 record, so the results (and error lines) are the same as a straight top-to-bottom read.
+	struct apt_chunk_t {
+		const char *	begin;
+		const char *	end;
+		int				first_line;
+		int				lines;
+		bool			done;
+		string			err;
+		AptVector		apts;
+	};
+	vector<apt_chunk_t>	chunks;
 
-		for(AptTaxiwayVector::iterator t = a->taxiways.begin(); t != a->taxiways.end(); ++t)
-		for(AptPolygon_t::iterator pt = t->area.begin(); pt != t->area.end(); ++pt)
+	if (ok.empty())
+	{
+		const char * body = TextScanner_GetBegin(s);
+		ptrdiff_t chunk_bytes = max<ptrdiff_t>(256 * 1024, (inEnd - body) / (8 * parallel_thread_count()));
+
+		chunks.push_back(apt_chunk_t());
+		chunks.back().begin = body;
+		chunks.back().first_line = ln;
+		while (!TextScanner_IsDone(s))
 		{
-			a->bounds +=  pt->pt;
-			if(pt->code == apt_lin_crv || pt->code == apt_rng_crv || pt-> code == apt_end_crv)
-				a->bounds +=  pt->ctrl;
+			const char * line = TextScanner_GetBegin(s);
+			if (line - chunks.back().begin >= chunk_bytes && is_apt_header_line(line, TextScanner_GetEnd(s)))
+			{
+				chunks.back().end = line;
+				chunks.push_back(apt_chunk_t());
+				chunks.back().begin = line;
+				chunks.back().first_line = ln;
+			}
+			TextScanner_Next(s);
+			++ln;
 		}
+		chunks.back().end = inEnd;
+	}
+	TextScanner_Close(s);
+
+	parallel_for(0, chunks.size(), 1, [&chunks, vers](int n, int worker) {
+		apt_chunk_t& c(chunks[n]);
+		c.lines = 0;
+		c.done = false;
+		c.err = ReadAptRecords(c.begin, c.end, vers, c.apts, c.lines, c.done);
+	});
 
-		for(AptBoundaryVector::iterator b = a->boundaries.begin(); b != a->boundaries.end(); ++b)
-		for(AptPolygon_t::iterator pt = b->area.begin(); pt != b->area.end(); ++pt)
+	size_t total = 0;
+	for (vector<apt_chunk_t>::iterator c = chunks.begin(); c != chunks.end(); ++c)
+		total += c->apts.size();
+	outApts.reserve(total);
+
+	for (vector<apt_chunk_t>::iterator c = chunks.begin(); c != chunks.end(); ++c)
+	{
+		outApts.insert(outApts.end(), make_move_iterator(c->apts.begin()), make_move_iterator(c->apts.end()));
+		ln = c->first_line + c->lines;
+		if (!c->err.empty())
 		{
-			a->bounds +=  pt->pt;
-			if(pt->code == apt_lin_crv || pt->code == apt_rng_crv || pt-> code == apt_end_crv)
-				a->bounds +=  pt->ctrl;
+			ok = c->err;
+			break;
 		}
+		if (c->done)
+			break;
+	}
 
-		//a->bounds.expand(0.001);
+	if (!ok.empty())
+	{
+		char buf[50];
+		sprintf(buf," (Line %d)",ln);
+		ok += buf;
+	}
+
+	#if OPENGL_MAP
+	// Preview outlines only touch their own airport.
+	parallel_for(0, outApts.size(), 16, [&](int n, int) {
+		GenerateOGL(&outApts[n]);
+	});
+	#endif
+	return ok;
+}
+
+/*
+	AIRPORT STORE
+
+	A store is every airport written out as its own complete little apt.dat, with a table up front giving each
+	one's bounds and byte range.  A tile job maps the store, scans the table and parses just the airports that
+	touch the tile, rather than parsing the whole global apt.dat for every tile.  Numbers are in native byte
+	order - the store is a build intermediate written by GISTool -aptindex, not an interchange format.
+*/
+
+struct	apt_store_header_t {
+	char		magic[8];
+	int			count;
+	int			reserved;
+};
+
+struct	apt_store_entry_t {
+	double		bounds[4];		// west, south, east, north
+	long long	offset;			// From the start of the file
+	long long	length;
+};
 
-		#if OPENGL_MAP
-			GenerateOGL(&*a);
-		#endif
+static const char	kAptStoreMagic[8] = { 'A', 'P', 'T', 'S', 'T', 'O', 'R', '1' };
+
+bool	WriteAptStore(const char * inFileName, const AptVector& inApts, int version)
+{
+	FILE * fi = fopen(inFileName, "wb");
+	if (fi == NULL) return false;
+
+	apt_store_header_t	hdr;
+	memcpy(hdr.magic, kAptStoreMagic, sizeof(hdr.magic));
+	hdr.count = inApts.size();
+	hdr.reserved = 0;
+	vector<apt_store_entry_t>	entries(inApts.size());
+
+	fwrite(&hdr, sizeof(hdr), 1, fi);
+	if (!entries.empty())
+		fwrite(&entries[0], sizeof(apt_store_entry_t), entries.size(), fi);
+
+	AptVector	one(1);
+	for (int n = 0; n < inApts.size(); ++n)
+	{
+		entries[n].bounds[0] = inApts[n].bounds.xmin();
+		entries[n].bounds[1] = inApts[n].bounds.ymin();
+		entries[n].bounds[2] = inApts[n].bounds.xmax();
+		entries[n].bounds[3] = inApts[n].bounds.ymax();
+		entries[n].offset = ftell(fi);
+		one[0] = inApts[n];
+		WriteAptFileOpen(fi, one, version);
+		entries[n].length = ftell(fi) - entries[n].offset;
 	}
+
+	fseek(fi, sizeof(hdr), SEEK_SET);
+	if (!entries.empty())
+		fwrite(&entries[0], sizeof(apt_store_entry_t), entries.size(), fi);
+
+	bool ok = !ferror(fi);
+	fclose(fi);
 	return ok;
 }
 
+string	ReadAptStore(const char * inFileName, const Bbox2& inBounds, AptVector& outApts)
+{
+	outApts.clear();
+	MFMemFile * f = MemFile_Open(inFileName);
+	if (f == NULL) return string("memfile_open failed");
+
+	const char * b = MemFile_GetBegin(f);
+	const char * e = MemFile_GetEnd(f);
+	const apt_store_header_t * hdr = (const apt_store_header_t *) b;
+	const apt_store_entry_t * entries = (const apt_store_entry_t *) (hdr + 1);
+
+	string err;
+	if (e - b < sizeof(apt_store_header_t) || memcmp(hdr->magic, kAptStoreMagic, sizeof(kAptStoreMagic)) != 0)
+		err = "Not an airport store";
+	else if (hdr->count < 0 || (e - (const char *) entries) / (ptrdiff_t) sizeof(apt_store_entry_t) < hdr->count)
+		err = "Airport store is truncated";
+
+	for (int n = 0; err.empty() && n < hdr->count; ++n)
+	{
+		const apt_store_entry_t& entry(entries[n]);
+		Bbox2	bounds;				// Not the 4-double ctor - it would turn the null bounds of an empty airport into a real box.
+		bounds.p1 = Point2(entry.bounds[0], entry.bounds[1]);
+		bounds.p2 = Point2(entry.bounds[2], entry.bounds[3]);
+		if (!bounds.overlap(inBounds))
+			continue;
+		if (entry.offset < 0 || entry.length < 0 || entry.offset + entry.length > e - b)
+		{
+			err = "Airport store is truncated";
+			break;
+		}
+
+		AptVector	apt;
+		err = ReadAptFileMem(b + entry.offset, b + entry.offset + entry.length, apt);
+		outApts.insert(outApts.end(), apt.begin(), apt.end());
+	}
+
+	MemFile_Close(f);
+	return err;
+}
+
 bool	WriteAptFile(const char * inFileName, const AptVector& inApts, int version)
 {
 	if (inApts.empty())
@@ -40,6 +40,11 @@ bool	WriteAptFile(const char * inFileName, const AptVector& outApts, int version
 bool	WriteAptFileOpen(FILE * inFile, const AptVector& outApts, int version);
 bool	WriteAptFileProcs(int (* print_func)(void *, const char *, ...), void * ref, const AptVector& outApts, int version);
 
+// Airport store: each airport as its own small apt.dat behind a table of bounds and file offsets.  Reading
+// maps the file and parses only the airports whose bounds overlap inBounds.
+bool	WriteAptStore(const char * inFileName, const AptVector& inApts, int version);
+string	ReadAptStore(const char * inFileName, const Bbox2& inBounds, AptVector& outApts);
+
 // Convert 810 to 850 layout
 void	ConvertForward(AptInfo_t& io_apt);
 
@@ -60,6 +60,8 @@
 #include "NetHelpers.h"
 #include "UTL_interval.h"
 #include "XUtils.h"
+#include "ParallelUtils.h"
+#include <mutex>
 
 #define	IGNORE_SHORT_AXIS	1
 
@@ -71,10 +73,20 @@
 // selected for zoning was grossly inappropriate AND the facade was made of tiny fragments.
 #define SMALL_CUT 0.1
 
-int num_block_processed = 0;
-int num_blocks_with_split = 0;
-int num_forest_split = 0;
-int num_line_integ = 0;
+atomic<int> num_block_processed(0);
+atomic<int> num_blocks_with_split(0);
+atomic<int> num_forest_split(0);
+atomic<int> num_line_integ(0);
+
+// Blocks are filled on several threads at once, so the global tables are only ever read with find - operator[]
+// would insert (and maybe rehash) on a missing key.  A missing key reads as a default entry, same as before.
+template <typename Table>
+inline const typename Table::mapped_type& table_entry(const Table& t, int key)
+{
+	static const typename Table::mapped_type none = typename Table::mapped_type();
+	typename Table::const_iterator i = t.find(key);
+	return (i == t.end()) ? none : i->second;
+}
 
 #include <stdarg.h>
 
@@ -82,6 +94,34 @@ typedef UTL_interval<double>	time_region;
 
 #include "GISTool_Globals.h"
 
+#if DEV && OPENGL_MAP
+// The debug selection and debug lines are plain globals, so a block that fails on a worker thread records them
+// here and process_blocks hands them over after the join, in block order.  Outside process_blocks there is no
+// record and we go straight to the globals.
+struct	block_failure_t {
+	vector<Pmwx::Face_handle>	faces;
+	vector<Segment2>			lines;
+};
+static thread_local block_failure_t *	sBlockFailure = NULL;
+
+struct	block_failure_scope {
+	block_failure_scope(block_failure_t * f) { sBlockFailure = f; }
+	~block_failure_scope() { sBlockFailure = NULL; }
+};
+
+static void	select_failed_face(Pmwx::Face_handle f)
+{
+	if(sBlockFailure)	sBlockFailure->faces.push_back(f);
+	else				gFaceSelection.insert(f);
+}
+
+static void	show_failed_line(const Segment2& s)
+{
+	if(sBlockFailure)	sBlockFailure->lines.push_back(s);
+	else				debug_mesh_line(s.p1,s.p2,1,0,0,1,0,0);
+}
+#endif
+
 #define DEBUG_BLOCK_CREATE_LINES 0
 
 //#include <CGAL/Arr_overlay_2.h>
@@ -678,21 +718,21 @@ static pair<int,bool>	WidestRoadTypeForSegment(Pmwx::Halfedge_const_handle he)
 	for (GISNetworkSegmentVector::const_iterator i = he->data().mSegments.begin(); i != he->data().mSegments.end(); ++i)
 	{
 		DebugAssert(i->mRepType != NO_VALUE);
-		if (gNetReps[i->mRepType].width() > best_width)
+		if (table_entry(gNetReps, i->mRepType).width() > best_width)
 		{
 			best_type = i->mRepType;
-			best_width = gNetReps[i->mRepType].width();
+			best_width = table_entry(gNetReps, i->mRepType).width();
 		}
 	}
 
 	for (GISNetworkSegmentVector::const_iterator i = he->twin()->data().mSegments.begin(); i != he->twin()->data().mSegments.end(); ++i)
 	{
 		if(i->mRepType == NO_VALUE)	return pair<int,bool>(i->mFeatType,true);
-		if (gNetReps[i->mRepType].width() > best_width)
+		if (table_entry(gNetReps, i->mRepType).width() > best_width)
 		{
 			best_type = i->mRepType;
 			flip = true;
-			best_width = gNetReps[i->mRepType].width();
+			best_width = table_entry(gNetReps, i->mRepType).width();
 		}
 	}
 	return pair<int,bool>(best_type, flip);
@@ -702,9 +742,9 @@ float WidthForSegment(const pair<int,bool>& seg_type)
 {
 	if(gNetReps.count(seg_type.first) == 0) return 0.0f;
 	if(seg_type.second)
-		return gNetReps[seg_type.first].semi_r;
+		return table_entry(gNetReps, seg_type.first).semi_r;
 	else
-		return gNetReps[seg_type.first].semi_l;
+		return table_entry(gNetReps, seg_type.first).semi_l;
 }
 
 static bool edges_match(Block_2::Halfedge_handle a, Block_2::Halfedge_handle b)
@@ -728,7 +768,7 @@ static bool against_road(Block_2::Halfedge_const_handle h, bool rail_ok)
 	if(h->twin()->face()->data().usage != usage_Road)
 		return false;
 	
-	int road_use_mode = gNetReps[h->twin()->face()->data().feature].use_mode;
+	int road_use_mode = table_entry(gNetReps, h->twin()->face()->data().feature).use_mode;
 	return road_use_mode == use_Street || (rail_ok && road_use_mode == use_Rail);
 }
 
@@ -1828,7 +1868,7 @@ static int	init_subdivisions(
 				if(fac_rule == NULL)
 				{
 					#if DEV && OPENGL_MAP
-					gFaceSelection.insert(f);
+					select_failed_face(f);
 					#endif
 					DebugAssert(!"Fac fail!!?!?");
 					return 0;
@@ -2828,8 +2868,8 @@ static face_cat categorize_vertex(CDT& mesh, CDT::Face_handle f, int n, Bbox2& b
 	if(LowerPriorityNaturalTerrain(lu, b->first))
 		lu = b->first;
 	
-	if(gNaturalTerrainInfo[lu].autogen_mode == URBAN)			return (f->info().normal[2] < cos(max_slope * DEG_TO_RAD)) ? cat_forest : cat_urban;
-	else if (gNaturalTerrainInfo[lu].autogen_mode == FOREST)	return cat_forest;
+	if(table_entry(gNaturalTerrainInfo, lu).autogen_mode == URBAN)			return (f->info().normal[2] < cos(max_slope * DEG_TO_RAD)) ? cat_forest : cat_urban;
+	else if (table_entry(gNaturalTerrainInfo, lu).autogen_mode == FOREST)	return cat_forest;
 	else														return cat_flat;
 }
 
@@ -3111,9 +3151,15 @@ static void	init_mesh(CDT& mesh, CoordTranslator2& translator, vector<Block_2::X
 						(translator.mSrcMin.x() + translator.mSrcMax.x()) * 0.5,
 						(translator.mSrcMin.y() + translator.mSrcMax.y()) * 0.5);
 
+	// The triangulation's own locate walk keeps shared random state, so blocks being filled in parallel take turns.
+	static mutex	locate_lock;
 	int n;
 	CDT::Locate_type lt;
-	CDT::Face_handle root = mesh.locate(start, lt, n);
+	CDT::Face_handle root;
+	{
+		lock_guard<mutex>	lock(locate_lock);
+		root = mesh.locate(start, lt, n);
+	}
 
 	DebugAssert(lt != CDT::OUTSIDE_AFFINE_HULL);
 	DebugAssert(lt != CDT::OUTSIDE_CONVEX_HULL);
@@ -3571,9 +3617,9 @@ bool	apply_fill_rules(
 {
 	bool did_promote = false;
 	if(orig_face->data().GetParam(af_Median,0) == 0.0)
-	if(gZoningInfo[zoning].fill_area)
+	if(table_entry(gZoningInfo, zoning).fill_area)
 	{
-		bool fill_rail = gZoningInfo[zoning].fill_rail != 0;
+		bool fill_rail = table_entry(gZoningInfo, zoning).fill_rail != 0;
 	
 		FillRule_t * r = GetFillRuleForBlock(orig_face);
 		bool has_backup = r && (r->fac_id != NO_VALUE || r->ags_id != NO_VALUE);
@@ -3663,7 +3709,7 @@ bool	apply_fill_rules(
 //	simplify_block(block, 0.75);
 //	clean_block(block);
 	
-	if(gZoningInfo[zoning].fill_veg)
+	if(table_entry(gZoningInfo, zoning).fill_veg)
 	{
 		for(Block_2::Face_iterator f = block.faces_begin(); f != block.faces_end(); ++f)
 		if(!f->is_unbounded())
@@ -3974,9 +4020,9 @@ void	fail_extraction(Pmwx::Face_handle dest_face, vector<Polygon2>& shape, Coord
 			if(trans) {
 				si.p1 = trans->Reverse(si.p1);
 				si.p2 = trans->Reverse(si.p2); }
-			debug_mesh_line(si.p1,si.p2,1,0,0,1,0,0);
+			show_failed_line(si);
 		}
-		gFaceSelection.insert(dest_face);
+		select_failed_face(dest_face);
 		vprintf(fmt,arg);
 	#else
 		AssertPrintfv(fmt,arg);
@@ -4004,7 +4050,7 @@ void	extract_features(
 	double	block_height = dest_face->data().GetParam(af_HeightObjs,8.0);
 
 	int zoning = dest_face->data().GetZoning();
-	bool fill_rail = gZoningInfo[zoning].fill_rail != 0;
+	bool fill_rail = table_entry(gZoningInfo, zoning).fill_rail != 0;
 
 
 	bool did_split = false;
@@ -4259,7 +4305,7 @@ void	extract_features(
 #if DEV && OPENGL_MAP
 	catch (...) 
 	{
-		gFaceSelection.insert(dest_face);
+		select_failed_face(dest_face);
 	}
 #endif	
 	if(did_split)
@@ -4305,3 +4351,66 @@ bool process_block(Pmwx::Face_handle f, CDT& mesh, const DEMGeo& ag_ok_approx_de
 //	printf("Face had %d vertices.\n", total);
 	return ret;
 }
+
+static int block_cost(Pmwx::Face_handle f)
+{
+	int n = 0;
+	if(!f->is_unbounded())
+		n += count_circulator(f->outer_ccb());
+	for(Pmwx::Hole_iterator h = f->holes_begin(); h != f->holes_end(); ++h)
+		n += count_circulator(*h);
+	return n;
+}
+
+void process_blocks(Pmwx& ioMap, const vector<Pmwx::Face_handle>& faces, CDT& mesh, const DEMGeo& ag_ok_approx_dem, const DEMGeo& forest_dem, ForestIndex& forest_index, ProgressFunc prog)
+{
+	if(faces.empty())
+		return;
+
+	// Lazy exact coordinates cache their value the first time they are read - do that now for every map and mesh
+	// vertex while we are single threaded, so that the blocks only ever read them.
+	for(Pmwx::Vertex_iterator v = ioMap.vertices_begin(); v != ioMap.vertices_end(); ++v)
+	{
+		CGAL::to_double(v->point().x());
+		CGAL::to_double(v->point().y());
+	}
+	for(CDT::Finite_vertices_iterator v = mesh.finite_vertices_begin(); v != mesh.finite_vertices_end(); ++v)
+	{
+		CGAL::to_double(v->point().x());
+		CGAL::to_double(v->point().y());
+	}
+
+	// Big blocks go first - faces are handed out one at a time, so the small ones fill in behind the slow ones
+	// instead of one thread being left with a huge block at the end.
+	vector<pair<int, int> >	order(faces.size());
+	for(int n = 0; n < faces.size(); ++n)
+		order[n] = pair<int,int>(-block_cost(faces[n]), n);
+	sort(order.begin(), order.end());
+
+	int total = faces.size();
+	int check = max(1, total / 100);
+	atomic<int>	done(0);
+#if DEV && OPENGL_MAP
+	vector<block_failure_t>	failures(total);
+#endif
+	parallel_for(0, total, 1, [&](int n, int worker) {
+		{
+#if DEV && OPENGL_MAP
+			block_failure_scope	record(&failures[n]);
+#endif
+			process_block(faces[order[n].second], mesh, ag_ok_approx_dem, forest_dem, forest_index);
+		}
+		int d = ++done;
+		if(worker == 0)
+			PROGRESS_CHECK(prog, 0, 1, "Creating 3-d.", d, total, check)
+	});
+
+#if DEV && OPENGL_MAP
+	for(int n = 0; n < total; ++n)
+	{
+		gFaceSelection.insert(failures[n].faces.begin(), failures[n].faces.end());
+		for(vector<Segment2>::iterator l = failures[n].lines.begin(); l != failures[n].lines.end(); ++l)
+			debug_mesh_line(l->p1,l->p2,1,0,0,1,0,0);
+	}
+#endif
+}
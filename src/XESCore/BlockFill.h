@@ -28,6 +28,8 @@
 #include "MeshDefs.h"
 #include "RTree2.h"
 #include "MapDefs.h"
+#include "ProgressUtils.h"
+#include <atomic>
 
 struct CoordTranslator2;
 
@@ -62,7 +64,16 @@ bool	process_block(
 					const DEMGeo&			forest_dem,
 					ForestIndex&			forest_index);
 
-
+// Runs process_block on every face in the list, spreading the faces over all threads.  Each face's
+// autogen lands only in that face's own data, so the results match a serial run face for face.
+void	process_blocks(
+					Pmwx&					ioMap,
+					const vector<Pmwx::Face_handle>&	faces,
+					CDT&					mesh,
+					const DEMGeo&			ag_ok_approx_dem,
+					const DEMGeo&			forest_dem,
+					ForestIndex&			forest_index,
+					ProgressFunc			prog);
 
 
 bool block_pts_from_ccb(
@@ -75,8 +86,8 @@ bool block_pts_from_ccb(
 float WidthForSegment(const pair<int,bool>& seg_type);
 
 
-extern int num_block_processed;
-extern int num_blocks_with_split;
-extern int num_forest_split;
-extern int num_line_integ;
+extern std::atomic<int> num_block_processed;
+extern std::atomic<int> num_blocks_with_split;
+extern std::atomic<int> num_forest_split;
+extern std::atomic<int> num_line_integ;
 #endif /* BlockFill_H */
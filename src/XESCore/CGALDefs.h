@@ -65,6 +65,10 @@ typedef CGAL::Lazy_exact_nt<CGAL::Quotient<CGAL::MP_Float> >  NT;
 // tend to be predicate-bound.
 typedef CGAL::Filtered_kernel<CGAL::Simple_cartesian<NT> > FastKernel;
 
+// Kernel policy: anything that builds or edits a Pmwx or CDT (overlay, snap rounding, meshing) stays on FastKernel - the
+// arrangement code needs exact constructions.  Passes that only read a finished map (stats, measuring, export) should take
+// a MapSnapshot (MapAlgs.h) or MeshSnapshot (MeshAlgs.h) instead: plain doubles, built once, no lazy nodes, thread-safe.
+
 
 // Gotta debug?  Use this...it cuts out a lot of the ptrs that drive GDB nuts.  Actually the kernel is still freaking
 // impossible to read but...
@@ -34,6 +34,7 @@
 #include "DEMAlgs.h"
 #include "WED_Globals.h"
 #include <math.h>
+#include <limits>
 #include "AptAlgs.h"
 #include "MemFileUtils.h"
 #include "XESIO.h"
@@ -42,6 +43,7 @@
 #include "MapAlgs.h"
 #include "MapTopology.h"
 #include "Zoning.h"
+#include "ParallelUtils.h"
 
 // Minimum bathymetric depth from water surface at any point!
 #define	MIN_DEPTH 1.0f
@@ -288,6 +290,10 @@ void	CalculateFilter(int dim, float * k, int kind, bool normalize)
 /*
  * Produce a DEM that is 1:ratio smaller, using averaging.
  *
+ * The resample family below runs row-parallel - every output row only reads the source
+ * and writes itself.  Voids are folded in with a 0/1 mask rather than a branch so the
+ * inner loops stay straight-line; the sums come out identical to the branchy version.
+ *
  */
 void	DownsampleDEM(const DEMGeo& ioDem, DEMGeo& smaller, int ratio)
 {
@@ -298,24 +304,28 @@ void	DownsampleDEM(const DEMGeo& ioDem, DEMGeo& smaller, int ratio)
 	smaller.mWest = ioDem.mWest;
 	smaller.mPost = ioDem.mPost;
 
-	for (int y = 0; y < smaller.mHeight; ++y)
-	for (int x = 0; x < smaller.mWidth; ++x)
-	{
-		float c = 0;
-		float h = 0.0;
-		for (int dy = y * ratio - (ratio / 2); dy < (y * ratio + (ratio / 2)); ++dy)
-		for (int dx = x * ratio - (ratio / 2); dx < (x * ratio + (ratio / 2)); ++dx)
+	parallel_for(0, smaller.mHeight, 16, [&](int y, int) {
+		float * dst = smaller.mData + y * smaller.mWidth;
+		for (int x = 0; x < smaller.mWidth; ++x)
 		{
-			float lh = ioDem.get(dx, dy);
-			if (lh != DEM_NO_DATA) c+=1.0, h += lh;
-		}
-		if (c > 0)
-			h /= c;
-		else
-			h = DEM_NO_DATA;
+			float c = 0;
+			float h = 0.0;
+			for (int dy = y * ratio - (ratio / 2); dy < (y * ratio + (ratio / 2)); ++dy)
+			for (int dx = x * ratio - (ratio / 2); dx < (x * ratio + (ratio / 2)); ++dx)
+			{
+				float lh = ioDem.get(dx, dy);
+				float m = (lh != DEM_NO_DATA) ? 1.0f : 0.0f;
+				c += m;
+				h += m * lh;
+			}
+			if (c > 0)
+				h /= c;
+			else
+				h = DEM_NO_DATA;
 
-		smaller(x,y)=h;
-	}
+			dst[x] = h;
+		}
+	});
 }
 void	UpsampleDEM(const DEMGeo& ioDem, DEMGeo& bigger, int ratio)
 {
@@ -324,22 +334,68 @@ void	UpsampleDEM(const DEMGeo& ioDem, DEMGeo& bigger, int ratio)
 	bigger.mSouth = ioDem.mSouth;
 	bigger.mEast = ioDem.mEast;
 	bigger.mWest = ioDem.mWest;
-	for (int y = 0; y < bigger.mHeight; ++y)
-	for (int x = 0; x < bigger.mWidth; ++x)
-		bigger(x,y) = ioDem(x/ratio,y/ratio);
+	parallel_for(0, bigger.mHeight, 64, [&](int y, int) {
+		float * dst = bigger.mData + y * bigger.mWidth;
+		for (int x = 0; x < bigger.mWidth; ++x)
+			dst[x] = ioDem(x/ratio,y/ratio);
+	});
 }
 
 void ResampleDEM(const DEMGeo& inSrc, DEMGeo& inDst)
 {
-	for(int y = 0; y < inDst.mHeight; ++y)
-	for(int x = 0; x < inDst.mWidth; ++x)
-	{
-		double lon = inDst.x_to_lon(x);
+	parallel_for(0, inDst.mHeight, 16, [&](int y, int) {
 		double lat = inDst.y_to_lat(y);
-		
-		double e = inSrc.value_linear(lon, lat);
-		inDst(x,y) = e;
+		float * dst = inDst.mData + y * inDst.mWidth;
+		for(int x = 0; x < inDst.mWidth; ++x)
+		{
+			double lon = inDst.x_to_lon(x);
+
+			double e = inSrc.value_linear(lon, lat);
+			dst[x] = e;
+		}
+	});
+}
+
+// This is DEMGeo::get_median with the sort replaced by a selection and the sample buffer
+// hoisted out to the caller, so a worker can reuse one buffer for a whole row.  The
+// sample walk is kept step-for-step so that we pick exactly the same sample.
+static float median_of_window(const DEMGeo& src, double lon, double lat, double xstep, double ystep, int r, vector<float>& es)
+{
+	if (lon < src.mWest || lon > src.mEast || lat < src.mSouth || lat > src.mNorth) return DEM_NO_DATA;
+
+	double lons = lon - (r * xstep);
+	double lats = lat - (r * ystep);
+	double lono = lons;
+	double lato = lats;
+
+	es.clear();
+	for (int ry = 0; ry < ((r*2)+1); ry++)
+	{
+		for (int rx = 0; rx < ((r*2)+1); rx++)
+		{
+			double x_fract = (lono - src.mWest) / (src.mEast - src.mWest);
+			double y_fract = (lato - src.mSouth) / (src.mNorth - src.mSouth);
+			x_fract *= (double) (src.mWidth-src.mPost);
+			y_fract *= (double) (src.mHeight-src.mPost);
+			x_fract -= src.pixel_offset();
+			y_fract -= src.pixel_offset();
+
+			float e = src.get((int) x_fract, (int) y_fract);
+			if (e != DEM_NO_DATA)
+				es.push_back(e);
+			lono = lono + xstep;
+		}
+		lono = lons;
+		lato = lato + ystep;
 	}
+
+	if (es.empty()) return DEM_NO_DATA;
+
+	// get_median picks the (n+1)/2'th sample of the sorted set - clamp for the n=1 case,
+	// where that would be one past the end.
+	int mid = min((int) (es.size() + 1) / 2, (int) es.size() - 1);
+	nth_element(es.begin(), es.begin() + mid, es.end());
+	return es[mid];
 }
 
 void ResampleDEMmedian(const DEMGeo& inSrc, DEMGeo& inDst, int radius)
@@ -347,16 +403,21 @@ void ResampleDEMmedian(const DEMGeo& inSrc, DEMGeo& inDst, int radius)
 	double xstep = (inDst.mEast - inDst.mWest) / inDst.x_res();
 	double ystep = (inDst.mNorth - inDst.mSouth) / inDst.y_res();
 
+	vector<vector<float> >	scratch(parallel_thread_count());
+	for (auto& s : scratch)
+		s.reserve(((radius*2)+1)*((radius*2)+1));
 
-	for(int y = 0; y < inDst.mHeight; ++y)
-	for(int x = 0; x < inDst.mWidth; ++x)
-	{
-		double lon = inDst.x_to_lon(x);
+	parallel_for(0, inDst.mHeight, 4, [&](int y, int w) {
 		double lat = inDst.y_to_lat(y);
+		float * dst = inDst.mData + y * inDst.mWidth;
+		for(int x = 0; x < inDst.mWidth; ++x)
+		{
+			double lon = inDst.x_to_lon(x);
 
-		double e = inSrc.get_median(lon, lat, xstep, ystep, radius);
-		inDst(x,y) = e;
-	}
+			double e = median_of_window(inSrc, lon, lat, xstep, ystep, radius, scratch[w]);
+			dst[x] = e;
+		}
+	});
 }
 
 void InterpDoubleDEM(const DEMGeo& inDEM, DEMGeo& bigger)
@@ -898,6 +959,9 @@ void	UpsampleEnvironmentalParams(DEMGeoMap& ioDEMs, ProgressFunc inProg)
 	soil_style.swap(derived_soil);
 	clim_style.swap(derived_clim);
 	agri_style.swap(derived_agri);
+	soil_style.mStorage = DEMGeo_MinimalStorage(soil_style);
+	clim_style.mStorage = DEMGeo_MinimalStorage(clim_style);
+	agri_style.mStorage = DEMGeo_MinimalStorage(agri_style);
 	
 	return;
 	
@@ -1091,13 +1155,15 @@ void	DeriveDEMs(
 //		ioDEMs[dem_OrigLandUse] = ioDEMs[dem_LandUse];
 		DEMGeo& lu_t = ioDEMs[dem_LandUse];
 		if(do_translate)
-		for (int y = 0; y < lu_t.mHeight; ++y)
-		for (int x = 0; x < lu_t.mWidth; ++x)
-		{
-			int luv = lu_t.get(x,y);
-			if (gLandUseTransTable.count(luv))
-				lu_t(x,y) = gLandUseTransTable[luv];
-		}
+		parallel_for(0, lu_t.mHeight, 16, [&lu_t](int y, int) {
+			for (int x = 0; x < lu_t.mWidth; ++x)
+			{
+				int luv = lu_t.get(x,y);
+				LandUseTransTable::const_iterator t = gLandUseTransTable.find(luv);
+				if (t != gLandUseTransTable.end())
+					lu_t(x,y) = t->second;
+			}
+		});
 
 	}
 
@@ -1146,10 +1212,12 @@ void	DeriveDEMs(
 
 	double	radial_max = 0.0;
 
+	// The per-post passes below are independent row by row, so they all run row-parallel; the
+	// only cross-row state is the radial max, which each worker keeps on its own.
 	{
 		DEMGeo	urbanTemp(landuse.mWidth, landuse.mHeight);
-		for (y = 0; y < landuse.mHeight;++y)
-		for (x = 0; x < landuse.mWidth; ++x)
+		parallel_for(0, landuse.mHeight, 16, [&](int y, int) {
+		for (int x = 0; x < landuse.mWidth; ++x)
 		{
 			float e = landuse.get(x,y);
 			
@@ -1176,6 +1244,7 @@ void	DeriveDEMs(
 			else														e = 0.0;		
 				urbanTemp(x,y) = e;
 		}
+		});
 		
 		urbanTemp.derez(8);
 		
@@ -1183,25 +1252,31 @@ void	DeriveDEMs(
 		urbanRadial.resize(urbanTemp.mWidth,urbanTemp.mHeight);
 		urbanTrans.resize(urbanTemp.mWidth,urbanTemp.mHeight);
 
-		for (y = 0; y < urbanTemp.mHeight;++y)
-		for (x = 0; x < urbanTemp.mWidth; ++x)
+		vector<double>	worker_max(parallel_thread_count(), 0.0);
+		parallel_for(0, urbanTemp.mHeight, 8, [&](int y, int w) {
+		for (int x = 0; x < urbanTemp.mWidth; ++x)
 		{
-			urban(x,y) 		= urbanTemp.kernelN(x,y, URBAN_DENSE_KERN_SIZE , sUrbanDenseSpreaderKernel);
+			urban(x,y) 		= max(0.0f, min(1.0f, urbanTemp.kernelN(x,y, URBAN_DENSE_KERN_SIZE , sUrbanDenseSpreaderKernel)));
 //			urban(x,y) 		= urbanTemp(x,y);
 			double local 	= urbanTemp.kernelN(x,y, URBAN_RADIAL_KERN_SIZE, sUrbanRadialSpreaderKernel);
 			urbanRadial(x,y) = local;
-			radial_max = max(local, radial_max);
+			worker_max[w] = max(local, worker_max[w]);
 		}
+		});
+		for (int w = 0; w < worker_max.size(); ++w)
+			radial_max = max(radial_max, worker_max[w]);
 	}
 
-	if (radial_max > 0.0) urbanRadial *= (1.0 / radial_max);
-
-	for (y = 0; y < urban.mHeight;++y)
-	for (x = 0; x < urban.mWidth; ++x)
-	{
-		urban(x,y) = max(0.0f, min(1.0f, urban(x,y)));
-		urbanRadial(x,y) = max(0.0f, min(1.0f, urbanRadial(x,y)));
-	}
+	float radial_scale = (radial_max > 0.0) ? (1.0 / radial_max) : 1.0;
+	parallel_for(0, urbanRadial.mHeight, 64, [&](int y, int) {
+		for (int x = 0; x < urbanRadial.mWidth; ++x)
+		{
+			float e = urbanRadial(x,y);
+			if (e != DEM_NO_DATA)
+				e *= radial_scale;
+			urbanRadial(x,y) = max(0.0f, min(1.0f, e));
+		}
+	});
 
 	if (inMap.number_of_halfedges() > 0)
 		BuildRoadDensityDEM(inMap, urbanTrans);
@@ -1225,12 +1300,13 @@ void	DeriveDEMs(
 
 	urbanTrans.filter_self(URBAN_TRANS_KERN_SIZE, sUrbanTransSpreaderKernel);
 
-	for (y = 0; y < urbanTrans.mHeight; ++y)
-	for (x = 0; x < urbanTrans.mWidth; ++x)
-		urbanTrans(x,y) = max(0.0f, min(urbanTrans(x,y), 1.0f));
+	parallel_for(0, urbanTrans.mHeight, 64, [&](int y, int) {
+		for (int x = 0; x < urbanTrans.mWidth; ++x)
+			urbanTrans(x,y) = max(0.0f, min(urbanTrans(x,y), 1.0f));
+	});
 
-	for (y = 0; y < urbanSquare.mHeight; ++y)
-	for (x = 0; x < urbanSquare.mWidth; ++x)
+	parallel_for(0, urbanSquare.mHeight, 16, [&](int y, int) {
+	for (int x = 0; x < urbanSquare.mWidth; ++x)
 	{
 		float e = urbanSquare.get(x,y);
 		
@@ -1251,6 +1327,7 @@ else if(e == lu_globcover_INDUSTRY)							e = 2.0;
 else														e = DEM_NO_DATA;		
 		urbanSquare(x,y)=e;
 	}
+	});
 
 	SpreadDEMValues(urbanSquare);
 	if(urbanSquare.get(0,0) == DEM_NO_DATA)
@@ -1552,8 +1629,8 @@ else														e = DEM_NO_DATA;
 
 	if (inProg) inProg(0, 1, "Calculating Derived Raster Data", 1.0);
 
-	for (y = 0; y < landuse.mHeight;++y)
-	for (x = 0; x < landuse.mWidth; ++x)
+	parallel_for(0, landuse.mHeight, 16, [&](int y, int) {
+	for (int x = 0; x < landuse.mWidth; ++x)
 	{
 		int l = landuse.get(x,y);
 		float t = temp.get(temp.map_x_from(landuse,x),
@@ -1566,6 +1643,7 @@ else														e = DEM_NO_DATA;
 		if(f == NO_VALUE) f = DEM_NO_DATA;
 		forests(x,y) = f;				
 	}
+	});
 
 	forests.fill_nearest();
 
@@ -1885,13 +1963,11 @@ void	CalcSlopeParams(DEMGeoMap& ioDEMs, bool force, ProgressFunc inProg)
 	DEMGeo&	relativeElev = ioDEMs[dem_RelativeElevation];
 	DEMGeo& elevationRange = ioDEMs[dem_ElevationRange];
 
-	int y, x, x0, x1;
-	float e0, e1;
-
 	// This fills in missing datapoints with a simple, fast, scanline fill.
 	// this is needed to clean up raw SRTM data.
-	for (y = 0; y < elev.mHeight; ++y)
-	{
+	parallel_for(0, elev.mHeight, 16, [&elev](int y, int) {
+		int x, x0, x1;
+		float e0, e1;
 		x0 = 0;
 		while (x0 < elev.mWidth)
 		{
@@ -1925,17 +2001,31 @@ void	CalcSlopeParams(DEMGeoMap& ioDEMs, bool force, ProgressFunc inProg)
 
 			x0 = x1;
 		}
-	}
+	});
+
+	// Slope runs on the DEM reduced to no more than 1201 posts, relative elevation and range on
+	// the DEM reduced while both sides are over 1200.  For the usual 3601 SRTM tile both chains
+	// end up at the same 901x901 DEM - derez is deterministic, so we only build it once and
+	// then compute all four layers in one sweep over it.
+	int	slope_dz = 0, range_dz = 0;
+	for (int w = elev.mWidth, h = elev.mHeight; w > 1201 || h > 1201; ++slope_dz)
+		w = (w + 2 - 1 - elev.mPost) / 2 + elev.mPost, h = (h + 2 - 1 - elev.mPost) / 2 + elev.mPost;
+	for (int w = elev.mWidth, h = elev.mHeight; w > 1200 && h > 1200; ++range_dz)
+		w = (w + 2 - 1 - elev.mPost) / 2 + elev.mPost, h = (h + 2 - 1 - elev.mPost) / 2 + elev.mPost;
+	bool	one_sweep = slope_dz == range_dz;
 
 	DEMGeo	elev_not_insane(elev);
-	while(elev_not_insane.mWidth > 1201 || elev_not_insane.mHeight > 1201)
+	for (int n = 0; n < slope_dz; ++n)
 		elev_not_insane.derez(2);
 
-	DEMGeo	elev2(elev);
-	while(elev2.mWidth > 1200 && elev2.mHeight > 1200)
+	DEMGeo	elev2_own;
+	if (!one_sweep)
 	{
-		elev2.derez(2);
+		elev2_own = elev;
+		for (int n = 0; n < range_dz; ++n)
+			elev2_own.derez(2);
 	}
+	const DEMGeo& elev2(one_sweep ? elev_not_insane : elev2_own);
 
 	slope.resize(elev_not_insane.mWidth, elev_not_insane.mHeight);
 	slopeHeading.resize(elev_not_insane.mWidth, elev_not_insane.mHeight);
@@ -1946,17 +2036,17 @@ void	CalcSlopeParams(DEMGeoMap& ioDEMs, bool force, ProgressFunc inProg)
 	elevationRange.mEast = relativeElev.mEast = slope.mEast = slopeHeading.mEast = elev.mEast;
 	elevationRange.mWest = relativeElev.mWest = slope.mWest = slopeHeading.mWest = elev.mWest;
 
-	elev_not_insane.calc_slope(slope, slopeHeading, inProg);
+	slope.mPost = slopeHeading.mPost = elev_not_insane.mPost;
 
-	{
-		DEMGeo	mins, maxs;
-		DEMGeo_ReduceMinMaxN(elev2, mins, maxs, 8);
+	DEMGeo	mins, maxs;
+	DEMGeo_ReduceMinMaxN(elev2, mins, maxs, 8);
 
-		for (y = 0; y < elev2.mHeight; ++y)
-		for (x = 0; x < elev2.mWidth ; ++x)
+	auto range_rows = [&](int y1, int y2) {
+		for (int y = y1; y < y2; ++y)
+		for (int x = 0; x < elev2.mWidth ; ++x)
 		{
-			e0 = mins.value_linear(elev2.x_to_lon(x), elev2.y_to_lat(y));
-			e1 = maxs.value_linear(elev2.x_to_lon(x), elev2.y_to_lat(y));
+			float e0 = mins.value_linear(elev2.x_to_lon(x), elev2.y_to_lat(y));
+			float e1 = maxs.value_linear(elev2.x_to_lon(x), elev2.y_to_lat(y));
 			elevationRange(x,y) = e1 - e0;
 
 			if (e0 == e1)
@@ -1964,9 +2054,22 @@ void	CalcSlopeParams(DEMGeoMap& ioDEMs, bool force, ProgressFunc inProg)
 			else
 				relativeElev(x,y) = min(1.0f, max(0.0f, (elev2(x,y) - e0) / (e1 - e0)));
 		}
-		if (inProg) inProg(1, 2, "Calculating local min/max", 1.0);
+	};
 
-	}
+	if (inProg) inProg(0, 2, "Calculating Slope", 0.0);
+	parallel_for_blocks(0, elev_not_insane.mHeight, 32, [&](int y1, int y2, int w) {
+		elev_not_insane.calc_slope_rows(slope, slopeHeading, y1, y2);
+		if (one_sweep)
+			range_rows(y1, y2);
+		if (w == 0 && inProg) inProg(0, 2, "Calculating Slope", (double) y2 / (double) elev_not_insane.mHeight);
+	});
+	if (inProg) inProg(0, 2, "Calculating Slope", 1.0);
+
+	if (!one_sweep)
+	parallel_for_blocks(0, elev2.mHeight, 32, [&](int y1, int y2, int) {
+		range_rows(y1, y2);
+	});
+	if (inProg) inProg(1, 2, "Calculating local min/max", 1.0);
 
 #if 0
 	{
@@ -2198,54 +2301,64 @@ static void normalize_kernel(float k[], int w)
 	}
 }
 
-static float sample_kernel_h(const DEMGeo& src, int x, int y, float k[], int width)
+// Separable NO_DATA-aware convolution.  Both passes work a whole row at a time: for each
+// kernel tap we sweep the row, so the inner loop is a contiguous multiply-add that the
+// compiler can vectorize.  Voids contribute zero weight via a 0/1 mask.  Taps are applied
+// in the same order as the old per-pixel loop, so the per-pixel sums are unchanged.
+static void accum_kernel_row(const float * src, float * s, float * wt, int x1, int x2, float k)
 {
-	float s = 0.0f;
-	float wt = 0.0f;
-	for(int w = -width; w <= width; ++w)
+	for (int x = x1; x < x2; ++x)
 	{
-		float e = src.get(x+w,y);
-		if(e != DEM_NO_DATA)
-		{
-			wt += *k;
-			s += e * *k;
-		}
-		++k;
+		float e = src[x];
+		float m = (e != DEM_NO_DATA) ? k : 0.0f;
+		wt[x] += m;
+		s[x] += m * e;
 	}
-	if (wt == 0.0f) return DEM_NO_DATA;
-	return s / wt;
 }
 
-static float sample_kernel_v(const DEMGeo& src, int x, int y, float k[], int width)
+static void finish_kernel_row(const float * s, const float * wt, float * dst, int w)
 {
-	float s = 0.0f;
-	float wt = 0.0f;
-	for(int w = -width; w <= width; ++w)
-	{
-		float e = src.get(x,y+w);
-		if(e != DEM_NO_DATA)
-		{
-			wt += *k;
-			s += e * *k;
-		}
-		++k;
-	}
-	if (wt == 0.0f) return DEM_NO_DATA;
-	return s / wt;
+	for (int x = 0; x < w; ++x)
+		dst[x] = (wt[x] == 0.0f) ? DEM_NO_DATA : s[x] / wt[x];
 }
 
 static void copy_kernel_h(const DEMGeo& src, DEMGeo& dst, float k[], int width)
 {
-	for(int y = 0; y < src.mHeight; ++y)
-	for(int x = 0; x < src.mWidth; ++x)
-		dst(x,y) = sample_kernel_h(src,x,y,k,width);
+	int w = src.mWidth;
+	vector<vector<float> >	scratch(parallel_thread_count(), vector<float>(w * 2));
+	parallel_for(0, src.mHeight, 8, [&](int y, int t) {
+		float * s = &scratch[t][0];
+		float * wt = s + w;
+		fill(s, s + w * 2, 0.0f);
+		const float * row = src.mData + y * w;
+		for (int o = -width; o <= width; ++o)
+		{
+			// x + o must land inside the row; anything else was DEM_NO_DATA before.
+			int x1 = max(0, -o);
+			int x2 = min(w, w - o);
+			if (x1 < x2)
+				accum_kernel_row(row + o, s, wt, x1, x2, k[o + width]);
+		}
+		finish_kernel_row(s, wt, dst.mData + y * w, w);
+	});
 }
 
 static void copy_kernel_v(const DEMGeo& src, DEMGeo& dst, float k[], int width)
 {
-	for(int y = 0; y < src.mHeight; ++y)
-	for(int x = 0; x < src.mWidth; ++x)
-		dst(x,y) = sample_kernel_v(src,x,y,k,width);
+	int w = src.mWidth;
+	vector<vector<float> >	scratch(parallel_thread_count(), vector<float>(w * 2));
+	parallel_for(0, src.mHeight, 8, [&](int y, int t) {
+		float * s = &scratch[t][0];
+		float * wt = s + w;
+		fill(s, s + w * 2, 0.0f);
+		for (int o = -width; o <= width; ++o)
+		{
+			int yy = y + o;
+			if (yy >= 0 && yy < src.mHeight)
+				accum_kernel_row(src.mData + yy * w, s, wt, 0, w, k[o + width]);
+		}
+		finish_kernel_row(s, wt, dst.mData + y * w, w);
+	});
 }
 
 void GaussianBlurDEM(DEMGeo& dem, float sigma)
@@ -2266,6 +2379,148 @@ void GaussianBlurDEM(DEMGeo& dem, float sigma)
 	copy_kernel_h(temp,dem,&*k.begin(),width);
 }
 
+/************************************************************************************************************************
+ * EUCLIDEAN DISTANCE FIELD
+ ************************************************************************************************************************
+
+	This is the separable exact distance transform (Felzenszwalb & Huttenlocher / Meijster et al): first each column is
+	scanned twice to get the vertical distance g to the nearest feature post in that column, then each row takes the lower
+	envelope of the parabolas (x - i)^2 + g(i)^2.  Both passes are linear in the number of posts and each column (and then
+	each row) is independent, so we hand them out to the worker threads.
+
+ */
+
+// 1-D squared distance transform of f[0..n) into d[0..n).  f may contain DT_INF for "no feature in this column".
+// v, z are scratch: v holds the parabola centers of the lower envelope, z the boundaries between them.
+static void edt_1d(const double * f, double * d, int n, int * v, double * z)
+{
+	const double DT_INF = numeric_limits<double>::infinity();
+	int k = -1;
+	for (int q = 0; q < n; ++q)
+	{
+		if (f[q] == DT_INF) continue;
+		if (k < 0)
+		{
+			k = 0;
+			v[0] = q;
+			z[0] = -DT_INF;
+			z[1] = DT_INF;
+			continue;
+		}
+		// z[0] is -inf so this always stops at k = 0 at worst.
+		double s;
+		while (1)
+		{
+			int p = v[k];
+			s = ((f[q] + (double) q * q) - (f[p] + (double) p * p)) / (2.0 * (q - p));
+			if (s > z[k]) break;
+			--k;
+		}
+		++k;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = DT_INF;
+	}
+
+	if (k < 0)
+	{
+		for (int q = 0; q < n; ++q)
+			d[q] = DT_INF;
+		return;
+	}
+
+	int j = 0;
+	for (int q = 0; q < n; ++q)
+	{
+		while (z[j+1] < q) ++j;
+		double dx = q - v[j];
+		d[q] = dx * dx + f[v[j]];
+	}
+}
+
+// Squared distance from every post to the nearest post where is_feature is true; DT_INF if there are none at all.
+template <typename Pred>
+static void edt_2d(const DEMGeo& dem, vector<double>& dist2, Pred is_feature)
+{
+	const double DT_INF = numeric_limits<double>::infinity();
+	int w = dem.mWidth;
+	int h = dem.mHeight;
+	dist2.resize((size_t) w * h);
+
+	// Pass 1: vertical distance, one column at a time.  Columns are strided in memory so hand them out in groups.
+	parallel_for_blocks(0, w, 16, [&](int x1, int x2, int) {
+		for (int x = x1; x < x2; ++x)
+		{
+			double g = DT_INF;
+			for (int y = 0; y < h; ++y)
+			{
+				if (is_feature(dem.mData[x + y * w]))	g = 0.0;
+				else if (g != DT_INF)					g += 1.0;
+				dist2[x + (size_t) y * w] = g;
+			}
+			g = DT_INF;
+			for (int y = h - 1; y >= 0; --y)
+			{
+				double& c = dist2[x + (size_t) y * w];
+				if (c == 0.0)							g = 0.0;
+				else if (g != DT_INF)					g += 1.0;
+				if (g < c)								c = g;
+			}
+			for (int y = 0; y < h; ++y)
+			{
+				double& c = dist2[x + (size_t) y * w];
+				if (c != DT_INF) c *= c;
+			}
+		}
+	});
+
+	// Pass 2: lower envelope along each row.  Each worker keeps its own scratch.
+	int workers = parallel_thread_count();
+	vector<vector<double> >	f(workers), d(workers), z(workers);
+	vector<vector<int> >	v(workers);
+
+	parallel_for(0, h, 8, [&](int y, int worker) {
+		vector<double>& fw(f[worker]);
+		vector<double>& dw(d[worker]);
+		vector<double>& zw(z[worker]);
+		vector<int>&	vw(v[worker]);
+		if (fw.size() < (size_t) w)
+		{
+			fw.resize(w);
+			dw.resize(w);
+			zw.resize(w + 1);
+			vw.resize(w);
+		}
+		double * row = &dist2[(size_t) y * w];
+		std::copy(row, row + w, fw.begin());
+		edt_1d(&*fw.begin(), &*dw.begin(), w, &*vw.begin(), &*zw.begin());
+		std::copy(dw.begin(), dw.begin() + w, row);
+	});
+}
+
+void	CalcDistanceField(DEMGeo& ioDem, bool inSigned)
+{
+	if (ioDem.mWidth <= 0 || ioDem.mHeight <= 0)
+		return;
+
+	vector<double>	outside, inside;
+	edt_2d(ioDem, outside, [](float v) { return v == 0.0f; });
+	if (inSigned)
+		edt_2d(ioDem, inside, [](float v) { return v != 0.0f; });
+
+	const double DT_INF = numeric_limits<double>::infinity();
+	int w = ioDem.mWidth;
+	parallel_for_blocks(0, ioDem.mHeight, 64, [&](int y1, int y2, int) {
+		for (size_t i = (size_t) y1 * w; i < (size_t) y2 * w; ++i)
+		{
+			if (ioDem.mData[i] != 0.0f)
+				ioDem.mData[i] = (outside[i] == DT_INF) ? FLT_MAX : sqrt(outside[i]);
+			else if (inSigned)
+				ioDem.mData[i] = (inside[i] == DT_INF) ? -FLT_MAX : -sqrt(inside[i]);
+		}
+	});
+}
+
 // Line integral of the DEM over the points x1,y1 to x2,y2.  Over-sample by over_sample_ratio (should
 // usually be higher than 1.4.
 float	IntegLine(const DEMGeo& dem, double x1, double y1, double x2, double y2, int over_sample_ratio)
@@ -2295,9 +2550,45 @@ struct sort_pixel_by_height {
 	}
 };
 
+// Every pixel address sorted by height.  This used to be a std::sort on the addresses, which is slow on big rasters and
+// leaves equal heights in whatever order the sort likes.  Now we sort (height, address) pairs - runs in parallel, then
+// merged in parallel - so ties are in address order and the result is the same for any thread count.  The order within
+// one height only changes which pixel seeds a new shed (and thus the numbering), not the shape of the sheds.
+static void	sort_pixels_by_height(const DEMGeo& input, vector<DEMGeo::address>& out_pixels)
+{
+	typedef pair<float, DEMGeo::address>	height_key;
+	int count = input.mWidth * input.mHeight;
+	vector<height_key>	keys(count), merged(count);
+	parallel_for_blocks(0, count, 65536, [&](int lo, int hi, int) {
+		for(int i = lo; i < hi; ++i)
+			keys[i] = height_key(input[i], i);
+	});
+
+	int run = max(65536, (count + parallel_thread_count() - 1) / parallel_thread_count());
+	parallel_for(0, (count + run - 1) / run, 1, [&](int r, int) {
+		sort(keys.begin() + r * run, keys.begin() + min(count, (r+1) * run));
+	});
+	for(; run < count; run *= 2)
+	{
+		parallel_for(0, (count + 2 * run - 1) / (2 * run), 1, [&](int r, int) {
+			int lo = r * 2 * run;
+			int mid = min(count, lo + run);
+			int hi = min(count, lo + 2 * run);
+			merge(keys.begin() + lo, keys.begin() + mid, keys.begin() + mid, keys.begin() + hi, merged.begin() + lo);
+		});
+		keys.swap(merged);
+	}
+
+	out_pixels.resize(count);
+	parallel_for_blocks(0, count, 65536, [&](int lo, int hi, int) {
+		for(int i = lo; i < hi; ++i)
+			out_pixels[i] = keys[i].second;
+	});
+}
+
 // This code is directly based on "Watersheds in Digital Spaces: An Efficient Algorithm Based on Immersion Simulations"
 // by Luc Vincent and Pierre Soille from their 1991 paper.
-void	Watershed(DEMGeo& input, DEMGeo& output,vector<DEMGeo::address> * out_watersheds)
+static void	watershed_immerse(DEMGeo& input, DEMGeo& output,vector<DEMGeo::address> * out_watersheds, const vector<DEMGeo::address>& all_pixels)
 {
 	#define MASK -2.0f
 	#define WSHED DEM_NO_DATA
@@ -2313,16 +2604,9 @@ void	Watershed(DEMGeo& input, DEMGeo& output,vector<DEMGeo::address> * out_water
 	dist.clear_from(input,0.0f);
 	
 	address_fifo	fifo(input.mWidth * input.mHeight + 2);
-	
-	vector<DEMGeo::address>	all_pixels;
-	all_pixels.reserve(input.mWidth * input.mHeight);
-	for(DEMGeo::address i = input.address_begin(); i != input.address_end(); ++i)
-		all_pixels.push_back(i);
-		
-	sort(all_pixels.begin(), all_pixels.end(), sort_pixel_by_height(input));	
 
 	DEMGeo::neighbor_iterator<4> n;
-	vector<DEMGeo::address>::iterator hi = all_pixels.begin(), p;
+	vector<DEMGeo::address>::const_iterator hi = all_pixels.begin(), p;
 	while(hi != all_pixels.end())
 	{
 		//printf("Processing altitude %f\n", input[*hi]);
@@ -2456,6 +2740,13 @@ void	Watershed(DEMGeo& input, DEMGeo& output,vector<DEMGeo::address> * out_water
 	
 }
 
+void	Watershed(DEMGeo& input, DEMGeo& output,vector<DEMGeo::address> * out_watersheds)
+{
+	vector<DEMGeo::address>	all_pixels;
+	sort_pixels_by_height(input, all_pixels);
+	watershed_immerse(input, output, out_watersheds, all_pixels);
+}
+
 void VerifySheds(const DEMGeo& ws, vector<DEMGeo::address>& seeds)
 {
 	set<float>	found;
@@ -2474,18 +2765,19 @@ void	NeighborHisto(const DEMGeo& input, DEMGeo& output, int semi)
 {
 	output.clear_from(input);
 	
-	for(int y = 0; y < input.mHeight; ++y)
-	for(int x = 0; x < input.mWidth; ++x)
-	{
-		float v = input.get(x,y);
-		int c = 0;
-		for(int dy = y-semi; dy <= y+semi; ++dy)
-		for(int dx = x-semi; dx <= x+semi; ++dx)
-		if(input.get(dx,dy) != v)
-			++c;
-
-		output(x,y) = c;
-	}
+	parallel_for(0, input.mHeight, 16, [&](int y, int) {
+		for(int x = 0; x < input.mWidth; ++x)
+		{
+			float v = input.get(x,y);
+			int c = 0;
+			for(int dy = y-semi; dy <= y+semi; ++dy)
+			for(int dx = x-semi; dx <= x+semi; ++dx)
+			if(input.get(dx,dy) != v)
+				++c;
+
+			output(x,y) = c;
+		}
+	});
 }
 
 void	FindWatersheds(DEMGeo& ws, vector<DEMGeo::address>& out_sheds)
@@ -2624,6 +2916,7 @@ void	MergeMMU(DEMGeo& ws, vector<DEMGeo::address>& io_sheds, int min_mmu_size)
 
 }
 
+#if DEV
 static void	SetWatershedToDominant(DEMGeo& underlying, DEMGeo& ws, DEMGeo::address seed, address_fifo& fifo)
 {
 	DebugAssert(seed != -1);
@@ -2680,10 +2973,140 @@ static void	SetWatershedToDominant(DEMGeo& underlying, DEMGeo& ws, DEMGeo::addre
 	DebugAssert(fifo.empty());
 }
 
-void	SetWatershedsToDominant(DEMGeo& underlying, DEMGeo& ws, const vector<DEMGeo::address>& io_sheds)
+// The original one-flood-fill-per-shed version, kept for TEST_Watershed.
+static void	SetWatershedsToDominant_legacy(DEMGeo& underlying, DEMGeo& ws, const vector<DEMGeo::address>& io_sheds)
 {
 	address_fifo fifo(underlying.mWidth * underlying.mHeight);
 	for(vector<DEMGeo::address>::const_iterator a = io_sheds.begin(); a != io_sheds.end(); ++a)
 	if(*a != -1)
 		SetWatershedToDominant(underlying, ws, *a, fifo);
 }
+#endif
+
+struct	shed_histo_entry {
+	int		shed;
+	float	value;
+	int		count;
+	bool operator<(const shed_histo_entry& rhs) const { return shed == rhs.shed ? value < rhs.value : shed < rhs.shed; }
+};
+
+// Watershed and MergeMMU only ever grow a shed into its neighbors, so every shed id is one connected region and we don't
+// need to flood fill from the seeds: one parallel pass histograms the underlying values per shed, and a second paints
+// each shed with its most common value (the lowest value on ties, like the flood fill did).
+void	SetWatershedsToDominant(DEMGeo& underlying, DEMGeo& ws, const vector<DEMGeo::address>& io_sheds)
+{
+	const int band = 64;
+	int bands = (underlying.mHeight + band - 1) / band;
+	vector<vector<shed_histo_entry> >	partial(bands);
+
+	parallel_for(0, bands, 1, [&](int b, int) {
+		hash_map<long long, int>	counts;
+		int y2 = min(underlying.mHeight, (b+1) * band);
+		for(int y = b * band; y < y2; ++y)
+		for(int x = 0; x < underlying.mWidth; ++x)
+		{
+			int shed = ws(x,y);
+			if(shed < 0 || shed >= io_sheds.size() || io_sheds[shed] == -1)
+				continue;
+			float v = underlying(x,y);
+			unsigned int bits;
+			memcpy(&bits, &v, sizeof(bits));
+			counts[((long long) shed << 32) | bits]++;
+		}
+		for(hash_map<long long, int>::iterator c = counts.begin(); c != counts.end(); ++c)
+		{
+			shed_histo_entry e;
+			unsigned int bits = c->first & 0xFFFFFFFF;
+			e.shed = c->first >> 32;
+			memcpy(&e.value, &bits, sizeof(bits));
+			e.count = c->second;
+			partial[b].push_back(e);
+		}
+	});
+
+	vector<shed_histo_entry>	all;
+	for(int b = 0; b < bands; ++b)
+		all.insert(all.end(), partial[b].begin(), partial[b].end());
+	sort(all.begin(), all.end());
+
+	vector<float>	best_value(io_sheds.size(), 0.0f);
+	vector<int>		best_count(io_sheds.size(), 0);
+	for(vector<shed_histo_entry>::iterator i = all.begin(); i != all.end(); )
+	{
+		vector<shed_histo_entry>::iterator j = i;
+		int total = 0;
+		while(j != all.end() && j->shed == i->shed && j->value == i->value)
+			total += (j++)->count;
+		if(total > best_count[i->shed])
+		{
+			best_count[i->shed] = total;
+			best_value[i->shed] = i->value;
+		}
+		i = j;
+	}
+
+	parallel_for(0, underlying.mHeight, 64, [&](int y, int) {
+		for(int x = 0; x < underlying.mWidth; ++x)
+		{
+			int shed = ws(x,y);
+			if(shed >= 0 && shed < best_count.size() && best_count[shed] > 0)
+				underlying(x,y) = best_value[shed];
+		}
+	});
+}
+
+#if DEV
+// Checks the parallel watershed pieces against the serial code they replaced: the height sort must give the same sheds
+// up to numbering, and SetWatershedsToDominant must paint the same values.
+void	TEST_Watershed(void)
+{
+	DEMGeo	lu(301, 203);
+	unsigned int seed = 12345;
+	for(int y = 0; y < lu.mHeight; ++y)
+	for(int x = 0; x < lu.mWidth; ++x)
+	{
+		// Blotchy land use - mostly runs of the same value, so we get real sheds and lots of equal heights.
+		seed = seed * 1103515245 + 12345;
+		if(x > 0 && (seed >> 16) % 8 != 0)
+			lu(x,y) = (y > 0 && (seed >> 8) % 3 == 0) ? lu(x,y-1) : lu(x-1,y);
+		else
+			lu(x,y) = (seed >> 16) % 7;
+	}
+
+	DEMGeo	lhi, ws_new, ws_old;
+	vector<DEMGeo::address>	sheds_new, sheds_old;
+	NeighborHisto(lu, lhi, 2);
+
+	Watershed(lhi, ws_new, &sheds_new);
+
+	vector<DEMGeo::address>	old_order;
+	for(DEMGeo::address i = lhi.address_begin(); i != lhi.address_end(); ++i)
+		old_order.push_back(i);
+	sort(old_order.begin(), old_order.end(), sort_pixel_by_height(lhi));
+	watershed_immerse(lhi, ws_old, &sheds_old, old_order);
+
+	hash_map<int, int>	new_to_old, old_to_new;
+	int bad = 0;
+	for(DEMGeo::address a = lhi.address_begin(); a != lhi.address_end(); ++a)
+	{
+		int n = ws_new[a], o = ws_old[a];
+		if(new_to_old.count(n) == 0) new_to_old[n] = o;
+		if(old_to_new.count(o) == 0) old_to_new[o] = n;
+		if(new_to_old[n] != o || old_to_new[o] != n)
+			++bad;
+	}
+	printf("Watershed: %d sheds (old sort %d), %d pixels differ beyond numbering.\n", (int) sheds_new.size(), (int) sheds_old.size(), bad);
+	DebugAssert(bad == 0 && sheds_new.size() == sheds_old.size());
+
+	MergeMMU(ws_new, sheds_new, 20);
+	DEMGeo	lu_old(lu), ws_copy(ws_new);
+	SetWatershedsToDominant_legacy(lu_old, ws_copy, sheds_new);
+	SetWatershedsToDominant(lu, ws_new, sheds_new);
+	bad = 0;
+	for(DEMGeo::address a = lu.address_begin(); a != lu.address_end(); ++a)
+	if(lu[a] != lu_old[a] || ws_new[a] != ws_copy[a])
+		++bad;
+	printf("SetWatershedsToDominant: %d pixels differ from the flood fill version.\n", bad);
+	DebugAssert(bad == 0);
+}
+#endif
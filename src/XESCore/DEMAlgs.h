@@ -89,6 +89,10 @@ void	MakeTiles(const DEMGeo& inDEM, list<DEMGeo>& outTiles);
 void	DifferenceDEM(const DEMGeo& bottom, const DEMGeo& top, DEMGeo& diff);
 void	GaussianBlurDEM(DEMGeo& dem, float sigma);
 
+// Exact Euclidean distance (in posts) from every non-zero post to the nearest zero post.  If signed, zero posts get
+// minus the distance to the nearest non-zero post; otherwise they stay zero.  FLT_MAX if there is no such post.
+void	CalcDistanceField(DEMGeo& ioDem, bool inSigned);
+
 float	IntegLine(const DEMGeo& dem, double x1, double y1, double x2, double y2, int over_sample_ratio);
 
 /* WATERSHED GUNK */
@@ -23,7 +23,15 @@
 #include "DEMDefs.h"
 #include "CompGeomDefs3.h"
 #include "MathUtils.h"
+#include "ParallelUtils.h"
 #include <list>
+#include <mutex>
+#include <atomic>
+
+#if APL || LIN
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #define HIST_MAX	10
 
@@ -91,6 +99,204 @@ inline int		aligned_block(int x, int y, int x1, int x2, int y1, int y2, int& x_l
 }
 
 
+/*************************************************************************************
+ * SCRATCH STORE AND ALLOCATION
+ *************************************************************************************/
+
+// Every DEM allocation goes through dem_alloc/dem_free so that big rasters can come out of
+// the scratch store.  Scratch mappings are tracked by their base pointer, which is all a
+// DEMGeo has - swap() and friends just move the pointer around and keep working.
+
+struct	dem_scratch_t {
+	size_t								bytes;
+	size_t								row_bytes;
+	vector<list<pair<const float *, int> >::iterator>	lru_pos;
+	vector<bool>						on_lru;
+};
+
+static std::mutex							sScratchLock;
+static string								sScratchDir;
+static size_t								sScratchMinBytes = 0;
+static size_t								sScratchBudget = 0;
+static size_t								sScratchResident = 0;
+static map<const float *, dem_scratch_t>	sScratch;
+static list<pair<const float *, int> >		sScratchLRU;		// front is most recently used
+static std::atomic<int>						sScratchMaps(0);	// Live mappings - lets heap-only runs skip the lock.
+
+#if APL || LIN
+static float *	dem_scratch_map(size_t bytes)
+{
+	string path = sScratchDir + "/demXXXXXX";
+	vector<char> buf(path.begin(), path.end());
+	buf.push_back(0);
+	int fd = mkstemp(&buf[0]);
+	if (fd == -1) return NULL;
+	unlink(&buf[0]);			// The mapping keeps the file alive; nothing to clean up if we crash.
+	void * addr = MAP_FAILED;
+	if (ftruncate(fd, bytes) == 0)	// Sparse - reads back as zeros, like memset.
+		addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return (addr == MAP_FAILED) ? NULL : (float *) addr;
+}
+
+static void	dem_scratch_drop(const float * base, const dem_scratch_t& info, int block)
+{
+	static const size_t page = sysconf(_SC_PAGESIZE);
+	size_t b1 = (size_t) block * DEM_BLOCK_ROWS * info.row_bytes;
+	size_t b2 = min(b1 + DEM_BLOCK_ROWS * info.row_bytes, info.bytes);
+	b1 = (b1 + page - 1) / page * page;		// Only whole pages inside the block - neighbors stay put.
+	b2 = b2 / page * page;
+	if (b2 <= b1) return;
+	char * p = (char *) base + b1;
+	msync(p, b2 - b1, MS_ASYNC);
+	madvise(p, b2 - b1, MADV_DONTNEED);
+}
+#endif
+
+static float *	dem_alloc(size_t count, bool zero)
+{
+	size_t bytes = count * sizeof(float);
+#if APL || LIN
+	if (!sScratchDir.empty() && bytes >= sScratchMinBytes)
+	{
+		std::lock_guard<std::mutex> lock(sScratchLock);
+		if (float * p = dem_scratch_map(bytes))
+		{
+			dem_scratch_t& info = sScratch[p];
+			info.bytes = bytes;
+			info.row_bytes = 0;
+			++sScratchMaps;
+			return p;
+		}
+		// Scratch disk full or gone - fall back to the heap rather than failing the DEM.
+	}
+#endif
+	float * p = (float *) malloc(bytes);
+	if (p && zero)
+		memset(p, 0, bytes);
+	return p;
+}
+
+static void	dem_free(float * p)
+{
+	if (p == NULL) return;
+#if APL || LIN
+	{
+		std::lock_guard<std::mutex> lock(sScratchLock);
+		map<const float *, dem_scratch_t>::iterator i = sScratch.find(p);
+		if (i != sScratch.end())
+		{
+			for (int b = 0; b < i->second.on_lru.size(); ++b)
+			if (i->second.on_lru[b])
+			{
+				sScratchResident -= min((size_t) DEM_BLOCK_ROWS * i->second.row_bytes, i->second.bytes - (size_t) b * DEM_BLOCK_ROWS * i->second.row_bytes);
+				sScratchLRU.erase(i->second.lru_pos[b]);
+			}
+			munmap(p, i->second.bytes);
+			sScratch.erase(i);
+			--sScratchMaps;
+			return;
+		}
+	}
+#endif
+	free(p);
+}
+
+bool	DEMGeo_SetScratchStore(const char * scratch_dir, size_t min_bytes, size_t resident_budget)
+{
+	std::lock_guard<std::mutex> lock(sScratchLock);
+	sScratchDir.clear();
+	if (scratch_dir == NULL)
+		return true;
+#if APL || LIN
+	if (access(scratch_dir, W_OK) != 0)
+		return false;
+	sScratchDir = scratch_dir;
+	sScratchMinBytes = min_bytes;
+	sScratchBudget = resident_budget;
+	return true;
+#else
+	return false;
+#endif
+}
+
+size_t	DEMGeo_ScratchResidentBytes(void)
+{
+	std::lock_guard<std::mutex> lock(sScratchLock);
+	return sScratchResident;
+}
+
+void	DEMGeo::touch_block(int block) const
+{
+#if APL || LIN
+	if (sScratchMaps == 0) return;
+	std::lock_guard<std::mutex> lock(sScratchLock);
+	map<const float *, dem_scratch_t>::iterator i = sScratch.find(mData);
+	if (i == sScratch.end()) return;
+	dem_scratch_t& info = i->second;
+	if (info.row_bytes == 0)
+	{
+		info.row_bytes = (size_t) mWidth * sizeof(float);
+		int blocks = (mHeight + DEM_BLOCK_ROWS - 1) / DEM_BLOCK_ROWS;
+		info.lru_pos.resize(blocks);
+		info.on_lru.resize(blocks, false);
+	}
+	if (block < 0 || block >= info.on_lru.size()) return;
+
+	if (info.on_lru[block])
+	{
+		sScratchLRU.splice(sScratchLRU.begin(), sScratchLRU, info.lru_pos[block]);
+		return;
+	}
+
+	sScratchLRU.push_front(pair<const float *, int>(mData, block));
+	info.lru_pos[block] = sScratchLRU.begin();
+	info.on_lru[block] = true;
+	sScratchResident += min((size_t) DEM_BLOCK_ROWS * info.row_bytes, info.bytes - (size_t) block * DEM_BLOCK_ROWS * info.row_bytes);
+
+	while (sScratchBudget > 0 && sScratchResident > sScratchBudget && sScratchLRU.size() > 1)
+	{
+		pair<const float *, int> victim = sScratchLRU.back();
+		dem_scratch_t& vinfo = sScratch[victim.first];
+		dem_scratch_drop(victim.first, vinfo, victim.second);
+		sScratchResident -= min((size_t) DEM_BLOCK_ROWS * vinfo.row_bytes, vinfo.bytes - (size_t) victim.second * DEM_BLOCK_ROWS * vinfo.row_bytes);
+		vinfo.on_lru[victim.second] = false;
+		sScratchLRU.pop_back();
+	}
+#endif
+}
+
+void	DEMGeo::page_out(void) const
+{
+#if APL || LIN
+	if (sScratchMaps == 0) return;
+	std::lock_guard<std::mutex> lock(sScratchLock);
+	map<const float *, dem_scratch_t>::iterator i = sScratch.find(mData);
+	if (i == sScratch.end()) return;
+	dem_scratch_t& info = i->second;
+	if (info.row_bytes == 0)
+		info.row_bytes = (size_t) mWidth * sizeof(float);
+	int blocks = (mHeight + DEM_BLOCK_ROWS - 1) / DEM_BLOCK_ROWS;
+	for (int b = 0; b < blocks; ++b)
+	{
+		dem_scratch_drop(mData, info, b);
+		if (b < info.on_lru.size() && info.on_lru[b])
+		{
+			sScratchResident -= min((size_t) DEM_BLOCK_ROWS * info.row_bytes, info.bytes - (size_t) b * DEM_BLOCK_ROWS * info.row_bytes);
+			sScratchLRU.erase(info.lru_pos[b]);
+			info.on_lru[b] = false;
+		}
+	}
+#endif
+}
+
+bool	DEMGeo::is_scratch_backed(void) const
+{
+	if (sScratchMaps == 0) return false;
+	std::lock_guard<std::mutex> lock(sScratchLock);
+	return sScratch.count(mData) > 0;
+}
+
 DEMGeo::DEMGeo() :
 	mWest(0.0),
 	mSouth(0.0),
@@ -99,6 +305,7 @@ DEMGeo::DEMGeo() :
 	mWidth(0),
 	mHeight(0),
 	mPost(1),
+	mStorage(dem_Storage_Float32),
 	mData(0)
 {
 }
@@ -110,64 +317,55 @@ DEMGeo::DEMGeo(const DEMGeo& x) :
 	mNorth(x.mNorth),
 	mWidth(x.mWidth),
 	mPost(x.mPost),
+	mStorage(x.mStorage),
 	mHeight(x.mHeight)
 {
 	if (mWidth == 0 || mHeight == 0)
 	{
 		mData = 0;
 	} else {
-		mData = (float *) malloc(mWidth * mHeight * sizeof(float));
+		mData = dem_alloc((size_t) mWidth * mHeight, x.mData == NULL);
 		if (mData == NULL)
 			mWidth = mHeight = 0;
-		else {
-			if (x.mData)
-				memcpy(mData, x.mData, mWidth * mHeight * sizeof(float));
-			else
-				memset(mData, 0, mWidth * mHeight * sizeof(float));
-		}
+		else if (x.mData)
+			memcpy(mData, x.mData, mWidth * mHeight * sizeof(float));
 	}
 }
 
 DEMGeo::DEMGeo(int width, int height) :
 	mSouth(0.0), mNorth(0.0), mEast(0.0), mWest(0.0),
-	mWidth(width), mHeight(height), mPost(1)
+	mWidth(width), mHeight(height), mPost(1), mStorage(dem_Storage_Float32)
 {
 	if (mWidth == 0 || mHeight == 0)
 	{
 		mData = 0;
 	} else {
-		mData = (float *) malloc(mWidth * mHeight * sizeof(float));
+		mData = dem_alloc((size_t) mWidth * mHeight, true);
 		if (mData == NULL)
 			mWidth = mHeight = 0;
-		else
-			memset(mData, 0, mWidth * mHeight * sizeof(float));
 	}
 }
 
 DEMGeo::~DEMGeo()
 {
-	if (mData) free(mData);
+	dem_free(mData);
 }
 
 DEMGeo& DEMGeo::operator=(float v)
 {
-	int sz = mWidth * mHeight;
-	float * p = mData;
-	while (sz--)
-		*p++ = v;
+	for_each_block([&](int x1, int y1, int x2, int y2) {
+		fill(mData + y1 * mWidth, mData + y2 * mWidth, v);
+	});
 	return *this;
 }
 
 DEMGeo& DEMGeo::operator+=(float v)
 {
-	int sz = mWidth * mHeight;
-	float * p = mData;
-	while (sz--)
-	{
+	for_each_block([&](int x1, int y1, int x2, int y2) {
+		for (float * p = mData + y1 * mWidth; p != mData + y2 * mWidth; ++p)
 		if (*p != DEM_NO_DATA)
 			*p += v;
-		++p;
-	}
+	});
 	return *this;
 }
 
@@ -175,29 +373,30 @@ DEMGeo& DEMGeo::operator+=(const DEMGeo& rhs)
 {
 	if (rhs.mWidth != mWidth || rhs.mHeight != mHeight || mData == NULL || rhs.mData == NULL || mPost != rhs.mPost)
 		return *this;
-	int sz = mWidth * mHeight;
-	const float * src = rhs.mData;
-	float * dst = mData;
-	while (sz--)
-	{
-		if (*dst != DEM_NO_DATA && *src != DEM_NO_DATA)
-			*dst += *src;
-		++dst;
-		++src;
-	}
+	bool rhs_scratch = rhs.is_scratch_backed();
+	for_each_block([&](int x1, int y1, int x2, int y2) {
+		if (rhs_scratch) rhs.touch_block(y1 / DEM_BLOCK_ROWS);
+		int sz = (y2 - y1) * mWidth;
+		const float * src = rhs.mData + y1 * mWidth;
+		float * dst = mData + y1 * mWidth;
+		while (sz--)
+		{
+			if (*dst != DEM_NO_DATA && *src != DEM_NO_DATA)
+				*dst += *src;
+			++dst;
+			++src;
+		}
+	});
 	return *this;
 }
 
 DEMGeo& DEMGeo::operator*=(float v)
 {
-	int sz = mWidth * mHeight;
-	float * p = mData;
-	while (sz--)
-	{
+	for_each_block([&](int x1, int y1, int x2, int y2) {
+		for (float * p = mData + y1 * mWidth; p != mData + y2 * mWidth; ++p)
 		if (*p != DEM_NO_DATA)
 			*p *= v;
-		++p;
-	}
+	});
 	return *this;
 }
 
@@ -205,16 +404,20 @@ DEMGeo& DEMGeo::operator*=(const DEMGeo& rhs)
 {
 	if (rhs.mWidth != mWidth || rhs.mHeight != mHeight || mData == NULL || rhs.mData == NULL || mPost != rhs.mPost)
 		return *this;
-	int sz = mWidth * mHeight;
-	const float * src = rhs.mData;
-	float * dst = mData;
-	while (sz--)
-	{
-		if (*dst != DEM_NO_DATA && *src != DEM_NO_DATA)
-			*dst *= *src;
-		++dst;
-		++src;
-	}
+	bool rhs_scratch = rhs.is_scratch_backed();
+	for_each_block([&](int x1, int y1, int x2, int y2) {
+		if (rhs_scratch) rhs.touch_block(y1 / DEM_BLOCK_ROWS);
+		int sz = (y2 - y1) * mWidth;
+		const float * src = rhs.mData + y1 * mWidth;
+		float * dst = mData + y1 * mWidth;
+		while (sz--)
+		{
+			if (*dst != DEM_NO_DATA && *src != DEM_NO_DATA)
+				*dst *= *src;
+			++dst;
+			++src;
+		}
+	});
 	return *this;
 }
 
@@ -224,10 +427,10 @@ DEMGeo& DEMGeo::operator=(const DEMGeo& x)
 
 	if (x.mWidth != mWidth || x.mHeight != mHeight || mData == NULL)
 	{
-		if (mData)	free(mData);
+		dem_free(mData);
 		mWidth = x.mWidth;
 		mHeight = x.mHeight;
-		mData = (float *) malloc(mWidth * mHeight * sizeof(float));
+		mData = dem_alloc((size_t) mWidth * mHeight, false);
 	}
 
 	mSouth = x.mSouth;
@@ -235,6 +438,7 @@ DEMGeo& DEMGeo::operator=(const DEMGeo& x)
 	mWest = x.mWest;
 	mEast = x.mEast;
 	mPost = x.mPost;
+	mStorage = x.mStorage;
 	
 	if (mData == NULL)
 		mWidth = mHeight = 0;
@@ -258,10 +462,10 @@ void DEMGeo::clear_from(const DEMGeo& x, float v)
 	
 	if (x.mWidth != mWidth || x.mHeight != mHeight || mData == NULL)
 	{
-		if (mData)	free(mData);
+		dem_free(mData);
 		mWidth = x.mWidth;
 		mHeight = x.mHeight;
-		mData = (float *) malloc(mWidth * mHeight * sizeof(float));
+		mData = dem_alloc((size_t) mWidth * mHeight, false);
 	}
 
 	mSouth = x.mSouth;
@@ -285,10 +489,10 @@ void DEMGeo::clear_from(const DEMGeo& x)
 	
 	if (x.mWidth != mWidth || x.mHeight != mHeight || mData == NULL)
 	{
-		if (mData)	free(mData);
+		dem_free(mData);
 		mWidth = x.mWidth;
 		mHeight = x.mHeight;
-		mData = (float *) malloc(mWidth * mHeight * sizeof(float));
+		mData = dem_alloc((size_t) mWidth * mHeight, false);
 	}
 
 	mSouth = x.mSouth;
@@ -350,8 +554,8 @@ void DEMGeo::derez(int r)
 	smaller.mWest = mWest;
 	smaller.mPost = mPost;
 	
+	parallel_for(0, smaller.mHeight, 16, [&](int y, int) {
 	for(int x = 0; x < smaller.mWidth; ++x)
-	for(int y=  0; y < smaller.mHeight; ++y)
 	{
 		double	ct = 0;
 		double tot = 0;
@@ -371,6 +575,7 @@ void DEMGeo::derez(int r)
 		else
 			smaller(x,y) = DEM_NO_DATA;
 	}
+	});
 
 	this->swap(smaller);
 }
@@ -415,7 +620,7 @@ void DEMGeo::derez_nearest(void)
 void	DEMGeo::resize(int width, int height)
 {
 	if (width == mWidth && height == mHeight) return;
-	if (mData) free(mData);
+	dem_free(mData);
 
 	mWidth = width; mHeight = height;
 
@@ -423,11 +628,9 @@ void	DEMGeo::resize(int width, int height)
 	{
 		mData = 0;
 	} else {
-		mData = (float *) malloc((size_t) mWidth * (size_t) mHeight * sizeof(float));
+		mData = dem_alloc((size_t) mWidth * (size_t) mHeight, true);
 		if (mData == NULL)
 			mWidth = mHeight = 0;
-		else
-			memset(mData, 0, (size_t) mWidth * (size_t) mHeight * sizeof(float));
 	}
 }
 
@@ -482,6 +685,7 @@ void	DEMGeo::swap(DEMGeo& rhs)
 	std::swap(mHeight, rhs.mHeight);
 	std::swap(mData, rhs.mData);
 	std::swap(mPost, rhs.mPost);
+	std::swap(mStorage, rhs.mStorage);
 }
 
 void	DEMGeo::calc_normal(DEMGeo& outX, DEMGeo& outY, DEMGeo& outZ, ProgressFunc inProg) const
@@ -582,18 +786,33 @@ void	DEMGeo::calc_slope(DEMGeo& outSlope, DEMGeo& outHeading, ProgressFunc inPro
 	outHeading.mPost = mPost;
 	outSlope.mPost = mPost;
 
+	if (inProg) inProg(0, 1, "Calculating Slope", 0.0);
+	// Outputs have our dimensions, so block b is the same rows in all three; the band
+	// also reads one row past each edge, which the pager brings in on its own.
+	bool out_scratch = outSlope.is_scratch_backed() || outHeading.is_scratch_backed();
+	for_each_block_parallel([&](int x1, int y1, int x2, int y2, int w) {
+		if (out_scratch)
+		{
+			outSlope.touch_block(y1 / DEM_BLOCK_ROWS);
+			outHeading.touch_block(y1 / DEM_BLOCK_ROWS);
+		}
+		calc_slope_rows(outSlope, outHeading, y1, y2);
+		if (w == 0 && inProg) inProg(0, 1, "Calculating Slope", (double) y2 / (double) mHeight);
+	});
+	if (inProg) inProg(0, 1, "Calculating Slope", 1.0);
+}
+
+// Every post only reads the DEM and writes itself, so any band of rows can be done on its own.
+void	DEMGeo::calc_slope_rows(DEMGeo& outSlope, DEMGeo& outHeading, int y1, int y2) const
+{
 	double	x_res = x_dist_to_m(1);
 	double	y_res = y_dist_to_m(1);
 	float	h, hl, ht, hb, hr;
 	float	ld, rd, bd, td;
 
-	if (inProg) inProg(0, 1, "Calculating Slope", 0.0);
+	for (int y = y1; y < y2; ++y)
 	for (int x = 0; x < mWidth; ++x)
-	for (int y = 0; y < mHeight;++y)
 	{
-		if (y == 0 && (x % 50) == 0)
-			if (inProg) inProg(0, 1, "Calculating Slope", (double) x / (double) mWidth);
-
 		h = get(x,y);
 		if (h == DEM_NO_DATA)
 		{
@@ -656,7 +875,6 @@ void	DEMGeo::calc_slope(DEMGeo& outSlope, DEMGeo& outHeading, ProgressFunc inPro
 
 		}
 	}
-	if (inProg) inProg(0, 1, "Calculating Slope", 1.0);
 }
 
 
@@ -1183,6 +1401,118 @@ float	DEMGeo_LocalMinMaxWithCache(
 	return maxh - minh;
 }
 
+#pragma mark -
+
+void	DEMGeo_PackPosts(const float * src, void * dst, size_t count, int storage)
+{
+	switch(storage) {
+	case dem_Storage_UInt8:
+		for (unsigned char * d = (unsigned char *) dst; count--; ++src, ++d)
+			*d = (*src == DEM_NO_DATA) ? 0xFF : (unsigned char) *src;
+		break;
+	case dem_Storage_UInt16:
+		for (unsigned short * d = (unsigned short *) dst; count--; ++src, ++d)
+			*d = (*src == DEM_NO_DATA) ? 0xFFFF : (unsigned short) *src;
+		break;
+	case dem_Storage_Float16:
+		for (unsigned short * d = (unsigned short *) dst; count--; ++src, ++d)
+			*d = dem_float_to_half(*src);
+		break;
+	default:
+		memcpy(dst, src, count * sizeof(float));
+		break;
+	}
+}
+
+void	DEMGeo_UnpackPosts(const void * src, float * dst, size_t count, int storage)
+{
+	switch(storage) {
+	case dem_Storage_UInt8:
+		for (const unsigned char * s = (const unsigned char *) src; count--; ++s, ++dst)
+			*dst = (*s == 0xFF) ? DEM_NO_DATA : *s;
+		break;
+	case dem_Storage_UInt16:
+		for (const unsigned short * s = (const unsigned short *) src; count--; ++s, ++dst)
+			*dst = (*s == 0xFFFF) ? DEM_NO_DATA : *s;
+		break;
+	case dem_Storage_Float16:
+		for (const unsigned short * s = (const unsigned short *) src; count--; ++s, ++dst)
+			*dst = dem_half_to_float(*s);
+		break;
+	default:
+		memcpy(dst, src, count * sizeof(float));
+		break;
+	}
+}
+
+bool	DEMGeo_StorageFits(const DEMGeo& dem, int storage)
+{
+	float top;
+	switch(storage) {
+	case dem_Storage_Float32:	return true;
+	case dem_Storage_Float16:	top = 65504.0f;	break;
+	case dem_Storage_UInt16:	top = 65534.0f;	break;
+	case dem_Storage_UInt8:		top = 254.0f;	break;
+	default:					return false;
+	}
+	for (DEMGeo::const_iterator i = dem.begin(); i != dem.end(); ++i)
+	{
+		float e = *i;
+		if (e == DEM_NO_DATA) continue;
+		if (storage == dem_Storage_Float16)
+		{
+			if (!(fabsf(e) <= top)) return false;
+		}
+		else if (!(e >= 0.0f && e <= top && e == floorf(e)))
+			return false;
+	}
+	return true;
+}
+
+int		DEMGeo_MinimalStorage(const DEMGeo& dem)
+{
+	if (DEMGeo_StorageFits(dem, dem_Storage_UInt8))		return dem_Storage_UInt8;
+	if (DEMGeo_StorageFits(dem, dem_Storage_UInt16))	return dem_Storage_UInt16;
+	return dem_Storage_Float32;
+}
+
+DEMPacked::DEMPacked() :
+	mWest(0.0), mSouth(0.0), mEast(0.0), mNorth(0.0),
+	mWidth(0), mHeight(0), mPost(1), mStorage(dem_Storage_Float32)
+{
+}
+
+void	DEMPacked::pack(const DEMGeo& src, int storage)
+{
+	DebugAssert(DEMGeo_StorageFits(src, storage));
+	mWest = src.mWest;
+	mSouth = src.mSouth;
+	mEast = src.mEast;
+	mNorth = src.mNorth;
+	mWidth = src.mWidth;
+	mHeight = src.mHeight;
+	mPost = src.mPost;
+	mStorage = storage;
+	mData.resize((size_t) mWidth * mHeight * dem_storage_bytes(storage));
+	if (!mData.empty())
+		DEMGeo_PackPosts(src.mData, &mData[0], (size_t) mWidth * mHeight, storage);
+}
+
+void	DEMPacked::unpack(DEMGeo& dst) const
+{
+	dst.resize(mWidth, mHeight);
+	dst.mWest = mWest;
+	dst.mSouth = mSouth;
+	dst.mEast = mEast;
+	dst.mNorth = mNorth;
+	dst.mPost = mPost;
+	dst.mStorage = mStorage;
+	if (!mData.empty())
+		DEMGeo_UnpackPosts(&mData[0], dst.mData, (size_t) mWidth * mHeight, mStorage);
+}
+
+#pragma mark -
+
 DEMMask::DEMMask() :
 	mWest(-180), mEast(180), mSouth(-90), mNorth(90),
 	mWidth(0),mHeight(0), mPost(1)
@@ -29,6 +29,7 @@
 #include "XESConstants.h"
 #include "ProgressUtils.h"
 #include "AssertUtils.h"
+#include "ParallelUtils.h"
 
 /*
 
@@ -74,7 +75,27 @@
 		on addresses.  Template with 4 for orthogonal connection or 8 for diagonal
 		conncetion.
 		
+	OUT-OF-CORE STORAGE
 	
+	A 1 arc-second elevation layer plus a few dozen climate and land use layers
+	will not all fit in memory for a tile.  Once a scratch store is configured
+	(DEMGeo_SetScratchStore), any DEM bigger than the threshold gets its mData
+	from a memory-mapped, already-unlinked scratch file instead of the heap.
+	mData is still one flat array, so iterators, addresses, operator() and get/set
+	all keep working; the VM system pages the data in lazily on first touch and
+	writes cold pages back to the scratch file instead of swap.
+	
+	On top of that the DEM can be walked in blocks of DEM_BLOCK_ROWS full rows
+	(a block is one contiguous range of the scratch file).  Blocks visited via
+	for_each_block or for_each_block_parallel go on an LRU; when the resident
+	blocks of all DEMs exceed the budget, the least-recently-used blocks are
+	flushed and dropped from memory.  Right now the fill/add/multiply operators
+	and calc_slope walk the DEM this way; everything else (the resamplers, the
+	blur kernels, the hydro passes) does plain row or random access and is left
+	to the OS pager.
+	
+	With no scratch store (the default), or on Windows, DEMs live on the heap
+	and the block API is simply a banded loop - the LRU lock is never taken.
 
  */
 
@@ -122,6 +143,25 @@ inline	float	MIN_NODATA_XY(float a, float b, int& xo, int& yo, int xn, int yn )
 }
 
 
+/*************************************************************************************
+ * STORAGE TYPES
+ *************************************************************************************/
+
+// Enum layers (land use, climate, translated DEMs) and coarse climate values do not need
+// 32 bits per post.  A layer's storage type says how it is packed on disk and in a DEMPacked;
+// DEM_NO_DATA maps to the top value of the integer types and is exact in fp16.  The integer
+// types only hold integral values in [0, max-1]; fp16 rounds to 11 significant bits.
+enum {
+	dem_Storage_Float32 = 0,
+	dem_Storage_Float16 = 1,
+	dem_Storage_UInt16 = 2,
+	dem_Storage_UInt8 = 3
+};
+
+inline int				dem_storage_bytes(int storage) { return storage == dem_Storage_Float32 ? 4 : (storage == dem_Storage_UInt8 ? 1 : 2); }
+inline unsigned short	dem_float_to_half(float f);
+inline float			dem_half_to_float(unsigned short h);
+
 /*************************************************************************************
  * DEMGeo - SINGLE RASTER LAYER
  *************************************************************************************/
@@ -144,6 +184,7 @@ struct	DEMGeo {
 	int		mWidth;
 	int		mHeight;
 	int		mPost;		// If 1, pixels sit "on" grid-lines, e.g. 1201 samples on a 90m DEM. If 0, a pixel is an _area_ between grid-lines.
+	int		mStorage;	// dem_Storage_* - how the layer is packed in XES files and DEMPacked.  In memory it is always float.
 
 	// An array of width*height data points in floating point format.
 	// The first sample is the southwest corner, we then proceed east.
@@ -232,6 +273,22 @@ struct	DEMGeo {
 	void	subset(DEMGeo& newDEM, int x1, int y1, int x2, int y2) const;					// INCLUSIVE for post, EXCLUSIVE for area.
 	void	swap(DEMGeo& otherDEM);															// Swap all params, good for avoiding mem copies
 
+	/****************************************************************************
+	 * BLOCK ACCESS
+	 ****************************************************************************/	
+
+	// Visit the DEM in bands of DEM_BLOCK_ROWS rows, bottom to top; func(x1, y1, x2, y2) gets
+	// an EXCLUSIVE pixel rectangle.  For scratch-backed DEMs each block is made most-recently-used
+	// before the call and may be evicted once the resident budget is exceeded.
+	template <typename F>
+	void	for_each_block(F func) const;
+	// Same, but blocks are spread over the worker threads; func(x1, y1, x2, y2, worker).
+	template <typename F>
+	void	for_each_block_parallel(F func) const;
+	void	touch_block(int block) const;		// LRU bookkeeping for one block; no-op for heap DEMs.
+	void	page_out(void) const;				// Drop all resident blocks of a scratch-backed DEM.
+	bool	is_scratch_backed(void) const;
+
 	/****************************************************************************
 	 * FILTER FUNCTIONS AND SPECIALIZED PIXEL ACCESS
 	 ****************************************************************************/	
@@ -296,7 +353,8 @@ struct	DEMGeo {
 	 ****************************************************************************/	
 
 
-			void	calc_slope(DEMGeo& outSlope, DEMGeo& outHeading, ProgressFunc inFunc) const;
+			void	calc_slope(DEMGeo& outSlope, DEMGeo& outHeading, ProgressFunc inFunc) const;	// Row-parallel
+			void	calc_slope_rows(DEMGeo& outSlope, DEMGeo& outHeading, int y1, int y2) const;	// Rows [y1,y2) only, outputs must be sized
 			void	calc_normal(DEMGeo& outX, DEMGeo& outY, DEMGeo& outZ, ProgressFunc inFunc) const;
 			void	fill_nearest(void);
 			int		remove_linear(int iterations, float max_err);
@@ -339,6 +397,56 @@ struct	DEMGeo {
 	
 };
 
+/*************************************************************************************
+ * DEM PACKED - A LAYER IN ITS STORAGE TYPE
+ *************************************************************************************/
+
+// A read-mostly copy of a DEMGeo kept in its storage type - a land use layer as uint8 is a
+// quarter of the DEMGeo and four times as many posts fit in a cache line when sampling it.
+// Values are converted on access.  The sampling routines return exactly what the DEMGeo
+// routines of the same name return on the unpacked layer.
+struct	DEMPacked {
+
+	DEMPacked();
+
+	void	pack(const DEMGeo& src, int storage);		// storage must fit - see DEMGeo_StorageFits
+	void	unpack(DEMGeo& dst) const;
+
+	inline	float	pixel_offset() const { return mPost ? 0.0 : 0.5; }
+
+	inline float	get(int x, int y) const;									// Get value at x,y, DEM_NO_DATA if out of bonds
+	inline float	get_clamp(int x, int y) const;								// Get value at x,y, clamped to the edge
+	inline void		set(int x, int y, float v);									// Safe set - no-op if off
+	inline float	xy_nearest(double lon, double lat) const;					// Nearest-neighbor value (nearest non-void)
+	inline float	xy_nearest_raw(double lon, double lat) const;				// Nearest-neighbor value, void ok
+	inline float	search_nearest(double lon, double lat) const;				// Nearest-neighbor value, search indefinitely
+	inline double	lon_to_x(double inLon) const;
+	inline double	lat_to_y(double inLat) const;
+
+	double	mWest;
+	double	mSouth;
+	double	mEast;
+	double	mNorth;
+
+	int		mWidth;
+	int		mHeight;
+	int		mPost;
+	int		mStorage;
+
+	vector<unsigned char>	mData;
+};
+
+// Bulk conversion between floats and packed posts, native byte order.
+void	DEMGeo_PackPosts(const float * src, void * dst, size_t count, int storage);
+void	DEMGeo_UnpackPosts(const void * src, float * dst, size_t count, int storage);
+
+// True if every post of the DEM can be stored in 'storage' - exactly for the integer types,
+// in range for fp16.
+bool	DEMGeo_StorageFits(const DEMGeo& dem, int storage);
+
+// Smallest storage that holds the DEM exactly.
+int		DEMGeo_MinimalStorage(const DEMGeo& dem);
+
 /*************************************************************************************
  * DEM MASK
  *************************************************************************************/
@@ -467,6 +575,22 @@ public:
 	}
  };
 
+/*************************************************************************************
+ * OUT-OF-CORE SCRATCH STORE
+ *************************************************************************************/
+
+#define DEM_BLOCK_ROWS	64
+
+// Configure the scratch store used for new DEM allocations.  DEMs of at least min_bytes are
+// memory-mapped from unlinked files in scratch_dir; resident_budget caps the bytes of blocks
+// kept resident by for_each_block (0 = no cap).  Pass NULL to go back to heap allocation -
+// existing DEMs keep whatever storage they were made with.  Returns false if scratch_dir is
+// not usable or this platform has no scratch store.
+bool	DEMGeo_SetScratchStore(const char * scratch_dir, size_t min_bytes, size_t resident_budget);
+
+// Total bytes of scratch blocks currently on the LRU.
+size_t	DEMGeo_ScratchResidentBytes(void);
+
 /*************************************************************************************
  * DEM address FIFO
  *************************************************************************************/
@@ -500,6 +624,174 @@ public:
 
 
 
+inline unsigned short	dem_float_to_half(float f)
+{
+	union { float f; unsigned int u; } v;
+	v.f = f;
+	unsigned int	sign = (v.u >> 16) & 0x8000;
+	int				exp = (int) ((v.u >> 23) & 0xFF) - 127 + 15;
+	unsigned int	mant = v.u & 0x007FFFFF;
+
+	if (exp >= 31)												// Overflow, inf and nan all go to inf.
+		return sign | 0x7C00 | (((v.u >> 23) & 0xFF) == 0xFF && mant ? 0x200 : 0);
+	if (exp <= 0)												// Denormal or zero.
+	{
+		if (exp < -10) return sign;
+		mant |= 0x00800000;
+		int shift = 14 - exp;
+		unsigned int h = mant >> shift;
+		unsigned int rem = mant & ((1u << shift) - 1);
+		unsigned int half = 1u << (shift - 1);
+		if (rem > half || (rem == half && (h & 1))) ++h;
+		return sign | h;
+	}
+	unsigned int h = sign | (exp << 10) | (mant >> 13);
+	unsigned int rem = mant & 0x1FFF;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;		// Round to nearest even; a carry into the exponent is correct.
+	return h;
+}
+
+inline float	dem_half_to_float(unsigned short h)
+{
+	union { float f; unsigned int u; } v;
+	unsigned int	sign = (h & 0x8000) << 16;
+	int				exp = (h >> 10) & 0x1F;
+	unsigned int	mant = h & 0x3FF;
+	if (exp == 0)
+	{
+		if (mant == 0) { v.u = sign; return v.f; }
+		while (!(mant & 0x400)) { mant <<= 1; --exp; }			// Renormalize the denormal.
+		++exp;
+		mant &= 0x3FF;
+	}
+	else if (exp == 31)
+	{
+		v.u = sign | 0x7F800000 | (mant << 13);
+		return v.f;
+	}
+	v.u = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+	return v.f;
+}
+
+inline float	DEMPacked::get(int x, int y) const
+{
+	if (x < 0 || x >= mWidth || y < 0 || y >= mHeight) return DEM_NO_DATA;
+	size_t i = x + (size_t) y * mWidth;
+	switch(mStorage) {
+	case dem_Storage_UInt8:		{ unsigned char v = mData[i];								return v == 0xFF ? DEM_NO_DATA : v; }
+	case dem_Storage_UInt16:	{ unsigned short v = ((const unsigned short *) &mData[0])[i];	return v == 0xFFFF ? DEM_NO_DATA : v; }
+	case dem_Storage_Float16:	return dem_half_to_float(((const unsigned short *) &mData[0])[i]);
+	default:					return ((const float *) &mData[0])[i];
+	}
+}
+
+inline void	DEMPacked::set(int x, int y, float v)
+{
+	if (x < 0 || x >= mWidth || y < 0 || y >= mHeight) return;
+	size_t i = x + (size_t) y * mWidth;
+	switch(mStorage) {
+	case dem_Storage_UInt8:		mData[i] = v == DEM_NO_DATA ? 0xFF : (unsigned char) v;								break;
+	case dem_Storage_UInt16:	((unsigned short *) &mData[0])[i] = v == DEM_NO_DATA ? 0xFFFF : (unsigned short) v;	break;
+	case dem_Storage_Float16:	((unsigned short *) &mData[0])[i] = dem_float_to_half(v);								break;
+	default:					((float *) &mData[0])[i] = v;															break;
+	}
+}
+
+inline float	DEMPacked::get_clamp(int x, int y) const
+{
+	if (mData.empty()) return DEM_NO_DATA;
+	if (x < 0) x = 0;
+	if (x > (mWidth-1)) x = mWidth-1;
+	if (y < 0) y = 0;
+	if (y > (mHeight-1)) y = mHeight-1;
+	return get(x, y);
+}
+
+inline double	DEMPacked::lon_to_x(double inLon) const
+{
+	return (inLon - mWest) * (double) (mWidth-mPost) / (mEast - mWest) - pixel_offset();
+}
+
+inline double	DEMPacked::lat_to_y(double inLat) const
+{
+	return (inLat - mSouth) * (double) (mHeight-mPost) / (mNorth - mSouth) - pixel_offset();
+}
+
+inline float	DEMPacked::xy_nearest(double lon, double lat) const
+{
+	double x_fract = (lon - mWest) / (mEast - mWest) * (double) (mWidth-mPost) - pixel_offset();
+	double y_fract = (lat - mSouth) / (mNorth - mSouth) * (double) (mHeight-mPost) - pixel_offset();
+	int x = x_fract;
+	int y = y_fract;
+	float e[4] = { get(x,y), get(x+1,y), get(x,y+1), get(x+1,y+1) };
+
+	// Same preference order as DEMGeo::xy_nearest: the closest corner first, then its neighbors.
+	static const int order[4][4] = {
+		{ 0, 1, 2, 3 },		// x,y
+		{ 1, 3, 0, 2 },		// x+1,y
+		{ 2, 3, 0, 1 },		// x,y+1
+		{ 3, 2, 1, 0 } };	// x+1,y+1
+	const int * o = order[(x_fract - x > 0.5 ? 1 : 0) + (y_fract - y > 0.5 ? 2 : 0)];
+	for (int n = 0; n < 4; ++n)
+	if (e[o[n]] != DEM_NO_DATA)
+		return e[o[n]];
+	return DEM_NO_DATA;
+}
+
+inline float	DEMPacked::xy_nearest_raw(double lon, double lat) const
+{
+	double x_fract = (lon - mWest) / (mEast - mWest) * (double) (mWidth-mPost) - pixel_offset();
+	double y_fract = (lat - mSouth) / (mNorth - mSouth) * (double) (mHeight-mPost) - pixel_offset();
+	int x = x_fract;
+	int y = y_fract;
+	return get(x_fract - x > 0.5 ? x+1 : x, y_fract - y > 0.5 ? y+1 : y);
+}
+
+inline float	DEMPacked::search_nearest(double lon, double lat) const
+{
+	if (lon < mWest || lon > mEast || lat < mSouth || lat > mNorth) return DEM_NO_DATA;
+	int x = (lon - mWest) / (mEast - mWest) * (double) (mWidth-mPost) - pixel_offset() + 0.5;
+	int y = (lat - mSouth) / (mNorth - mSouth) * (double) (mHeight-mPost) - pixel_offset() + 0.5;
+	float h;
+
+	h = get_clamp(x,y); if (h != DEM_NO_DATA) return h;
+
+	for (int r = 1; r < mWidth && r < mHeight; ++r)
+	{
+		h = get_clamp(x-r,y  );	if (h != DEM_NO_DATA) return h;
+		h = get_clamp(x+r,y  );	if (h != DEM_NO_DATA) return h;
+		h = get_clamp(x  ,y+r);	if (h != DEM_NO_DATA) return h;
+		h = get_clamp(x  ,y-r);	if (h != DEM_NO_DATA) return h;
+		h = get_clamp(x-r,y-r);	if (h != DEM_NO_DATA) return h;
+		h = get_clamp(x+r,y-r);	if (h != DEM_NO_DATA) return h;
+		h = get_clamp(x+r,y+r);	if (h != DEM_NO_DATA) return h;
+		h = get_clamp(x-r,y+r);	if (h != DEM_NO_DATA) return h;
+	}
+	return DEM_NO_DATA;
+}
+
+template <typename F>
+void	DEMGeo::for_each_block(F func) const
+{
+	bool scratch = is_scratch_backed();
+	for (int y = 0, b = 0; y < mHeight; y += DEM_BLOCK_ROWS, ++b)
+	{
+		if (scratch) touch_block(b);
+		func(0, y, mWidth, min(y + DEM_BLOCK_ROWS, mHeight));
+	}
+}
+
+template <typename F>
+void	DEMGeo::for_each_block_parallel(F func) const
+{
+	bool scratch = is_scratch_backed();
+	parallel_for(0, (mHeight + DEM_BLOCK_ROWS - 1) / DEM_BLOCK_ROWS, 1, [&](int b, int w) {
+		if (scratch) touch_block(b);
+		int y = b * DEM_BLOCK_ROWS;
+		func(0, y, mWidth, min(y + DEM_BLOCK_ROWS, mHeight), w);
+	});
+}
+
 inline float&	DEMGeo::operator()(int x, int y)
 {
 	if (x < 0 || x >= mWidth || y < 0 || y >= mHeight)
@@ -1001,7 +1293,7 @@ inline float	DEMGeo::get_median(double lon, double lat, double xstep, double yst
 	if (es.empty()) return DEM_NO_DATA;
 	sort(es.begin(), es.end());
 
-	mid = (cnt + 1) / 2;
+	mid = min((cnt + 1) / 2, cnt - 1);	// (cnt+1)/2 runs off the end for a single sample
 	//printf("-- mid:%d,es[mid]:%f.\n", mid,es[mid]);
 	return es[mid];
 }
@@ -31,6 +31,7 @@
 #include "DEMTables.h"
 #include "BitmapUtils.h"
 #include "MathUtils.h"
+#include "ParallelUtils.h"
 
 #if IBM
 #define AVOID_WIN32_FILEIO
@@ -60,7 +61,7 @@ static	double	ReadReal48(const unsigned char * p)
 	return sign_negative ? ( -m * exponent) : (m * exponent);
 }
 
-void	WriteDEM(DEMGeo& inMap, IOWriter * inWriter)
+void	WriteDEM(DEMGeo& inMap, IOWriter * inWriter, int inStorage)
 {
 	inWriter->WriteInt(inMap.mWidth);
 	inWriter->WriteInt(inMap.mHeight);
@@ -69,12 +70,26 @@ void	WriteDEM(DEMGeo& inMap, IOWriter * inWriter)
 	inWriter->WriteDouble(inMap.mEast);
 	inWriter->WriteDouble(inMap.mNorth);
 
-	EndianSwapArray(platform_Native, platform_LittleEndian, inMap.mWidth *inMap.mHeight, sizeof(float), inMap.mData);
-	inWriter->WriteBulk((const char *) inMap.mData, inMap.mWidth * inMap.mHeight * sizeof(float), false);
-	EndianSwapArray(platform_LittleEndian, platform_Native, inMap.mWidth *inMap.mHeight, sizeof(float), inMap.mData);
+	if (inStorage == dem_Storage_Float32)
+	{
+		EndianSwapArray(platform_Native, platform_LittleEndian, inMap.mWidth *inMap.mHeight, sizeof(float), inMap.mData);
+		inWriter->WriteBulk((const char *) inMap.mData, inMap.mWidth * inMap.mHeight * sizeof(float), false);
+		EndianSwapArray(platform_LittleEndian, platform_Native, inMap.mWidth *inMap.mHeight, sizeof(float), inMap.mData);
+	}
+	else
+	{
+		// Packed posts go out in one bulk write too - pack the whole layer, then swap the packed copy.
+		int bytes = dem_storage_bytes(inStorage);
+		vector<char>	buf((size_t) inMap.mWidth * inMap.mHeight * bytes);
+		if (buf.empty()) return;
+		DEMGeo_PackPosts(inMap.mData, &buf[0], (size_t) inMap.mWidth * inMap.mHeight, inStorage);
+		if (bytes > 1)
+			EndianSwapArray(platform_Native, platform_LittleEndian, inMap.mWidth * inMap.mHeight, bytes, &buf[0]);
+		inWriter->WriteBulk(&buf[0], buf.size(), false);
+	}
 }
 
-void	ReadDEM (		DEMGeo& inMap, IOReader * inReader)
+void	ReadDEM (		DEMGeo& inMap, IOReader * inReader, int inStorage)
 {
 	int	hpix, vpix;
 	inReader->ReadInt(hpix);
@@ -86,11 +101,24 @@ void	ReadDEM (		DEMGeo& inMap, IOReader * inReader)
 	inReader->ReadDouble(inMap.mSouth);
 	inReader->ReadDouble(inMap.mEast);
 	inReader->ReadDouble(inMap.mNorth);
+	inMap.mStorage = inStorage;
 
 	if (inMap.mData)
 	{
-		inReader->ReadBulk((char *) inMap.mData, inMap.mWidth * inMap.mHeight * sizeof(float), false);
-		EndianSwapArray(platform_LittleEndian, platform_Native, inMap.mWidth * inMap.mHeight, sizeof(float), inMap.mData);
+		if (inStorage == dem_Storage_Float32)
+		{
+			inReader->ReadBulk((char *) inMap.mData, inMap.mWidth * inMap.mHeight * sizeof(float), false);
+			EndianSwapArray(platform_LittleEndian, platform_Native, inMap.mWidth * inMap.mHeight, sizeof(float), inMap.mData);
+		}
+		else
+		{
+			int bytes = dem_storage_bytes(inStorage);
+			vector<char>	buf((size_t) inMap.mWidth * inMap.mHeight * bytes);
+			inReader->ReadBulk(&buf[0], buf.size(), false);
+			if (bytes > 1)
+				EndianSwapArray(platform_LittleEndian, platform_Native, inMap.mWidth * inMap.mHeight, bytes, &buf[0]);
+			DEMGeo_UnpackPosts(&buf[0], inMap.mData, (size_t) inMap.mWidth * inMap.mHeight, inStorage);
+		}
 	}
 }
 
@@ -730,18 +758,23 @@ static	void	IgnoreTiffErrs(const char *, const char* fmt, va_list args)
 	vprintf(fmt, args);
 }
 
+// A TIFF client handle over a memory-mapped file.  The second form shares an already
+// open file so that several TIFF handles (one per decode thread) can each keep their
+// own read offset without re-mapping the file.
 struct	StTiffMemFile {
-	StTiffMemFile(const char * fname) { file = MemFile_Open(fname); offset = 0; }
-	~StTiffMemFile() { if (file) MemFile_Close(file); }
+	StTiffMemFile(const char * fname) { file = MemFile_Open(fname); offset = 0; owns = true; }
+	StTiffMemFile(MFMemFile * shared) { file = shared; offset = 0; owns = false; }
+	~StTiffMemFile() { if (file && owns) MemFile_Close(file); }
 
 	MFMemFile *		file;
-	int				offset;
+	toff_t			offset;
+	bool			owns;
 };
 
 static tsize_t	MemTIFFReadWriteProc(thandle_t handle, tdata_t data, tsize_t len)
 {
 	StTiffMemFile *	f = (StTiffMemFile *) handle;
-	int remain = MemFile_GetEnd(f->file) - MemFile_GetBegin(f->file) - f->offset;
+	tsize_t remain = (tsize_t) (MemFile_GetEnd(f->file) - MemFile_GetBegin(f->file)) - (tsize_t) f->offset;
 	if (len > remain) len = remain;
 	if (len < 0) len = 0;
 	if (len > 0)
@@ -1083,6 +1116,314 @@ bail:
 }
 
 
+/*
+	Windowed GeoTiff reading -
+
+	Continental mosaics are far too big to load whole just to crop out one tile, so the windowed reader works out
+	which strips or tiles of the file overlap the requested extent and decodes only those.  Output posts are
+	mapped back to source pixels up front (col_src/row_src below); each decoded block then drops its pixels
+	straight into the posts that want them.  Since every source pixel lives in exactly one block, blocks can be
+	decoded on separate threads (each with its own TIFF handle over the same mapped file - libtiff handles are
+	not thread safe) with no locking.
+
+	Resampling: when the output is coarser than the file we take the nearest source pixel as we go, so memory
+	is bounded by the output DEM, not the file.  When the output is finer we decode the (smaller) native window
+	and interpolate linearly from that.
+*/
+
+// Byte size of one sample for the formats we can convert, or 0 if we can't read it.
+static int	tiff_sample_bytes(int format, int d)
+{
+	switch(format) {
+	case SAMPLEFORMAT_UINT:
+	case SAMPLEFORMAT_INT:		return (d == 8 || d == 16 || d == 32) ? d / 8 : 0;
+	case SAMPLEFORMAT_IEEEFP:	return (d == 32 || d == 64) ? d / 8 : 0;
+	default:					return 0;
+	}
+}
+
+template<typename T>
+void sample_block(
+				const T * v,
+				int ox, int oy,				// Block origin in file pixels, row 0 = north
+				int stride,					// Samples per block row
+				const vector<int>& xs,		// DEM columns fed by this block
+				const vector<int>& ys,		// DEM rows fed by this block
+				const vector<int>& col_src,
+				const vector<int>& row_src,
+				DEMGeo& dem)
+{
+	for (vector<int>::const_iterator y = ys.begin(); y != ys.end(); ++y)
+	{
+		const T * line = v + (row_src[*y] - oy) * stride - ox;
+		for (vector<int>::const_iterator x = xs.begin(); x != xs.end(); ++x)
+			dem(*x,*y) = line[col_src[*x]];
+	}
+}
+
+static void	sample_block_any(const void * buf, int format, int d, int ox, int oy, int stride,
+				const vector<int>& xs, const vector<int>& ys, const vector<int>& col_src, const vector<int>& row_src, DEMGeo& dem)
+{
+	switch(format) {
+	case SAMPLEFORMAT_UINT:
+		if (d ==  8) sample_block((const unsigned char  *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		if (d == 16) sample_block((const unsigned short *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		if (d == 32) sample_block((const unsigned int   *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		break;
+	case SAMPLEFORMAT_INT:
+		if (d ==  8) sample_block((const signed char    *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		if (d == 16) sample_block((const short          *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		if (d == 32) sample_block((const int            *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		break;
+	case SAMPLEFORMAT_IEEEFP:
+		if (d == 32) sample_block((const float          *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		if (d == 64) sample_block((const double         *) buf, ox, oy, stride, xs, ys, col_src, row_src, dem);
+		break;
+	}
+}
+
+// Decode every strip/tile that feeds some post of 'dem'.  col_src[x] is the file column for DEM column x,
+// row_src[y] the file row (north = 0) for DEM row y; -1 means no source pixel (post is left alone).
+static bool	decode_tiff_window(TIFF * tif, MFMemFile * file, const char * inFileName, int format, int d,
+				const vector<int>& col_src, const vector<int>& row_src, DEMGeo& dem)
+{
+	uint32	w, h, bw, bh;
+	TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+	TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+
+	bool tiled = TIFFIsTiled(tif);
+	if (tiled)
+	{
+		TIFFGetField(tif, TIFFTAG_TILEWIDTH, &bw);
+		TIFFGetField(tif, TIFFTAG_TILELENGTH, &bh);
+	}
+	else
+	{
+		bw = w;
+		bh = h;
+		TIFFGetField(tif, TIFFTAG_ROWSPERSTRIP, &bh);
+		if (bh == 0 || bh > h) bh = h;
+	}
+
+	int		nbx = (w + bw - 1) / bw;
+	int		nby = (h + bh - 1) / bh;
+
+	vector<vector<int> >	xs_for(nbx), ys_for(nby);
+	for (int x = 0; x < col_src.size(); ++x)
+	if (col_src[x] >= 0)
+		xs_for[col_src[x] / bw].push_back(x);
+	for (int y = 0; y < row_src.size(); ++y)
+	if (row_src[y] >= 0)
+		ys_for[row_src[y] / bh].push_back(y);
+
+	vector<pair<int,int> >	blocks;
+	for (int by = 0; by < nby; ++by)
+	if (!ys_for[by].empty())
+	for (int bx = 0; bx < nbx; ++bx)
+	if (!xs_for[bx].empty())
+		blocks.push_back(pair<int,int>(bx, by));
+
+	printf("Decoding %d of %d %s.\n", (int) blocks.size(), nbx * nby, tiled ? "tiles" : "strips");
+
+	tsize_t					buf_size = tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+	int						workers = parallel_thread_count();
+	vector<TIFF *>			handles(workers, (TIFF *) NULL);
+	vector<StTiffMemFile *>	views(workers, (StTiffMemFile *) NULL);
+	vector<tdata_t>			bufs(workers, (tdata_t) NULL);
+	std::atomic<bool>		failed(false);
+	handles[0] = tif;
+
+	parallel_for(0, blocks.size(), 1, [&](int i, int wk) {
+		if (failed) return;
+		if (handles[wk] == NULL)
+		{
+			views[wk] = new StTiffMemFile(file);
+			handles[wk] = XTIFFClientOpen(inFileName, "r", views[wk],
+				MemTIFFReadWriteProc, MemTIFFReadWriteProc,
+				MemTIFFSeekProc, MemTIFFCloseProc,
+				MemTIFFSizeProc,
+				MemTIFFMapFileProc, MemTIFFUnmapFileProc);
+			if (handles[wk] == NULL) { failed = true; return; }
+		}
+		if (bufs[wk] == NULL)
+			bufs[wk] = _TIFFmalloc(buf_size);
+
+		int bx = blocks[i].first;
+		int by = blocks[i].second;
+		tsize_t got = tiled ?
+			TIFFReadEncodedTile(handles[wk], TIFFComputeTile(handles[wk], bx * bw, by * bh, 0, 0), bufs[wk], buf_size) :
+			TIFFReadEncodedStrip(handles[wk], by, bufs[wk], buf_size);
+		if (got == -1) { printf("Tiff error in read.\n"); failed = true; return; }
+
+		sample_block_any(bufs[wk], format, d, bx * bw, by * bh, bw, xs_for[bx], ys_for[by], col_src, row_src, dem);
+	});
+
+	for (int wk = 0; wk < workers; ++wk)
+	{
+		if (bufs[wk]) _TIFFfree(bufs[wk]);
+		if (wk > 0 && handles[wk]) TIFFClose(handles[wk]);
+		delete views[wk];
+	}
+	return !failed;
+}
+
+bool	ExtractGeoTiffWindow(DEMGeo& inMap, const char * inFileName, int post_style,
+				double west, double south, double east, double north, int x_samples, int y_samples)
+{
+	bool ok = false;
+	double	corners[8];
+	TIFF * tif = NULL;
+	TIFFErrorHandler	warnH = TIFFSetWarningHandler(IgnoreTiffWarnings);
+	TIFFErrorHandler	errH = TIFFSetErrorHandler(IgnoreTiffErrs);
+	StTiffMemFile	tiffMem(inFileName);
+	if (tiffMem.file == NULL) goto bail;
+
+	printf("Trying file: %s\n", inFileName);
+	tif = XTIFFClientOpen(inFileName, "r", &tiffMem,
+	    MemTIFFReadWriteProc, MemTIFFReadWriteProc,
+	    MemTIFFSeekProc, MemTIFFCloseProc,
+	    MemTIFFSizeProc,
+	    MemTIFFMapFileProc, MemTIFFUnmapFileProc);
+    if (tif == NULL) goto bail;
+
+	if (!FetchTIFFCornersWithTIFF(tif, corners, post_style))
+	{
+		printf("Could not read GeoTiff projection data.\n");
+		goto bail;
+	}
+
+	{
+		uint32 tw, th;
+		uint16 cc = 1;
+		uint16 d;
+		uint16 format = SAMPLEFORMAT_UINT;	// sample format is NOT mandatory - unsigned int is the default if not present!
+
+		TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tw);
+		TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &th);
+		TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &cc);
+		TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &d);
+		TIFFGetField(tif, TIFFTAG_SAMPLEFORMAT, &format);
+		int w = tw, h = th;
+		printf("Image is: %dx%d, samples: %d, depth: %d, format: %d\n", w, h, cc, d, format);
+
+		if (cc != 1 || tiff_sample_bytes(format, d) == 0)
+		{
+			printf("TIFF error: unsupported pixel format %d, depth %d, %d samples.\n", format, d, cc);
+			goto bail;
+		}
+
+		// Geometry of the whole file, in the same terms as a DEMGeo: column x sits at fw + (x + off) * dx.
+		int		post = (post_style == dem_want_Post);
+		double	off = post ? 0.0 : 0.5;
+		double	fw = corners[0], fs = corners[1];
+		double	dx = (corners[6] - fw) / (double) (w - post);
+		double	dy = (corners[7] - fs) / (double) (h - post);
+
+		// Native pixels whose sample points fall inside [lo,hi], clamped to the file.
+		int x0 = max(0,     (int) ceil ((west  - fw) / dx - off - 1.0e-6));
+		int x1 = min(w - 1, (int) floor((east  - fw) / dx - off + 1.0e-6));
+		int y0 = max(0,     (int) ceil ((south - fs) / dy - off - 1.0e-6));
+		int y1 = min(h - 1, (int) floor((north - fs) / dy - off + 1.0e-6));
+
+		bool	enlarge = false;
+		if (x_samples > 0 && y_samples > 0)
+		{
+			double want_dx = (east - west) / (double) (x_samples - post);
+			double want_dy = (north - south) / (double) (y_samples - post);
+			enlarge = want_dx < dx || want_dy < dy;
+			if (enlarge)
+			{
+				// Interpolation needs the posts just outside the window too.
+				x0 = max(0,     (int) floor((west  - fw) / dx - off));
+				x1 = min(w - 1, (int) ceil ((east  - fw) / dx - off));
+				y0 = max(0,     (int) floor((south - fs) / dy - off));
+				y1 = min(h - 1, (int) ceil ((north - fs) / dy - off));
+			}
+		}
+
+		if (x0 > x1 || y0 > y1)
+		{
+			printf("GeoTiff %s does not overlap %lf,%lf -> %lf,%lf\n", inFileName, west, south, east, north);
+			goto bail;
+		}
+
+		DEMGeo	native;
+		DEMGeo&	crop = (x_samples > 0 && y_samples > 0) ? native : inMap;
+
+		vector<int>	col_src, row_src;
+
+		if (x_samples > 0 && y_samples > 0 && !enlarge)
+		{
+			// Reducing - pick the nearest file pixel for each output post as the blocks come in.
+			inMap.mWest = west;
+			inMap.mSouth = south;
+			inMap.mEast = east;
+			inMap.mNorth = north;
+			inMap.mPost = post;
+			inMap.resize(x_samples, y_samples);
+			inMap = DEM_NO_DATA;
+
+			col_src.resize(x_samples);
+			row_src.resize(y_samples);
+			for (int x = 0; x < x_samples; ++x)
+			{
+				int c = round((inMap.x_to_lon(x) - fw) / dx - off);
+				col_src[x] = (c >= 0 && c < w) ? c : -1;
+			}
+			for (int y = 0; y < y_samples; ++y)
+			{
+				int r = round((inMap.y_to_lat(y) - fs) / dy - off);
+				row_src[y] = (r >= 0 && r < h) ? h - 1 - r : -1;
+			}
+
+			ok = decode_tiff_window(tif, tiffMem.file, inFileName, format, d, col_src, row_src, inMap);
+		}
+		else
+		{
+			// Native-resolution crop of the window - this is the result, or the source for enlarging.
+			crop.mWest  = fw + (double) x0 * dx;
+			crop.mEast  = fw + (double) (x1 + 1 - post) * dx;
+			crop.mSouth = fs + (double) y0 * dy;
+			crop.mNorth = fs + (double) (y1 + 1 - post) * dy;
+			crop.mPost = post;
+			crop.resize(x1 - x0 + 1, y1 - y0 + 1);
+
+			col_src.resize(crop.mWidth);
+			row_src.resize(crop.mHeight);
+			for (int x = 0; x < crop.mWidth; ++x)
+				col_src[x] = x0 + x;
+			for (int y = 0; y < crop.mHeight; ++y)
+				row_src[y] = h - 1 - (y0 + y);
+
+			ok = decode_tiff_window(tif, tiffMem.file, inFileName, format, d, col_src, row_src, crop);
+
+			if (ok && &crop != &inMap)
+			{
+				inMap.mWest = west;
+				inMap.mSouth = south;
+				inMap.mEast = east;
+				inMap.mNorth = north;
+				inMap.mPost = post;
+				inMap.resize(x_samples, y_samples);
+
+				parallel_for(0, y_samples, 16, [&](int y, int) {
+					double lat = inMap.y_to_lat(y);
+					for (int x = 0; x < x_samples; ++x)
+						inMap(x,y) = native.value_linear(inMap.x_to_lon(x), lat);
+				});
+			}
+		}
+
+		printf("Window: %d,%d -> %d,%d of %dx%d file, DEM is %dx%d.\n", x0, y0, x1, y1, w, h, inMap.mWidth, inMap.mHeight);
+	}
+
+bail:
+	if (tif) TIFFClose(tif);
+	TIFFSetWarningHandler(warnH);
+	TIFFSetErrorHandler(errH);
+	return ok;
+}
+
 bool	WriteGeoTiff(DEMGeo& inMap, const char * inFileName)
 {
 	int result = -1;
@@ -1663,6 +2004,7 @@ bool	TranslateDEMForward(DEMGeo& ioDem, const vector<int>& inForwardMap)
 		else if (v >= inForwardMap.size()) {ioDem(x,y)=DEM_NO_DATA;					ret = false;	printf("Out of range: %d\n", v); }
 		else 							   {ioDem(x,y)=inForwardMap[v];							}
 	}
+	ioDem.mStorage = DEMGeo_MinimalStorage(ioDem);
 	return ret;
 }
 
@@ -1681,6 +2023,7 @@ bool	TranslateDEMReverse(DEMGeo& ioDem, const hash_map<int, int>& inReverseMap)
 		} else
 			ioDem(x,y) = i->second;
 	}
+	ioDem.mStorage = DEMGeo_MinimalStorage(ioDem);
 	return ret;
 
 }
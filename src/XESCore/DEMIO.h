@@ -55,8 +55,11 @@ struct	DEMSpec {
 
 // These DEM IO Routines write the 'DEM format' that is part of an XES file.
 // They do NOT write the atom container that holds the DEMs, just the contents.
-void	WriteDEM(		DEMGeo& inMap, IOWriter * inWriter);
-void	ReadDEM (		DEMGeo& inMap, IOReader * inReader);
+// The storage type (dem_Storage_*) is not part of the DEM format - the XES file keeps
+// it in a separate atom - so the reader must be told what the writer used.  Writing
+// with a storage the DEM does not fit in (DEMGeo_StorageFits) mangles the data.
+void	WriteDEM(		DEMGeo& inMap, IOWriter * inWriter, int inStorage = dem_Storage_Float32);
+void	ReadDEM (		DEMGeo& inMap, IOReader * inReader, int inStorage = dem_Storage_Float32);
 
 // Translate the values of the DEM as enums.  Useful when loading an enum-based
 // DEM like land use or climate.
@@ -84,6 +87,11 @@ bool	ExtractUSGSNaturalFile(DEMGeo& inMap, const char * inFileName);
 
 // GeoTiff - must be geographic projected for us to use.  Origin is NW corner.
 bool	ExtractGeoTiff(DEMGeo& inMap, const char * inFileName, int post_style, int no_geo_needed);
+// Windowed GeoTiff read: only the strips/tiles overlapping west/south/east/north are decoded (on several threads).
+// With zero samples the window is cropped at the file's own resolution, otherwise it is resampled to x_samples by
+// y_samples covering exactly the extent - nearest pixel when reducing, linear when enlarging.
+bool	ExtractGeoTiffWindow(DEMGeo& inMap, const char * inFileName, int post_style,
+				double west, double south, double east, double north, int x_samples, int y_samples);
 bool	WriteGeoTiff(DEMGeo& inMap, const char * inFileName);
 
 // DTED - contains its own geo info
@@ -125,7 +133,8 @@ bool	LoadTranslationFile(const char * 		inFileName,
 						vector<int>& 			outForwardMap,
 						hash_map<int, int> * 	outReverseMap,
 						vector<char> *			outCLUT);
-// Translate a DEM by the given mappings.
+// Translate a DEM by the given mappings.  The result is an enum layer, so its storage type is set to the
+// smallest one that holds it (see DEMGeo_MinimalStorage).
 bool	TranslateDEMForward(DEMGeo& ioDEM, const vector<int>& inForwardMap);
 bool	TranslateDEMReverse(DEMGeo& ioDEM, const hash_map<int, int>& inReverseMap);
 // One-step - load the filter, translate the DEM.
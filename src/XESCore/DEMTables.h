@@ -340,8 +340,11 @@ inline bool	LowerPriorityNaturalTerrain(int lhs, int rhs)
 	DebugAssert(gNaturalTerrainInfo.count(lhs));
 	DebugAssert(gNaturalTerrainInfo.count(rhs));
 
-	int lhs_layer = gNaturalTerrainInfo[lhs].layer;
-	int rhs_layer = gNaturalTerrainInfo[rhs].layer;
+	// find, not [] - this is called from the parallel block filler and must never insert.
+	NaturalTerrainInfoMap::const_iterator li = gNaturalTerrainInfo.find(lhs);
+	NaturalTerrainInfoMap::const_iterator ri = gNaturalTerrainInfo.find(rhs);
+	int lhs_layer = li == gNaturalTerrainInfo.end() ? 0 : li->second.layer;
+	int rhs_layer = ri == gNaturalTerrainInfo.end() ? 0 : ri->second.layer;
 
 	// Lookups - if we have a layer difference, that goes.
 	if (lhs_layer < rhs_layer) return true;
@@ -37,6 +37,7 @@
 #include "MathUtils.h"
 #include "PerfUtils.h"
 #include "GISTool_Globals.h"
+#include "ParallelUtils.h"
 
 /*
 	TODO:
@@ -327,6 +328,154 @@ struct	road_coords_checker {
 	}
 };
 
+// The exported shape of one road chain: bezier points from the chain's shape points, simplified, with the
+// end control points pulled in so we don't cross our neighbors at the junctions.  This only reads the chain,
+// its junctions and their other chains, so it is run for all chains at once; the DSF writer gets the
+// results afterward, in chain order, on the main thread.
+struct	chain_export_t {
+	list<Point2c>	pts;
+	int				orig_shape_count;
+	int				reduced_shape_count;
+	vector<Point2>	bad_fixes;				// LOG_POINT_FAIL these when we write the chain.
+	chain_export_t() : orig_shape_count(0), reduced_shape_count(0) { }
+};
+
+static void build_chain_export(Net_ChainInfo_t * chain, chain_export_t& out)
+{
+	NetRepInfoTable::const_iterator rep = gNetReps.find(chain->rep_type);
+	DebugAssert(rep != gNetReps.end());
+	const NetRepInfo * info = &rep->second;
+
+	list<Point2c>&	pts(out.pts);
+
+	pts.push_back(Point2c(chain->start_junction->location,false));
+
+	for(int n = 0; n < chain->shape.size(); ++n)
+	{
+		if(chain->shape.size() == 1)
+		{
+			generate_bezier(chain->start_junction->location,
+							chain->shape[0  ],
+							chain->end_junction->location,
+							info->min_defl_deg_mtr, info->crease_angle_cos,
+							pts);
+		}
+		else if(n == 0)
+		{
+			generate_bezier(chain->start_junction->location,
+							chain->shape[n  ],
+							chain->shape[n+1],
+							info->min_defl_deg_mtr, info->crease_angle_cos,
+							pts);
+		}
+		else if (n == chain->shape.size()-1)
+		{
+			generate_bezier(chain->shape[n-1],
+							chain->shape[n  ],
+							chain->end_junction->location,
+							info->min_defl_deg_mtr, info->crease_angle_cos,
+							pts);
+		}
+		else
+		{
+			generate_bezier(chain->shape[n-1],
+							chain->shape[n  ],
+							chain->shape[n+1],
+							info->min_defl_deg_mtr, info->crease_angle_cos,
+							pts);
+		}
+	}
+
+	pts.push_back(Point2c(chain->end_junction->location,false));
+	DebugAssert(pts.size() >= 2);
+
+	DebugAssert(pts.back().c == 0);
+	#if CAN_OPTIMIZE_BEZIERS
+	if(info->max_err > 0.0)
+	#if ONLY_OPTIMIZE_RAMPS
+	if(info->use_mode == use_Ramp && pts.size() > 20)
+	#endif
+	{
+		#if SHOW_BEZIERS
+			visualize_bezier(pts,true,0.1f, 0.0f);
+		#endif
+		out.orig_shape_count += pts.size();
+		bezier_multi_simplify_straight_ok(pts, MTR_TO_DEG_LAT * info->max_err, 0.00005);// * MTR_TO_DEG_LAT * 5.0 * 5.0);
+		out.reduced_shape_count += pts.size();
+		#if SHOW_BEZIERS
+			visualize_bezier(pts,false,1.0f,1.0f);
+		#endif
+	}
+	#endif
+	DebugAssert(pts.size() >= 2);
+
+	Net_ChainInfo_t * start_ccw = chain->start_junction->GetNeighborLimit(chain, true);
+	Net_ChainInfo_t * start_cw = chain->start_junction->GetNeighborLimit(chain, false);
+
+	Net_ChainInfo_t * end_ccw = chain->end_junction->GetNeighborLimit(chain, true);
+	Net_ChainInfo_t * end_cw = chain->end_junction->GetNeighborLimit(chain, false);
+
+	int fix_start = 0, fix_end = 0;
+
+	if(start_ccw)
+	{
+		Vector2	start_ccw_dir = start_ccw->dir_out_of_junc(chain->start_junction);
+		Vector2 my_dir = start_dir(pts);
+		if(start_ccw_dir.left_turn(my_dir))
+		{
+			++fix_start;
+			//debug_mesh_point(*nth_from(pts.begin(),1), 1, 0, 0);
+			fix_control_point(*nth_from(pts.begin(),0), *nth_from(pts.begin(),1),start_ccw_dir);
+		}
+	}
+
+	if(start_cw)
+	{
+		Vector2	start_cw_dir = start_cw->dir_out_of_junc(chain->start_junction);
+		Vector2 my_dir = start_dir(pts);
+		if(start_cw_dir.right_turn(my_dir))
+		{
+			++fix_start;
+			//debug_mesh_point(*nth_from(pts.begin(),1), 1, 0, 0);
+			fix_control_point(*nth_from(pts.begin(),0), *nth_from(pts.begin(),1),start_cw_dir);
+		}
+	}
+//	DebugAssert(fix_start < 2);
+	if(fix_start >= 2)
+	{
+		out.bad_fixes.push_back(*nth_from(pts.begin(),1));
+	}
+
+	if(end_ccw)
+	{
+		Vector2	end_ccw_dir = end_ccw->dir_out_of_junc(chain->end_junction);
+		Vector2 my_dir = end_dir(pts);
+		if(end_ccw_dir.left_turn(my_dir))
+		{
+			//debug_mesh_point(*nth_from(pts.rbegin(),1), 1, 0, 0);
+			fix_control_point(*nth_from(pts.rbegin(),0), *nth_from(pts.rbegin(),1),end_ccw_dir);
+			++fix_end;
+		}
+	}
+
+	if(end_cw)
+	{
+		Vector2	end_cw_dir = end_cw->dir_out_of_junc(chain->end_junction);
+		Vector2 my_dir = end_dir(pts);
+		if(end_cw_dir.right_turn(my_dir))
+		{
+			//debug_mesh_point(*nth_from(pts.rbegin(),1), 1, 0, 0);
+			fix_control_point(*nth_from(pts.rbegin(),0), *nth_from(pts.rbegin(),1),end_cw_dir);
+			++fix_end;
+		}
+	}
+//	DebugAssert(fix_end < 2);
+	if(fix_end >= 2)
+	{
+		out.bad_fixes.push_back(*nth_from(pts.rbegin(),1));
+	}
+}
+
 // We have to transform generic/specific int pair land uses into one numbering system and back!
 
 // Edge-wrapper...turns out CDT::Edge is so deeply templated that stuffing it in a map crashes CW8.
@@ -529,19 +678,30 @@ static void ProjectTex(double lon, double lat, double& s, double& t, const tex_p
 
 
 
-static double GetWaterBlend(CDT::Vertex_handle v_han, const DEMGeo& dem_land, const DEMGeo& dem_water)
+// Lon/lat of every mesh vertex in doubles, keyed by vertex.  The DSF jobs run on many threads and reading a lazy
+// coordinate can settle it (not thread safe), so we fill this in one serial walk and the jobs only read it.
+typedef hash_map<const void *, Point2>	vertex_ll_map;
+
+static void SnapshotVertexLL(CDT& inMesh, vertex_ll_map& outLL)
+{
+	outLL.clear();
+	outLL.reserve(inMesh.number_of_vertices());
+	for (CDT::Finite_vertices_iterator v = inMesh.finite_vertices_begin(); v != inMesh.finite_vertices_end(); ++v)
+		outLL[&*v] = cgal2ben(v->point());
+}
+
+// The caller stores the result in the vertex's wave_height - we run on many threads at once.
+static double CalcWaterBlend(const Point2& v_ll, const DEMGeo& dem_land, const DEMGeo& dem_water)
 {
 	double lon, lat;
-	lon = doblim(CGAL::to_double(v_han->point().x()),dem_land.mWest ,dem_land.mEast );
-	lat = doblim(CGAL::to_double(v_han->point().y()),dem_land.mSouth,dem_land.mNorth);
+	lon = doblim(v_ll.x(),dem_land.mWest ,dem_land.mEast );
+	lat = doblim(v_ll.y(),dem_land.mSouth,dem_land.mNorth);
 
 	float land_ele  = dem_land.value_linear(lon, lat);
 	float water_ele = dem_water.value_linear(lon, lat);
 
 	float ret = interp(0, 0, 50, 1, land_ele - water_ele);
 
-	v_han->info().wave_height = ret;
-
 	if (ret > 1.0)
 		printf("Over.\n");
 	if (ret < 0.0)
@@ -1139,7 +1299,7 @@ const float edge_path_builder::k_colors[] = {
 		0,1,1,
 		0,0,1 };
 
-void make_airport_rings(CDT& mesh,vector<dsf_airport_edge_info_t>& out_rings)
+void make_airport_rings(CDT& mesh, const vertex_ll_map& ll, vector<dsf_airport_edge_info_t>& out_rings)
 {
 	struct apt_ring_info {
 		CDT::Edge	next;
@@ -1187,8 +1347,8 @@ void make_airport_rings(CDT& mesh,vector<dsf_airport_edge_info_t>& out_rings)
 		
 		CDT::Edge stop = me;
 		do {
-			auto p1 = cgal2ben(edge_source(me)->point());
-			auto p2 = cgal2ben(edge_target(me)->point());
+			Point2 p1 = ll.find(&*edge_source(me))->second;
+			Point2 p2 = ll.find(&*edge_target(me))->second;
 
 			auto iter = links.find(me);
 			if(iter == links.end())
@@ -1346,6 +1506,164 @@ struct beach_splitter {
 };
 
 
+/************************************************************************************************************************
+ * DSF COMMAND BUFFERS
+ ************************************************************************************************************************
+ * The DSF writer isn't thread safe, and the order of the calls we make decides the bytes in the file.  So parts of
+ * BuildDSF that run on worker threads record their calls into one of these (via the callbacks from GetCallbacks,
+ * with the buffer as the ref) and the buffers are replayed into the real writer in a fixed order afterward.
+ *
+ * Only the patch and polygon calls are supported - that's all the jobs make.
+ */
+class	DSFCommandBuffer {
+public:
+
+	static void		GetCallbacks(DSFCallbacks_t * cbs);
+	void			Replay(DSFCallbacks_t& cbs, void * writer) const;
+
+private:
+
+	enum {
+		op_BeginPatch,
+		op_BeginPrimitive,
+		op_AddPatchVertex,
+		op_EndPrimitive,
+		op_EndPatch,
+		op_BeginPolygon,
+		op_BeginPolygonWinding,
+		op_AddPolygonPoint,
+		op_EndPolygonWinding,
+		op_EndPolygon
+	};
+
+	vector<int>		mOps;			// Op codes, each followed by its int params
+	vector<double>	mCoords;		// All double params, in call order
+	int				mDepth = 0;		// Coordinate depth of the patch or polygon being recorded
+
+	static void	BeginPatch(unsigned int inTerrainType, double inNearLOD, double inFarLOD, unsigned char inFlags, int inCoordDepth, void * inRef)
+	{
+		DSFCommandBuffer * me = (DSFCommandBuffer *) inRef;
+		me->mOps.push_back(op_BeginPatch);
+		me->mOps.push_back(inTerrainType);
+		me->mOps.push_back(inFlags);
+		me->mOps.push_back(inCoordDepth);
+		me->mCoords.push_back(inNearLOD);
+		me->mCoords.push_back(inFarLOD);
+		me->mDepth = inCoordDepth;
+	}
+	static void	BeginPrimitive(int inType, void * inRef)
+	{
+		DSFCommandBuffer * me = (DSFCommandBuffer *) inRef;
+		me->mOps.push_back(op_BeginPrimitive);
+		me->mOps.push_back(inType);
+	}
+	static void	AddPatchVertex(double inCoordinates[], void * inRef)
+	{
+		DSFCommandBuffer * me = (DSFCommandBuffer *) inRef;
+		me->mOps.push_back(op_AddPatchVertex);
+		me->mCoords.insert(me->mCoords.end(), inCoordinates, inCoordinates + me->mDepth);
+	}
+	static void	EndPrimitive(void * inRef)	{ ((DSFCommandBuffer *) inRef)->mOps.push_back(op_EndPrimitive); }
+	static void	EndPatch(void * inRef)		{ ((DSFCommandBuffer *) inRef)->mOps.push_back(op_EndPatch); }
+
+	static void	BeginPolygon(unsigned int inPolygonType, unsigned short inParam, int inCoordDepth, void * inRef)
+	{
+		DSFCommandBuffer * me = (DSFCommandBuffer *) inRef;
+		me->mOps.push_back(op_BeginPolygon);
+		me->mOps.push_back(inPolygonType);
+		me->mOps.push_back(inParam);
+		me->mOps.push_back(inCoordDepth);
+		me->mDepth = inCoordDepth;
+	}
+	static void	BeginPolygonWinding(void * inRef)	{ ((DSFCommandBuffer *) inRef)->mOps.push_back(op_BeginPolygonWinding); }
+	static void	AddPolygonPoint(double * inCoordinates, void * inRef)
+	{
+		DSFCommandBuffer * me = (DSFCommandBuffer *) inRef;
+		me->mOps.push_back(op_AddPolygonPoint);
+		me->mCoords.insert(me->mCoords.end(), inCoordinates, inCoordinates + me->mDepth);
+	}
+	static void	EndPolygonWinding(void * inRef)		{ ((DSFCommandBuffer *) inRef)->mOps.push_back(op_EndPolygonWinding); }
+	static void	EndPolygon(void * inRef)			{ ((DSFCommandBuffer *) inRef)->mOps.push_back(op_EndPolygon); }
+};
+
+void	DSFCommandBuffer::GetCallbacks(DSFCallbacks_t * cbs)
+{
+	memset(cbs, 0, sizeof(*cbs));
+	cbs->BeginPatch_f = BeginPatch;
+	cbs->BeginPrimitive_f = BeginPrimitive;
+	cbs->AddPatchVertex_f = AddPatchVertex;
+	cbs->EndPrimitive_f = EndPrimitive;
+	cbs->EndPatch_f = EndPatch;
+	cbs->BeginPolygon_f = BeginPolygon;
+	cbs->BeginPolygonWinding_f = BeginPolygonWinding;
+	cbs->AddPolygonPoint_f = AddPolygonPoint;
+	cbs->EndPolygonWinding_f = EndPolygonWinding;
+	cbs->EndPolygon_f = EndPolygon;
+}
+
+void	DSFCommandBuffer::Replay(DSFCallbacks_t& cbs, void * writer) const
+{
+	vector<int>::const_iterator		op = mOps.begin();
+	vector<double>::const_iterator	c = mCoords.begin();
+	int								depth = 0;
+	double							pt[16];
+
+	while (op != mOps.end())
+	{
+		switch(*op++) {
+		case op_BeginPatch:
+			{
+				unsigned int	terrain = *op++;
+				unsigned char	flags = *op++;
+				depth = *op++;
+				double			near_lod = *c++;
+				double			far_lod = *c++;
+				DebugAssert(depth <= 16);
+				cbs.BeginPatch_f(terrain, near_lod, far_lod, flags, depth, writer);
+			}
+			break;
+		case op_BeginPrimitive:
+			cbs.BeginPrimitive_f(*op++, writer);
+			break;
+		case op_AddPatchVertex:
+			copy(c, c + depth, pt);
+			c += depth;
+			cbs.AddPatchVertex_f(pt, writer);
+			break;
+		case op_EndPrimitive:
+			cbs.EndPrimitive_f(writer);
+			break;
+		case op_EndPatch:
+			cbs.EndPatch_f(writer);
+			break;
+		case op_BeginPolygon:
+			{
+				unsigned int	type = *op++;
+				unsigned short	param = *op++;
+				depth = *op++;
+				DebugAssert(depth <= 16);
+				cbs.BeginPolygon_f(type, param, depth, writer);
+			}
+			break;
+		case op_BeginPolygonWinding:
+			cbs.BeginPolygonWinding_f(writer);
+			break;
+		case op_AddPolygonPoint:
+			copy(c, c + depth, pt);
+			c += depth;
+			cbs.AddPolygonPoint_f(pt, writer);
+			break;
+		case op_EndPolygonWinding:
+			cbs.EndPolygonWinding_f(writer);
+			break;
+		case op_EndPolygon:
+			cbs.EndPolygon_f(writer);
+			break;
+		}
+	}
+	DebugAssert(c == mCoords.end());
+}
+
 void	BuildDSF(
 			const char *	inFileName1,
 			const char *	inFileName2,
@@ -1360,6 +1678,7 @@ void	BuildDSF(
 			rf_region		inRegion,
 			ProgressFunc	inProgress)
 {
+	StPerfScope	profile("BuildDSF");
 
 
 vector<CDT::Face_handle>	sHiResTris[PATCH_DIM_HI * PATCH_DIM_HI];
@@ -1393,13 +1712,11 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 		CDT::Finite_faces_iterator		fi;
 		CDT::Face_handle				f;
 		CDT::Vertex_handle				avert;
-		CDT::Finite_vertices_iterator	vert;
 		map<int, int, SortByLULayer>::iterator 		lu_ranked;
 		map<int, int>::iterator 		lu;
 		map<int, int>::iterator 		obdef;
 		map<int, int, ObjPrio>::iterator obdef_prio;
 		set<int>::iterator				border_lu;
-		bool							is_water, is_overlay;
 		list<CDT::Face_handle>::iterator nf;
 
 		Pmwx::Face_iterator						pf;
@@ -1431,11 +1748,15 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 	 * SETUP
 	 ****************************************************************/
 
+	// The height range walk also reads every vertex's coordinates once, so any lazy value they cache on first use is
+	// cached while we are single threaded, and the patch jobs below only ever read the points.
 	double hmin = 9.9e9, hmax = -9.9e9;
-	for(vert = inHiresMesh.finite_vertices_begin(); vert != inHiresMesh.finite_vertices_end(); ++vert)
+	for(CDT::Finite_vertices_iterator v = inHiresMesh.finite_vertices_begin(); v != inHiresMesh.finite_vertices_end(); ++v)
 	{
-		hmin = min(hmin, vert->info().height);
-		hmax = max(hmax, vert->info().height);
+		CGAL::to_double(v->point().x());
+		CGAL::to_double(v->point().y());
+		hmin = min(hmin, v->info().height);
+		hmax = max(hmax, v->info().height);
 	}
 	int emin = floor(hmin);
 	int emax = ceil(hmax);
@@ -1561,6 +1882,9 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 				CGAL::to_double(fi->vertex(1)->point().x()),CGAL::to_double(fi->vertex(1)->point().y()),
 				CGAL::to_double(fi->vertex(2)->point().x()),CGAL::to_double(fi->vertex(2)->point().y()));
 
+		// Checked here rather than in the patch jobs - comparing exact coordinates is not safe on many threads.
+		CHECK_TRI(fi->vertex(0),fi->vertex(1),fi->vertex(2));
+
 		// Accumulate the various texes into the various layers.  This means marking what land uses we have per each patch
 		// and also any borders we need.
 		sHiResTris[(int) x + (int) y * PATCH_DIM_HI].push_back(fi);
@@ -1657,34 +1981,244 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 
 	if (inProgress && inProgress(0, 5, "Compiling Mesh", 1.0)) return;
 
+	/****************************************************************
+	 * PATCH, BEACH AND AIRPORT RING GENERATION
+	 ****************************************************************/
+
+	// Patches, beaches and airport rings only read the mesh, so they are built as independent jobs - one per
+	// (land use, patch) pair plus one each for beaches and rings - that record their DSF calls into command
+	// buffers.  The buffers are then replayed into the writer in the order the old serial loops made the calls,
+	// so the DSF comes out byte-identical no matter how many threads we use.
+
+	enum { job_Beaches, job_AirportRings, job_LoResPatch, job_HiResPatch, job_BorderPatch };
+
+	struct dsf_build_job_t {
+		int					kind;
+		int					terrain;
+		int					dsf_index;
+		int					cell;
+		DSFCommandBuffer	out;
+		int					tris = 0;
+		int					tri_fans = 0;
+		int					border_tris = 0;
+		int					add_tri_fan = 0;
+		vector<pair<CDT::Vertex_handle, double> >	wave_heights;	// GetWaterBlend results, stored after the join
+		vector<dsf_airport_edge_info_t>				apt_edges;
+	};
+
+	vector<dsf_build_job_t>		jobs;
+	DSFCallbacks_t				rec;
+	DSFCommandBuffer::GetCallbacks(&rec);
+
+	auto add_job = [&jobs](int kind, int terrain, int dsf_index, int cell) {
+		jobs.push_back(dsf_build_job_t());
+		jobs.back().kind = kind;
+		jobs.back().terrain = terrain;
+		jobs.back().dsf_index = dsf_index;
+		jobs.back().cell = cell;
+	};
+
+	// Beaches read the wave heights the patch jobs compute, so that job runs on its own after the patches are
+	// replayed.  Rings are a single long job, so they go first among the parallel ones.
+	bool has_beaches = false;
+#if !PHONE
 	if(writer1)
-	for (prog_c = 0.0, lu_ranked = landuses.begin(); lu_ranked != landuses.end(); ++lu_ranked, prog_c += 1.0)
 	{
-		if (inProgress && inProgress(1, 5, "Sorting Mesh", prog_c / (float) landuses.size())) return;
+		add_job(job_Beaches, NO_VALUE, 0, 0);
+		has_beaches = true;
+	}
+#endif
+	add_job(job_AirportRings, NO_VALUE, 0, 0);
+
+	int first_patch_job = jobs.size();
+	if(writer1)
+	for (lu_ranked = landuses.begin(); lu_ranked != landuses.end(); ++lu_ranked)
+	{
+#if !NO_ORTHO
+		for (cur_id = 0; cur_id < (PATCH_DIM_LO*PATCH_DIM_LO); ++cur_id)
+		if (sLoResLU[cur_id].count(lu_ranked->first))
+			add_job(job_LoResPatch, lu_ranked->first, lu_ranked->second, cur_id);
+#endif
+		for (cur_id = 0; cur_id < (PATCH_DIM_HI*PATCH_DIM_HI); ++cur_id)
+		if (sHiResLU[cur_id].count(lu_ranked->first))
+			add_job(job_HiResPatch, lu_ranked->first, lu_ranked->second, cur_id);
+#if !NO_BORDERS
+		for (cur_id = 0; cur_id < (PATCH_DIM_HI*PATCH_DIM_HI); ++cur_id)		// For each triangle in this patch
+		if (lu_ranked->first >= terrain_Natural)
+		if (sHiResBO[cur_id].count(lu_ranked->first))							// Quick check: do we have ANY border tris in this layer in this patch?
+			add_job(job_BorderPatch, lu_ranked->first, lu_ranked->second, cur_id);
+#endif
+	}
+
+	if (inProgress && inProgress(1, 5, "Sorting Mesh", 0.0)) return;
+
+	// The patch and ring jobs take their coordinates from here; fan building keeps its own face set, so the only thing
+	// the jobs share is read-only mesh state.
+	vertex_ll_map	vert_ll;
+	SnapshotVertexLL(inHiresMesh, vert_ll);
+
+	auto run_job = [&](int j, int worker) {
+		dsf_build_job_t&	job(jobs[j]);
+		void *				ref = &job.out;
+		double				coords3[3];
+		double				coords8[8];
+		int					tris_this_patch = 0;
+		CDT::Face_handle	f;
+
+		bool is_water		= job.terrain == terrain_VisualWater || job.terrain == terrain_Water;
+		bool is_overlay		= IsCustomOverWaterAny(job.terrain);		// This layer is an overlay to water, so be sure to set the flags!
+
+		switch(job.kind) {
 
 		/***************************************************************************************************************************************
-		 * WRITE OUT LOW RES ORTHOPHOTO PATCHES
+		 * BEACH EXPORT
 		 ***************************************************************************************************************************************/
+		case job_Beaches:
+		{
+			// Beach export - we are going to export polygon rings/chains out of
+			// every homogenous continous coastline type.  Two issues:
+			// When a beach is not a ring, we need to find the start link
+			// We also need to identify rings somehow.
+
+			typedef edge_hash_map														LinkMap;
+			typedef set<CDT::Edge>													LinkSet;
+			typedef edge_info_map														LinkInfo;
+
+			LinkMap			linkNext;	// A hash map from each halfedge to the next with matching beach.  Uses CCW traversal to handle screw cases.
+			LinkSet			nonStart;	// Set of all halfedges that are pointed to by another.
+			LinkInfo		all;		// Ones we haven't exported.
+			LinkSet			starts;		// Ones that are not pointed to by a HE
+			CDT::Edge	beach, last_beach;
+			int				beachKind;
+
+			// Go through and build up the link map, e.g. for each edge, who's next.
+			// Also record each edge that's pointed to by another - these are NOT
+			// the starts of non-ring beaches.
+			for (CDT::Finite_faces_iterator bf = inHiresMesh.finite_faces_begin(); bf != inHiresMesh.finite_faces_end(); ++bf)
+			for (int v = 0; v < 3; ++v)
+			{
+				CDT::Edge edge;
+				edge.first = bf;
+				edge.second = v;
+				if (has_beach(edge, inHiresMesh, beachKind, inLanduse))
+				{
+					all[edge] = beachKind;
+					starts.insert(edge);
+					// Go through each he coming out of our target starting with the one to the clockwise of us, going clockwise.
+					// We're searching for the next beach seg but skipping bogus in-water stuff like brides.
+					for (CDT::Edge iter = edge_next(edge); iter != edge_twin(edge); iter = edge_twin_next(iter))
+					{
+						if (has_beach(iter, inHiresMesh, beachKind, inLanduse))
+						{
+		//					DebugAssert(iter->twin() != he);
+							DebugAssert(linkNext.count(edge) == 0);
+							linkNext[edge] = iter;
+							DebugAssert(nonStart.count(iter) == 0);
+							nonStart.insert(iter);
+							break;
+						}
+						// If we hit something that isn't bounding water, we've gone out of our land into the next
+						// water out of this vertex.  Stop now before we link to a non-connected water body!!
+						if (iter.first->info().terrain != terrain_Water)
+							break;
+					}
+				}
+			}
 
-		is_water		= lu_ranked->first == terrain_VisualWater || lu_ranked->first == terrain_Water;
-		is_overlay		= IsCustomOverWaterAny(lu_ranked->first);		// This layer is an overlay to water, so be sure to set the flags!
+			for (LinkSet::iterator i = nonStart.begin(); i != nonStart.end(); ++i)
+			{
+				starts.erase(*i);
+			}
+
+			// Export non-ring beaches.  For each link that's not pointed to by someone else
+			// export the chain.
+
+			for (LinkSet::iterator a_start = starts.begin(); a_start != starts.end(); ++a_start)
+			{
+				FixBeachContinuity(linkNext, *a_start, all);
 
+				beach_splitter bs(&rec, ref, 0,0);
+
+				for (beach = *a_start; beach != CDT::Edge(); beach = ((linkNext.count(beach)) ? (linkNext[beach]) : CDT::Edge()))
+				{
+		//			printf("output non-circ beach type = %d, len = %lf\n", all[beach], edge_len(beach));
+					last_beach = beach;
+					DebugAssert(all.count(beach) != 0);
+					beachKind = all[beach];
+					BeachPtGrab(beach, false, inHiresMesh, coords3, beachKind);
+					coords3[0] = doblim(coords3[0],inElevation.mWest,  inElevation.mEast);
+					coords3[1] = doblim(coords3[1],inElevation.mSouth, inElevation.mNorth);
+					bs.add_pt(coords3);
+					all.erase(beach);
+				}
+				DebugAssert(all.count(*a_start) == 0);
+
+				BeachPtGrab(last_beach, true, inHiresMesh, coords3, beachKind);
+				coords3[0] = doblim(coords3[0],inElevation.mWest,  inElevation.mEast);
+				coords3[1] = doblim(coords3[1],inElevation.mSouth, inElevation.mNorth);
+				bs.add_pt(coords3);
+
+				//printf("end non-circular.\n");
+			}
+
+		#if DEV
+			for (LinkInfo::iterator test = all.begin(); test != all.end(); ++test)
+			{
+				DebugAssert(linkNext.count(test->first) != 0);
+			}
+		#endif
+
+			// Now just pick an edge and export in a circulator - we should only have rings!
+			while (!all.empty())
+			{
+				CDT::Edge this_start = all.begin()->first;
+				FixBeachContinuity(linkNext, this_start, all);
+
+				beach_splitter bs(&rec, ref, 0,1);
+
+				beach = this_start;
+				do {
+		//			printf("output circ beach type = %d, len = %lf\n", all[beach], edge_len(beach));
+					DebugAssert(all.count(beach) != 0);
+					DebugAssert(linkNext.count(beach) != 0);
+					beachKind = all.begin()->second;
+					BeachPtGrab(beach, false, inHiresMesh, coords3, beachKind);
+					coords3[0] = doblim(coords3[0],inElevation.mWest,  inElevation.mEast);
+					coords3[1] = doblim(coords3[1],inElevation.mSouth, inElevation.mNorth);
+					bs.add_pt(coords3);
+					all.erase(beach);
+					beach = linkNext[beach];
+				} while (beach != this_start);
+
+			}
+		}
+		break;
+
+		/***************************************************************************************************************************************
+		 * AIRPORT BORDER LINES
+		 ***************************************************************************************************************************************/
+		case job_AirportRings:
+			make_airport_rings(inHiresMesh, vert_ll, job.apt_edges);
+			break;
+
+		/***************************************************************************************************************************************
+		 * WRITE OUT LOW RES ORTHOPHOTO PATCHES
+		 ***************************************************************************************************************************************/
 #if !NO_ORTHO
-		for (cur_id = 0; cur_id < (PATCH_DIM_LO*PATCH_DIM_LO); ++cur_id)
-		if (sLoResLU[cur_id].count(lu_ranked->first))
+		case job_LoResPatch:
 		{
 			TriFanBuilder	fan_builder(&inLoresMesh);
-			for (tri = 0; tri < sLoResTris[cur_id].size(); ++tri)
+			for (int tri = 0; tri < sLoResTris[job.cell].size(); ++tri)
 			{
-				f = sLoResTris[cur_id][tri];
-				if (f->info().terrain == lu_ranked->first)
+				f = sLoResTris[job.cell][tri];
+				if (f->info().terrain == job.terrain)
 				{
 					CHECK_TRI(f->vertex(0),f->vertex(1),f->vertex(2));
 					fan_builder.AddTriToFanPool(f);
 				}
 			}
 			fan_builder.CalcFans();
-			cbs.BeginPatch_f(lu_ranked->second, ORTHO_NEAR_LOD, ORTHO_FAR_LOD, 0, 5, writer1);
+			rec.BeginPatch_f(job.dsf_index, ORTHO_NEAR_LOD, ORTHO_FAR_LOD, 0, 5, ref);
 			list<CDT::Vertex_handle>				primv;
 			list<CDT::Vertex_handle>::iterator		vert;
 			int										primt;
@@ -1694,14 +2228,13 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 				if(primv.empty()) break;
 				if(primt != dsf_Tri)
 				{
-					++total_tri_fans;
-					total_tris += (primv.size() - 2);
+					++job.tri_fans;
+					job.tris += (primv.size() - 2);
 				} else {
-					total_tris += (primv.size() / 3);
+					job.tris += (primv.size() / 3);
 					tris_this_patch += (primv.size() / 3);
 				}
-				if
-				cbs.BeginPrimitive_f(primt, writer1);
+				rec.BeginPrimitive_f(primt, ref);
 				for(vert = primv.begin(); vert != primv.end(); ++vert)
 				{
 					coords8[0] = (*vert)->point().x();
@@ -1713,73 +2246,71 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 					DebugAssert(coords8[3] <=  1.0);
 					DebugAssert(coords8[4] >= -1.0);
 					DebugAssert(coords8[4] <=  1.0);
-					cbs.AddPatchVertex_f(coords8, writer1);
+					rec.AddPatchVertex_f(coords8, ref);
 				}
-				cbs.EndPrimitive_f(writer1);
+				rec.EndPrimitive_f(ref);
 			}
-			cbs.EndPatch_f(writer1);
-			++total_patches;
+			rec.EndPatch_f(ref);
 		}
+		break;
 #endif
 
 		/***************************************************************************************************************************************
 		 * WRITE OUT HI RES BASE PATCHES
 		 ***************************************************************************************************************************************/
-		for (cur_id = 0; cur_id < (PATCH_DIM_HI*PATCH_DIM_HI); ++cur_id)
-		if (sHiResLU[cur_id].count(lu_ranked->first))
+		case job_HiResPatch:
 		{
 			TriFanBuilder	fan_builder(&inHiresMesh);
-			for (tri = 0; tri < sHiResTris[cur_id].size(); ++tri)
+			for (int tri = 0; tri < sHiResTris[job.cell].size(); ++tri)
 			{
-				f = sHiResTris[cur_id][tri];
-				if (f->info().terrain == lu_ranked->first ||
-					(IsCustomOverWaterHard(f->info().terrain) && lu_ranked->first == terrain_VisualWater) ||		// Take hard cus tris when doing vis water
-					(IsCustomOverWaterSoft(f->info().terrain) && lu_ranked->first == terrain_Water))				// Take soft cus tris when doing real water
+				f = sHiResTris[job.cell][tri];
+				if (f->info().terrain == job.terrain ||
+					(IsCustomOverWaterHard(f->info().terrain) && job.terrain == terrain_VisualWater) ||		// Take hard cus tris when doing vis water
+					(IsCustomOverWaterSoft(f->info().terrain) && job.terrain == terrain_Water))				// Take soft cus tris when doing real water
 				{
-					CHECK_TRI(f->vertex(0),f->vertex(1),f->vertex(2));
 					fan_builder.AddTriToFanPool(f);
 
-					++debug_add_tri_fan;
+					++job.add_tri_fan;
 				}
 			}
 			fan_builder.CalcFans();
 
-			tex_proj_info * pinfo = (gTexProj.count(lu_ranked->first)) ? &gTexProj[lu_ranked->first] : NULL;
+			TexProjTable::iterator proj = gTexProj.find(job.terrain);
+			tex_proj_info * pinfo = (proj != gTexProj.end()) ? &proj->second : NULL;
 
 			int flags = 0;
 			if(is_overlay)  flags |= dsf_Flag_Overlay;
-			if(lu_ranked->first != terrain_VisualWater &&			// Every patch is physical EXCEPT: visual water, obviously just for looks!
-				!IsCustomOverWaterSoft(lu_ranked->first))			// custom over soft water - we get physics from who is underneath
+			if(job.terrain != terrain_VisualWater &&			// Every patch is physical EXCEPT: visual water, obviously just for looks!
+				!IsCustomOverWaterSoft(job.terrain))			// custom over soft water - we get physics from who is underneath
 				flags |= dsf_Flag_Physical;
 
-			cbs.BeginPatch_f(lu_ranked->second, TERRAIN_NEAR_LOD, TERRAIN_FAR_LOD, flags, is_water ? 7 : (pinfo ? 7 : 5), writer1);
+			rec.BeginPatch_f(job.dsf_index, TERRAIN_NEAR_LOD, TERRAIN_FAR_LOD, flags, is_water ? 7 : (pinfo ? 7 : 5), ref);
 			list<CDT::Vertex_handle>				primv;
 			list<CDT::Vertex_handle>::iterator		vert;
 			int										primt;
 			while(1)
 			{
-                primt = fan_builder.GetNextPrimitive(primv);
-                if(primv.empty()) break;
-                if(primt != dsf_Tri)
-                 {
-                    ++total_tri_fans;
-                    total_tris += (primv.size() - 2);
-                } else {
-                    total_tris += (primv.size() / 3);
-                    tris_this_patch += (primv.size() / 3);
-                }
-                cbs.BeginPrimitive_f(primt, writer1);
-                for(vert = primv.begin(); vert != primv.end(); ++vert)
-                {
+				primt = fan_builder.GetNextPrimitive(primv);
+				if(primv.empty()) break;
+				if(primt != dsf_Tri)
+				{
+					++job.tri_fans;
+					job.tris += (primv.size() - 2);
+				} else {
+					job.tris += (primv.size() / 3);
+					tris_this_patch += (primv.size() / 3);
+				}
+				rec.BeginPrimitive_f(primt, ref);
+				for(vert = primv.begin(); vert != primv.end(); ++vert)
+				{
 					// Ben says: the use of doblim warrants some explanation: CGAL provides EXACT arithmetic, but it does not give exact
 					// conversion back to float EVEN when that is possible!!  So the edge of our tile is guaranteed to be exactly on the DSF
 					// border but is not guaranteed to be within the DSF border once rounded.
 					// Because of this, we have to clamp our output to the double-precision bounds after conversion, since DSFLib is sensitive
 					// to out-of-boundary conditions!
-					DebugAssert((*vert)->point().x() >= inElevation.mWest  && (*vert)->point().x() <= inElevation.mEast );
-					DebugAssert((*vert)->point().y() >= inElevation.mSouth && (*vert)->point().y() <= inElevation.mNorth);
-					coords8[0] = doblim(CGAL::to_double((*vert)->point().x()),inElevation.mWest ,inElevation.mEast );
-					coords8[1] = doblim(CGAL::to_double((*vert)->point().y()),inElevation.mSouth,inElevation.mNorth);
+					const Point2& v_ll = vert_ll.find(&**vert)->second;
+					coords8[0] = doblim(v_ll.x(),inElevation.mWest ,inElevation.mEast );
+					coords8[1] = doblim(v_ll.y(),inElevation.mSouth,inElevation.mNorth);
 					DebugAssert(coords8[0] >= inElevation.mWest  && coords8[0] <= inElevation.mEast );
 					DebugAssert(coords8[1] >= inElevation.mSouth && coords8[1] <= inElevation.mNorth);
 					coords8[2] =USE_DEM_H( (*vert)->info().height, is_water,inHiresMesh,(*vert));
@@ -1787,7 +2318,8 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 					coords8[4] =USE_DEM_N(-(*vert)->info().normal[1]);
 					if (is_water)
 					{
-						coords8[5] = GetWaterBlend((*vert), inElevation, inBathymetry);						// Fetch
+						coords8[5] = CalcWaterBlend(v_ll, inElevation, inBathymetry);						// Fetch
+						job.wave_heights.push_back(make_pair(*vert, coords8[5]));
 						coords8[6] = CategorizeVertex(inHiresMesh,*vert,terrain_Water) >= 0 ? 0.0 : 1.0;	// Depth categorize
 						DebugAssert(coords8[5] >= 0.0);
 						DebugAssert(coords8[5] <= 1.0);
@@ -1803,35 +2335,36 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 					DebugAssert(coords8[3] <=  1.0);
 					DebugAssert(coords8[4] >= -1.0);
 					DebugAssert(coords8[4] <=  1.0);
-					cbs.AddPatchVertex_f(coords8, writer1);
+					rec.AddPatchVertex_f(coords8, ref);
 				}
-				cbs.EndPrimitive_f(writer1);
+				rec.EndPrimitive_f(ref);
 			}
-			cbs.EndPatch_f(writer1);
-			++total_patches;
+			rec.EndPatch_f(ref);
 		}
+		break;
 
 		/***************************************************************************************************************************************
 		 * WRITE OUT HI RES BORDER PATCHES
 		 ***************************************************************************************************************************************/
-
 #if !NO_BORDERS
-		for (cur_id = 0; cur_id < (PATCH_DIM_HI*PATCH_DIM_HI); ++cur_id)		// For each triangle in this patch
-		if (lu_ranked->first >= terrain_Natural)
-		if (sHiResBO[cur_id].count(lu_ranked->first))							// Quick check: do we have ANY border tris in this layer in this patch?
+		case job_BorderPatch:
 		{
-			cbs.BeginPatch_f(lu_ranked->second, TERRAIN_NEAR_BORDER_LOD, TERRAIN_FAR_BORDER_LOD, dsf_Flag_Overlay, /*is_composite ? 8 :*/ 7, writer1);
-			cbs.BeginPrimitive_f(dsf_Tri, writer1);
+			rec.BeginPatch_f(job.dsf_index, TERRAIN_NEAR_BORDER_LOD, TERRAIN_FAR_BORDER_LOD, dsf_Flag_Overlay, /*is_composite ? 8 :*/ 7, ref);
+			rec.BeginPrimitive_f(dsf_Tri, ref);
 			tris_this_patch = 0;
-			for (tri = 0; tri < sHiResTris[cur_id].size(); ++tri)				// For each tri
+			for (int tri = 0; tri < sHiResTris[job.cell].size(); ++tri)				// For each tri
 			{
-				f = sHiResTris[cur_id][tri];
-				if (f->info().terrain_border.count(lu_ranked->first))			// If it has this border...
+				f = sHiResTris[job.cell][tri];
+				if (f->info().terrain_border.count(job.terrain))			// If it has this border...
 				{
 					float	bblend[3];
 					int vi;
 					for (vi = 0; vi < 3; ++vi)
-						bblend[vi] = f->vertex(vi)->info().border_blend[lu_ranked->first];
+					{
+						// Not operator[] - other jobs read this vertex at the same time, so no inserts.
+						hash_map<int, float>::const_iterator bb = f->vertex(vi)->info().border_blend.find(job.terrain);
+						bblend[vi] = (bb == f->vertex(vi)->info().border_blend.end()) ? 0.0f : bb->second;
+					}
 
 					// Ben says: normally we would like to draw one DSF overdrawn tri for each border tri.  But there is an exception case:
 					// if ALL of our border blends are 100% but our border is NOT a variant (e.g. this is a meaningful border change) then
@@ -1840,7 +2373,7 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 					// the non-cliff terrain surrouding on 3 sides.)  In this case we make THREE passes and force one vertex to 0% blend for
 					// each pass.
 					int ts = -1, te = 0;
-//					if (!AreVariants(lu_ranked->first, f->info().terrain))
+//					if (!AreVariants(job.terrain, f->info().terrain))
 					if (bblend[0] == bblend[1] &&
 						bblend[1] == bblend[2] &&
 						bblend[0] == 1.0)
@@ -1853,52 +2386,69 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 
 						if (tris_this_patch >= MAX_TRIS_PER_PATCH)
 						{
-							cbs.EndPrimitive_f(writer1);
-							cbs.BeginPrimitive_f(dsf_Tri, writer1);
+							rec.EndPrimitive_f(ref);
+							rec.BeginPrimitive_f(dsf_Tri, ref);
 							tris_this_patch = 0;
 						}
 
 						for (vi = 2; vi >= 0 ; --vi)
 						{
-							DebugAssert(f->vertex(vi)->point().x() >= inElevation.mWest  && f->vertex(vi)->point().x() <= inElevation.mEast );
-							DebugAssert(f->vertex(vi)->point().y() >= inElevation.mSouth && f->vertex(vi)->point().y() <= inElevation.mNorth);
-							coords8[0] = doblim(CGAL::to_double(f->vertex(vi)->point().x()),inElevation.mWest ,inElevation.mEast );
-							coords8[1] = doblim(CGAL::to_double(f->vertex(vi)->point().y()),inElevation.mSouth,inElevation.mNorth);
+							const Point2& v_ll = vert_ll.find(&*f->vertex(vi))->second;
+							coords8[0] = doblim(v_ll.x(),inElevation.mWest ,inElevation.mEast );
+							coords8[1] = doblim(v_ll.y(),inElevation.mSouth,inElevation.mNorth);
 							DebugAssert(coords8[0] >= inElevation.mWest  && coords8[0] <= inElevation.mEast );
 							DebugAssert(coords8[1] >= inElevation.mSouth && coords8[1] <= inElevation.mNorth);
 
 							coords8[2] =USE_DEM_H( f->vertex(vi)->info().height , is_water, inHiresMesh,f->vertex(vi));
 							coords8[3] =USE_DEM_N( f->vertex(vi)->info().normal[0]);
 							coords8[4] =USE_DEM_N(-f->vertex(vi)->info().normal[1]);
-//							coords8[5] = f->vertex(vi)->info().border_blend[lu_ranked->first];
 							coords8[5] = vi == border_pass ? 0.0 : bblend[vi];
-							coords8[6] = GetTightnessBlend(inHiresMesh, f, f->vertex(vi), lu_ranked->first);
+							coords8[6] = GetTightnessBlend(inHiresMesh, f, f->vertex(vi), job.terrain);
 							DebugAssert(coords8[5] >= 0.0);
 							DebugAssert(coords8[5] <= 1.0);
 							DebugAssert(coords8[6] >= 0.0);
 							DebugAssert(coords8[6] <= 1.0);
 							DebugAssert(!is_water);
-	//						if (is_composite)
-	//							coords8[7] = is_water ? GetWaterBlend(f->vertex(vi), waterType) : f->vertex(vi)->info().vege_density;
 							DebugAssert(coords8[3] >= -1.0);
 							DebugAssert(coords8[3] <=  1.0);
 							DebugAssert(coords8[4] >= -1.0);
 							DebugAssert(coords8[4] <=  1.0);
-							cbs.AddPatchVertex_f(coords8, writer1);
+							rec.AddPatchVertex_f(coords8, ref);
 						}
-						++total_tris;
-						++border_tris;
+						++job.tris;
+						++job.border_tris;
 						++tris_this_patch;
 					}
 				}
 			}
-			cbs.EndPrimitive_f(writer1);
-			cbs.EndPatch_f(writer1);
-			++total_patches;
+			rec.EndPrimitive_f(ref);
+			rec.EndPatch_f(ref);
 		}
+		break;
 #endif
+		}
+	};
+
+	parallel_for(has_beaches ? 1 : 0, jobs.size(), 1, run_job);
+
+	// Replay the patches in layer order.
+	for (int j = first_patch_job; j < jobs.size(); ++j)
+	{
+		if (inProgress && (j % 64) == 0 && inProgress(1, 5, "Sorting Mesh", (float) (j - first_patch_job) / (float) (jobs.size() - first_patch_job))) return;
+		jobs[j].out.Replay(cbs, writer1);
+		total_tris += jobs[j].tris;
+		total_tri_fans += jobs[j].tri_fans;
+		border_tris += jobs[j].border_tris;
+		debug_add_tri_fan += jobs[j].add_tri_fan;
+		++total_patches;
+		for (vector<pair<CDT::Vertex_handle, double> >::iterator w = jobs[j].wave_heights.begin(); w != jobs[j].wave_heights.end(); ++w)
+			w->first->info().wave_height = w->second;
 	}
 
+	// Every wave height is in place now - the beaches can be built.
+	if (has_beaches)
+		run_job(job_Beaches, 0);
+
 	if(writer1)
 	for (lu = landuses_reversed.begin(); lu != landuses_reversed.end(); ++lu)
 	{
@@ -1942,125 +2492,11 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 	 * BEACH EXPORT
 	 ****************************************************************/
 
+	// Built after the patch replay above - just feed the writer.
 #if !PHONE
 	if(writer1)
 	{
-		// Beach export - we are going to export polygon rings/chains out of
-		// every homogenous continous coastline type.  Two issues:
-		// When a beach is not a ring, we need to find the start link
-		// We also need to identify rings somehow.
-
-		typedef edge_hash_map														LinkMap;
-		typedef set<CDT::Edge>													LinkSet;
-		typedef edge_info_map														LinkInfo;
-
-		LinkMap			linkNext;	// A hash map from each halfedge to the next with matching beach.  Uses CCW traversal to handle screw cases.
-		LinkSet			nonStart;	// Set of all halfedges that are pointed to by another.
-		LinkInfo		all;		// Ones we haven't exported.
-		LinkSet			starts;		// Ones that are not pointed to by a HE
-		CDT::Edge	beach, last_beach;
-		int				beachKind;
-
-		// Go through and build up the link map, e.g. for each edge, who's next.
-		// Also record each edge that's pointed to by another - these are NOT
-		// the starts of non-ring beaches.
-		for (fi = inHiresMesh.finite_faces_begin(); fi != inHiresMesh.finite_faces_end(); ++fi)
-		for (v = 0; v < 3; ++v)
-		{
-			CDT::Edge edge;
-			edge.first = fi;
-			edge.second = v;
-			if (has_beach(edge, inHiresMesh, beachKind, inLanduse))
-			{
-				all[edge] = beachKind;
-				starts.insert(edge);
-				// Go through each he coming out of our target starting with the one to the clockwise of us, going clockwise.
-				// We're searching for the next beach seg but skipping bogus in-water stuff like brides.
-				for (CDT::Edge iter = edge_next(edge); iter != edge_twin(edge); iter = edge_twin_next(iter))
-				{
-					if (has_beach(iter, inHiresMesh, beachKind, inLanduse))
-					{
-	//					DebugAssert(iter->twin() != he);
-						DebugAssert(linkNext.count(edge) == 0);
-						linkNext[edge] = iter;
-						DebugAssert(nonStart.count(iter) == 0);
-						nonStart.insert(iter);
-						break;
-					}
-					// If we hit something that isn't bounding water, we've gone out of our land into the next
-					// water out of this vertex.  Stop now before we link to a non-connected water body!!
-					if (iter.first->info().terrain != terrain_Water)
-						break;
-				}
-			}
-		}
-
-		for (LinkSet::iterator i = nonStart.begin(); i != nonStart.end(); ++i)
-		{
-			starts.erase(*i);
-		}
-
-		// Export non-ring beaches.  For each link that's not pointed to by someone else
-		// export the chain.
-
-		for (LinkSet::iterator a_start = starts.begin(); a_start != starts.end(); ++a_start)
-		{
-			FixBeachContinuity(linkNext, *a_start, all);
-
-			beach_splitter bs(&cbs, writer1, 0,0);
-
-			for (beach = *a_start; beach != CDT::Edge(); beach = ((linkNext.count(beach)) ? (linkNext[beach]) : CDT::Edge()))
-			{
-	//			printf("output non-circ beach type = %d, len = %lf\n", all[beach], edge_len(beach));
-				last_beach = beach;
-				DebugAssert(all.count(beach) != 0);
-				beachKind = all[beach];
-				BeachPtGrab(beach, false, inHiresMesh, coords3, beachKind);
-				coords3[0] = doblim(coords3[0],inElevation.mWest,  inElevation.mEast);
-				coords3[1] = doblim(coords3[1],inElevation.mSouth, inElevation.mNorth);
-				bs.add_pt(coords3);
-				all.erase(beach);
-			}
-			DebugAssert(all.count(*a_start) == 0);
-
-			BeachPtGrab(last_beach, true, inHiresMesh, coords3, beachKind);
-			coords3[0] = doblim(coords3[0],inElevation.mWest,  inElevation.mEast);
-			coords3[1] = doblim(coords3[1],inElevation.mSouth, inElevation.mNorth);
-			bs.add_pt(coords3);
-
-			//printf("end non-circular.\n");
-		}
-
-	#if DEV
-		for (LinkInfo::iterator test = all.begin(); test != all.end(); ++test)
-		{
-			DebugAssert(linkNext.count(test->first) != 0);
-		}
-	#endif
-
-		// Now just pick an edge and export in a circulator - we should only have rings!
-		while (!all.empty())
-		{
-			CDT::Edge this_start = all.begin()->first;
-			FixBeachContinuity(linkNext, this_start, all);
-			
-			beach_splitter bs(&cbs, writer1, 0,1);
-
-			beach = this_start;
-			do {
-	//			printf("output circ beach type = %d, len = %lf\n", all[beach], edge_len(beach));
-				DebugAssert(all.count(beach) != 0);
-				DebugAssert(linkNext.count(beach) != 0);
-				beachKind = all.begin()->second;
-				BeachPtGrab(beach, false, inHiresMesh, coords3, beachKind);
-				coords3[0] = doblim(coords3[0],inElevation.mWest,  inElevation.mEast);
-				coords3[1] = doblim(coords3[1],inElevation.mSouth, inElevation.mNorth);
-				bs.add_pt(coords3);
-				all.erase(beach);
-				beach = linkNext[beach];
-			} while (beach != this_start);
-
-		}
+		jobs[job_Beaches].out.Replay(cbs, writer1);
 		cbs.AcceptPolygonDef_f("lib/g12/beaches.bch", writer1);
 	}
 #endif
@@ -2070,7 +2506,9 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 	 ****************************************************************/
 
 	vector<dsf_airport_edge_info_t> apt_edges;
-	make_airport_rings(inHiresMesh, apt_edges);
+	for (vector<dsf_build_job_t>::iterator j = jobs.begin(); j != jobs.end(); ++j)
+	if (j->kind == job_AirportRings)
+		apt_edges.swap(j->apt_edges);
 
 	/****************************************************************
 	 * OBJECT EXPORT/FACADE/FOREST WRITEOUT
@@ -2327,6 +2765,15 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 
 			};
 
+			// Chains are independent once the network is final - build every chain's bezier shape on all threads
+			// first, then write them out in set order below so the DSF comes out the same with any thread count.
+			vector<Net_ChainInfo_t *>	chain_list(chains.begin(), chains.end());
+			vector<chain_export_t>		chain_out(chain_list.size());
+			parallel_for(0, chain_list.size(), 16, [&](int n, int worker) {
+				build_chain_export(chain_list[n], chain_out[n]);
+			});
+
+			int chain_n = 0;
 			for (ci = chains.begin(); ci != chains.end(); ++ci)
 			{
 				Point2 s = (*ci)->start_junction->location;
@@ -2371,140 +2818,13 @@ set<int>					sLoResLU[PATCH_DIM_LO * PATCH_DIM_LO];
 				//debug_mesh_point(Point2(coords3[0],coords3[1]),1,0,0);
 
 
-				NetRepInfo * info = &gNetReps[(*ci)->rep_type];
-
-				list<Point2c>	pts;
-
-				pts.push_back(Point2c((*ci)->start_junction->location,false));
+				chain_export_t&	shape_out(chain_out[chain_n++]);
+				list<Point2c>&	pts(shape_out.pts);
+				orig_shape_count += shape_out.orig_shape_count;
+				reduced_shape_count += shape_out.reduced_shape_count;
+				for(vector<Point2>::iterator b = shape_out.bad_fixes.begin(); b != shape_out.bad_fixes.end(); ++b)
+					LOG_POINT_FAIL(*b);
 
-				for(int n = 0; n < (*ci)->shape.size(); ++n)
-				{
-					if((*ci)->shape.size() == 1)
-					{
-						generate_bezier((*ci)->start_junction->location,
-										(*ci)->shape[0  ],
-										(*ci)->end_junction->location,
-										info->min_defl_deg_mtr, info->crease_angle_cos,
-										pts);
-					}
-					else if(n == 0)
-					{
-						generate_bezier((*ci)->start_junction->location,
-										(*ci)->shape[n  ],
-										(*ci)->shape[n+1],
-										info->min_defl_deg_mtr, info->crease_angle_cos,
-										pts);
-					}
-					else if (n == (*ci)->shape.size()-1)
-					{
-						generate_bezier((*ci)->shape[n-1],
-										(*ci)->shape[n  ],
-										(*ci)->end_junction->location,
-										info->min_defl_deg_mtr, info->crease_angle_cos,
-										pts);
-					}
-					else
-					{
-						generate_bezier((*ci)->shape[n-1],
-										(*ci)->shape[n  ],
-										(*ci)->shape[n+1],
-										info->min_defl_deg_mtr, info->crease_angle_cos,
-										pts);
-					}
-				}
-
-				pts.push_back(Point2c((*ci)->end_junction->location,false));
-				DebugAssert(pts.size() >= 2);
-
-				list<Point2c>::iterator last(pts.end()), start(pts.begin());
-				--last;
-				DebugAssert(last->c == 0);
-				#if CAN_OPTIMIZE_BEZIERS
-				if(gNetReps[(*ci)->rep_type].max_err > 0.0)
-				#if ONLY_OPTIMIZE_RAMPS
-				if(gNetReps[(*ci)->rep_type].use_mode == use_Ramp && pts.size() > 20)
-				#endif
-				{
-					#if SHOW_BEZIERS
-						visualize_bezier(pts,true,0.1f, 0.0f);
-					#endif
-					orig_shape_count += pts.size();
-					bezier_multi_simplify_straight_ok(pts, MTR_TO_DEG_LAT * gNetReps[(*ci)->rep_type].max_err, 0.00005);// * MTR_TO_DEG_LAT * 5.0 * 5.0);
-					reduced_shape_count += pts.size();
-					#if SHOW_BEZIERS
-						visualize_bezier(pts,false,1.0f,1.0f);
-					#endif
-				}
-				#endif
-				DebugAssert(pts.size() >= 2);
-				
-				Net_ChainInfo_t * start_ccw = (*ci)->start_junction->GetNeighborLimit(*ci, true);
-				Net_ChainInfo_t * start_cw = (*ci)->start_junction->GetNeighborLimit(*ci, false);
-
-				Net_ChainInfo_t * end_ccw = (*ci)->end_junction->GetNeighborLimit(*ci, true);
-				Net_ChainInfo_t * end_cw = (*ci)->end_junction->GetNeighborLimit(*ci, false);
-
-				int fix_start = 0, fix_end = 0;
-
-				if(start_ccw)
-				{
-					Vector2	start_ccw_dir = start_ccw->dir_out_of_junc((*ci)->start_junction);
-					Vector2 my_dir = start_dir(pts);
-					if(start_ccw_dir.left_turn(my_dir))
-					{
-						++fix_start;
-						//debug_mesh_point(*nth_from(pts.begin(),1), 1, 0, 0);
-						fix_control_point(*nth_from(pts.begin(),0), *nth_from(pts.begin(),1),start_ccw_dir);
-					}
-				}
-
-				if(start_cw)
-				{
-					Vector2	start_cw_dir = start_cw->dir_out_of_junc((*ci)->start_junction);
-					Vector2 my_dir = start_dir(pts);
-					if(start_cw_dir.right_turn(my_dir))
-					{
-						++fix_start;
-						//debug_mesh_point(*nth_from(pts.begin(),1), 1, 0, 0);
-						fix_control_point(*nth_from(pts.begin(),0), *nth_from(pts.begin(),1),start_cw_dir);
-					}
-				}
-//				DebugAssert(fix_start < 2);
-				if(fix_start >= 2)
-				{
-					LOG_POINT_FAIL(*nth_from(pts.begin(),1));
-				}
-
-				if(end_ccw)
-				{
-					Vector2	end_ccw_dir = end_ccw->dir_out_of_junc((*ci)->end_junction);
-					Vector2 my_dir = end_dir(pts);
-					if(end_ccw_dir.left_turn(my_dir))
-					{
-						//debug_mesh_point(*nth_from(pts.rbegin(),1), 1, 0, 0);
-						fix_control_point(*nth_from(pts.rbegin(),0), *nth_from(pts.rbegin(),1),end_ccw_dir);
-						++fix_end;
-					}
-				}
-
-				if(end_cw)
-				{
-					Vector2	end_cw_dir = end_cw->dir_out_of_junc((*ci)->end_junction);
-					Vector2 my_dir = end_dir(pts);
-					if(end_cw_dir.right_turn(my_dir))
-					{
-						//debug_mesh_point(*nth_from(pts.rbegin(),1), 1, 0, 0);
-						fix_control_point(*nth_from(pts.rbegin(),0), *nth_from(pts.rbegin(),1),end_cw_dir);
-						++fix_end;
-					}
-				}
-//				DebugAssert(fix_end < 2);
-				if(fix_end >= 2)
-				{
-					LOG_POINT_FAIL(*nth_from(pts.rbegin(),1));
-				}
-			
-				
 				pts.pop_back();
 				pts.pop_front();
 				for(list<Point2c>::iterator p = pts.begin(); p != pts.end(); ++p)
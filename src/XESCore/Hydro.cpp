@@ -39,6 +39,9 @@
 #include "DEMToVector.h"
 #include "CompGeomUtils.h"
 #include "PlatformUtils.h"
+#include "ParallelUtils.h"
+#include <queue>
+#include <float.h>
 
 inline Halfedge_handle	dominant(Halfedge_handle e) { return e->data().mDominant ? e : e->twin(); }
 
@@ -367,6 +370,387 @@ found:
 	return ctr;
 }
 
+// The original drainage: steepest descent everywhere, then FixSink from every point that has no way down.  Replaced by
+// HydroFillSinks - kept so the two can be compared.
+int	HydroFillSinks_Legacy(DEMGeo& elev, DEMGeo& hydro_dir)
+{
+	int x, y, n;
+	float e[DIRS_COUNT+1];
+	for (x = 0; x < hydro_dir.mWidth; ++x)
+	for (y = 0; y < hydro_dir.mHeight; ++y)
+	{
+		if (hydro_dir(x,y) == sink_Known || hydro_dir(x,y) == sink_Invalid)
+			continue;
+		for (n = 0; n < DIRS_COUNT; ++n)
+			e[n] = elev.get(x+dirs_x[n], y + dirs_y[n]);
+		e[DIRS_COUNT] = elev.get(x  ,y  );
+		hydro_dir(x,y) = GetFlowDir(e);
+	}
+
+	int total_sink_pts = 0;
+	for (x = 0; x < hydro_dir.mWidth; ++x)
+	for (y = 0; y < hydro_dir.mHeight; ++y)
+	if (hydro_dir(x,y) == sink_Unresolved)
+		total_sink_pts += FixSink(x, y, elev, hydro_dir);
+	return total_sink_pts;
+}
+
+/******************************************************************************************************************************
+ * PRIORITY-FLOOD SINK FILLING
+ ******************************************************************************************************************************/
+
+/*
+	Sink filling by priority-flood (Barnes, Lehman & Mulla, 2014): grow inward from the outlets (sink_Known), always taking
+	the lowest point on the edge of the flooded area next; a point reached from a higher one is raised to that height.
+	Every point goes through the queue once, so this is O(n log n) however flat the DEM is - FixSink re-searches a whole
+	flat for every point on it that has no way down.  Points raised to the height of whoever reached them go on a plain
+	FIFO instead of the heap, which makes pits and flats nearly linear.
+
+	The tiled version (Barnes, 2016) floods each tile on its own thread, using the tile's edge points as extra outlets and
+	labeling every point with the edge point (or real outlet) it was reached from.  Where two labels touch we keep the
+	lowest height water could spill over between them.  A small priority-flood over that label graph gives the real spill
+	height of each label, and every point ends up at max(tile fill, spill of its label) - the same DEM the one-pass flood
+	makes.
+
+	Drainage is then steepest descent on the filled DEM.  Points on flats (nothing lower around) drain toward the nearest
+	point that has a way down, by a breadth-first walk over equal heights.  Raised areas that are too big or too deep are
+	given up on (sink_Invalid), like FixSink did.
+ */
+
+int		gHydroFloodTile = 0;
+
+typedef pair<float, int>																flood_pt_t;
+typedef priority_queue<flood_pt_t, vector<flood_pt_t>, greater<flood_pt_t> >			flood_queue_t;
+typedef hash_map<long long, float>														flood_spill_map;
+
+enum {
+	flood_dry = 0,		// Not (yet) connected to an outlet.
+	flood_wet,			// Drains to an outlet.
+	flood_wall			// No data or sink_Invalid - water does not go through here.
+};
+
+inline bool	flood_is_wall(float e, float code) { return e == DEM_NO_DATA || code == sink_Invalid; }
+
+inline void	flood_add_spill(flood_spill_map& spills, int a, int b, float e)
+{
+	if (a > b) swap(a, b);
+	long long key = ((long long) a << 32) | (long long) b;
+	flood_spill_map::iterator i = spills.find(key);
+	if (i == spills.end())
+		spills[key] = e;
+	else if (e < i->second)
+		i->second = e;
+}
+
+// Floods the rect x1,y1 - x2,y2 (x2,y2 exclusive) from the points already in open, which must be labeled.  Each point
+// reached takes the label of the point it was reached from; where two labels touch, the spill height between them goes
+// into spills (if not NULL).  Walls are never reached.
+static void	flood_rect(DEMGeo& elev, const vector<char>& state, vector<int>& label, int x1, int y1, int x2, int y2,
+						flood_queue_t& open, flood_spill_map * spills)
+{
+	int w = elev.mWidth;
+	vector<int>		pit;
+	int				pit_next = 0;
+
+	while (pit_next < pit.size() || !open.empty())
+	{
+		int c;
+		if (pit_next < pit.size())
+			c = pit[pit_next++];
+		else
+		{
+			c = open.top().second;
+			open.pop();
+		}
+		if (pit_next == pit.size())
+		{
+			pit.clear();
+			pit_next = 0;
+		}
+		float ce = elev.mData[c];
+		int cx = c % w;
+		int cy = c / w;
+		for (int n = 0; n < DIRS_COUNT; ++n)
+		{
+			int nx = cx + dirs_x[n];
+			int ny = cy + dirs_y[n];
+			if (nx < x1 || ny < y1 || nx >= x2 || ny >= y2) continue;
+			int ni = nx + ny * w;
+			if (label[ni] == 0)
+			{
+				if (state[ni] == flood_wall) continue;
+				label[ni] = label[c];
+				if (elev.mData[ni] <= ce)
+				{
+					elev.mData[ni] = ce;
+					pit.push_back(ni);
+				}
+				else
+					open.push(flood_pt_t(elev.mData[ni], ni));
+			}
+			else if (spills && label[ni] != label[c])
+				flood_add_spill(*spills, label[c], label[ni], max(ce, elev.mData[ni]));
+		}
+	}
+}
+
+static void	flood_fill_one(DEMGeo& elev, const DEMGeo& hydro_dir, vector<char>& state)
+{
+	int w = elev.mWidth;
+	int h = elev.mHeight;
+	flood_queue_t	open;
+	vector<int>		label(w * h, 0);
+
+	for (int i = 0; i < w * h; ++i)
+	{
+		if (flood_is_wall(elev.mData[i], hydro_dir.mData[i]))
+			state[i] = flood_wall;
+		else if (hydro_dir.mData[i] == sink_Known)
+		{
+			label[i] = 1;
+			open.push(flood_pt_t(elev.mData[i], i));
+		}
+	}
+
+	flood_rect(elev, state, label, 0, 0, w, h, open, NULL);
+
+	for (int i = 0; i < w * h; ++i)
+	if (label[i] != 0)
+		state[i] = flood_wet;
+}
+
+static void	flood_fill_tiled(DEMGeo& elev, const DEMGeo& orig, const DEMGeo& hydro_dir, vector<char>& state, int tile)
+{
+	int w = elev.mWidth;
+	int h = elev.mHeight;
+	int tiles_x = (w + tile - 1) / tile;
+	int tiles_y = (h + tile - 1) / tile;
+	int tiles = tiles_x * tiles_y;
+
+	// Label 0 is unreached/wall, 1 is every real outlet; each tile then gets a run of labels for its edge points.
+	vector<int>	first_label(tiles + 1);
+	first_label[0] = 2;
+	for (int t = 0; t < tiles; ++t)
+	{
+		int tw = min(tile, w - (t % tiles_x) * tile);
+		int th = min(tile, h - (t / tiles_x) * tile);
+		first_label[t+1] = first_label[t] + tw * th - max(tw - 2, 0) * max(th - 2, 0);
+	}
+
+	vector<int>				label(w * h, 0);
+	vector<flood_spill_map>	spills(tiles);
+
+	parallel_for(0, tiles, 1, [&](int t, int) {
+		int x1 = (t % tiles_x) * tile;
+		int y1 = (t / tiles_x) * tile;
+		int x2 = min(x1 + tile, w);
+		int y2 = min(y1 + tile, h);
+		int next_label = first_label[t];
+		flood_queue_t	open;
+
+		for (int y = y1; y < y2; ++y)
+		for (int x = x1; x < x2; ++x)
+		{
+			int i = x + y * w;
+			bool edge = x == x1 || y == y1 || x == x2-1 || y == y2-1;
+			if (flood_is_wall(elev.mData[i], hydro_dir.mData[i]))
+			{
+				state[i] = flood_wall;
+				if (edge) ++next_label;
+				continue;
+			}
+			if (hydro_dir.mData[i] == sink_Known)	label[i] = 1;
+			if (edge)								{ if (label[i] == 0) label[i] = next_label; ++next_label; }
+			if (label[i] != 0)
+				open.push(flood_pt_t(elev.mData[i], i));
+		}
+
+		flood_rect(elev, state, label, x1, y1, x2, y2, open, &spills[t]);
+	});
+
+	// Spill points across tile edges.  Edge points were never raised, so their heights are still the originals.
+	parallel_for(0, tiles, 1, [&](int t, int) {
+		int x1 = (t % tiles_x) * tile;
+		int y1 = (t / tiles_x) * tile;
+		int x2 = min(x1 + tile, w);
+		int y2 = min(y1 + tile, h);
+		for (int y = y1; y < y2; ++y)
+		for (int x = x1; x < x2; ++x)
+		if (x == x1 || y == y1 || x == x2-1 || y == y2-1)
+		{
+			int i = x + y * w;
+			if (label[i] == 0) continue;
+			for (int n = 0; n < DIRS_COUNT; ++n)
+			{
+				int nx = x + dirs_x[n];
+				int ny = y + dirs_y[n];
+				if (nx < 0 || ny < 0 || nx >= w || ny >= h) continue;
+				if (nx >= x1 && ny >= y1 && nx < x2 && ny < y2) continue;
+				int ni = nx + ny * w;
+				if (label[ni] != 0 && label[ni] != label[i])
+					flood_add_spill(spills[t], label[i], label[ni], max(elev.mData[i], elev.mData[ni]));
+			}
+		}
+	});
+
+	int labels = first_label[tiles];
+	vector<vector<pair<int, float> > >	graph(labels);
+	for (int t = 0; t < tiles; ++t)
+	for (flood_spill_map::iterator s = spills[t].begin(); s != spills[t].end(); ++s)
+	{
+		int a = s->first >> 32;
+		int b = s->first & 0xFFFFFFFF;
+		graph[a].push_back(pair<int, float>(b, s->second));
+		graph[b].push_back(pair<int, float>(a, s->second));
+	}
+	spills.clear();
+
+	vector<float>	spill(labels, FLT_MAX);
+	flood_queue_t	q;
+	spill[1] = -FLT_MAX;
+	q.push(flood_pt_t(-FLT_MAX, 1));
+	while (!q.empty())
+	{
+		flood_pt_t l = q.top();
+		q.pop();
+		if (l.first > spill[l.second]) continue;
+		for (vector<pair<int, float> >::iterator e = graph[l.second].begin(); e != graph[l.second].end(); ++e)
+		{
+			float s = max(l.first, e->second);
+			if (s < spill[e->first])
+			{
+				spill[e->first] = s;
+				q.push(flood_pt_t(s, e->first));
+			}
+		}
+	}
+
+	parallel_for(0, h, 64, [&](int y, int) {
+		for (int x = 0; x < w; ++x)
+		{
+			int i = x + y * w;
+			if (label[i] == 0) continue;
+			float s = spill[label[i]];
+			if (s == FLT_MAX)
+			{
+				// Never connects to an outlet - leave it as it was, as the one-pass flood would.
+				elev.mData[i] = orig.mData[i];
+				continue;
+			}
+			state[i] = flood_wet;
+			if (elev.mData[i] < s)
+				elev.mData[i] = s;
+		}
+	});
+}
+
+static void	flood_drain(const DEMGeo& elev, DEMGeo& hydro_dir, const vector<char>& state)
+{
+	int w = elev.mWidth;
+	int h = elev.mHeight;
+
+	parallel_for(0, h, 16, [&](int y, int) {
+		float e[DIRS_COUNT+1];
+		for (int x = 0; x < w; ++x)
+		{
+			if (hydro_dir(x,y) == sink_Known || hydro_dir(x,y) == sink_Invalid)
+				continue;
+			for (int n = 0; n < DIRS_COUNT; ++n)
+				e[n] = elev.get(x+dirs_x[n], y + dirs_y[n]);
+			e[DIRS_COUNT] = elev.get(x  ,y  );
+			hydro_dir(x,y) = GetFlowDir(e);
+		}
+	});
+
+	// Flats: start from every point that has a way out (or is an outlet) next to a stuck point of the same height.
+	vector<int>	working;
+	for (int y = 0; y < h; ++y)
+	for (int x = 0; x < w; ++x)
+	{
+		int code = hydro_dir(x,y);
+		if (code != sink_Known && code < drain_Dir0) continue;
+		if (elev(x,y) == DEM_NO_DATA) continue;
+		for (int n = 0; n < DIRS_COUNT; ++n)
+		if (hydro_dir.get(x+dirs_x[n], y+dirs_y[n]) == sink_Unresolved && elev.get(x+dirs_x[n], y+dirs_y[n]) == elev(x,y))
+		{
+			working.push_back(x + y * w);
+			break;
+		}
+	}
+	for (int k = 0; k < working.size(); ++k)
+	{
+		int cx = working[k] % w;
+		int cy = working[k] / w;
+		for (int n = 0; n < DIRS_COUNT; ++n)
+		{
+			int nx = cx - dirs_x[n];
+			int ny = cy - dirs_y[n];
+			if (nx < 0 || ny < 0 || nx >= w || ny >= h) continue;
+			if (hydro_dir(nx,ny) != sink_Unresolved || state[nx + ny * w] != flood_wet) continue;
+			if (elev(nx,ny) != elev(cx,cy)) continue;
+			hydro_dir(nx,ny) = n+drain_Dir0;
+			working.push_back(nx + ny * w);
+		}
+	}
+
+	// Anything still stuck has no outlet at all.
+	for (int i = 0; i < w * h; ++i)
+	if (hydro_dir.mData[i] == sink_Unresolved)
+		hydro_dir.mData[i] = sink_Invalid;
+}
+
+// Each connected area the flood raised to one height is a filled sink.  If it is huge or deep, we don't believe it.
+static int	flood_limit_sinks(const DEMGeo& orig, const DEMGeo& elev, DEMGeo& hydro_dir)
+{
+	int w = elev.mWidth;
+	int h = elev.mHeight;
+	int raised = 0;
+	vector<char>	seen(w * h, 0);
+	vector<int>		sink;
+	for (int i = 0; i < w * h; ++i)
+	if (!seen[i] && elev.mData[i] > orig.mData[i])
+	{
+		float depth = 0.0;
+		sink.clear();
+		sink.push_back(i);
+		seen[i] = 1;
+		for (int k = 0; k < sink.size(); ++k)
+		{
+			int c = sink[k];
+			depth = max(depth, elev.mData[c] - orig.mData[c]);
+			for (int n = 0; n < DIRS_COUNT; ++n)
+			{
+				int nx = c % w + dirs_x[n];
+				int ny = c / w + dirs_y[n];
+				if (nx < 0 || ny < 0 || nx >= w || ny >= h) continue;
+				int ni = nx + ny * w;
+				if (!seen[ni] && elev.mData[ni] > orig.mData[ni] && elev.mData[ni] == elev.mData[c])
+				{
+					seen[ni] = 1;
+					sink.push_back(ni);
+				}
+			}
+		}
+		raised += sink.size();
+		if (depth > MAX_FLOOD || sink.size() > MAX_AREA)
+		for (int k = 0; k < sink.size(); ++k)
+			hydro_dir.mData[sink[k]] = sink_Invalid;
+	}
+	return raised;
+}
+
+int	HydroFillSinks(DEMGeo& elev, DEMGeo& hydro_dir, int tile_size)
+{
+	DEMGeo			orig(elev);
+	vector<char>	state(elev.mWidth * elev.mHeight, flood_dry);
+	if (tile_size > 0 && (tile_size < elev.mWidth || tile_size < elev.mHeight))
+		flood_fill_tiled(elev, orig, hydro_dir, state, tile_size);
+	else
+		flood_fill_one(elev, hydro_dir, state);
+	flood_drain(elev, hydro_dir, state);
+	return flood_limit_sinks(orig, elev, hydro_dir);
+}
+
 inline float MinSlopeNear(const DEMGeo& dem, int x, int y)
 {
 	float e = dem.get(x,y);
@@ -379,20 +763,53 @@ inline float MinSlopeNear(const DEMGeo& dem, int x, int y)
 	return e;
 }
 
-inline int HydroFlowToPt(int x, int y, DEMGeo * elev, DEMGeo * dirs, DEMGeo * flows, DEMGeo * slope, int * ctr)
+// Flow is the number of DEM points that drain through each point (counting itself); slope is the smallest non-negative
+// drop from any point that drains into it.  This used to be a recursive walk up from every sink, but drainage across big
+// flats can run for thousands of points, so we go in topological order instead: a point is done once everything upstream is.
+static void HydroFlowAccumulate(const DEMGeo& elev, const DEMGeo& dirs, DEMGeo& flows, DEMGeo& slope)
 {
-	(*ctr)++;
-	float sum = 1.0;
-	float slp = DEM_NO_DATA;
-	float me_elev = elev->get(x,y);
-	for (int n = 0; n < DIRS_COUNT; ++n)
+	int w = dirs.mWidth;
+	int h = dirs.mHeight;
+	vector<int>	downstream(w * h, -1);
+	vector<int>	upstream(w * h, 0);
+	for (int y = 0; y < h; ++y)
+	for (int x = 0; x < w; ++x)
+	{
+		int code = dirs(x,y);
+		if (code < drain_Dir0) continue;
+		int dx = x + dirs_x[code - drain_Dir0];
+		int dy = y + dirs_y[code - drain_Dir0];
+		if (dx < 0 || dy < 0 || dx >= w || dy >= h) continue;
+		downstream[x + y * w] = dx + dy * w;
+		upstream[dx + dy * w]++;
+	}
+
+	vector<int>	ready;
+	for (int i = 0; i < w * h; ++i)
+	{
+		flows.mData[i] = 1.0;
+		if (upstream[i] == 0)
+			ready.push_back(i);
+	}
+	for (int k = 0; k < ready.size(); ++k)
 	{
-		if (dirs->get(x-dirs_x[n],y-dirs_y[n]) == (n+drain_Dir0))
+		int d = downstream[ready[k]];
+		if (d == -1) continue;
+		flows.mData[d] += flows.mData[ready[k]];
+		if (--upstream[d] == 0)
+			ready.push_back(d);
+	}
+
+	parallel_for(0, h, 64, [&](int y, int) {
+		for (int x = 0; x < w; ++x)
 		{
-			sum += HydroFlowToPt(x-dirs_x[n],y-dirs_y[n], elev, dirs, flows, slope, ctr);
+			float slp = DEM_NO_DATA;
+			float me_elev = elev.get(x,y);
 			if (me_elev != DEM_NO_DATA)
+			for (int n = 0; n < DIRS_COUNT; ++n)
+			if (dirs.get(x-dirs_x[n],y-dirs_y[n]) == (n+drain_Dir0))
 			{
-				float other_elev = elev->get(x-dirs_x[n],y-dirs_y[n]);
+				float other_elev = elev.get(x-dirs_x[n],y-dirs_y[n]);
 				if (other_elev != DEM_NO_DATA)
 				{
 					float grad = other_elev - me_elev;
@@ -400,12 +817,10 @@ inline int HydroFlowToPt(int x, int y, DEMGeo * elev, DEMGeo * dirs, DEMGeo * fl
 						slp = MIN_NODATA(grad, slp);
 				}
 			}
+			if (slp == DEM_NO_DATA) slp = 0.0;
+			slope(x,y) = slp;
 		}
-	}
-	(*flows)(x,y) = sum;
-	if (slp == DEM_NO_DATA) slp = 0.0;
-	(*slope)(x,y) = slp;
-	return sum;
+	});
 }
 
 static void BurnRiver(DEMGeo& dem, const Point2& p1, const Point2& p2, float v)
@@ -540,8 +955,8 @@ void	BuildRiverPolygon(int x, int y, const DEMGeo& hydro_dir, const DEMGeo& hydr
 
 void	BuildRivers(const Pmwx& inMap, DEMGeoMap& ioDEMs, int borders[4], ProgressFunc inProg)
 {
-	if (inProg) inProg(0, 4, "Preparing elevation maps", 0.0);
-	int x, y, n, max_hydro;
+	if (inProg) inProg(0, 3, "Preparing elevation maps", 0.0);
+	int x, y, max_hydro;
 
 #if 0
 	gMeshPoints.clear();
@@ -570,7 +985,7 @@ void	BuildRivers(const Pmwx& inMap, DEMGeoMap& ioDEMs, int borders[4], ProgressF
 		BurnRiver(is_river, cgal2ben(he->source()->point()), cgal2ben(he->target()->point()), 1);
 	}
 
-	if (inProg) inProg(0, 4, "Preparing elevation maps", 1.0);
+	if (inProg) inProg(0, 3, "Preparing elevation maps", 1.0);
 
 	// For each border, if we have a border file, it means our adjacent tile is already done.  It's not up to us to decide
 	// whether we sink to this edge, so mark the entire edge as invalid.
@@ -615,56 +1030,12 @@ void	BuildRivers(const Pmwx& inMap, DEMGeoMap& ioDEMs, int borders[4], ProgressF
 	}
 
 	max_hydro = elev.mWidth * elev.mHeight;
-	float e[DIRS_COUNT+1];
-	if (inProg) inProg(1, 4, "Calculating drainage...", 0.0);
-	for (x = 0; x < hydro_dir.mWidth; ++x)
-	{
-		if (inProg && (x % 20) == 0) inProg(1, 4, "Calculating drainage...", (float) x / (float) hydro_dir.mWidth);
-
-		for (y = 0; y < hydro_dir.mHeight; ++y)
-		{
-			if (hydro_dir(x,y) == sink_Known || hydro_dir(x,y) == sink_Invalid)
-				continue;
-			for (n = 0; n < DIRS_COUNT; ++n)
-				e[n] = elev.get(x+dirs_x[n], y + dirs_y[n]);
-			e[DIRS_COUNT] = elev.get(x  ,y  );
-			hydro_dir(x,y) = GetFlowDir(e);
-		}
-	}
-	if (inProg) inProg(1, 4, "Calculating drainage...", 1.0);
-
-
-	if (inProg) inProg(2, 4, "Removing sinks...", 0.0);
-	int total_sink_pts = 0;
-//	map<int, int>	histo;
-	for (x = 0; x < hydro_dir.mWidth; ++x)
-	{
-		if (inProg && (x % 20) == 0) inProg(2, 4, "Removing sinks...", (float) x / (float) hydro_dir.mWidth);
-		for (y = 0; y < hydro_dir.mHeight; ++y)
-		{
-			if (hydro_dir(x,y) == sink_Unresolved)
-			{
-				int worked = FixSink(x, y, elev, hydro_dir);
-				total_sink_pts += worked;
-				worked -= (worked % 100);
-//				histo[worked]++;
-			}
-		}
-	}
-//	printf("HISTO:\n");
-//	for (map<int, int>::iterator i = histo.begin(); i != histo.end(); ++i)
-//		printf("%10d %10d\n", i->first, i->second);
-	if (inProg) inProg(2, 4, "Removing sinks...", 1.0);
+	if (inProg) inProg(1, 3, "Calculating drainage...", 0.0);
+	int raised_pts = HydroFillSinks(elev, hydro_dir, gHydroFloodTile);
+	if (inProg) inProg(1, 3, "Calculating drainage...", 1.0);
 
-	if (inProg) inProg(3, 4, "Calculating Flow...", 0.0);
-	int ctr = 0;
-	for (y = 0; y < hydro_dir.mHeight; ++y)
-	{
-		if (inProg && (y % 20) == 0) inProg(3, 4, "Calculating Flow...", (float) y / (float) hydro_dir.mHeight);
-		for (x = 0; x < hydro_dir.mWidth; ++x)
-		if (hydro_dir(x,y) < drain_Dir0)
-			HydroFlowToPt(x, y, &elev, &hydro_dir, &hydro_flw, &hydro_slp, &ctr);
-	}
+	if (inProg) inProg(2, 3, "Calculating Flow...", 0.0);
+	HydroFlowAccumulate(elev, hydro_dir, hydro_flw, hydro_slp);
 
 	for (y = 0; y < hydro_dir.mHeight; ++y)
 	for (x = 0; x < hydro_dir.mWidth; ++x)
@@ -677,7 +1048,7 @@ void	BuildRivers(const Pmwx& inMap, DEMGeoMap& ioDEMs, int borders[4], ProgressF
 		if (hydro_dir(x,y) == sink_Lake)
 			hydro_elev(x,y) = elev(x,y);
 	}
-	if (inProg) inProg(3, 4, "Calculating Flow...", 1.0);
+	if (inProg) inProg(2, 3, "Calculating Flow...", 1.0);
 
 #if 0
 	for (y = 0; y < hydro_dir.mHeight; ++y)
@@ -716,7 +1087,7 @@ void	BuildRivers(const Pmwx& inMap, DEMGeoMap& ioDEMs, int borders[4], ProgressF
 	ioDEMs[dem_HydroDirection].swap(hydro_dir);
 	ioDEMs[dem_HydroQuantity].swap(hydro_flw);
 
-	printf("Total sink points: %d\n", total_sink_pts);
+	printf("Raised (filled) points: %d\n", raised_pts);
 }
 
 #pragma mark -
@@ -27,6 +27,7 @@
 #include "MapDefs.h"
 
 class	DEMGeoMap;
+struct	DEMGeo;
 class	GISHalfedge;
 class	GISFace;
 class	Bbox2;
@@ -47,4 +48,13 @@ void	BridgeRebuild(Pmwx& ioMap, ProgressFunc inFunc);
 
 bool	MakeWetMask(const char * inShapeDir, int lon, int lat, const char * inMaskDir);
 
+// Fill sinks in elev and work out the drainage direction of every point for the river builder.  hydro_dir comes in as
+// sink_Known at outlets (water, river exits), sink_Invalid where we must not drain, anything else elsewhere; every other
+// point comes out as a drain_Dir or sink_Invalid.  tile_size > 0 floods in tiles of that many posts on all threads (same
+// result).  Returns the number of points raised.
+int		HydroFillSinks(DEMGeo& elev, DEMGeo& hydro_dir, int tile_size);
+int		HydroFillSinks_Legacy(DEMGeo& elev, DEMGeo& hydro_dir);		// The old FixSink pass, for comparison.
+
+extern int	gHydroFloodTile;		// Tile size BuildRivers passes to HydroFillSinks; 0 floods in one pass.
+
 #endif
@@ -1927,6 +1927,128 @@ int		SetupRasterizerForDEM(const set<Halfedge_handle>& inEdges, const DEMGeo& de
 	return floor(rasterizer.masters.front().y1);
 }
 
+/*
+ * MAP SNAPSHOTS
+ *
+ * The map's kernel has lazy-exact coordinates, and it needs them: overlay, snap rounding and every other pass that
+ * inserts or splits edges must have exact constructions or the arrangement can go haywire.  But a lot of passes only
+ * ever look at the map - counting, measuring, exporting - and for them every coordinate read goes through the lazy
+ * number's filter machinery, and any arithmetic on Point_2 builds another lazy node that lives until the number is
+ * freed.  For those passes we copy the geometry once into plain doubles and work on arrays.
+ *
+ */
+void	SnapshotMap(const Pmwx& inMap, MapSnapshot& outSnap)
+{
+	outSnap.verts.clear();
+	outSnap.faces.clear();
+	outSnap.face_ring_start.clear();
+	outSnap.ring_start.clear();
+	outSnap.ring_verts.clear();
+
+	outSnap.verts.reserve(inMap.number_of_vertices());
+	outSnap.x.resize(inMap.number_of_vertices());
+	outSnap.y.resize(inMap.number_of_vertices());
+
+	hash_map<const void *, int>	vidx;
+	vidx.reserve(inMap.number_of_vertices());
+	for(Pmwx::Vertex_const_iterator v = inMap.vertices_begin(); v != inMap.vertices_end(); ++v)
+	{
+		int i = outSnap.verts.size();
+		vidx[&*v] = i;
+		outSnap.verts.push_back(v);
+		outSnap.x[i] = CGAL::to_double(v->point().x());
+		outSnap.y[i] = CGAL::to_double(v->point().y());
+	}
+
+	outSnap.faces.reserve(inMap.number_of_faces());
+	outSnap.face_ring_start.reserve(inMap.number_of_faces() + 1);
+	outSnap.ring_start.reserve(inMap.number_of_faces() + 1);
+	outSnap.ring_verts.reserve(inMap.number_of_halfedges() / 2);
+
+	for(Pmwx::Face_const_iterator f = inMap.faces_begin(); f != inMap.faces_end(); ++f)
+	if(!f->is_unbounded())
+	{
+		outSnap.faces.push_back(f);
+		outSnap.face_ring_start.push_back(outSnap.ring_start.size());
+
+		Pmwx::Ccb_halfedge_const_circulator circ, stop;
+		circ = stop = f->outer_ccb();
+		outSnap.ring_start.push_back(outSnap.ring_verts.size());
+		do {
+			outSnap.ring_verts.push_back(vidx[&*circ->source()]);
+		} while(++circ != stop);
+
+		for(Pmwx::Hole_const_iterator h = f->holes_begin(); h != f->holes_end(); ++h)
+		{
+			circ = stop = *h;
+			outSnap.ring_start.push_back(outSnap.ring_verts.size());
+			do {
+				outSnap.ring_verts.push_back(vidx[&*circ->source()]);
+			} while(++circ != stop);
+		}
+	}
+	outSnap.face_ring_start.push_back(outSnap.ring_start.size());
+	outSnap.ring_start.push_back(outSnap.ring_verts.size());
+}
+
+double	MapSnapshotRingArea(const MapSnapshot& inSnap, int inRing)
+{
+	int b = inSnap.ring_start[inRing];
+	int e = inSnap.ring_start[inRing+1];
+	if(e - b < 3) return 0.0;
+	// Shoelace, relative to the first point to keep the products small.
+	double x0 = inSnap.x[inSnap.ring_verts[b]];
+	double y0 = inSnap.y[inSnap.ring_verts[b]];
+	double a = 0.0;
+	for(int n = b + 1; n < e - 1; ++n)
+	{
+		int p = inSnap.ring_verts[n], q = inSnap.ring_verts[n+1];
+		a += (inSnap.x[p] - x0) * (inSnap.y[q] - y0) - (inSnap.x[q] - x0) * (inSnap.y[p] - y0);
+	}
+	return a * 0.5;
+}
+
+// Same steps as GetMapFaceAreaMeters: the outer ring's bounds pick the projection, holes use it too.
+double	MapSnapshotFaceAreaMeters(const MapSnapshot& inSnap, int inFace, Bbox2 * out_bounds)
+{
+	Polygon2			ring;
+	CoordTranslator2	trans;
+	double				me = 0.0;
+	for (int r = inSnap.face_ring_start[inFace]; r < inSnap.face_ring_start[inFace+1]; ++r)
+	{
+		ring.clear();
+		for (int n = inSnap.ring_start[r]; n < inSnap.ring_start[r+1]; ++n)
+			ring.push_back(Point2(inSnap.x[inSnap.ring_verts[n]], inSnap.y[inSnap.ring_verts[n]]));
+
+		if (r == inSnap.face_ring_start[inFace])
+		{
+			CreateTranslatorForPolygon(ring, trans);
+			if (out_bounds)
+				*out_bounds = Bbox2(trans.mSrcMin, trans.mSrcMax);
+		}
+		for (int n = 0; n < ring.size(); ++n)
+			ring[n] = trans.Forward(ring[n]);
+		me += ring.area();
+	}
+	return me;
+}
+
+double	MapSnapshotRingLength(const MapSnapshot& inSnap, int inRing)
+{
+	int b = inSnap.ring_start[inRing];
+	int e = inSnap.ring_start[inRing+1];
+	double l = 0.0;
+	for(int n = b; n < e; ++n)
+	{
+		int p = inSnap.ring_verts[n];
+		int q = inSnap.ring_verts[(n + 1 < e) ? n + 1 : b];
+		double dx = inSnap.x[q] - inSnap.x[p];
+		double dy = inSnap.y[q] - inSnap.y[p];
+		l += sqrt(dx * dx + dy * dy);
+	}
+	return l;
+}
+
 void DumpMapStats(const Pmwx& ioMap)
 {
 	printf("Map has %zd faces / %zd edges / %zd vertices\n",
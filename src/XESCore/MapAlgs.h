@@ -285,6 +285,33 @@ bool	ClipDEMToFaceSet(const set<Face_handle>& inFaces, const DEMGeo& inSrcDEM, D
 int		SetupRasterizerForDEM(const Face_handle f, const DEMGeo& dem, PolyRasterizer<double>& rasterizer);
 int		SetupRasterizerForDEM(const set<Halfedge_handle>& inEdges, const DEMGeo& dem, PolyRasterizer<double>& rasterizer);
 
+/*
+ * MapSnapshot
+ *
+ * A flat, double-precision copy of the bounded faces of a map, for read-only passes (stats, measuring, export)
+ * that only need coordinates and rings, not exact constructions.  Vertices are numbered in iterator order.
+ * Face i's rings are rings face_ring_start[i] up to face_ring_start[i+1], outer boundary first, then holes;
+ * ring r's vertices are ring_verts[ring_start[r]] up to ring_verts[ring_start[r+1]], in ccb order.  Building
+ * it settles every lazy coordinate (single threaded), so it can then be read from any number of threads.
+ * It is stale as soon as the map changes.
+ *
+ */
+struct	MapSnapshot {
+	vector<Pmwx::Vertex_const_handle>	verts;
+	vector<Pmwx::Face_const_handle>		faces;
+	vector<double>						x, y;
+	vector<int>							face_ring_start;	// faces.size() + 1
+	vector<int>							ring_start;			// rings + 1
+	vector<int>							ring_verts;
+};
+
+void	SnapshotMap(const Pmwx& inMap, MapSnapshot& outSnap);
+// Signed area (in degrees squared, ccw positive) and length (in degrees) of one snapshot ring.
+double	MapSnapshotRingArea(const MapSnapshot& inSnap, int inRing);
+double	MapSnapshotRingLength(const MapSnapshot& inSnap, int inRing);
+// GetMapFaceAreaMeters for snapshot face inFace - same projection, same result, safe on any thread.
+double	MapSnapshotFaceAreaMeters(const MapSnapshot& inSnap, int inFace, Bbox2 * out_bounds = NULL);
+
 /*
  * DumpMapStats
  *
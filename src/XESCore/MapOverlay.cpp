@@ -26,6 +26,9 @@
 #include "MapTopology.h"
 #include "MapHelpers.h"
 #include "GISTool_Globals.h"
+#include "PerfUtils.h"
+#include "ParallelUtils.h"
+#include <CGAL/Arr_batched_point_location.h>
 /******************************************************************************************************************************************************
  * OVERLAY HELPERS
  ******************************************************************************************************************************************************/
@@ -71,6 +74,15 @@ private:
 
 public:
 
+	// When the inputs are cropped pieces of bigger maps, the area that was the unbounded face is now a bounded face
+	// too.  The grid code marks real faces as contained; with this set, "not contained" is what counts as outside.
+	bool					outside_by_contained;
+
+	Arr_full_overlay_traits() : outside_by_contained(false) { }
+
+	template <class Face_handle_X>
+	bool outside(Face_handle_X f) const { return f->is_unbounded() || (outside_by_contained && !f->contained()); }
+
 	virtual void create_vertex (Vertex_handle_A v1, Vertex_handle_B v2, Vertex_handle_R v) const
 	{
 		v->set_data(overlay_vertex_data(v1->data(),v2->data()));
@@ -113,9 +125,9 @@ public:
 
 	virtual void create_face (Face_handle_A f1, Face_handle_B f2, Face_handle_R f) const
 	{
-		f->set_contained(!f2->is_unbounded());
-		if(f1->is_unbounded())			f->set_data(f2->data());				// If one face is unbounded, use the other...
-		else if (f2->is_unbounded())	f->set_data(f1->data());				// The unbounded face cannot contain featuers and land uses in our model!!
+		f->set_contained(!outside(f2));
+		if(outside(f1))					f->set_data(f2->data());				// If one face is unbounded, use the other...
+		else if (outside(f2))			f->set_data(f1->data());				// The unbounded face cannot contain featuers and land uses in our model!!
 		else
 			f->set_data (overlay_face_data (f1->data(), f2->data()));
 	}
@@ -216,6 +228,63 @@ public:
 };
 
 
+/*
+	Stitch overlay traits: used to glue together the per-cell results of a grid overlay.  The two inputs cover disjoint
+	sets of cells, so every result face lies inside exactly one of them (or in neither, outside the grid) - that input's
+	face supplies the data.  The only edges they share are the cut lines themselves, which are removed afterwards.
+*/
+
+template <class ArrangementA, class ArrangementB, class ArrangementR>
+class Arr_stitch_overlay_traits :
+public CGAL::_Arr_default_overlay_traits_base<ArrangementA, ArrangementB, ArrangementR>
+{
+public:
+
+	typedef typename ArrangementA::Face_const_handle    Face_handle_A;
+	typedef typename ArrangementB::Face_const_handle    Face_handle_B;
+	typedef typename ArrangementR::Face_handle          Face_handle_R;
+
+	typedef typename ArrangementA::Halfedge_const_handle  Halfedge_handle_A;
+	typedef typename ArrangementB::Halfedge_const_handle  Halfedge_handle_B;
+	typedef typename ArrangementR::Halfedge_handle        Halfedge_handle_R;
+
+	typedef typename ArrangementA::Vertex_const_handle  Vertex_handle_A;
+	typedef typename ArrangementB::Vertex_const_handle  Vertex_handle_B;
+	typedef typename ArrangementR::Vertex_handle        Vertex_handle_R;
+
+	void create_vertex (Vertex_handle_A v1, Vertex_handle_B v2, Vertex_handle_R v) const override		{ v->set_data(v1->data()); }
+	void create_vertex (Vertex_handle_A v1, Halfedge_handle_B e2, Vertex_handle_R v) const override		{ v->set_data(v1->data()); }
+	void create_vertex (Vertex_handle_A v1, Face_handle_B f2, Vertex_handle_R v) const override			{ v->set_data(v1->data()); }
+	void create_vertex (Halfedge_handle_A e1, Vertex_handle_B v2, Vertex_handle_R v) const override		{ v->set_data(v2->data()); }
+	void create_vertex (Face_handle_A f1, Vertex_handle_B v2, Vertex_handle_R v) const override			{ v->set_data(v2->data()); }
+	void create_vertex (Halfedge_handle_A e1, Halfedge_handle_B e2, Vertex_handle_R v) const override	{ }
+
+	void create_edge (Halfedge_handle_A e1, Halfedge_handle_B e2, Halfedge_handle_R e) const override
+	{
+		e->		   set_data (e1->data());
+		e->twin()->set_data (e1->twin()->data());
+	}
+
+	void create_edge (Halfedge_handle_A e1, Face_handle_B f2, Halfedge_handle_R e) const override
+	{
+		e->		   set_data (e1->data());
+		e->twin()->set_data (e1->twin()->data());
+	}
+
+	void create_edge (Face_handle_A f1, Halfedge_handle_B e2, Halfedge_handle_R e) const override
+	{
+		e->		   set_data (e2->data());
+		e->twin()->set_data (e2->twin()->data());
+	}
+
+	void create_face (Face_handle_A f1, Face_handle_B f2, Face_handle_R f) const override
+	{
+		Face_handle_A	src = f1->is_unbounded() ? f2 : f1;
+		f->set_contained(src->contained());
+		f->set_data(src->data());
+	}
+};
+
 /*
 	Overlay functors to try to merge our meta-data as best we can when we do a full overlay and have overlapping data.
 */
@@ -286,13 +355,16 @@ struct Overlay_network
 };
 
 
-void	MapMerge(Pmwx& src_a, Pmwx& src_b, Pmwx& result)
+int		gMapOverlayGrid = 0;
+
+static void	MapMergeOne(Pmwx& src_a, Pmwx& src_b, Pmwx& result, bool outside_by_contained)
 {
 	Arr_full_overlay_traits<Pmwx, Pmwx, Pmwx, Overlay_vertex, Overlay_network, Overlay_terrain> 	t;
+	t.outside_by_contained = outside_by_contained;
 	CGAL::overlay(src_a,src_b,result,t);
 }
 
-void	MapOverlay(Pmwx& bottom, Pmwx& top, Pmwx& result)
+static void	MapOverlayOne(Pmwx& bottom, Pmwx& top, Pmwx& result)
 {
 	vector<Halfedge_handle>		dead;
 	Arr_replace_overlay_traits<Pmwx,Pmwx,Pmwx>		t;
@@ -306,6 +378,418 @@ void	MapOverlay(Pmwx& bottom, Pmwx& top, Pmwx& result)
 	}
 }
 
+/*
+	GRID OVERLAY
+
+	A sweep over two big maps is O((n+k) log n) and single threaded.  For dense imports we instead cut the area into a
+	grid of cells and sweep each cell on its own thread:
+
+	1.	Pick cut lines.  The outer frame sits outside both maps, and no cut line passes through an input vertex, so no
+		input edge can lie ON a cut line - any edge that does is ours.
+	2.	One serial pass over each input settles its lazy numbers and hands every edge to the cells its bounding box
+		touches.  The lazy numbers have unlocked ref counts and compute their exact value on first use, so after this
+		pass the threads only ever read them.
+	3.	Each thread builds its cell's piece of both inputs from the cell's edges alone, with fresh numbers, crops the
+		pieces to the cell and puts the input data back on: halfedge and vertex data by edge, face data from the input
+		face on either side of an input edge (or, in a cell no edge crosses, the input face under the cell).  For a
+		merge, faces are contained if they came from a bounded input face, because after the crop the old unbounded
+		area is a bounded face.  Then the pieces are swept with the normal traits.
+	4.	Stitch the cells back together, pairwise, in contiguous runs of row-major cells - a run never encloses a hole,
+		so "unbounded" always means "in no cell of this run".
+	5.	Remove the cut-line edges and re-join the input edges that the cut lines split.
+
+	The result has the same faces and data as a one-sweep overlay.  Each cell only ever holds its own edges, plus the
+	ones that cross its border, so the pieces together cost about one more copy of the inputs.  The stitch sweeps
+	are extra work, so this only wins once the intersection work dominates.  A few cells per side is plenty.
+*/
+
+static bool	on_cut(const NT& c, const vector<double>& cuts)
+{
+	double d = CGAL::to_double(c);
+	vector<double>::const_iterator i = lower_bound(cuts.begin(), cuts.end(), d);
+	return i != cuts.end() && *i == d && c == NT(d);
+}
+
+static bool	is_cut_edge(Halfedge_handle e, const vector<double>& xcuts, const vector<double>& ycuts)
+{
+	const Point_2& s(e->source()->point());
+	const Point_2& t(e->target()->point());
+	if(s.x() == t.x() && on_cut(s.x(), xcuts)) return true;
+	if(s.y() == t.y() && on_cut(s.y(), ycuts)) return true;
+	return false;
+}
+
+// Make sure reading n never changes it again: a number whose interval is not a point gets its exact value computed now.
+static void	settle_nt(const NT& n)
+{
+	pair<double,double> i = CGAL::to_interval(n);
+	if(i.first != i.second)
+		n.exact();
+}
+
+static void	settle_point(const Point_2& p)
+{
+	settle_nt(p.x());
+	settle_nt(p.y());
+}
+
+static void	settle_polygon(const Polygon_2& p)
+{
+	for(Polygon_2::Vertex_const_iterator v = p.vertices_begin(); v != p.vertices_end(); ++v)
+		settle_point(*v);
+}
+
+// A copy of n that shares no lazy rep (or exact rep) with n.  Only reads n, so it is safe on many threads once n is
+// settled.
+static NT	detached_nt(const NT& n)
+{
+	pair<double,double> i = CGAL::to_interval(n);
+	if(i.first == i.second)
+		return NT(i.first);
+	const NT::ET& e(n.exact());
+	return NT(NT::ET(e.numerator(), e.denominator()));
+}
+
+static Point_2	detached_point(const Point_2& p)
+{
+	return Point_2(detached_nt(p.x()), detached_nt(p.y()));
+}
+
+static Polygon_2	detached_polygon(const Polygon_2& p)
+{
+	Polygon_2	r;
+	for(Polygon_2::Vertex_const_iterator v = p.vertices_begin(); v != p.vertices_end(); ++v)
+		r.push_back(detached_point(*v));
+	return r;
+}
+
+// Face data copied field by field - the GIS_face_data copy would share the feature geometry's lazy reps.
+static void	detached_face_data(const GIS_face_data& src, GIS_face_data& dst)
+{
+	dst.mTerrainType = src.mTerrainType;
+	dst.mParams = src.mParams;
+	dst.mAreaFeature = src.mAreaFeature;
+	dst.mObjs = src.mObjs;
+	dst.mPolyObjs = src.mPolyObjs;
+	dst.mTemp1 = src.mTemp1;
+	dst.mTemp2 = src.mTemp2;
+	dst.mHasElevation = src.mHasElevation;
+
+	dst.mPointFeatures.resize(src.mPointFeatures.size());
+	for(int n = 0; n < src.mPointFeatures.size(); ++n)
+	{
+		const GISPointFeature_t&	s(src.mPointFeatures[n]);
+		GISPointFeature_t&			d(dst.mPointFeatures[n]);
+		d.mFeatType = s.mFeatType;
+		d.mParams = s.mParams;
+		d.mLocation = detached_point(s.mLocation);
+		d.mInstantiated = s.mInstantiated;
+	}
+
+	dst.mPolygonFeatures.resize(src.mPolygonFeatures.size());
+	for(int n = 0; n < src.mPolygonFeatures.size(); ++n)
+	{
+		const GISPolygonFeature_t&	s(src.mPolygonFeatures[n]);
+		GISPolygonFeature_t&		d(dst.mPolygonFeatures[n]);
+		d.mFeatType = s.mFeatType;
+		d.mParams = s.mParams;
+		d.mShape = Polygon_with_holes_2(detached_polygon(s.mShape.outer_boundary()));
+		for(Polygon_with_holes_2::Hole_const_iterator h = s.mShape.holes_begin(); h != s.mShape.holes_end(); ++h)
+			d.mShape.add_hole(detached_polygon(*h));
+		d.mInstantiated = s.mInstantiated;
+	}
+}
+
+// One input's share of each grid cell.
+struct	overlay_grid_input_t {
+	vector<vector<Halfedge_handle> >	edges;			// Edges whose bounding box touches the cell, each as the halfedge that runs along its curve
+	vector<vector<Vertex_handle> >		isolated;		// Isolated vertices that may be in the cell
+	vector<Face_handle>					center_face;	// The face under the cell's center, for cells no edge crosses
+};
+
+// The cells [c1, c2] whose span touches [lo, hi].  The span is padded a hair so rounding can't lose an edge - an extra
+// edge in a cell is cropped away.
+static void	grid_cell_range(const vector<double>& cuts, double lo, double hi, int& c1, int& c2)
+{
+	int n = cuts.size() - 1;
+	double slop = (cuts.back() - cuts.front()) * 1.0e-9;
+	c1 = upper_bound(cuts.begin(), cuts.end(), lo - slop) - cuts.begin() - 1;
+	c2 = lower_bound(cuts.begin(), cuts.end(), hi + slop) - cuts.begin() - 1;
+	c1 = max(0, min(n - 1, c1));
+	c2 = max(0, min(n - 1, c2));
+}
+
+// The serial pass over one input: settle its numbers, deal its edges and isolated vertices out to the cells and find
+// the face under each cell's center.
+static void	split_for_grid(Pmwx& m, const vector<double>& xcuts, const vector<double>& ycuts, overlay_grid_input_t& out)
+{
+	int grid = xcuts.size() - 1;
+	int cells = grid * grid;
+	out.edges.assign(cells, vector<Halfedge_handle>());
+	out.isolated.assign(cells, vector<Vertex_handle>());
+	out.center_face.assign(cells, Face_handle());
+
+	for(Pmwx::Vertex_iterator v = m.vertices_begin(); v != m.vertices_end(); ++v)
+	{
+		settle_point(v->point());
+		if(!v->is_isolated())
+			continue;
+		int x1, x2, y1, y2;
+		double x = CGAL::to_double(v->point().x()), y = CGAL::to_double(v->point().y());
+		grid_cell_range(xcuts, x, x, x1, x2);
+		grid_cell_range(ycuts, y, y, y1, y2);
+		for(int cy = y1; cy <= y2; ++cy)
+		for(int cx = x1; cx <= x2; ++cx)
+			out.isolated[cx + cy * grid].push_back(v);
+	}
+
+	for(Pmwx::Edge_iterator e = m.edges_begin(); e != m.edges_end(); ++e)
+	{
+		Halfedge_handle h = he_get_same_direction(Halfedge_handle(e));
+		double sx = CGAL::to_double(h->source()->point().x()), sy = CGAL::to_double(h->source()->point().y());
+		double tx = CGAL::to_double(h->target()->point().x()), ty = CGAL::to_double(h->target()->point().y());
+		int x1, x2, y1, y2;
+		grid_cell_range(xcuts, min(sx, tx), max(sx, tx), x1, x2);
+		grid_cell_range(ycuts, min(sy, ty), max(sy, ty), y1, y2);
+		for(int cy = y1; cy <= y2; ++cy)
+		for(int cx = x1; cx <= x2; ++cx)
+			out.edges[cx + cy * grid].push_back(h);
+	}
+
+	for(Pmwx::Face_iterator f = m.faces_begin(); f != m.faces_end(); ++f)
+	{
+		for(GISPointFeatureVector::iterator p = f->data().mPointFeatures.begin(); p != f->data().mPointFeatures.end(); ++p)
+			settle_point(p->mLocation);
+		for(GISPolygonFeatureVector::iterator p = f->data().mPolygonFeatures.begin(); p != f->data().mPolygonFeatures.end(); ++p)
+		{
+			settle_polygon(p->mShape.outer_boundary());
+			for(Polygon_with_holes_2::Hole_const_iterator h = p->mShape.holes_begin(); h != p->mShape.holes_end(); ++h)
+				settle_polygon(*h);
+		}
+	}
+
+	vector<Point_2>	centers;
+	for(int cy = 0; cy < grid; ++cy)
+	for(int cx = 0; cx < grid; ++cx)
+		centers.push_back(Point_2((xcuts[cx] + xcuts[cx+1]) * 0.5, (ycuts[cy] + ycuts[cy+1]) * 0.5));
+	vector<pair<Point_2, CGAL::Object> >	hits;
+	CGAL::locate(m, centers.begin(), centers.end(), back_inserter(hits));
+	for(int n = 0; n < hits.size(); ++n)
+	{
+		int cx, cx2, cy, cy2;
+		grid_cell_range(xcuts, CGAL::to_double(hits[n].first.x()), CGAL::to_double(hits[n].first.x()), cx, cx2);
+		grid_cell_range(ycuts, CGAL::to_double(hits[n].first.y()), CGAL::to_double(hits[n].first.y()), cy, cy2);
+		Face_const_handle		f;
+		Vertex_const_handle		v;
+		if(CGAL::assign(f, hits[n].second))
+			out.center_face[cx + cy * grid] = m.non_const_handle(f);
+		else if(CGAL::assign(v, hits[n].second) && v->is_isolated())
+			out.center_face[cx + cy * grid] = m.non_const_handle(v->face());
+		// A center on an edge means an edge crosses the cell, so the cell never needs its center face.
+	}
+}
+
+// The input face on the near side of any input edge around f, or a null handle if f is bounded by cut edges only.
+static Face_handle	grid_source_face(Face_handle f, const vector<Halfedge_handle>& edges)
+{
+	vector<Pmwx::Ccb_halfedge_circulator>	ccbs;
+	if(!f->is_unbounded())
+		ccbs.push_back(f->outer_ccb());
+	for(Pmwx::Hole_iterator h = f->holes_begin(); h != f->holes_end(); ++h)
+		ccbs.push_back(*h);
+	for(int n = 0; n < ccbs.size(); ++n)
+	{
+		Pmwx::Ccb_halfedge_circulator circ, stop;
+		circ = stop = ccbs[n];
+		do {
+			if(!circ->curve().data().empty())
+			{
+				Halfedge_handle src = edges[*circ->curve().data().begin()];
+				return he_is_same_direction(Halfedge_handle(circ)) ? src->face() : src->twin()->face();
+			}
+		} while(++circ != stop);
+	}
+	return Face_handle();
+}
+
+// Builds cell c's piece of the input src into out, cropped to the cell, with src's data.  Runs on a worker thread: it
+// only reads src (split_for_grid has settled it) and every number in out is new.
+static void	build_grid_cell(Pmwx& src, const overlay_grid_input_t& in, int c, double x1, double y1, double x2, double y2, bool is_merge, Pmwx& out)
+{
+	const vector<Halfedge_handle>&	edges(in.edges[c]);
+
+	// Until the crop is done each curve's data is its index in the cell's edge list, so we can find the input edge.
+	vector<X_monotone_curve_2>	curves;
+	curves.reserve(edges.size());
+	for(int n = 0; n < edges.size(); ++n)
+		curves.push_back(X_monotone_curve_2(Segment_2(detached_point(edges[n]->source()->point()), detached_point(edges[n]->target()->point())), n));
+	CGAL::insert_non_intersecting_curves(out, curves.begin(), curves.end());
+
+	// Edge and vertex data go on before the crop, which carries edge data over its splits.
+	for(Pmwx::Edge_iterator e = out.edges_begin(); e != out.edges_end(); ++e)
+	{
+		Halfedge_handle h = he_get_same_direction(Halfedge_handle(e));
+		Halfedge_handle s = edges[*h->curve().data().begin()];
+		h->set_data(s->data());
+		h->twin()->set_data(s->twin()->data());
+		h->source()->set_data(s->source()->data());
+		h->target()->set_data(s->target()->data());
+	}
+
+	CropMap(out, x1, y1, x2, y2, false, NULL);
+
+	Point_2	sw(x1, y1), ne(x2, y2);
+	for(vector<Vertex_handle>::const_iterator v = in.isolated[c].begin(); v != in.isolated[c].end(); ++v)
+	{
+		Point_2 p = detached_point((*v)->point());
+		if(p.x() > sw.x() && p.x() < ne.x() && p.y() > sw.y() && p.y() < ne.y())
+			CGAL::insert_point(out, p)->set_data((*v)->data());
+	}
+
+	for(Pmwx::Face_iterator f = out.faces_begin(); f != out.faces_end(); ++f)
+	{
+		Face_handle s = f->is_unbounded() ? src.unbounded_face() : grid_source_face(f, edges);
+		if(s == Face_handle())
+			s = in.center_face[c];
+		DebugAssert(s != Face_handle());
+		GIS_face_data	d;
+		detached_face_data(s->data(), d);
+		f->set_data(d);
+		f->set_contained(is_merge ? !s->is_unbounded() : s->contained());
+	}
+
+	// Now the input edges get their own curve data back; the cut edges keep none.
+	for(Pmwx::Edge_iterator e = out.edges_begin(); e != out.edges_end(); ++e)
+	if(!e->curve().data().empty())
+		out.modify_edge(Halfedge_handle(e), X_monotone_curve_2(e->curve(), edges[*e->curve().data().begin()]->curve().data()));
+}
+
+static void	pick_cuts(vector<double>& coords, double lo, double hi, int n, vector<double>& out_cuts)
+{
+	sort(coords.begin(), coords.end());
+	double span = hi - lo;
+	double margin = max(span * 0.001, 1.0e-6);
+	out_cuts.resize(n + 1);
+	out_cuts[0] = lo - margin;
+	out_cuts[n] = hi + margin;
+	for(int i = 1; i < n; ++i)
+	{
+		double c = lo + span * (double) i / (double) n;
+		while(binary_search(coords.begin(), coords.end(), c))
+			c += margin * 1.0e-3;
+		out_cuts[i] = c;
+	}
+}
+
+static void	MapOverlayGrid(Pmwx& a, Pmwx& b, Pmwx& result, int grid, bool is_merge)
+{
+	StPerfScope	profile("MapOverlayGrid");
+
+	vector<double>	xs, ys;
+	xs.reserve(a.number_of_vertices() + b.number_of_vertices());
+	ys.reserve(a.number_of_vertices() + b.number_of_vertices());
+	for(Pmwx::Vertex_iterator v = a.vertices_begin(); v != a.vertices_end(); ++v)
+	{
+		xs.push_back(CGAL::to_double(v->point().x()));
+		ys.push_back(CGAL::to_double(v->point().y()));
+	}
+	for(Pmwx::Vertex_iterator v = b.vertices_begin(); v != b.vertices_end(); ++v)
+	{
+		xs.push_back(CGAL::to_double(v->point().x()));
+		ys.push_back(CGAL::to_double(v->point().y()));
+	}
+	if(xs.empty())
+	{
+		if(is_merge)	MapMergeOne(a, b, result, false);
+		else			MapOverlayOne(a, b, result);
+		return;
+	}
+
+	vector<double>	xcuts, ycuts;
+	pick_cuts(xs, *min_element(xs.begin(), xs.end()), *max_element(xs.begin(), xs.end()), grid, xcuts);
+	pick_cuts(ys, *min_element(ys.begin(), ys.end()), *max_element(ys.begin(), ys.end()), grid, ycuts);
+
+	overlay_grid_input_t	in_a, in_b;
+	split_for_grid(a, xcuts, ycuts, in_a);
+	split_for_grid(b, xcuts, ycuts, in_b);
+
+	int cells = grid * grid;
+	vector<Pmwx *>	parts(cells);
+	for(int c = 0; c < cells; ++c)
+		parts[c] = new Pmwx;
+
+	parallel_for(0, cells, 1, [&](int c, int) {
+		int cx = c % grid;
+		int cy = c / grid;
+		Pmwx	ca, cb;
+		build_grid_cell(a, in_a, c, xcuts[cx], ycuts[cy], xcuts[cx+1], ycuts[cy+1], is_merge, ca);
+		build_grid_cell(b, in_b, c, xcuts[cx], ycuts[cy], xcuts[cx+1], ycuts[cy+1], is_merge, cb);
+		if(is_merge)	MapMergeOne(ca, cb, *parts[c], true);
+		else			MapOverlayOne(ca, cb, *parts[c]);
+	});
+
+	for(int step = 1; step < cells; step *= 2)
+	{
+		parallel_for(0, (cells + 2 * step - 1) / (2 * step), 1, [&](int n, int) {
+			int lo = n * 2 * step;
+			int hi = lo + step;
+			if(hi >= cells) return;
+			// The last stitch writes straight into the result, so the finished map is never copied.
+			Pmwx *	joined = (2 * step >= cells) ? &result : new Pmwx;
+			Arr_stitch_overlay_traits<Pmwx,Pmwx,Pmwx>	t;
+			CGAL::overlay(*parts[lo], *parts[hi], *joined, t);
+			delete parts[lo];
+			delete parts[hi];
+			parts[lo] = joined;
+			parts[hi] = NULL;
+		});
+	}
+	DebugAssert(parts[0] == &result);
+
+	vector<Halfedge_handle>	kill;
+	for(Pmwx::Edge_iterator e = result.edges_begin(); e != result.edges_end(); ++e)
+	if(is_cut_edge(e, xcuts, ycuts))
+		kill.push_back(e);
+	for(vector<Halfedge_handle>::iterator k = kill.begin(); k != kill.end(); ++k)
+		result.remove_edge(*k);
+
+	// Input edges that crossed a cut line were split there; put them back together.  The two halves are collinear
+	// exactly (the split point is an exact construction) and carry the same data.
+	for(Pmwx::Vertex_iterator v = result.vertices_begin(); v != result.vertices_end(); )
+	{
+		Vertex_handle vv(v);
+		++v;
+		if(vv->degree() != 2) continue;
+		if(!on_cut(vv->point().x(), xcuts) && !on_cut(vv->point().y(), ycuts)) continue;
+
+		Halfedge_handle h1(vv->incident_halfedges());			// points into vv
+		Halfedge_handle next = h1->next();
+		if(next->twin() == h1) continue;						// antenna tip
+		if(!CGAL::collinear(h1->source()->point(), vv->point(), next->target()->point())) continue;
+		if(h1->source() == next->target()) continue;
+
+		X_monotone_curve_2	nc(Segment_2(h1->source()->point(), next->target()->point()), h1->curve().data());
+		result.merge_edge(h1, next, nc);
+	}
+}
+
+void	MapMerge(Pmwx& src_a, Pmwx& src_b, Pmwx& result)
+{
+	if(gMapOverlayGrid > 1)
+		MapOverlayGrid(src_a, src_b, result, gMapOverlayGrid, true);
+	else
+		MapMergeOne(src_a, src_b, result, false);
+}
+
+void	MapOverlay(Pmwx& bottom, Pmwx& top, Pmwx& result)
+{
+	StPerfScope	profile("MapOverlay");
+	if(gMapOverlayGrid > 1)
+		MapOverlayGrid(bottom, top, result, gMapOverlayGrid, false);
+	else
+		MapOverlayOne(bottom, top, result);
+}
+
 /************************************************************************************************************************************************
  *
  ************************************************************************************************************************************************/
@@ -493,6 +977,7 @@ void OverlayMap_legacy(
 
 void MergeMaps_legacy(Pmwx& ioDstMap, Pmwx& ioSrcMap, bool inForceProps, set<Face_handle> * outFaces, bool pre_integrated, ProgressFunc func)
 {
+	StPerfScope	profile("MergeMaps");
 	DebugAssert(outFaces == NULL || !inForceProps);
 	if(outFaces) outFaces->clear();
 
@@ -43,6 +43,10 @@ void	MapMerge(Pmwx& src_a, Pmwx& src_b, Pmwx& result);
 // Faces that were bounded in top ("in") top are set as contained, A is not.
 void	MapOverlay(Pmwx& bottom, Pmwx& top, Pmwx& result);
 
+// If more than 1, MapMerge and MapOverlay cut the area into this many cells per side and sweep the cells on all
+// threads, then stitch them back together.  Same result, better for dense maps.  0 (the default) sweeps once.
+extern int	gMapOverlayGrid;
+
 
 
 /******************************************************************************************************************************
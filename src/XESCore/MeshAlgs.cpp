@@ -43,6 +43,8 @@
 #include "MeshSimplify.h"
 #include "NetHelpers.h"
 #include "Zoning.h"	// for urban cheat table.
+#include "ParallelUtils.h"
+#include <mutex>
 #if OPENGL_MAP
 #include "GISTool_Globals.h"
 #endif
@@ -152,7 +154,8 @@
 	/* border_match		*/	PHONE ?		1		: 1,
 	/* optimize_borders	*/	PHONE ?		1		: 1,
 	/* max_tri_size_m	*/	PHONE ?		6000	: 250,
-	/* rep_switch_m		*/	PHONE ?		50000	: 50000
+	/* rep_switch_m		*/	PHONE ?		50000	: 50000,
+	/* simplify_mode	*/	simplify_Serial
 	};
 #elif UHD_MESH
 	MeshPrefs_t gMeshPrefs = {		/*iphone*/
@@ -161,7 +164,8 @@
 	/* border_match		*/	PHONE ?		1		: 1,
 	/* optimize_borders	*/	PHONE ?		1		: 1,
 	/* max_tri_size_m	*/	PHONE ?		6000	: 200,
-	/* rep_switch_m		*/	PHONE ?		50000	: 50000
+	/* rep_switch_m		*/	PHONE ?		50000	: 50000,
+	/* simplify_mode	*/	simplify_Serial
 	};
 #else
 	MeshPrefs_t gMeshPrefs = {		/*iphone*/
@@ -170,7 +174,8 @@
 	/* border_match		*/	PHONE ?		1		: 1,
 	/* optimize_borders	*/	PHONE ?		1		: 1,
 	/* max_tri_size_m	*/	PHONE ?		6000	: 1500,
-	/* rep_switch_m		*/	PHONE ?		50000	: 50000
+	/* rep_switch_m		*/	PHONE ?		50000	: 50000,
+	/* simplify_mode	*/	simplify_Serial
 	};
 #endif
 
@@ -1379,17 +1384,18 @@ struct sort_cdt_face_by_lowest_height {
 #define NEW_ALG 1
 // this is faster - by going in order from bottom to top we avoid a crapload of retries on neighboring verts.
 // going by MESH FACE is not so good - mesh face is at THREE alts at once..in theory at least.  or something.
-void FlattenWater(CDT& ioMesh, const DEMGeo& water_surface)
+// Each vertex only reads its own faces and writes its own height, so this runs per vertex on all threads; the
+// snapshot's heights are kept in sync for the normals pass that follows.
+void FlattenWater(CDT& ioMesh, MeshSnapshot& ioSnap, const DEMGeo& water_surface)
 {
-	for(CDT::Finite_vertices_iterator v = ioMesh.finite_vertices_begin(); v != ioMesh.finite_vertices_end(); ++v)
-	{
+	parallel_for(0, ioSnap.verts.size(), 1024, [&](int i, int) {
+		CDT::Vertex_handle v = ioSnap.verts[i];
 		if(CategorizeVertex(ioMesh, v,terrain_Water) <= 0)
 		if(!IsNoFlattenVertex(ioMesh,v))
 		{
-			Point2 p = cgal2ben(v->point());
-			v->info().height = water_surface.search_nearest(p.x(),p.y());
+			v->info().height = ioSnap.z[i] = water_surface.search_nearest(ioSnap.x[i],ioSnap.y[i]);
 		}
-	}
+	});
 	
 	return;
 	
@@ -1622,73 +1628,171 @@ void FlattenWater(CDT& ioMesh, const DEMGeo& water_surface)
 }
 
 /*
- * CalculateMeshNormals
+ * MESH SNAPSHOT
  *
- * This routine calcs the normals per vertex.
+ * The CGAL walk is pointer chasing all the way down, and every coordinate read goes through a lazy exact number.  For
+ * passes that touch every vertex or face once (normals, water flattening) we copy what they need into flat arrays first.
+ * The copy is one serial walk (it has to be - settling a lazy number is not thread safe); the passes themselves are then
+ * plain loops over arrays, split across threads.
  *
  */
-void CalculateMeshNormals(CDT& ioMesh)
+void SnapshotMesh(CDT& inMesh, MeshSnapshot& outSnap)
 {
-	for(CDT::Finite_faces_iterator f = ioMesh.finite_faces_begin(); f != ioMesh.finite_faces_end(); ++f)
+	outSnap.verts.clear();
+	outSnap.faces.clear();
+	outSnap.verts.reserve(inMesh.number_of_vertices());
+	outSnap.faces.reserve(inMesh.number_of_faces());
+
+	hash_map<const void *, int>	vidx, fidx;
+	vidx.reserve(inMesh.number_of_vertices());
+	fidx.reserve(inMesh.number_of_faces());
+
+	for(CDT::Finite_vertices_iterator v = inMesh.finite_vertices_begin(); v != inMesh.finite_vertices_end(); ++v)
 	{
-		Point3	selfP(CGAL::to_double(f->vertex(0)->point().x()), CGAL::to_double(f->vertex(0)->point().y()), f->vertex(0)->info().height);
-		Point3  lastP(CGAL::to_double(f->vertex(1)->point().x()), CGAL::to_double(f->vertex(1)->point().y()), f->vertex(1)->info().height);
-		Point3  nowiP(CGAL::to_double(f->vertex(2)->point().x()), CGAL::to_double(f->vertex(2)->point().y()), f->vertex(2)->info().height);
-		Vector3 v1(selfP, lastP);
-		Vector3 v2(selfP, nowiP);
-		v1.dx *= (DEG_TO_MTR_LAT * cos(selfP.y * DEG_TO_RAD));
-		v2.dx *= (DEG_TO_MTR_LAT * cos(selfP.y * DEG_TO_RAD));
-		v1.dy *= (DEG_TO_MTR_LAT);
-		v2.dy *= (DEG_TO_MTR_LAT);
-		
-		Vector3 normal;
-		
-		if((v1.dx == 0.0 && v1.dy == 0.0 && v1.dz == 0.0) ||
-		   (v2.dx == 0.0 && v2.dy == 0.0 && v2.dz == 0.0))
+		vidx[&*v] = outSnap.verts.size();
+		outSnap.verts.push_back(v);
+	}
+	for(CDT::Finite_faces_iterator f = inMesh.finite_faces_begin(); f != inMesh.finite_faces_end(); ++f)
+	{
+		fidx[&*f] = outSnap.faces.size();
+		outSnap.faces.push_back(f);
+	}
+
+	int nv = outSnap.verts.size();
+	int nf = outSnap.faces.size();
+	outSnap.x.resize(nv);
+	outSnap.y.resize(nv);
+	outSnap.z.resize(nv);
+	for(int i = 0; i < nv; ++i)
+	{
+		outSnap.x[i] = CGAL::to_double(outSnap.verts[i]->point().x());
+		outSnap.y[i] = CGAL::to_double(outSnap.verts[i]->point().y());
+		outSnap.z[i] = outSnap.verts[i]->info().height;
+	}
+
+	outSnap.face_verts.resize(nf * 3);
+	outSnap.face_nbrs.resize(nf * 3);
+	parallel_for(0, nf, 4096, [&](int f, int) {
+		for(int k = 0; k < 3; ++k)
 		{
-			normal = Vector3(0,0,1);
+			outSnap.face_verts[f*3+k] = vidx.find(&*outSnap.faces[f]->vertex(k))->second;
+			CDT::Face_handle n = outSnap.faces[f]->neighbor(k);
+			outSnap.face_nbrs[f*3+k] = inMesh.is_infinite(n) ? -1 : fidx.find(&*n)->second;
 		}
-		else 
+	});
+
+	// Vertex-to-face table: count, prefix sum, then fill - both passes circulate in the same order.
+	outSnap.vert_face_start.assign(nv + 1, 0);
+	parallel_for(0, nv, 4096, [&](int i, int) {
+		int n = 0;
+		CDT::Face_circulator circ, stop;
+		circ = stop = inMesh.incident_faces(outSnap.verts[i]);
+		do {
+			if(!inMesh.is_infinite(circ))
+				++n;
+		} while (++circ != stop);
+		outSnap.vert_face_start[i+1] = n;
+	});
+	for(int i = 0; i < nv; ++i)
+		outSnap.vert_face_start[i+1] += outSnap.vert_face_start[i];
+
+	outSnap.vert_faces.resize(outSnap.vert_face_start[nv]);
+	parallel_for(0, nv, 4096, [&](int i, int) {
+		int n = outSnap.vert_face_start[i];
+		CDT::Face_circulator circ, stop;
+		circ = stop = inMesh.incident_faces(outSnap.verts[i]);
+		do {
+			if(!inMesh.is_infinite(circ))
+				outSnap.vert_faces[n++] = fidx.find(&*circ)->second;
+		} while (++circ != stop);
+	});
+}
+
+/*
+ * CalculateMeshNormals
+ *
+ * This routine calcs the normals per vertex.
+ *
+ */
+void CalculateMeshNormals(const MeshSnapshot& inSnap)
+{
+	int nv = inSnap.verts.size();
+	int nf = inSnap.faces.size();
+
+	// Face normals go into a flat array first (as floats, same as face info) so the vertex pass never touches a face.
+	vector<float>	fn(nf * 3);
+	parallel_for_blocks(0, nf, 4096, [&](int f1, int f2, int) {
+		for(int f = f1; f < f2; ++f)
 		{
-		
-			v1.normalize();
-			v2.normalize();
-			normal = v1.cross(v2);
-			if(normal.dz <= 0.0)
+			const int * fv = &inSnap.face_verts[f*3];
+			Point3	selfP(inSnap.x[fv[0]], inSnap.y[fv[0]], inSnap.z[fv[0]]);
+			Point3  lastP(inSnap.x[fv[1]], inSnap.y[fv[1]], inSnap.z[fv[1]]);
+			Point3  nowiP(inSnap.x[fv[2]], inSnap.y[fv[2]], inSnap.z[fv[2]]);
+			Vector3 v1(selfP, lastP);
+			Vector3 v2(selfP, nowiP);
+			v1.dx *= (DEG_TO_MTR_LAT * cos(selfP.y * DEG_TO_RAD));
+			v2.dx *= (DEG_TO_MTR_LAT * cos(selfP.y * DEG_TO_RAD));
+			v1.dy *= (DEG_TO_MTR_LAT);
+			v2.dy *= (DEG_TO_MTR_LAT);
+
+			Vector3 normal;
+
+			if((v1.dx == 0.0 && v1.dy == 0.0 && v1.dz == 0.0) ||
+			   (v2.dx == 0.0 && v2.dy == 0.0 && v2.dz == 0.0))
 			{
 				normal = Vector3(0,0,1);
-			} 
+			}
 			else
-				normal.normalize();
+			{
+				v1.normalize();
+				v2.normalize();
+				normal = v1.cross(v2);
+				if(normal.dz <= 0.0)
+				{
+					normal = Vector3(0,0,1);
+				}
+				else
+					normal.normalize();
+			}
+
+			fn[f*3  ] = normal.dx;
+			fn[f*3+1] = normal.dy;
+			fn[f*3+2] = normal.dz;
 		}
+	});
 
-		f->info().normal[0] = normal.dx;
-		f->info().normal[1] = normal.dy;
-		f->info().normal[2] = normal.dz;		
-	}
+	parallel_for(0, nf, 4096, [&](int f, int) {
+		MeshFaceInfo& fi(inSnap.faces[f]->info());
+		fi.normal[0] = fn[f*3  ];
+		fi.normal[1] = fn[f*3+1];
+		fi.normal[2] = fn[f*3+2];
+	});
 
-	for (CDT::Finite_vertices_iterator i = ioMesh.finite_vertices_begin(); i != ioMesh.finite_vertices_end(); ++i)
-	{
+	parallel_for(0, nv, 4096, [&](int i, int) {
 		Vector3	total(0.0, 0.0, 0.0);
-		CDT::Face_circulator circ, stop;
-		circ = stop = ioMesh.incident_faces(i);
+		for(int n = inSnap.vert_face_start[i]; n < inSnap.vert_face_start[i+1]; ++n)
+		{
+			const float * nrml = &fn[inSnap.vert_faces[n] * 3];
+			total.dx += nrml[0];
+			total.dy += nrml[1];
+			total.dz += nrml[2];
+		}
 
-		do {
-			if(!ioMesh.is_infinite(circ))
-			{
-				total.dx += circ->info().normal[0];
-				total.dy += circ->info().normal[1];
-				total.dz += circ->info().normal[2];
-			}
-		} while (++circ != stop);
-		
-        DebugAssert(total.dx != 0.0 || total.dy != 0.0 || total.dz != 0.0);
-        DebugAssert(total.dz > 0.0);
-        total.normalize();
-        i->info().normal[0] = total.dx;
-        i->info().normal[1] = total.dy;
-        i->info().normal[2] = total.dz;
-	}
+		DebugAssert(total.dx != 0.0 || total.dy != 0.0 || total.dz != 0.0);
+		DebugAssert(total.dz > 0.0);
+		total.normalize();
+		MeshVertexInfo& vi(inSnap.verts[i]->info());
+		vi.normal[0] = total.dx;
+		vi.normal[1] = total.dy;
+		vi.normal[2] = total.dz;
+	});
+}
+
+void CalculateMeshNormals(CDT& ioMesh)
+{
+	MeshSnapshot	snap;
+	SnapshotMesh(ioMesh, snap);
+	CalculateMeshNormals(snap);
 }
 
 /*******************************************************************************************
@@ -1698,10 +1802,11 @@ void CalculateMeshNormals(CDT& ioMesh)
  *******************************************************************************************/
 
 
-double dist_from_line(const Point_2& p, const Point_2& q, const Point_2& r)
+double dist_from_line(const Point2& p, const Point2& q, const Point2& r)
 {
-	Line_2 l(p,r);
-	return CGAL::to_double(CGAL::squared_distance(l,q));
+	if(p == r)
+		return q.squared_distance(p);
+	return Segment2(p,r).squared_distance_supporting_line(q);
 }
 
 
@@ -1710,6 +1815,7 @@ double dist_from_line(const Point_2& p, const Point_2& q, const Point_2& r)
 
 void	TriangulateMesh(Pmwx& inMap, CDT& outMesh, DEMGeoMap& inDEMs, const char * mesh_folder, ProgressFunc prog)
 {
+	StPerfScope	profile("TriangulateMesh");
 	DEMGeo& sdf = inDEMs[dem_Wizard];
 	sdf.resize(1200,1200);
 	sdf.copy_geo_from(inDEMs[dem_Elevation]);
@@ -1841,7 +1947,13 @@ void	TriangulateMesh(Pmwx& inMap, CDT& outMesh, DEMGeoMap& inDEMs, const char *
 		printf("Before simplify: %zd/%zd\n",outMesh.number_of_vertices(),outMesh.number_of_faces());
 //		RF_Notifiable::Notify(rf_Cat_File, rf_Msg_TriangleHiChange, NULL); 
 		MeshSimplify	simplify_me(outMesh, dist_from_line);
-		simplify_me.simplify(0.0001 * 0.0001);
+		simplify_me.simplify(0.0001 * 0.0001, gMeshPrefs.simplify_mode);
+		for(int r = 0; r < simplify_me.rounds().size(); ++r)
+		{
+			const MeshSimplifyRound& rs(simplify_me.rounds()[r]);
+			printf("  Round %d: %d evaluated, %d candidates, %d picked, %d removed (%.3lf sec)\n",
+				r, rs.evaluated, rs.candidates, rs.selected, rs.removed, rs.seconds);
+		}
 		printf("After simplify: %zd/%zd\n",outMesh.number_of_vertices(),outMesh.number_of_faces());
 	}
 
@@ -2093,7 +2205,9 @@ void	TriangulateMesh(Pmwx& inMap, CDT& outMesh, DEMGeoMap& inDEMs, const char *
 
 #endif
 
-	FlattenWater(outMesh, inDEMs[dem_Water_Surface]);
+	MeshSnapshot	snap;
+	SnapshotMesh(outMesh, snap);
+	FlattenWater(outMesh, snap, inDEMs[dem_Water_Surface]);
 
 	/*********************************************************************************************************************
 	 * CLEANUP - CALC MESH NORMALS
@@ -2101,10 +2215,13 @@ void	TriangulateMesh(Pmwx& inMap, CDT& outMesh, DEMGeoMap& inDEMs, const char *
 
 
 	if (prog) prog(2, 3, "Calculating Wet Areas", 0.5);
-	CalculateMeshNormals(outMesh);
+	CalculateMeshNormals(snap);
 
 	if (prog) prog(2, 3, "Calculating Wet Areas", 1.0);
 
+	perf_count("mesh vertices", outMesh.number_of_vertices());
+	perf_count("mesh faces", outMesh.number_of_faces());
+
 //	orig.swap(water);
 }
 
@@ -2123,7 +2240,9 @@ void	TriangulateMesh(Pmwx& inMap, CDT& outMesh, DEMGeoMap& inDEMs, const char *
 		on all but water through the spreadsheet.
 */
 
-float enum_sample_tri(DEMGeo& d, double x0, double y0, double x1, double y1, double x2, double y2, double center_x, double center_y)
+// DEM is a DEMGeo or a DEMPacked.
+template <class DEM>
+static float enum_sample_tri(const DEM& d, double x0, double y0, double x1, double y1, double x2, double y2, double center_x, double center_y)
 {
 /*
 	float lu0  = d.search_nearest(center_x, center_y);
@@ -2198,7 +2317,8 @@ void	AssignLandusesToMesh(	DEMGeoMap& inDEMs,
 								const char * mesh_folder,
 								ProgressFunc	inProg)
 {
-
+	StPerfScope	profile("AssignLandusesToMesh");
+	int			faces_classified = 0;
 
 		CDT::Finite_faces_iterator tri;
 		CDT::Finite_vertices_iterator vert;
@@ -2208,9 +2328,6 @@ void	AssignLandusesToMesh(	DEMGeoMap& inDEMs,
 	if (inProg) inProg(0, 1, "Assigning Landuses", 0.0);
 
 //	DEMGeo&	inClimate(inDEMs[dem_Clima0te]);
-	DEMGeo&	inClimStyle(inDEMs[dem_ClimStyle]);
-	DEMGeo&	inAgriStyle(inDEMs[dem_AgriStyle]);
-	DEMGeo&	inSoilStyle(inDEMs[dem_SoilStyle]);
 	DEMGeo&	inElevation(inDEMs[dem_Elevation]);
 	DEMGeo&	inSlope(inDEMs[dem_Slope]);
 	DEMGeo&	inSlopeHeading(inDEMs[dem_SlopeHeading]);
@@ -2222,25 +2339,36 @@ void	AssignLandusesToMesh(	DEMGeoMap& inDEMs,
 	DEMGeo& inUrbanDensity(inDEMs[dem_UrbanDensity]);
 	DEMGeo& inUrbanRadial(inDEMs[dem_UrbanRadial]);
 	DEMGeo& inUrbanTransport(inDEMs[dem_UrbanTransport]);
-	DEMGeo& usquare(inDEMs[dem_UrbanSquare]);
 
-	DEMGeo	landuse(inDEMs[dem_LandUse]);
+	// The enum layers are only sampled from here on, a few times per triangle - sample packed copies (uint8 or uint16
+	// for the usual enum counts) so far more of each layer stays in cache.  A layer that holds non-integral values
+	// packs as float and samples exactly as before.
+	DEMPacked	inClimStyle, inAgriStyle, inSoilStyle, usquare, landuse;
+	inClimStyle.pack(inDEMs[dem_ClimStyle], DEMGeo_MinimalStorage(inDEMs[dem_ClimStyle]));
+	inAgriStyle.pack(inDEMs[dem_AgriStyle], DEMGeo_MinimalStorage(inDEMs[dem_AgriStyle]));
+	inSoilStyle.pack(inDEMs[dem_SoilStyle], DEMGeo_MinimalStorage(inDEMs[dem_SoilStyle]));
+	usquare.pack(inDEMs[dem_UrbanSquare], DEMGeo_MinimalStorage(inDEMs[dem_UrbanSquare]));
 
-// BEN SEZ: do NOT overwrite interrupted and other such areas with nearest landuse - that causes problems.
-	for (int y = 0; y < landuse.mHeight;++y)
-	for (int x = 0; x < landuse.mWidth; ++x)
 	{
-		float e = landuse(x,y);
-		if (e == NO_VALUE ||
-//			e == lu_usgs_INTERRUPTED_AREAS ||
-//			e == lu_usgs_URBAN_SQUARE ||
-//			e == lu_usgs_URBAN_IRREGULAR ||
-			e == lu_globcover_WATER)
-//			e == lu_usgs_SEA_WATER)
-//			e == lu_usgs_DEM_NO_DATA)
-			landuse(x,y) = DEM_NO_DATA;
+		DEMGeo	lu_filled(inDEMs[dem_LandUse]);
+
+	// BEN SEZ: do NOT overwrite interrupted and other such areas with nearest landuse - that causes problems.
+		for (int y = 0; y < lu_filled.mHeight;++y)
+		for (int x = 0; x < lu_filled.mWidth; ++x)
+		{
+			float e = lu_filled(x,y);
+			if (e == NO_VALUE ||
+//				e == lu_usgs_INTERRUPTED_AREAS ||
+//				e == lu_usgs_URBAN_SQUARE ||
+//				e == lu_usgs_URBAN_IRREGULAR ||
+				e == lu_globcover_WATER)
+//				e == lu_usgs_SEA_WATER)
+//				e == lu_usgs_DEM_NO_DATA)
+				lu_filled(x,y) = DEM_NO_DATA;
+		}
+		lu_filled.fill_nearest();
+		landuse.pack(lu_filled, DEMGeo_MinimalStorage(lu_filled));
 	}
-	landuse.fill_nearest();
 
 	/***********************************************************************************************
 	 * ASSIGN BASIC LAND USES TO MESH
@@ -2416,12 +2544,14 @@ void	AssignLandusesToMesh(	DEMGeoMap& inDEMs,
 				//fprintf(stderr, "->%d", terrain);
 
 				tri->info().terrain = terrain;
+				++faces_classified;
 
 			}
 
 		}
 	}
-	
+	perf_count("mesh faces classified", faces_classified);
+
 	/***********************************************************************************************
 	 * ASSIGN BASIC LAND USES TO MESH
 	 ***********************************************************************************************/
@@ -3039,52 +3169,8 @@ void	CreateWaterSDF(const Pmwx& inMap, DEMGeo& ioDem)
 		rasterizer.AdvanceScanline(y);
 	}
 
-	//https://mshgrid.com/2021/02/04/the-fast-sweeping-algorithm/
-	int width = ioDem.mWidth;
-	int height = ioDem.mHeight;
-
-	const int NSweeps = 4;
-    // sweep directions { start, end, step }
-    const int dirX[NSweeps][3] = { {0, width - 1, 1} , {width - 1, 0, -1}, {width - 1, 0, -1}, {0, width - 1, 1} };
-    const int dirY[NSweeps][3] = { {0, height - 1, 1}, {0, height - 1, 1}, {height - 1, 0, -1}, {height - 1, 0, -1} };
-
-	float aa[2];
-    double d_new, a, b;
-    int s, ix, iy;
-    const double h = 1.0, f = 1.0;
-	
-    for (int s = 0; s < NSweeps; s++)
-    {
-        for (int iy = dirY[s][0]; dirY[s][2] * iy <= dirY[s][1]; iy += dirY[s][2])
-        {
-            for (int ix = dirX[s][0]; dirX[s][2] * ix <= dirX[s][1]; ix += dirX[s][2])
-            {
-				float v = ioDem.get(ix, iy);
-				if(v > 0.0)
-				{
-					if (iy == 0)
-						aa[1] = min(v,ioDem.get(ix,iy+1));
-					else if (iy == (height - 1))
-						aa[1] = min(v, ioDem.get(ix,iy-1));
-					else
-						aa[1] = min(ioDem.get(ix,iy-1),ioDem.get(ix,iy+1));
-				 
-					if (ix == 0)
-						aa[0] = min(v,ioDem.get(ix+1,iy));
-					else if (ix == (width - 1))
-						aa[0] = min(v,ioDem.get(ix-1,iy));
-					else
-						aa[0] = min(ioDem.get(ix-1,iy), ioDem.get(ix+1,iy));
- 
-					a = aa[0]; b = aa[1];
-					d_new = (fabs(a - b) < f * h ? (a + b + sqrt(2.0 * f * f * h * h - (a - b) * (a - b))) * 0.5 : std::fminf(a, b) + f * h);
-
-					if(d_new < v)
-						ioDem.set(ix,iy,d_new);
-                }
-            }
-        }
-    }
+	// Water posts get their distance (in posts) to the nearest land post.
+	CalcDistanceField(ioDem, false);
 }
 
 
@@ -3190,133 +3276,504 @@ double	MeshHeightAtPoint(CDT& inMesh, double inLon, double inLat, int hint_id)
 	}
 }
 
-int	CalcMeshError(CDT& mesh, DEMGeo& elev, float& out_min, float& out_max, float& out_ave, float& std_dev, ProgressFunc inFunc)
+/************************************************************************************************************************
+ * BATCHED DRAPING
+ ************************************************************************************************************************
+
+	MeshHeightAtPoint is fine for a handful of queries, but draping millions of points one at a time is dominated by
+	the locate: CGAL walks from the last hint, and with poor locality that walk crosses a good part of the mesh.
+
+	The batched path fixes this three ways:
+	1. Points are sorted along a Morton (Z-order) curve first, so consecutive queries are close together.
+	2. A uniform grid over the mesh keeps one face per cell, so the first query of a run (or after a jump in the
+	   curve) starts a cell away from its answer, not a tile away.
+	3. The walk itself is a plain visibility walk over a MeshSnapshot.  CDT::locate keeps a random generator inside
+	   the triangulation and every orientation test reads lazy exact coordinates, so neither can be run from
+	   several threads.  The snapshot is all doubles, so blocks of the sorted batch are draped in parallel.  Points
+	   where the walk runs off the hull or fails to converge (possible in principle in a constrained, non-Delaunay
+	   region) are collected and located with CGAL afterward, on the calling thread.
+
+ */
+
+MeshFaceGrid::MeshFaceGrid() : mWest(0.0), mSouth(0.0), mCellW(1.0), mCellH(1.0), mX(0), mY(0)
 {
-	if (inFunc) inFunc(0, 1, "Calculating Error", 0.0);
-	int ctr = 0;
-	
-	out_max = 0.0;
-	out_ave = 0.0;
-	std_dev = 0.0;
-	out_min = 9.9e9;
-	
-	CDT::Face_handle	last_tri;
-	Plane3				last_plane;
-	Point2				last_tri_loc[3];
-	double				DEG_TO_NM_LON = DEG_TO_NM_LAT;
-
-	float				worst_pos = 0.0;
-	float				worst_neg = 0.0;
-	Point2				worst_pos_p;
-	Point2				worst_neg_p;
-	
-	if(mesh.number_of_faces() >= 1)
-	for (int y = 0; y < elev.mHeight; ++y)
+}
+
+void	MeshFaceGrid::build(const MeshSnapshot& inSnap, int inFacesPerCell)
+{
+	mCells.clear();
+	mX = mY = 0;
+	int nf = inSnap.faces.size();
+	if (nf < 1) return;
+
+	double	west = 9.9e9, south = 9.9e9, east = -9.9e9, north = -9.9e9;
+	for (int v = 0; v < inSnap.x.size(); ++v)
+	{
+		west  = min(west, inSnap.x[v]);	east  = max(east, inSnap.x[v]);
+		south = min(south, inSnap.y[v]);	north = max(north, inSnap.y[v]);
+	}
+	if (east <= west || north <= south) return;
+
+	int side = max(1, (int) sqrt((double) nf / (double) max(1, inFacesPerCell)));
+	mX = mY = side;
+	mWest = west;
+	mSouth = south;
+	mCellW = (east - west) / (double) mX;
+	mCellH = (north - south) / (double) mY;
+	mCells.resize(mX * mY, -1);
+
+	// Keep the face whose centroid is closest to each cell's center...
+	vector<double>	best(mX * mY, 9.9e9);
+	for (int f = 0; f < nf; ++f)
+	{
+		const int * fv = &inSnap.face_verts[f*3];
+		double cx = (inSnap.x[fv[0]] + inSnap.x[fv[1]] + inSnap.x[fv[2]]) / 3.0;
+		double cy = (inSnap.y[fv[0]] + inSnap.y[fv[1]] + inSnap.y[fv[2]]) / 3.0;
+		int c = cell_of(cx, cy);
+		double dx = (cx - mWest) / mCellW - (double) (c % mX) - 0.5;
+		double dy = (cy - mSouth) / mCellH - (double) (c / mX) - 0.5;
+		double d = dx * dx + dy * dy;
+		if (d < best[c])
+		{
+			best[c] = d;
+			mCells[c] = f;
+		}
+	}
+
+	// ...and let cells with no face of their own (big triangles) borrow a neighbor's.
+	for (int y = 0; y < mY; ++y)
+	{
+		for (int x = 1; x < mX; ++x)
+		if (mCells[y * mX + x] == -1)
+			mCells[y * mX + x] = mCells[y * mX + x - 1];
+		for (int x = mX - 2; x >= 0; --x)
+		if (mCells[y * mX + x] == -1)
+			mCells[y * mX + x] = mCells[y * mX + x + 1];
+	}
+	for (int x = 0; x < mX; ++x)
 	{
-		if (inFunc && (y % 20) == 0) inFunc(0, 1, "Calculating Error", (float) y / (float) elev.mHeight);
+		for (int y = 1; y < mY; ++y)
+		if (mCells[y * mX + x] == -1)
+			mCells[y * mX + x] = mCells[(y - 1) * mX + x];
+		for (int y = mY - 2; y >= 0; --y)
+		if (mCells[y * mX + x] == -1)
+			mCells[y * mX + x] = mCells[(y + 1) * mX + x];
+	}
+}
 
-		for (int x = 0; x < elev.mWidth ; ++x)
+int		MeshFaceGrid::cell_of(double inLon, double inLat) const
+{
+	int x = max(0, min(mX - 1, (int) floor((inLon - mWest) / mCellW)));
+	int y = max(0, min(mY - 1, (int) floor((inLat - mSouth) / mCellH)));
+	return y * mX + x;
+}
+
+int		MeshFaceGrid::start_face(double inLon, double inLat) const
+{
+	if (mCells.empty()) return -1;
+	return mCells[cell_of(inLon, inLat)];
+}
+
+int		MeshSnapshotLocate(const MeshSnapshot& inSnap, const MeshFaceGrid * inGrid, int hint, double inLon, double inLat)
+{
+	int nf = inSnap.faces.size();
+	if (nf < 1) return -1;
+	if (hint < 0 && inGrid)
+		hint = inGrid->start_face(inLon, inLat);
+	if (hint < 0)
+		hint = 0;
+
+	// Visibility walk toward p.  Rotating the first edge we try breaks the cycles a fixed order can fall into.
+	int f = hint;
+	int came_from = -1;
+	int limit = nf + 16;
+	for (int step = 0; step < limit; ++step)
+	{
+		const int * fv = &inSnap.face_verts[f*3];
+		int next = -1;
+		for (int j = 0, i = step % 3; j < 3; ++j, i = (i + 1) % 3)
+		if (i != came_from)
 		{
-			float ideal = elev.get(x,y);
-			if (ideal != DEM_NO_DATA)
+			int a = fv[CDT::ccw(i)], b = fv[CDT::cw(i)];
+			double side = (inSnap.x[b] - inSnap.x[a]) * (inLat - inSnap.y[a]) - (inSnap.y[b] - inSnap.y[a]) * (inLon - inSnap.x[a]);
+			if (side < 0.0)
 			{
-				Point2	ll(elev.x_to_lon(x), elev.y_to_lat(y));
-				if(last_tri == CDT::Face_handle() ||
-				   Segment2(last_tri_loc[0],last_tri_loc[1]).on_right_side(ll) ||
-				   Segment2(last_tri_loc[1],last_tri_loc[2]).on_right_side(ll) ||
-				   Segment2(last_tri_loc[2],last_tri_loc[0]).on_right_side(ll))
-				{
+				next = i;
+				break;
+			}
+		}
+		if (next == -1)
+			return f;
 
-					CDT::Face_handle	f = CDT::Face_handle();
-					int	n;
-					CDT::Locate_type lt;
-					f = mesh.locate(CDT::Point(ll.x(), ll.y()), lt, n, last_tri);
-					if (lt == CDT::EDGE && mesh.is_infinite(f))
-					{
-						f = f->neighbor(n);
-					}
-					
-					if(!mesh.is_infinite(f))
-					{
-						last_tri = f;
+		int n = inSnap.face_nbrs[f*3+next];
+		if (n == -1)
+			return -1;
+		const int * nv = &inSnap.face_nbrs[n*3];
+		came_from = (nv[0] == f) ? 0 : ((nv[1] == f) ? 1 : 2);
+		f = n;
+	}
+	return -1;
+}
 
-						last_tri_loc[0] = cgal2ben(f->vertex(0)->point());
-						last_tri_loc[1] = cgal2ben(f->vertex(1)->point());
-						last_tri_loc[2] = cgal2ben(f->vertex(2)->point());
-						
+CDT::Face_handle	MeshLocateFace(CDT& inMesh, CDT::Face_handle hint, double inLon, double inLat)
+{
+	if (inMesh.number_of_faces() < 1) return CDT::Face_handle();
+	CDT::Point	p(inLon, inLat);
 
-						DEG_TO_NM_LON = DEG_TO_NM_LAT * cos(CGAL::to_double(ll.y()) * DEG_TO_RAD);
+	CDT::Locate_type	lt;
+	int					n;
+	CDT::Face_handle	f = inMesh.locate(p, lt, n, hint);
+	if (lt == CDT::VERTEX && inMesh.is_infinite(f))
+	{
+		CDT::Face_circulator circ, stop;
+		circ = stop = inMesh.incident_faces(f->vertex(n));
+		do {
+			if (!inMesh.is_infinite(circ))
+				return circ;
+		} while (++circ != stop);
+	}
+	if (lt == CDT::EDGE && inMesh.is_infinite(f))
+		f = f->neighbor(n);
+	return inMesh.is_infinite(f) ? CDT::Face_handle() : f;
+}
 
-						Point3	p1((last_tri_loc[0].x()),// * (DEG_TO_NM_LON * NM_TO_MTR)),
-								   (last_tri_loc[0].y()),// * (DEG_TO_NM_LAT * NM_TO_MTR)),
-								   (last_tri->vertex(0)->info().height));
+// Spread the low 16 bits of v out to the even bits.
+inline unsigned int	morton_spread(unsigned int v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
 
-						Point3	p2((last_tri_loc[1].x()),// * (DEG_TO_NM_LON * NM_TO_MTR)),
-								   (last_tri_loc[1].y()),// * (DEG_TO_NM_LAT * NM_TO_MTR)),
-								   (last_tri->vertex(1)->info().height));
+void	MeshHeightAtPoints(CDT& inMesh, const MeshSnapshot& inSnap, const MeshFaceGrid * inGrid, int inCount, const Point2 * inPts,
+							double * outHeights, Vector3 * outNormals, CDT::Face_handle * outFaces)
+{
+	if (inCount < 1) return;
 
-						Point3	p3((last_tri_loc[2].x()),// * (DEG_TO_NM_LON * NM_TO_MTR)),
-								   (last_tri_loc[2].y()),// * (DEG_TO_NM_LAT * NM_TO_MTR)),
-								   (last_tri->vertex(2)->info().height));
+	Bbox2	bounds(inPts[0]);
+	for (int i = 1; i < inCount; ++i)
+		bounds += inPts[i];
+	double	sx = bounds.xspan() > 0.0 ? 65535.0 / bounds.xspan() : 0.0;
+	double	sy = bounds.yspan() > 0.0 ? 65535.0 / bounds.yspan() : 0.0;
 
-						Vector3	s1(p2, p3);
-						Vector3	s2(p2, p1);
-						Vector3	n = s1.cross(s2);
-						n.normalize();
-						last_plane = Plane3(p1,n);
-					}
+	vector<pair<unsigned int, int> >	order(inCount);
+	for (int i = 0; i < inCount; ++i)
+	{
+		unsigned int qx = (inPts[i].x() - bounds.xmin()) * sx;
+		unsigned int qy = (inPts[i].y() - bounds.ymin()) * sy;
+		order[i] = pair<unsigned int, int>(morton_spread(qx) | (morton_spread(qy) << 1), i);
+	}
+	sort(order.begin(), order.end());
+
+	// Blocks remember the points the snapshot walk couldn't place; each block's list is in sorted order.
+	int									blocks = (inCount + 4095) / 4096;
+	vector<vector<int> >				missed(blocks);
+
+	parallel_for_blocks(0, inCount, 4096, [&](int lo, int hi, int) {
+		int					f = -1;
+		int					last_cell = -1;
+		for (int k = lo; k < hi; ++k)
+		{
+			int				i = order[k].second;
+			const Point2&	p = inPts[i];
+
+			// Within a grid cell the last face is the closest start; crossing into a new cell, the cell's own face is.
+			if (inGrid && !inGrid->empty())
+			{
+				int c = inGrid->cell_of(p.x(), p.y());
+				if (c != last_cell)
+				{
+					f = inGrid->start_face(p.x(), p.y());
+					last_cell = c;
 				}
-				
-				if(last_tri != CDT::Face_handle())
+			}
+
+			int hit = MeshSnapshotLocate(inSnap, inGrid, f, p.x(), p.y());
+			if (hit == -1)
+			{
+				missed[lo / 4096].push_back(i);
+				continue;
+			}
+			f = hit;
+
+			if (outFaces)
+				outFaces[i] = inSnap.faces[hit];
+
+			const int *	fv = &inSnap.face_verts[hit*3];
+			double	DEG_TO_NM_LON = DEG_TO_NM_LAT * cos(p.y() * DEG_TO_RAD);
+			Point3	c[3];
+			for (int v = 0; v < 3; ++v)
+				c[v] = Point3(inSnap.x[fv[v]] * (DEG_TO_NM_LON * NM_TO_MTR),
+							  inSnap.y[fv[v]] * (DEG_TO_NM_LAT * NM_TO_MTR),
+							  inSnap.z[fv[v]]);
+
+			if (outHeights)
+			{
+				int v;
+				for (v = 0; v < 3; ++v)
+				if (inSnap.x[fv[v]] == p.x() && inSnap.y[fv[v]] == p.y())
+					break;
+				if (v < 3)
+					outHeights[i] = inSnap.z[fv[v]];
+				else
 				{
-					double real = (last_plane.n.dx * ll.x() +
-								   last_plane.n.dy * ll.y() -
-								   last_plane.ndotp) / -last_plane.n.dz;
-					
-					double	close = last_plane.distance_denormaled(Point3(ll.x(),ll.y(),ideal));
-					float derr = real - ideal;
-					derr = close;
+					// Same plane as HeightWithinTri, in doubles.
+					Vector3	n = Vector3(c[1], c[2]).cross(Vector3(c[1], c[0]));
+					outHeights[i] = c[0].z - (n.dx * (p.x() * (DEG_TO_NM_LON * NM_TO_MTR) - c[0].x) +
+											   n.dy * (p.y() * (DEG_TO_NM_LAT * NM_TO_MTR) - c[0].y)) / n.dz;
+				}
+			}
 
-					Point2	me(elev.x_to_lon(x), elev.y_to_lat(y));
-					if(derr > worst_pos)
-					{
-						worst_pos = derr;
-						worst_pos_p = me;
-					}
-					if(derr < worst_neg)
+			if (outNormals)
+			{
+				Vector3	n = Vector3(c[0], c[1]).cross(Vector3(c[0], c[2]));
+				n.normalize();
+				outNormals[i] = n;
+			}
+		}
+	});
+
+	// Whatever the walk gave up on goes through CGAL here, on this thread - it is off the hull or rare.
+	CDT::Face_handle	f;
+	for (int b = 0; b < blocks; ++b)
+	for (int k = 0; k < missed[b].size(); ++k)
+	{
+		int				i = missed[b][k];
+		const Point2&	p = inPts[i];
+
+		CDT::Face_handle hit = MeshLocateFace(inMesh, f, p.x(), p.y());
+		if (hit != CDT::Face_handle())
+			f = hit;
+
+		if (outFaces)
+			outFaces[i] = hit;
+
+		if (hit == CDT::Face_handle())
+		{
+			if (outHeights) outHeights[i] = DEM_NO_DATA;
+			if (outNormals) outNormals[i] = Vector3(0.0, 0.0, 1.0);
+			continue;
+		}
+
+		CDT::Point	cp(p.x(), p.y());
+		if (outHeights)
+		{
+			int v;
+			for (v = 0; v < 3; ++v)
+			if (hit->vertex(v)->point() == cp)
+				break;
+			outHeights[i] = (v < 3) ? hit->vertex(v)->info().height : HeightWithinTri(inMesh, hit, cp);
+		}
+
+		if (outNormals)
+		{
+			double	DEG_TO_NM_LON = DEG_TO_NM_LAT * cos(p.y() * DEG_TO_RAD);
+			Point3	c[3];
+			for (int v = 0; v < 3; ++v)
+				c[v] = Point3(CGAL::to_double(hit->vertex(v)->point().x()) * (DEG_TO_NM_LON * NM_TO_MTR),
+							  CGAL::to_double(hit->vertex(v)->point().y()) * (DEG_TO_NM_LAT * NM_TO_MTR),
+							  hit->vertex(v)->info().height);
+			Vector3	n = Vector3(c[0], c[1]).cross(Vector3(c[0], c[2]));
+			n.normalize();
+			outNormals[i] = n;
+		}
+	}
+}
+
+// Running error statistics for one band of DEM rows.  Mean and sum of squared deviations are kept with
+// Welford's update and bands are combined with Chan's pairwise merge, so the totals don't depend on how
+// the rows were split up (and don't lose precision over tens of millions of posts like a float sum did).
+struct	mesh_err_stats_t {
+	mesh_err_stats_t() : count(0), mean(0.0), m2(0.0), lo(9.9e9), hi(0.0), worst_pos(0.0), worst_neg(0.0) { }
+
+	int		count;
+	double	mean;
+	double	m2;
+	float	lo;
+	float	hi;
+	float	worst_pos;
+	float	worst_neg;
+	Point2	worst_pos_p;
+	Point2	worst_neg_p;
+
+	void	add(float e, const Point2& where)
+	{
+		++count;
+		double d = e - mean;
+		mean += d / (double) count;
+		m2 += d * (e - mean);
+		lo = min(lo, e);
+		hi = max(hi, e);
+		if (e > worst_pos) { worst_pos = e; worst_pos_p = where; }
+		if (e < worst_neg) { worst_neg = e; worst_neg_p = where; }
+	}
+
+	// Merge a band that comes AFTER us in row order - ties keep the earlier worst point, like a serial scan.
+	void	merge(const mesh_err_stats_t& o)
+	{
+		if (o.count == 0) return;
+		if (count == 0) { *this = o; return; }
+		int		n = count + o.count;
+		double	d = o.mean - mean;
+		mean += d * (double) o.count / (double) n;
+		m2 += o.m2 + d * d * (double) count * (double) o.count / (double) n;
+		count = n;
+		lo = min(lo, o.lo);
+		hi = max(hi, o.hi);
+		if (o.worst_pos > worst_pos) { worst_pos = o.worst_pos; worst_pos_p = o.worst_pos_p; }
+		if (o.worst_neg < worst_neg) { worst_neg = o.worst_neg; worst_neg_p = o.worst_neg_p; }
+	}
+};
+
+int	CalcMeshError(CDT& mesh, DEMGeo& elev, float& out_min, float& out_max, float& out_ave, float& std_dev, ProgressFunc inFunc, DEMGeo * outErrors)
+{
+	// Errors may go right back into the DEM we measure against - work from a copy so we don't wipe it first.
+	if (outErrors == &elev)
+	{
+		DEMGeo	ideal(elev);
+		return CalcMeshError(mesh, ideal, out_min, out_max, out_ave, std_dev, inFunc, outErrors);
+	}
+
+	if (inFunc) inFunc(0, 1, "Calculating Error", 0.0);
+
+	if (outErrors)
+	{
+		outErrors->mWest = elev.mWest;
+		outErrors->mSouth = elev.mSouth;
+		outErrors->mEast = elev.mEast;
+		outErrors->mNorth = elev.mNorth;
+		outErrors->mPost = elev.mPost;
+		outErrors->resize(elev.mWidth, elev.mHeight);
+		*outErrors = DEM_NO_DATA;
+	}
+
+	// The bands only ever see the snapshot's doubles; the mesh itself is touched on this thread alone.
+	MeshSnapshot		snap;
+	SnapshotMesh(mesh, snap);
+	MeshFaceGrid		grid;
+	grid.build(snap);
+
+	// Rows are cut into fixed bands so that each band's statistics (and which triangle each post lands on)
+	// are the same no matter how many threads run or in what order the bands finish.
+	const int					band_rows = 16;
+	int							bands = (elev.mHeight + band_rows - 1) / band_rows;
+	vector<mesh_err_stats_t>	band_stats(bands);
+	vector<vector<int> >		band_missed(bands);		// x + y * width of posts the snapshot walk gave up on
+	std::atomic<int>			rows_done(0);
+
+	if(mesh.number_of_faces() >= 1)
+	parallel_for_blocks(0, elev.mHeight, band_rows, [&](int y_lo, int y_hi, int worker) {
+
+		mesh_err_stats_t&	stats = band_stats[y_lo / band_rows];
+		int					last_tri = -1;
+		Plane3				last_plane;
+		Point2				last_tri_loc[3];
+
+		for (int y = y_lo; y < y_hi; ++y)
+		{
+			if (inFunc && worker == 0) inFunc(0, 1, "Calculating Error", (float) rows_done / (float) elev.mHeight);
+
+			for (int x = 0; x < elev.mWidth ; ++x)
+			{
+				float ideal = elev.get(x,y);
+				if (ideal != DEM_NO_DATA)
+				{
+					Point2	ll(elev.x_to_lon(x), elev.y_to_lat(y));
+					if(last_tri == -1 ||
+					   Segment2(last_tri_loc[0],last_tri_loc[1]).on_right_side(ll) ||
+					   Segment2(last_tri_loc[1],last_tri_loc[2]).on_right_side(ll) ||
+					   Segment2(last_tri_loc[2],last_tri_loc[0]).on_right_side(ll))
 					{
-						worst_neg = derr;
-						worst_neg_p = me;
+						int	f = MeshSnapshotLocate(snap, &grid, last_tri, ll.x(), ll.y());
+						if(f == -1)
+						{
+							band_missed[y_lo / band_rows].push_back(x + y * elev.mWidth);
+							continue;
+						}
+
+						last_tri = f;
+						Point3	p[3];
+						for(int v = 0; v < 3; ++v)
+						{
+							int sv = snap.face_verts[f*3+v];
+							last_tri_loc[v] = Point2(snap.x[sv], snap.y[sv]);
+							p[v] = Point3(snap.x[sv], snap.y[sv], snap.z[sv]);
+						}
+
+						Vector3	s1(p[1], p[2]);
+						Vector3	s2(p[1], p[0]);
+						Vector3	n = s1.cross(s2);
+						n.normalize();
+						last_plane = Plane3(p[0],n);
 					}
-					
-					out_min = min(out_min,derr);
-					out_max = max(out_max,derr);
-					out_ave += derr;
-					std_dev += (derr*derr);
-					++ctr;
+
+					float derr = last_plane.distance_denormaled(Point3(ll.x(),ll.y(),ideal));
+					stats.add(derr, ll);
+					if (outErrors)
+						(*outErrors)(x,y) = derr;
 				}
 			}
+			++rows_done;
 		}
+	});
+
+	// Posts off the snapshot walk (off the hull, or a walk that didn't converge) get CGAL's locate, here on one
+	// thread and in band order, so the totals still don't depend on the thread count.
+	CDT::Face_handle	hint;
+	for (int b = 0; b < bands; ++b)
+	for (int k = 0; k < band_missed[b].size(); ++k)
+	{
+		int		x = band_missed[b][k] % elev.mWidth;
+		int		y = band_missed[b][k] / elev.mWidth;
+		Point2	ll(elev.x_to_lon(x), elev.y_to_lat(y));
+		CDT::Face_handle	f = MeshLocateFace(mesh, hint, ll.x(), ll.y());
+		if (f == CDT::Face_handle())
+			continue;
+		hint = f;
+
+		Point3	p[3];
+		for(int v = 0; v < 3; ++v)
+		{
+			Point2	loc = cgal2ben(f->vertex(v)->point());
+			p[v] = Point3(loc.x(), loc.y(), f->vertex(v)->info().height);
+		}
+		Vector3	s1(p[1], p[2]);
+		Vector3	s2(p[1], p[0]);
+		Vector3	n = s1.cross(s2);
+		n.normalize();
+
+		float derr = Plane3(p[0],n).distance_denormaled(Point3(ll.x(),ll.y(),elev.get(x,y)));
+		band_stats[b].add(derr, ll);
+		if (outErrors)
+			(*outErrors)(x,y) = derr;
 	}
-	if(worst_pos > 0.0)
+
+	mesh_err_stats_t	total;
+	for (int b = 0; b < bands; ++b)
+		total.merge(band_stats[b]);
+
+	if(total.worst_pos > 0.0)
 	{	
-//		debug_mesh_point(worst_pos_p,1,0,0);
-		printf("Worst positive error is %f meters at %+08.6lf, %+09.7lf\n", worst_pos, worst_pos_p.x(), worst_pos_p.y());
+//		debug_mesh_point(total.worst_pos_p,1,0,0);
+		printf("Worst positive error is %f meters at %+08.6lf, %+09.7lf\n", total.worst_pos, total.worst_pos_p.x(), total.worst_pos_p.y());
 	}	
-	if(worst_neg < 0.0)
-	{
-		printf("Worst negative error is %f meters at %+08.6lf, %+09.7lf\n", worst_neg, worst_neg_p.x(), worst_neg_p.y());	
-//		debug_mesh_point(worst_neg_p,1,0,1);
-	}
-	
-	if(ctr > 0)
+	if(total.worst_neg < 0.0)
 	{
-		out_ave /= (float) ctr;
-		std_dev = sqrt(std_dev / float(ctr));
+		printf("Worst negative error is %f meters at %+08.6lf, %+09.7lf\n", total.worst_neg, total.worst_neg_p.x(), total.worst_neg_p.y());	
+//		debug_mesh_point(total.worst_neg_p,1,0,1);
 	}
 	
+	// As before, max starts at zero and "std dev" is the RMS error, i.e. measured from zero, not from the mean.
+	out_min = total.lo;
+	out_max = total.hi;
+	out_ave = total.count > 0 ? total.mean : 0.0;
+	std_dev = total.count > 0 ? sqrt(total.m2 / (double) total.count + total.mean * total.mean) : 0.0;
+
 	if (inFunc) inFunc(0, 1, "Calculating Error", 1.0);
-	return ctr;
+	return total.count;
 }
 
 int	CalcMeshTextures(CDT& inMesh, map<int, int>& out_lus)
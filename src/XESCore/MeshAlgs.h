@@ -49,6 +49,7 @@ struct	MeshPrefs_t {
 	int		optimize_borders;
 	float	max_tri_size_m;
 	float	rep_switch_m;
+	int		simplify_mode;		// simplify_Serial, simplify_Rounds or simplify_RoundsFast - see MeshSimplify.h
 };
 extern MeshPrefs_t	gMeshPrefs;
 
@@ -64,8 +65,64 @@ void	CreateWaterSDF(const Pmwx& inMap, DEMGeo& ioDem);
 
 double	HeightWithinTri(CDT& inMesh, CDT::Face_handle tri, CDT::Point in);
 double	MeshHeightAtPoint(CDT& inMesh, double inLon, double inLat, int hint_id);
+
+// A flat (structure-of-arrays) copy of the finite part of a mesh, for passes that sweep every vertex or face.
+// Vertices and faces are numbered in finite-iterator order; vertex i's faces are vert_faces[vert_face_start[i]]
+// up to vert_faces[vert_face_start[i+1]], in incident_faces order.  Building it settles every lazy coordinate
+// (single threaded), so the arrays and handles can then be read from any number of threads.  It is stale as
+// soon as the mesh changes.
+struct	MeshSnapshot {
+	vector<CDT::Vertex_handle>	verts;
+	vector<CDT::Face_handle>	faces;
+	vector<double>				x, y, z;			// Per vertex: lon, lat, height
+	vector<int>					face_verts;			// 3 per face
+	vector<int>					face_nbrs;			// 3 per face: the face across from vertex k, -1 off the hull
+	vector<int>					vert_face_start;	// verts.size() + 1
+	vector<int>					vert_faces;
+};
+
+// Batched draping - see MeshAlgs.cpp.  A MeshFaceGrid is a uniform grid over a mesh snapshot where every cell
+// remembers a face (snapshot index) near its center, so a locate can start within a few triangles of its answer.
+// It must be rebuilt along with the snapshot.
+class	MeshFaceGrid {
+public:
+						MeshFaceGrid();
+	void				build(const MeshSnapshot& inSnap, int inFacesPerCell = 4);
+	int					start_face(double inLon, double inLat) const;
+	int					cell_of(double inLon, double inLat) const;
+	bool				empty(void) const { return mCells.empty(); }
+
+private:
+	double				mWest, mSouth, mCellW, mCellH;
+	int					mX, mY;
+	vector<int>			mCells;
+};
+
+// Finds the snapshot face containing a point by walking the snapshot's doubles from hint (or the grid's start
+// face if hint is -1).  Safe to call from several threads.  Returns -1 if the walk runs off the hull or does not
+// converge - the caller should then ask MeshLocateFace.
+int					MeshSnapshotLocate(const MeshSnapshot& inSnap, const MeshFaceGrid * inGrid, int hint, double inLon, double inLat);
+
+// Finds the finite face containing a point with CGAL's exact locate.  Not thread safe - it reads lazy
+// coordinates and the mesh's locate cache.  Returns a null handle if the point is off the mesh.
+CDT::Face_handle	MeshLocateFace(CDT& inMesh, CDT::Face_handle hint, double inLon, double inLat);
+
+// Drapes inCount points (lon/lat) over the mesh.  Heights are DEM_NO_DATA for points off the mesh.  Normals
+// (unit, up-facing, in meters) and faces are optional.  The grid is optional too but is what makes big,
+// scattered batches fast.  inSnap must be a current snapshot of inMesh.  Results match MeshHeightAtPoint to
+// within double rounding.
+void	MeshHeightAtPoints(CDT& inMesh, const MeshSnapshot& inSnap, const MeshFaceGrid * inGrid, int inCount, const Point2 * inPts,
+							double * outHeights, Vector3 * outNormals, CDT::Face_handle * outFaces);
+
+void	SnapshotMesh(CDT& inMesh, MeshSnapshot& outSnap);
+// Face normals into face info and averaged vertex normals into vertex info, from the snapshot's heights.
+void	CalculateMeshNormals(const MeshSnapshot& inSnap);
+void	CalculateMeshNormals(CDT& ioMesh);
+
 void	Calc2ndDerivative(DEMGeo& ioDEM);
-int		CalcMeshError(CDT& mesh, DEMGeo& elev, float& out_min, float& out_max, float& out_ave, float& std_dev, ProgressFunc inFunc);
+// Error of the mesh vs. every post of elev, run in bands of rows on all threads.  If outErrors is passed it
+// gets the signed error of every post (DEM_NO_DATA where there is none), on elev's grid; it may be elev itself.
+int		CalcMeshError(CDT& mesh, DEMGeo& elev, float& out_min, float& out_max, float& out_ave, float& std_dev, ProgressFunc inFunc, DEMGeo * outErrors = NULL);
 int		CalcMeshTextures(CDT& inMesh, map<int, int>& out_lus);
 
 
@@ -26,148 +26,307 @@
 #include "IODefs.h"
 #include "SimpleIO.h"
 #include "XChunkyFileUtils.h"
+#include "ParallelUtils.h"
+
+/*
+	MESH ATOM FORMATS
+
+	The original mesh atom holds two sub-atoms: 'mesh' (the TDS - vertex indices, neighbors and constraints
+	of every face) and 'dat1' (per-vertex and per-face info), each written one int or float at a time.  Numbering
+	the mesh through std::maps and all those tiny reads and writes is what made reloading a tile's mesh slow.
+
+	The flat atom 'msh2' holds the same data as whole arrays (structure-of-arrays, little endian), so each
+	array is one bulk write or read and the TDS can be wired up straight from index arrays - still no
+	re-triangulation, just pointers.  Face arrays are always 3 wide, with -1 in slots a lower-dimension
+	mesh doesn't use.  The atom starts with a version number; readers refuse versions newer than they know.
+
+	We only write the flat atom now, but ReadMesh still reads the old pair if there is no flat atom, so old
+	XES files load fine.
+*/
 
 const int kMeshControlID = 'mesh';
 const int kMeshData1ID = 'dat1';
+const int kMeshFlatID = 'msh2';
+const int kMeshFlatVersion = 1;
+
+template <typename T>
+static void write_flat_array(IOWriter& w, vector<T>& a)
+{
+	if (a.empty()) return;
+	EndianSwapArray(platform_Native, platform_LittleEndian, a.size(), sizeof(T), &a[0]);
+	w.WriteBulk((const char *) &a[0], a.size() * sizeof(T), false);
+}
+
+template <typename T>
+static void read_flat_array(IOReader& r, vector<T>& a, int n)
+{
+	a.resize(n);
+	if (a.empty()) return;
+	r.ReadBulk((char *) &a[0], a.size() * sizeof(T), false);
+	EndianSwapArray(platform_LittleEndian, platform_Native, a.size(), sizeof(T), &a[0]);
+}
 
 void WriteMesh(FILE * fi, CDT& mesh, int inAtomID, ProgressFunc func)
 {
 	StAtomWriter	meshAtom(fi, inAtomID);
 
-	// These maps assign numbers to all entities in the mesh.
-	map<TDS::Vertex_handle, int>	V;
-	map<TDS::Face_handle, int>		F;
-	TDS::Face_iterator				ib;
-	TDS::Vertex_iterator			vit;
-
-	int 							vnum = 0;
-	int								fnum = 0;
+	PROGRESS_START(func, 0, 1, "Writing terrain mesh...")
 
-	int j;
+	// Number everything: the infinite vertex is always vertex 0, the rest in TDS order.
+	vector<TDS::Vertex_handle>			VT;
+	vector<TDS::Face_handle>			FT;
+	hash_map<const void *, int>			V, F;
+
+	VT.reserve(mesh.tds().number_of_vertices());
+	V.reserve(mesh.tds().number_of_vertices());
+	VT.push_back(mesh.infinite_vertex());
+	for (TDS::Vertex_iterator vit = mesh.tds().vertices_begin(); vit != mesh.tds().vertices_end(); ++vit)
+	if (!(&*vit == &*mesh.infinite_vertex()))
+		VT.push_back(vit);
+	for (TDS::Face_iterator ib = mesh.tds().face_iterator_base_begin(); ib != mesh.tds().face_iterator_base_end(); ++ib)
+		FT.push_back(ib);
+	F.reserve(FT.size());
+	for (int i = 0; i < VT.size(); ++i)	V[&*VT[i]] = i;
+	for (int i = 0; i < FT.size(); ++i)	F[&*FT[i]] = i;
+
+	int	nv = VT.size();
+	int	nf = FT.size();
+	int	verts_per_face = (mesh.dimension() == -1 ? 1 :  mesh.dimension() + 1);
+	int	neighbors_per_face = mesh.tds().dimension() + 1;
+
+	PROGRESS_SHOW(func, 0, 1, "Writing terrain mesh...", 1, 4)
+
+	vector<double>			v_xy(nv * 2), v_height(nv), v_wave(nv);
+	vector<float>			v_normal(nv * 3);
+	vector<int>				v_blend_count(nv);
+	vector<int>				f_verts(nf * 3, -1), f_neighbors(nf * 3, -1);
+	vector<unsigned char>	f_constraints(nf);
+	vector<int>				f_feature(nf), f_terrain(nf), f_flag(nf), f_border_count(nf);
+	vector<float>			f_normal(nf * 3);
+
+	// Coordinates are lazy numbers - to_double can evaluate and cache them and touches their ref counts - so they
+	// are read on this thread.  The info and index work below is plain data and fans out.
+	for (int j = 0; j < nv; ++j)
+	{
+		v_xy[j*2  ] = CGAL::to_double(VT[j]->point().x());
+		v_xy[j*2+1] = CGAL::to_double(VT[j]->point().y());
+	}
 
-	int ctr = 0;
-	int tot = mesh.tds().number_of_vertices() * 2 + mesh.tds().number_of_full_dim_faces() * 4;
-	int step = tot / 150;
+	parallel_for(0, nv, 4096, [&](int j, int) {
+		const MeshVertexInfo& vi(VT[j]->info());
+		v_height[j] = vi.height;
+		v_wave[j] = vi.wave_height;
+		v_normal[j*3  ] = vi.normal[0];
+		v_normal[j*3+1] = vi.normal[1];
+		v_normal[j*3+2] = vi.normal[2];
+		v_blend_count[j] = vi.border_blend.size();
+	});
+
+	parallel_for(0, nf, 4096, [&](int j, int) {
+		TDS::Face_handle f(FT[j]);
+		for (int k = 0; k < verts_per_face; ++k)
+			f_verts[j*3+k] = V.find(&*f->vertex(k))->second;
+		for (int k = 0; k < neighbors_per_face; ++k)
+			f_neighbors[j*3+k] = F.find(&*f->neighbor(k))->second;
+		f_constraints[j] = (f->is_constrained(0) ? 1 : 0) | (f->is_constrained(1) ? 2 : 0) | (f->is_constrained(2) ? 4 : 0);
+		const MeshFaceInfo& fi(f->info());
+		f_feature[j] = fi.feature;
+		f_terrain[j] = fi.terrain;
+		f_flag[j] = fi.flag;
+		f_normal[j*3  ] = fi.normal[0];
+		f_normal[j*3+1] = fi.normal[1];
+		f_normal[j*3+2] = fi.normal[2];
+		f_border_count[j] = fi.terrain_border.size();
+	});
+
+	// The variable-length parts - border blends and terrain borders - are flattened in order.
+	vector<int>		blend_type, border;
+	vector<float>	blend_level;
+	for (int j = 0; j < nv; ++j)
+	for (hash_map<int,float>::iterator bb = VT[j]->info().border_blend.begin(); bb != VT[j]->info().border_blend.end(); ++bb)
+	{
+		blend_type.push_back(bb->first);
+		blend_level.push_back(bb->second);
+	}
+	for (int j = 0; j < nf; ++j)
+		border.insert(border.end(), FT[j]->info().terrain_border.begin(), FT[j]->info().terrain_border.end());
 
-	PROGRESS_START(func, 0, 1, "Writing terrain mesh...")
+	PROGRESS_SHOW(func, 0, 1, "Writing terrain mesh...", 2, 4)
 
 	{
-		// TDS CONTROL ATOM
-		// This atom contains the basic mesh structure.
+		StAtomWriter	flatAtom(fi, kMeshFlatID);
+		FileWriter		writer(fi);
+
+		writer.WriteInt(kMeshFlatVersion);
+		writer.WriteInt(nv);
+		writer.WriteInt(nf);
+		writer.WriteInt(mesh.tds().dimension());
+
+		write_flat_array(writer, v_xy);
+		write_flat_array(writer, v_height);
+		write_flat_array(writer, v_wave);
+		write_flat_array(writer, v_normal);
+		write_flat_array(writer, v_blend_count);
+		writer.WriteInt(blend_type.size());
+		write_flat_array(writer, blend_type);
+		write_flat_array(writer, blend_level);
+
+		write_flat_array(writer, f_verts);
+		write_flat_array(writer, f_neighbors);
+		write_flat_array(writer, f_constraints);
+		write_flat_array(writer, f_feature);
+		write_flat_array(writer, f_terrain);
+		write_flat_array(writer, f_flag);
+		write_flat_array(writer, f_normal);
+		write_flat_array(writer, f_border_count);
+		writer.WriteInt(border.size());
+		write_flat_array(writer, border);
+	}
 
-		StAtomWriter 	mainAtom(fi, kMeshControlID);
-		FileWriter		writer1(fi);
+	PROGRESS_DONE(func, 0, 1, "Writing terrain mesh...")
+}
 
-		// HEADER - number of vertices, number of full DIM faces,
-		// dimension of mesh.
+static void ReadMeshFlat(XAtomContainer& flatContainer, CDT& mesh, const TokenConversionMap& conv, ProgressFunc func)
+{
+	MemFileReader	reader(flatContainer.begin, flatContainer.end);
 
-		writer1.WriteInt(mesh.tds().number_of_vertices());
-		writer1.WriteInt(mesh.tds().number_of_full_dim_faces());
-		writer1.WriteInt(mesh.tds().dimension());
+	int version, n, m, d;	// format version, number of verts, faces, dimension
+	reader.ReadInt(version);
+	if (version < 1 || version > kMeshFlatVersion)
+	{
+		printf("Mesh atom is version %d - this build reads up to version %d.\n", version, kMeshFlatVersion);
+		return;
+	}
+	reader.ReadInt(n);
+	reader.ReadInt(m);
+	reader.ReadInt(d);
 
-		// Write out vertices
-		V[mesh.infinite_vertex()] = vnum++;
+	if (n == 0) return;
 
-		for (vit = mesh.tds().vertices_begin(); vit != mesh.tds().vertices_end(); ++vit, ++ctr)
-		if (!(&*vit == &*mesh.infinite_vertex()))
-		{
-			PROGRESS_CHECK(func, 0, 1, "Writing terrain mesh...", ctr, tot, step)
-			V[vit] = vnum++;
-		}
+	PROGRESS_START(func, 0, 1, "Reading mesh...")
 
-		// Write out faces
-		int dim = (mesh.dimension() == -1 ? 1 :  mesh.dimension() + 1);
-		for(ib = mesh.tds().face_iterator_base_begin(); ib != mesh.tds().face_iterator_base_end(); ++ib, ++ctr)
-		{
-			PROGRESS_CHECK(func, 0, 1, "Writing terrain mesh...", ctr, tot, step)
-			F[ib] = fnum++;
-			for(int j = 0; j < dim ; ++j)
-			{
-				writer1.WriteInt(V[ib->vertex(j)]);
-			}
-		}
+	vector<double>			v_xy, v_height, v_wave;
+	vector<float>			v_normal, blend_level, f_normal;
+	vector<int>				v_blend_count, blend_type, f_verts, f_neighbors, f_feature, f_terrain, f_flag, f_border_count, border;
+	vector<unsigned char>	f_constraints;
+	int						blends, borders;
+
+	read_flat_array(reader, v_xy, n * 2);
+	read_flat_array(reader, v_height, n);
+	read_flat_array(reader, v_wave, n);
+	read_flat_array(reader, v_normal, n * 3);
+	read_flat_array(reader, v_blend_count, n);
+	reader.ReadInt(blends);
+	read_flat_array(reader, blend_type, blends);
+	read_flat_array(reader, blend_level, blends);
+
+	read_flat_array(reader, f_verts, m * 3);
+	read_flat_array(reader, f_neighbors, m * 3);
+	read_flat_array(reader, f_constraints, m);
+	read_flat_array(reader, f_feature, m);
+	read_flat_array(reader, f_terrain, m);
+	read_flat_array(reader, f_flag, m);
+	read_flat_array(reader, f_normal, m * 3);
+	read_flat_array(reader, f_border_count, m);
+	reader.ReadInt(borders);
+	read_flat_array(reader, border, borders);
+
+	PROGRESS_SHOW(func, 0, 1, "Reading mesh...", 1, 4)
+
+	// Creating elements allocates out of the TDS' containers, so that part stays serial.
+	mesh.tds().set_dimension(d);
 
-		// Write out neighbors
-		for(ib = mesh.tds().face_iterator_base_begin(); ib != mesh.tds().face_iterator_base_end(); ++ib, ++ctr)
-		{
-			PROGRESS_CHECK(func, 0, 1, "Writing terrain mesh...", ctr, tot, step)
-			for(j = 0; j < mesh.tds().dimension()+1; ++j)
-				writer1.WriteInt(F[ib->neighbor(j)]);
-		}
+	std::vector<TDS::Vertex_handle > V(n);
+	std::vector<TDS::Face_handle> 	F(m);
+	for (int i = 0; i < n; ++i)
+		V[i] = mesh.tds().create_vertex();
+	for (int i = 0; i < m; ++i)
+		F[i] = mesh.tds().create_face();
 
-		// Write out constraints
-		for(ib = mesh.tds().face_iterator_base_begin(); ib != mesh.tds().face_iterator_base_end(); ++ib, ++ctr)
+	for (int i = 0; i < m; ++i)
+	for (int j = 0; j < 3; ++j)
+	{
+		int v = f_verts[i*3+j];
+		if (v >= 0)
 		{
-			PROGRESS_CHECK(func, 0, 1, "Writing terrain mesh...", ctr, tot, step)
-			for (j = 0; j < 3; ++j)
-				writer1.WriteInt(ib->is_constrained(j) ? 1 : 0);
+			F[i]->set_vertex(j, V[v]);
+			V[v]->set_face(F[i]);
 		}
+		int nb = f_neighbors[i*3+j];
+		if (nb >= 0)
+			F[i]->set_neighbor(j, F[nb]);
+		F[i]->set_constraint(j, (f_constraints[i] >> j) & 1);
 	}
 
-	// Reverse the vertex and face tables...
-	vector<TDS::Vertex_handle>	VT(vnum);
-	vector<TDS::Face_handle>	FT(fnum);
-	for (map<TDS::Vertex_handle, int>::iterator viter = V.begin(); viter != V.end(); ++viter)
-		VT[viter->second] = viter->first;
-	for (map<TDS::Face_handle, int>::iterator fiter = F.begin(); fiter != F.end(); ++fiter)
-		FT[fiter->second] = fiter->first;
+	PROGRESS_SHOW(func, 0, 1, "Reading mesh...", 2, 4)
 
+	// Making the lazy points allocates and ref-counts shared reps, so that is serial too.
+	for (int j = 0; j < n; ++j)
+		V[j]->set_point(CDT::Point(v_xy[j*2], v_xy[j*2+1]));
 
-	{
-		StAtomWriter	data1(fi, kMeshData1ID);
-		FileWriter		writer2(fi);
+	// Per-element info only touches its own element, so it can fan out.  Prefix sums find each element's
+	// slice of the variable-length arrays.
+	vector<int>	blend_start(n + 1, 0), border_start(m + 1, 0);
+	for (int i = 0; i < n; ++i)	blend_start[i+1] = blend_start[i] + v_blend_count[i];
+	for (int i = 0; i < m; ++i)	border_start[i+1] = border_start[i] + f_border_count[i];
 
-		// Write out per-vertex info.
-		for (j = 0; j < vnum; ++j, ++ctr)
-		{
-			PROGRESS_CHECK(func, 0, 1, "Writing terrain mesh...", ctr, tot, step)
-
-			writer2.WriteDouble(CGAL::to_double(VT[j]->point().x()));
-			writer2.WriteDouble(CGAL::to_double(VT[j]->point().y()));
-			writer2.WriteDouble(VT[j]->info().height);
-			writer2.WriteDouble(VT[j]->info().wave_height);
-			writer2.WriteFloat(VT[j]->info().normal[0]);
-			writer2.WriteFloat(VT[j]->info().normal[1]);
-			writer2.WriteFloat(VT[j]->info().normal[2]);
-
-			writer2.WriteInt(VT[j]->info().border_blend.size());
-			for (hash_map<int,float>::iterator bb = VT[j]->info().border_blend.begin();
-				bb != VT[j]->info().border_blend.end(); ++bb)
-			{
-				writer2.WriteInt(bb->first);
-				writer2.WriteFloat(bb->second);
-			}
-		}
-		// Write out per-face info.
-		for (j = 0; j < fnum; ++j, ++ctr)
+	parallel_for(0, n, 4096, [&](int j, int) {
+		MeshVertexInfo	vi;
+		vi.height = v_height[j];
+		vi.wave_height = v_wave[j];
+		vi.normal[0] = v_normal[j*3  ];
+		vi.normal[1] = v_normal[j*3+1];
+		vi.normal[2] = v_normal[j*3+2];
+		for (int b = blend_start[j]; b < blend_start[j+1]; ++b)
+			vi.border_blend[conv[blend_type[b]]] = blend_level[b];
+
+		V[j]->info() = vi;
+	});
+
+	parallel_for(0, m, 4096, [&](int j, int) {
+		MeshFaceInfo	fi;
+		fi.feature = f_feature[j];
+		fi.terrain = f_terrain[j];
+		fi.flag = f_flag[j];
+		fi.normal[0] = f_normal[j*3  ];
+		fi.normal[1] = f_normal[j*3+1];
+		fi.normal[2] = f_normal[j*3+2];
+
+		// Faces on the infinite vertex carry junk feature/terrain - don't run it through the token map.
+		if (F[j]->vertex(0) != V[0] &&
+			F[j]->vertex(1) != V[0] &&
+			F[j]->vertex(2) != V[0])
 		{
-			PROGRESS_CHECK(func, 0, 1, "Writing terrain mesh...", ctr, tot, step)
-
-			writer2.WriteInt(FT[j]->info().feature);
-			writer2.WriteInt(FT[j]->info().terrain);
-			writer2.WriteInt(FT[j]->info().flag);
-			writer2.WriteFloat(FT[j]->info().normal[0]);
-			writer2.WriteFloat(FT[j]->info().normal[1]);
-			writer2.WriteFloat(FT[j]->info().normal[2]);
-			writer2.WriteInt(FT[j]->info().terrain_border.size());
-			for (set<int>::iterator tb = FT[j]->info().terrain_border.begin();
-				tb != FT[j]->info().terrain_border.end(); ++tb)
-			{
-				writer2.WriteInt(*tb);
-			}
+			fi.feature = conv[fi.feature];
+			fi.terrain = conv[fi.terrain];
 		}
-	}
-	PROGRESS_DONE(func, 0, 1, "Writing terrain mesh...")
+
+		for (int b = border_start[j]; b < border_start[j+1]; ++b)
+			fi.terrain_border.insert(conv[border[b]]);
+
+		F[j]->info() = fi;
+	});
+
+  	mesh.set_infinite_vertex(V[0]);
+	PROGRESS_DONE(func, 0, 1, "Reading mesh...")
 }
 
 void ReadMesh(XAtomContainer& container, CDT& mesh, int atomID, const TokenConversionMap& conv, ProgressFunc func)
 {
-	XAtom			meAtom, ctrlAtom, data1Atom;
-	XAtomContainer	meContainer, ctrlContainer, data1Container;
+	XAtom			meAtom, ctrlAtom, data1Atom, flatAtom;
+	XAtomContainer	meContainer, ctrlContainer, data1Container, flatContainer;
 
 	if (!container.GetNthAtomOfID(atomID, 0, meAtom)) return;
 	meAtom.GetContents(meContainer);
 
+	if (meContainer.GetNthAtomOfID(kMeshFlatID, 0, flatAtom))
+	{
+		flatAtom.GetContents(flatContainer);
+		if (mesh.tds().number_of_vertices() != 0)    { mesh.tds().clear(); mesh.cache_reset(); }
+		ReadMeshFlat(flatContainer, mesh, conv, func);
+		return;
+	}
+
 	if (!meContainer.GetNthAtomOfID(kMeshControlID, 0, ctrlAtom)) return;
 	ctrlAtom.GetContents(ctrlContainer);
 
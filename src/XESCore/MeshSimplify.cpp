@@ -24,6 +24,9 @@
 #include "MeshSimplify.h"
 #include "MeshAlgs.h"		// for burn predicate
 #include "MapHelpers.h"
+#include "ParallelUtils.h"
+#include "PerfUtils.h"
+#include <unordered_set>
 
 //#include "GISTool_Globals.h"
 
@@ -44,10 +47,17 @@ MeshSimplify::MeshSimplify(CDT& in_mesh, mesh_error_f in_err) : mesh(in_mesh), e
 {
 }
 
-void MeshSimplify::simplify(double in_max_err)
+void MeshSimplify::simplify(double in_max_err, int mode)
 {
 	max_err = in_max_err;
 	queue.clear();
+	round_stats.clear();
+	cache_orig_pts();
+	if(mode != simplify_Serial)
+	{
+		run_rounds(mode == simplify_Rounds);
+		return;
+	}
 	init_q();
 //	printf("Q: %d vertices.\n", queue.size());
 	
@@ -61,6 +71,17 @@ void MeshSimplify::simplify(double in_max_err)
 	}
 }
 
+// Every original vertex the error walk can reach is on a burned chain, and before anything is removed every
+// vertex on a burned chain is in the mesh - so the mesh's vertices cover them all.
+void MeshSimplify::cache_orig_pts(void)
+{
+	orig_pts.clear();
+	orig_pts.reserve(mesh.number_of_vertices());
+	for(CDT::Finite_vertices_iterator v = mesh.finite_vertices_begin(); v != mesh.finite_vertices_end(); ++v)
+	if(v->info().orig_vertex != Vertex_handle())
+		orig_pts[&*v->info().orig_vertex] = cgal2ben(v->info().orig_vertex->point());
+}
+
 void MeshSimplify::init_q(void)
 {
 	for(CDT::Finite_vertices_iterator q = mesh.finite_vertices_begin(); q != mesh.finite_vertices_end(); ++q)
@@ -105,24 +126,7 @@ void MeshSimplify::run_vertex(CDT::Vertex_handle q)
 	if(can_remove_locked(q,p,r))
 	{
 		//debug_mesh_point(cgal2ben(q->point()),1,1,0);
-		CDT::Edge pq,qr;
-		if(!mesh.is_edge(p,q,pq.first,pq.second))
-		{
-			Assert(!"Where is pq?");
-		}
-		if(!mesh.is_edge(q,r,qr.first,qr.second))
-		{
-			Assert(!"Where is qr?");
-		}
-		DebugAssert(mesh.is_constrained(pq));
-		DebugAssert(mesh.is_constrained(qr));
-		mesh.remove_constrained_edge(pq.first,pq.second);
-		mesh.remove_constrained_edge(qr.first,qr.second);
-		DebugAssert(!mesh.are_there_incident_constraints(q));
-		mesh.remove(q);
-		
-		// DO NOT do this until q is gone!  PQR could be colinear...
-		mesh.insert_constraint(p,r);
+		remove_vertex(p,q,r);
 	}
 	else
 	{
@@ -135,6 +139,150 @@ void MeshSimplify::run_vertex(CDT::Vertex_handle q)
 	}
 }
 
+// Replace the constrained path pqr with pr, removing q from the mesh.
+void MeshSimplify::remove_vertex(CDT::Vertex_handle p, CDT::Vertex_handle q, CDT::Vertex_handle r)
+{
+	CDT::Edge pq,qr;
+	if(!mesh.is_edge(p,q,pq.first,pq.second))
+	{
+		Assert(!"Where is pq?");
+	}
+	if(!mesh.is_edge(q,r,qr.first,qr.second))
+	{
+		Assert(!"Where is qr?");
+	}
+	DebugAssert(mesh.is_constrained(pq));
+	DebugAssert(mesh.is_constrained(qr));
+	mesh.remove_constrained_edge(pq.first,pq.second);
+	mesh.remove_constrained_edge(qr.first,qr.second);
+	DebugAssert(!mesh.are_there_incident_constraints(q));
+	mesh.remove(q);
+	
+	// DO NOT do this until q is gone!  PQR could be colinear...
+	mesh.insert_constraint(p,r);
+}
+
+struct	simplify_cand_t {
+	CDT::Vertex_handle	q;
+	double				err;
+	double				x, y;
+};
+
+struct	sort_cand_by_location {
+	bool operator()(const simplify_cand_t& lhs, const simplify_cand_t& rhs) const {
+		if(lhs.err != rhs.err) return lhs.err < rhs.err;
+		if(lhs.x != rhs.x) return lhs.x < rhs.x;
+		return lhs.y < rhs.y;
+	}
+};
+
+struct	sort_cand_by_address {
+	bool operator()(const simplify_cand_t& lhs, const simplify_cand_t& rhs) const {
+		if(lhs.err != rhs.err) return lhs.err < rhs.err;
+		return &*lhs.q < &*rhs.q;
+	}
+};
+
+void MeshSimplify::run_rounds(bool deterministic)
+{
+	vector<CDT::Vertex_handle>	dirty, next, picked;
+	vector<double>				errs;
+	vector<simplify_cand_t>		cands;
+	unordered_set<const void *>	blocked, removed;
+
+	for(CDT::Finite_vertices_iterator q = mesh.finite_vertices_begin(); q != mesh.finite_vertices_end(); ++q)
+		dirty.push_back(q);
+
+	while(!dirty.empty())
+	{
+		unsigned long long start = query_hpc();
+		MeshSimplifyRound	stats = { (int) dirty.size(), 0, 0, 0, 0.0 };
+
+		// Evaluating a vertex only reads the mesh's connectivity, the original map's connectivity and the cached
+		// original locations, so the whole round goes at once.  The topology test uses exact predicates, which can
+		// cache into the points - that one waits for the serial pass.
+		errs.assign(dirty.size(), max_err);
+		parallel_for(0, dirty.size(), 256, [&](int i, int) {
+			CDT::Vertex_handle p, r;
+			if(can_remove_locked(dirty[i],p,r))
+				errs[i] = calc_remove_error(p,dirty[i],r);
+		});
+
+		cands.clear();
+		for(int i = 0; i < dirty.size(); ++i)
+		if(errs[i] < max_err)
+		{
+			simplify_cand_t c = { dirty[i], errs[i], 0.0, 0.0 };
+			if(deterministic)
+			{
+				c.x = CGAL::to_double(dirty[i]->point().x());
+				c.y = CGAL::to_double(dirty[i]->point().y());
+			}
+			cands.push_back(c);
+		}
+		if(deterministic)
+			sort(cands.begin(), cands.end(), sort_cand_by_location());
+		else
+			sort(cands.begin(), cands.end(), sort_cand_by_address());
+		stats.candidates = cands.size();
+
+		// Cheapest first, take every candidate that isn't next to one we already took - no two picks share a face.
+		// The ones that lose out just wait for the next round.
+		blocked.clear();
+		picked.clear();
+		next.clear();
+		for(vector<simplify_cand_t>::iterator c = cands.begin(); c != cands.end(); ++c)
+		{
+			if(blocked.count(&*c->q))
+			{
+				next.push_back(c->q);
+				continue;
+			}
+			picked.push_back(c->q);
+			blocked.insert(&*c->q);
+			CDT::Vertex_circulator circ, stop;
+			circ = stop = c->q->incident_vertices();
+			do {
+				blocked.insert(&*circ);
+			} while(++circ != stop);
+		}
+		stats.selected = picked.size();
+
+		// Removal re-triangulates, so it is serial.  Inserting pr can flip edges past q's old star, so the locked and
+		// topology tests are redone right before each removal.
+		removed.clear();
+		for(vector<CDT::Vertex_handle>::iterator q = picked.begin(); q != picked.end(); ++q)
+		{
+			CDT::Vertex_handle p, r;
+			if(can_remove_locked(*q,p,r))
+			if(can_remove_topo(p,*q,r))
+			{
+				CDT::Vertex_circulator circ, stop;
+				circ = stop = (*q)->incident_vertices();
+				do {
+					next.push_back(circ);
+				} while(++circ != stop);
+
+				remove_vertex(p,*q,r);
+				removed.insert(&*(*q));
+				++stats.removed;
+			}
+		}
+
+		// Next round: the candidates that were blocked plus the neighbors of everything removed - an earlier removal in
+		// this batch can make a later pick adjacent to something, so drop anything that is gone.
+		dirty.clear();
+		for(vector<CDT::Vertex_handle>::iterator v = next.begin(); v != next.end(); ++v)
+		if(!mesh.is_infinite(*v) && removed.count(&*(*v)) == 0)
+			dirty.push_back(*v);
+		sort(dirty.begin(), dirty.end(), [](const CDT::Vertex_handle& a, const CDT::Vertex_handle& b) { return &*a < &*b; });
+		dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+
+		stats.seconds = hpc_to_microseconds(query_hpc() - start) / 1000000.0;
+		round_stats.push_back(stats);
+	}
+}
+
 void		MeshSimplify::update_q(CDT::Vertex_handle q)
 {
 	bool	want_q = false;
@@ -395,7 +543,7 @@ double MeshSimplify::calc_remove_error(CDT::Vertex_handle p, CDT::Vertex_handle
 	DebugAssert((degree_with_predicate<Pmwx,must_burn_he>(q_orig) == 2));
 	
 	// First: can I pull Q AT ALL?
-	double err = err_f(p_orig->point(),q_orig->point(),r_orig->point());
+	double err = err_f(orig_pt(p_orig),orig_pt(q_orig),orig_pt(r_orig));
 	if(err >= max_err)
 		return err;
 	
@@ -411,7 +559,7 @@ double MeshSimplify::calc_remove_error(CDT::Vertex_handle p, CDT::Vertex_handle
 			while(h->target() != p_orig && h->target() != r_orig)
 			{
 				// If PR as a supporting line fails this point, we're done.
-				err = max(err,err_f(p_orig->point(), h->target()->point(), r_orig->point()));
+				err = max(err,err_f(orig_pt(p_orig), orig_pt(h->target()), orig_pt(r_orig)));
 				if(err >= max_err)
 					return err;
 					
@@ -29,38 +29,76 @@
 	This algorithm simplifies the constraints in a constrained delaunay triangulation.
 
 	The passed in error function measures how far constraints can deviate from their
-	original positions.
+	original positions.  It gets plain doubles: the original map's coordinates are read
+	once, up front and on one thread, so the rounds can evaluate errors on all threads
+	without touching a lazy exact number.
 
 	The constraints are simplified such that not only do no they not cross when done,
 	but no set of constraints will cross a topological boundary to another set.
 
+	There are two ways to run it:
+
+	- Serial: one global queue, always removing the cheapest vertex next and re-queueing
+	  its neighbors.  This is the original algorithm.
+	- Rounds: every vertex that needs (re)evaluating has its error calculated at once on
+	  all threads.  Then the cheapest candidates that share no face with each other are
+	  removed as a batch, and their neighbors are evaluated again next round.  The result
+	  is close to, but not the same as, serial.  With ties in error broken by location it
+	  is the same on any number of threads and from run to run; broken by address it
+	  skips the coordinate reads but is only repeatable with the same allocation pattern.
+
  */
 
 #include "MeshDefs.h"
+#include <unordered_map>
+
+typedef double (*mesh_error_f)(const Point2& p, const Point2& q, const Point2& r);
 
-typedef double (*mesh_error_f)(const Point_2& p, const Point_2& q, const Point_2& r);
+enum {
+	simplify_Serial = 0,		// One global queue, one vertex at a time.
+	simplify_Rounds,			// Independent sets on all threads, ties broken by location (repeatable).
+	simplify_RoundsFast			// Independent sets on all threads, ties broken by address.
+};
 
+struct	MeshSimplifyRound {
+	int		evaluated;			// Vertices whose removal error was calculated this round
+	int		candidates;			// ...that could be removed within the error limit
+	int		selected;			// ...that made it into the independent set
+	int		removed;			// ...that still passed the topology test and were removed
+	double	seconds;
+};
 
 class	MeshSimplify {
 public:
 
 				MeshSimplify(CDT& io_mesh, mesh_error_f err);
-	void		simplify(double max_error);
+	void		simplify(double max_error, int mode = simplify_Serial);
+
+	// One entry per round of the last simplify - empty for serial mode.
+	const vector<MeshSimplifyRound>&	rounds(void) const { return round_stats; }
 
 private:
 
 	bool		can_remove_topo(CDT::Vertex_handle p, CDT::Vertex_handle q, CDT::Vertex_handle r);
 	bool		can_remove_locked(CDT::Vertex_handle q, CDT::Vertex_handle& p, CDT::Vertex_handle& r);
 	double		calc_remove_error(CDT::Vertex_handle p, CDT::Vertex_handle q, CDT::Vertex_handle r);
+	void		remove_vertex(CDT::Vertex_handle p, CDT::Vertex_handle q, CDT::Vertex_handle r);
 
 	void		init_q(void);
 	void		run_vertex(CDT::Vertex_handle v);
 	void		update_q(CDT::Vertex_handle v);
 
+	void		run_rounds(bool deterministic);
+	void		cache_orig_pts(void);
+	const Point2&	orig_pt(Vertex_handle v) const { return orig_pts.find(&*v)->second; }
+
 	CDT&			mesh;
 	VertexQueue		queue;
 	mesh_error_f	err_f;
 	double			max_err;
+	unordered_map<const void *, Point2>	orig_pts;		// Original map vertex -> its location
+
+	vector<MeshSimplifyRound>	round_stats;
 	
 };	
 	
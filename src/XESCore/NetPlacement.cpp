@@ -573,9 +573,10 @@ void	BuildNetworkTopology(Pmwx& inMap, CDT& /*inMesh*/, Net_JunctionInfoSet& out
 	outJunctions.clear();
 	outChains.clear();
 
-	typedef	map<Pmwx::Vertex *, Net_JunctionInfo_t*>		JunctionTableType;
-	typedef	map<Pmwx::Halfedge_handle, Net_ChainInfo_t*>	ChainTableType;
-	JunctionTableType										junctionTable;
+	// Vertex -> junction lookup is hit twice per road segment; a hash table keeps that O(1) on big road grids.
+	typedef	hash_map<const Pmwx::Vertex *, Net_JunctionInfo_t*>	JunctionTableType;
+	JunctionTableType											junctionTable;
+	junctionTable.reserve(inMap.number_of_vertices());
 
 	CDT::Face_handle	f;
 	CDT::Locate_type	lt;
@@ -629,8 +630,11 @@ void	BuildNetworkTopology(Pmwx& inMap, CDT& /*inMesh*/, Net_JunctionInfoSet& out
 		chain->export_type = NO_VALUE;
 //		chain->draped = true;
 		chain->over_water = e->face()->data().IsWater() && e->twin()->face()->data().IsWater();
-		chain->start_junction = junctionTable[&*e->source()];
-		chain->end_junction = junctionTable[&*e->target()];
+		JunctionTableType::iterator src = junctionTable.find(&*e->source());
+		JunctionTableType::iterator dst = junctionTable.find(&*e->target());
+		DebugAssert(src != junctionTable.end() && dst != junctionTable.end());
+		chain->start_junction = src->second;
+		chain->end_junction = dst->second;
 		chain->start_junction->chains.insert(chain);
 		chain->end_junction->chains.insert(chain);
 		chain->start_layer = seg->mSourceHeight;
@@ -25,6 +25,7 @@
 #include "DEMTables.h"
 #include "EnumSystem.h"
 #include "ParamDefs.h"
+#include <limits>
 
 RepTable						gRepTable;
 RepFeatureIndex					gRepFeatureIndex;
@@ -44,6 +45,136 @@ RepTableTerrainIndex			gRepTableTerrainIndex;
 string							gObjPlacementFile;
 string							gObjLibPrefix;
 
+/*
+	QUERY INDEX
+
+	The size queries below used to walk a terrain's whole slice of the rep table for every block.  Instead, at load time
+	we pre-filter the slice for every (rep type, feature, terrain, road/fill) key - everything that does not depend on
+	size - into a list of rows, still in table order.  Each list carries a segment tree: for every node, the smallest
+	lower bound and the biggest upper bound of the rows under it, per dimension (width, depth, height).  A query walks
+	the tree left to right and skips any node whose bounds cannot contain the request, then runs the original test on
+	the rows that survive.  So the answer is the same rows in the same order as the old scan, but an empty or nearly
+	empty answer costs a few node visits instead of a pass over the table.
+
+	For objects the size rule is "the slot is at least as big as the object", which is the interval [size, +inf).
+*/
+
+struct	rep_query_key_t {
+	int		obj_type;
+	int		feature;
+	int		terrain;
+	int		flags;			// objects only: 1 = road wanted, 2 = fill wanted
+	bool operator<(const rep_query_key_t& rhs) const
+	{
+		if(obj_type != rhs.obj_type)	return obj_type < rhs.obj_type;
+		if(feature != rhs.feature)		return feature < rhs.feature;
+		if(terrain != rhs.terrain)		return terrain < rhs.terrain;
+		return flags < rhs.flags;
+	}
+};
+
+struct	rep_query_node_t {
+	float	lo[3];
+	float	hi[3];
+};
+
+struct	rep_query_list_t {
+	vector<int>					rows;
+	int							leaves;		// power of 2 >= rows.size()
+	vector<rep_query_node_t>	tree;		// 2 * leaves, root at 1
+};
+
+static map<rep_query_key_t, rep_query_list_t>	sRepQueryIndex;
+
+static void	rep_query_bounds(const RepInfo_t& rec, rep_query_node_t& b)
+{
+	if(rec.obj_type == rep_Fac)
+	{
+		b.lo[0] = rec.width_min;	b.hi[0] = rec.width_max;
+		b.lo[1] = rec.depth_min;	b.hi[1] = rec.depth_max;
+		b.lo[2] = rec.height_min;	b.hi[2] = rec.height_max;
+	}
+	else
+	{
+		b.lo[0] = rec.width_max;	b.hi[0] = numeric_limits<float>::infinity();
+		b.lo[1] = rec.depth_max;	b.hi[1] = numeric_limits<float>::infinity();
+		b.lo[2] = rec.height_max;	b.hi[2] = numeric_limits<float>::infinity();
+	}
+}
+
+static void	BuildRepQueryIndex(void)
+{
+	sRepQueryIndex.clear();
+	for(RepTableTerrainIndex::iterator r = gRepTableTerrainIndex.begin(); r != gRepTableTerrainIndex.end(); ++r)
+	for(int row = r->second.first; row < r->second.second; ++row)
+	{
+		const RepInfo_t& rec = gRepTable[row];
+		if(rec.terrain != NO_VALUE && rec.terrain != r->first)
+			continue;
+		rep_query_key_t k = { rec.obj_type, rec.feature, r->first, 0 };
+		if(rec.obj_type == rep_Fac)
+			sRepQueryIndex[k].rows.push_back(row);
+		else for(k.flags = 0; k.flags < 4; ++k.flags)
+		if(!(k.flags & 1) || rec.road)
+		if(!(k.flags & 2) || rec.fill)
+			sRepQueryIndex[k].rows.push_back(row);
+	}
+
+	for(map<rep_query_key_t, rep_query_list_t>::iterator i = sRepQueryIndex.begin(); i != sRepQueryIndex.end(); ++i)
+	{
+		rep_query_list_t& l(i->second);
+		l.leaves = 1;
+		while(l.leaves < l.rows.size())
+			l.leaves *= 2;
+		rep_query_node_t empty;
+		for(int d = 0; d < 3; ++d)
+		{
+			empty.lo[d] = numeric_limits<float>::infinity();
+			empty.hi[d] = -numeric_limits<float>::infinity();
+		}
+		l.tree.assign(l.leaves * 2, empty);
+		for(int n = 0; n < l.rows.size(); ++n)
+			rep_query_bounds(gRepTable[l.rows[n]], l.tree[l.leaves + n]);
+		for(int n = l.leaves - 1; n > 0; --n)
+		for(int d = 0; d < 3; ++d)
+		{
+			l.tree[n].lo[d] = min(l.tree[n*2].lo[d], l.tree[n*2+1].lo[d]);
+			l.tree[n].hi[d] = max(l.tree[n*2].hi[d], l.tree[n*2+1].hi[d]);
+		}
+	}
+}
+
+static const rep_query_list_t *	FindRepQueryList(int obj_type, int feature, int terrain, int flags)
+{
+	rep_query_key_t k = { obj_type, feature, terrain, flags };
+	map<rep_query_key_t, rep_query_list_t>::const_iterator i = sRepQueryIndex.find(k);
+	return i == sRepQueryIndex.end() ? NULL : &i->second;
+}
+
+// Can any row under this node take size q in dimension d?  A "don't care" (any) dimension always can.
+inline bool	rep_query_may_fit(const rep_query_node_t& n, const float q[3], const bool any[3])
+{
+	for(int d = 0; d < 3; ++d)
+	if(!any[d])
+	if(q[d] < n.lo[d] || q[d] > n.hi[d])
+		return false;
+	return true;
+}
+
+// Visits the rows under node, left to right, that may fit, calling test(row) on each until it returns false.
+template <typename F>
+static bool	rep_query_walk(const rep_query_list_t& l, int node, const float q[3], const bool any[3], F& test)
+{
+	if(!rep_query_may_fit(l.tree[node], q, any))
+		return true;
+	if(node >= l.leaves)
+	{
+		int n = node - l.leaves;
+		return n >= l.rows.size() || test(l.rows[n]);
+	}
+	return rep_query_walk(l, node * 2, q, any, test) && rep_query_walk(l, node * 2 + 1, q, any, test);
+}
+
 static int ObjScheduleJump(int height)
 {
 	// This is the "Obj Jump schedule" - it indicates the increments between successive objects.
@@ -236,6 +367,29 @@ bool	ReadFeatureProps(const vector<string>& tokens, void * ref)
 	return true;
 }
 
+static void	BuildRepTableTerrainIndex(void)
+{
+	gRepTableTerrainIndex.clear();
+
+	hash_map<int, int>	mins, maxs;
+	for (int n = 0; n < gRepTable.size(); ++n)
+	{
+		int terrain = gRepTable[n].terrain;
+		if (mins.count(terrain)==0)		mins[terrain] = n;
+		else							mins[terrain] = min(mins[terrain], n);
+
+										maxs[terrain] = max(maxs[terrain], n+1);
+	}
+
+	for (hash_map<int, int>::iterator range = mins.begin(); range != mins.end(); ++range)
+	{
+		int terrain = range->first;
+		int ilow = range->second;
+		int ihi = maxs[terrain];
+		gRepTableTerrainIndex[terrain] = pair<int,int>(ilow, ihi);
+	}
+}
+
 /*
 bool	ReadFeatureToRep(const vector<string>& tokens, void * ref)
 {
@@ -276,23 +430,8 @@ void	LoadObjTables(void)
 //			gFeatureAsFacade.insert(i->first);
 //	}
 
-	hash_map<int, int>	mins, maxs;
-	for (int n = 0; n < gRepTable.size(); ++n)
-	{
-		int terrain = gRepTable[n].terrain;
-		if (mins.count(terrain)==0)		mins[terrain] = n;
-		else							mins[terrain] = min(mins[terrain], n);
-
-										maxs[terrain] = max(maxs[terrain], n+1);
-	}
-
-	for (hash_map<int, int>::iterator range = mins.begin(); range != mins.end(); ++range)
-	{
-		int terrain = range->first;
-		int ilow = range->second;
-		int ihi = maxs[terrain];
-		gRepTableTerrainIndex[terrain] = pair<int,int>(ilow, ihi);
-	}
+	BuildRepTableTerrainIndex();
+	BuildRepQueryIndex();
 }
 
 /************************************************************************************************
@@ -322,38 +461,28 @@ int	QueryUsableFacsBySize(
 					int				inMaxResults)
 {
 	int 						ret = 0;
-	pair<int,int>				range = gRepTableTerrainIndex[terrain];
-	for (int row = range.first; row < range.second; ++row)
-	{
-		RepInfo_t& rec = gRepTable[row];
+	const rep_query_list_t *	list = FindRepQueryList(rep_Fac, feature, terrain, 0);
+	if (list == NULL)
+		return 0;
 
-		// Evaluate this choice
-		if (rec.obj_type == rep_Fac)
-//		if ((rec.max_num == 0 || rec.max_num > gRepUsage[rec.obj_name]) &&
-//			(rec.freq == 0.0 || (rec.freq * (float) gRepUsageTotal >= gRepUsage[rec.obj_name])) &&
+	float	q[3] = { inLongSide, inShortSide, inTargetHeight };
+	bool	any[3] = { false, false, false };
 
-			// Enum rules
-		if ((rec.feature == feature) &&
-			(rec.terrain == NO_VALUE || rec.terrain == terrain) &&
-			// Range Rules
-//			RANGE_RULE(temp) &&
-//			RANGE_RULE(slope) &&
-//			RANGE_RULE(rain) &&
-//			RANGE_RULE(urban_dense) &&
-//			RANGE_RULE(urban_radial) &&
-//			RANGE_RULE(urban_trans) &&
-
-			(inLongSide >= rec.width_min && inLongSide <= rec.width_max) &&			// FACADES: the width range limits the 'big' side, the
+	auto test = [&](int row) {
+		const RepInfo_t& rec = gRepTable[row];
+
+		// Feature and terrain rules are already applied by the index.
+		if ((inLongSide >= rec.width_min && inLongSide <= rec.width_max) &&			// FACADES: the width range limits the 'big' side, the
 			(inShortSide >= rec.depth_min && inShortSide <= rec.depth_max) &&		// depth range limits the 'small' side.  We must know this - we are making a facade.
 
 			(inTargetHeight >= rec.height_min && inTargetHeight <= rec.height_max))
 		{
 			outResults[ret] = row;
 			++ret;
-			if (ret >= inMaxResults)
-				return ret;
 		}
-	}
+		return ret < inMaxResults;
+	};
+	rep_query_walk(*list, 1, q, any, test);
 	return ret;
 }
 
@@ -395,32 +524,71 @@ int QueryUsableObjsBySize(
 	// since the antenna is in the smack middle of the facade, it
 	// is conceivable that a huge object could fit there.
 
-	pair<int,int>				range = gRepTableTerrainIndex[terrain];
+	const rep_query_list_t *	list = FindRepQueryList(rep_Obj, feature, terrain, (road ? 1 : 0) | (fill ? 2 : 0));
+	if (list == NULL)
+		return 0;
+
+	float	q[3] = { inWidth, inDepth, inHeightMax };
+	bool	any[3] = { inWidth == -1, inDepth == -1, false };
+
+	auto test = [&](int row) {
+		const RepInfo_t& rec = gRepTable[row];
+
+		// Feature, terrain, road and fill rules are already applied by the index.
+		if ((inWidth == -1 || (inWidth >= rec.width_max)) &&					// FOR OBJECTS: give an object if (1) we have NO idea how big this slot is (try 'em all)
+			(inDepth == -1 || (inDepth >= rec.depth_max)) &&					// or if the lot is at least as bigger than the obj
+
+			(inHeightMax >= rec.height_max))				// For objs - obj height less than max!
+		{
+			outResults[ret] = row;
+			++ret;
+		}
+		return ret < inMaxResults;
+	};
+	rep_query_walk(*list, 1, q, any, test);
+	return ret;
+}
+
+#if DEV
+// The original linear scans over a terrain's slice of the rep table, kept for TEST_ObjTables.
+static int	QueryUsableFacsBySize_legacy(int feature, int terrain, float inLongSide, float inShortSide, float inTargetHeight,
+					int * outResults, int inMaxResults)
+{
+	int ret = 0;
+	pair<int,int> range = gRepTableTerrainIndex[terrain];
 	for (int row = range.first; row < range.second; ++row)
 	{
 		RepInfo_t& rec = gRepTable[row];
+		if (rec.obj_type == rep_Fac)
+		if ((rec.feature == feature) &&
+			(rec.terrain == NO_VALUE || rec.terrain == terrain) &&
+			(inLongSide >= rec.width_min && inLongSide <= rec.width_max) &&
+			(inShortSide >= rec.depth_min && inShortSide <= rec.depth_max) &&
+			(inTargetHeight >= rec.height_min && inTargetHeight <= rec.height_max))
+		{
+			outResults[ret] = row;
+			++ret;
+			if (ret >= inMaxResults)
+				return ret;
+		}
+	}
+	return ret;
+}
 
-		// Evaluate this choice
+static int	QueryUsableObjsBySize_legacy(int feature, int terrain, float inWidth, float inDepth, float inHeightMax, int road, int fill,
+					int * outResults, int inMaxResults)
+{
+	int ret = 0;
+	pair<int,int> range = gRepTableTerrainIndex[terrain];
+	for (int row = range.first; row < range.second; ++row)
+	{
+		RepInfo_t& rec = gRepTable[row];
 		if (rec.obj_type == rep_Obj)
-//		if ((rec.max_num == 0 || rec.max_num > gRepUsage[rec.obj_name]) &&
-//			(rec.freq == 0.0 || (rec.freq * (float) gRepUsageTotal >= gRepUsage[rec.obj_name])) &&
-
-			// Enum rules
 		if ((rec.feature == feature) &&
 			(rec.terrain == NO_VALUE || rec.terrain == terrain) &&
-			// Range Rules
-//			RANGE_RULE(slope) &&
-//			RANGE_RULE(temp) &&
-//			RANGE_RULE(rain) &&
-//			RANGE_RULE(urban_dense) &&
-//			RANGE_RULE(urban_radial) &&
-//			RANGE_RULE(urban_trans) &&
-			// Obj Rules
-			(inWidth == -1 || (inWidth >= rec.width_max)) &&					// FOR OBJECTS: give an object if (1) we have NO idea how big this slot is (try 'em all)
-			(inDepth == -1 || (inDepth >= rec.depth_max)) &&					// or if the lot is at least as bigger than the obj
-
-			(inHeightMax >= rec.height_max) &&				// For objs - obj height less than max!
-
+			(inWidth == -1 || (inWidth >= rec.width_max)) &&
+			(inDepth == -1 || (inDepth >= rec.depth_max)) &&
+			(inHeightMax >= rec.height_max) &&
 			(!fill || rec.fill) &&
 			(!road || rec.road))
 		{
@@ -433,6 +601,74 @@ int QueryUsableObjsBySize(
 	return ret;
 }
 
+// Checks the indexed size queries against the linear scans they replaced on a random table: same rows, same order, same
+// cut-off at inMaxResults.  The real tables are swapped out for the test and put back after.
+void	TEST_ObjTables(void)
+{
+	RepTable				saved_table;
+	RepTableTerrainIndex	saved_index;
+	saved_table.swap(gRepTable);
+	saved_index.swap(gRepTableTerrainIndex);
+
+	// Sizes come off a coarse grid so queries land exactly on the range ends, and terrains are shuffled so the
+	// terrain slices overlap and hold rows of other terrains and NO_VALUE rows.
+	unsigned int seed = 12345;
+	#define TEST_RAND(n)	((seed = seed * 1103515245 + 12345), (int) ((seed >> 16) % (n)))
+	for (int n = 0; n < 600; ++n)
+	{
+		RepInfo_t	info;
+		info.feature = TEST_RAND(4) == 0 ? NO_VALUE : TEST_RAND(3);
+		info.terrain = TEST_RAND(5) == 0 ? NO_VALUE : 10 + TEST_RAND(4);
+		info.road = TEST_RAND(2);
+		info.fill = TEST_RAND(2);
+		info.obj_type = TEST_RAND(2) ? rep_Obj : rep_Fac;
+		info.obj_name = n;
+		info.width_min = 5.0f * TEST_RAND(8);	info.width_max = info.width_min + 5.0f * TEST_RAND(8);
+		info.depth_min = 5.0f * TEST_RAND(8);	info.depth_max = info.depth_min + 5.0f * TEST_RAND(8);
+		info.height_min = 5.0f * TEST_RAND(8);	info.height_max = info.height_min + 5.0f * TEST_RAND(8);
+		gRepTable.push_back(info);
+	}
+	BuildRepTableTerrainIndex();
+	BuildRepQueryIndex();
+
+	const int	max_results[] = { 1, 2, 3, 7, 1000 };
+	int			res_new[1000], res_old[1000];
+	int			bad = 0, hits = 0, queries = 0;
+	for (int q = 0; q < 20000; ++q)
+	{
+		int feature = TEST_RAND(4) == 0 ? NO_VALUE : TEST_RAND(3);
+		int terrain = TEST_RAND(6) == 0 ? NO_VALUE : 10 + TEST_RAND(5);		// Terrain 14 has no rows at all.
+		int mr = max_results[TEST_RAND(5)];
+		float w = 5.0f * TEST_RAND(16), d = 5.0f * TEST_RAND(16), h = 5.0f * TEST_RAND(16);
+		int n_new, n_old;
+		if (q % 2)
+		{
+			n_new = QueryUsableFacsBySize(feature, terrain, w, d, h, res_new, mr);
+			n_old = QueryUsableFacsBySize_legacy(feature, terrain, w, d, h, res_old, mr);
+		}
+		else
+		{
+			if (TEST_RAND(4) == 0) w = -1;
+			if (TEST_RAND(4) == 0) d = -1;
+			int road = TEST_RAND(2), fill = TEST_RAND(2);
+			n_new = QueryUsableObjsBySize(feature, terrain, w, d, h, road, fill, res_new, mr);
+			n_old = QueryUsableObjsBySize_legacy(feature, terrain, w, d, h, road, fill, res_old, mr);
+		}
+		++queries;
+		hits += n_old;
+		if (n_new != n_old || !equal(res_new, res_new + n_new, res_old))
+			++bad;
+	}
+	#undef TEST_RAND
+	printf("ObjTables: %d queries, %d rows found, %d differ from the linear scan.\n", queries, hits, bad);
+	DebugAssert(bad == 0);
+
+	saved_table.swap(gRepTable);
+	saved_index.swap(gRepTableTerrainIndex);
+	BuildRepQueryIndex();
+}
+#endif
+
 void IncrementRepUsage(int inRep)
 {
 	gRepUsage[inRep]++;
@@ -79,13 +79,10 @@ void		TriFanBuilder::Validate(void)
 
 void		TriFanBuilder::AddTriToFanPool(CDT::Face_handle inFace)
 {
-//	if (inFace->info().flag)
-//		printf("WARNING: flag is NOT set up right.\n");
-	inFace->info().flag = true;
+	pool.insert(inFace);
 	vertices.insert(inFace->vertex(0));
 	vertices.insert(inFace->vertex(1));
 	vertices.insert(inFace->vertex(2));
-//	faces.insert(inFace);
 }
 
 void		TriFanBuilder::CalcFans(void)
@@ -97,10 +94,8 @@ void		TriFanBuilder::CalcFans(void)
 		TriFan_t * fan = NULL;
 		bool	circular = true;
 		do {
-			if (f->info().flag && !mesh->is_infinite(f))
+			if (!mesh->is_infinite(f) && pool.count(f))
 			{
-//				if (faces.count(f) == 0)
-//					printf("ERROR - WEIRD FACE!\n");
 				if (!fan)
 				{
 					fan = new TriFan_t;
@@ -160,10 +155,11 @@ void			TriFanBuilder::DoneWithFan(TriFan_t * inFan)
 	for (list<CDT::Face_handle>::iterator f = inFan->faces.begin(); f != inFan->faces.end(); ++f)
 	{
 #if DEV
-		if (!(*f)->info().flag)
+		if (pool.erase(*f) == 0)
 			printf("ERROR - this face was already used once.\n");
+#else
+		pool.erase(*f);
 #endif
-		(*f)->info().flag = false;
 	}
 	delete inFan;
 }
@@ -180,10 +176,11 @@ CDT::Face_handle 	TriFanBuilder::GetNextRemainingTriangle(void)
 	CDT::Face_handle	ff = f->faces.front();
 	delete f;
 #if DEV
-	if (!ff->info().flag)
+	if (pool.erase(ff) == 0)
 		printf("ERROR - this face was already used once.\n");
+#else
+	pool.erase(ff);
 #endif
-	ff->info().flag = false;
 
 	// OOPS!  We have to nuke all remaining triangles from the queue!!
 	for (TriFanQueue::iterator n = queue.begin(); n != queue.end(); )
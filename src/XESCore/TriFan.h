@@ -78,6 +78,8 @@ private:
 	TriFanQueue					queue;				// Our tri fans in priority order
 	TriFanTable					index;				// Index of who is using what tri fans
 	set<CDT::Vertex_handle>		vertices;			// Vertices that we need to tri fan for building up the struct
+	set<CDT::Face_handle>		pool;				// Faces added and not yet emitted.  Ours, not face info, so
+													// builders for different patches can run at once on one mesh.
 #endif
 	CDT *						mesh;				// Our mesh
 };
@@ -29,6 +29,7 @@
 
 const	int	kMapID = 'MAP1';
 const	int	kDemDirID = 'DEMd';
+const	int	kDemPackedDirID = 'DEMp';	// (layer, dem_Storage_*) pairs for layers not stored as float.
 const	int	kMeshID = 'MSH1';
 
 const	int	kTokensID = 'TOKN';
@@ -50,14 +51,38 @@ void	WriteXESFile(
 	WriteMap(fi, inMap, inFunc, kMapID);
 	WriteMesh(fi, inMesh, kMeshID, inFunc);
 
+	// A layer whose data no longer fits its storage type (e.g. a land use layer that picked up
+	// an enum > 254) silently goes out as float rather than losing data.
+	//
+	// Packed layers are listed in their own directory and NOT in the float one: a reader that
+	// predates packing only loads the layers in 'DEMd', so it skips a packed layer instead of
+	// reading its bytes as floats.
+	map<int, int>	storage;
+	for (DEMGeoMap::iterator dem = inDEM.begin(); dem != inDEM.end(); ++dem)
+	if (dem->second.mStorage != dem_Storage_Float32 && DEMGeo_StorageFits(dem->second, dem->second.mStorage))
+		storage[dem->first] = dem->second.mStorage;
+
 	{
 		StAtomWriter	demDir(fi, kDemDirID);
 		FileWriter		writer(fi);
-		writer.WriteInt(inDEM.size());
+		writer.WriteInt(inDEM.size() - storage.size());
 		for (DEMGeoMap::iterator dem = inDEM.begin(); dem != inDEM.end(); ++dem)
+		if (storage.count(dem->first) == 0)
 			writer.WriteInt(dem->first);
 	}
 
+	if (!storage.empty())
+	{
+		StAtomWriter	demPackedDir(fi, kDemPackedDirID);
+		FileWriter		writer(fi);
+		writer.WriteInt(storage.size());
+		for (map<int, int>::iterator s = storage.begin(); s != storage.end(); ++s)
+		{
+			writer.WriteInt(s->first);
+			writer.WriteInt(s->second);
+		}
+	}
+
 	if (!inApts.empty())
 	{
 		StAtomWriter	aptDir(fi, kAptID);
@@ -68,7 +93,8 @@ void	WriteXESFile(
 	{
 		StAtomWriter	demAtom(fi, dem->first);
 		FileWriter		writer(fi);
-		WriteDEM(dem->second, &writer);
+		map<int, int>::iterator s = storage.find(dem->first);
+		WriteDEM(dem->second, &writer, s == storage.end() ? dem_Storage_Float32 : s->second);
 	}
 
 	fclose(fi);
@@ -94,10 +120,11 @@ void	ReadXESFile(
 	ReadEnumsAtomFromFile(container, fileTokens, kTokensID);
 	BuildTokenConversionMap(gTokens, fileTokens, conversionMap);
 
-	XAtom	mapAtom, demAtom, demDirAtom, aptAtom;
-	XSpan	mapAtomData, demAtomData, demDirAtomData, aptAtomData;
+	XAtom	mapAtom, demAtom, demDirAtom, demPackedDirAtom, aptAtom;
+	XSpan	mapAtomData, demAtomData, demDirAtomData, demPackedDirAtomData, aptAtomData;
 
 	vector<int>	dems;
+	map<int, int>	storage;
 
 	if (inMap)
 	ReadMap(container, *inMap, inFunc, kMapID, conversionMap);
@@ -118,6 +145,21 @@ void	ReadXESFile(
 		}
 	}
 
+	if (container.GetNthAtomOfID(kDemPackedDirID, 0, demPackedDirAtom))
+	{
+		demPackedDirAtom.GetContents(demPackedDirAtomData);
+		MemFileReader	reader(demPackedDirAtomData.begin, demPackedDirAtomData.end);
+		int count, demID, demStorage;
+		reader.ReadInt(count);
+		while (count--)
+		{
+			reader.ReadInt(demID);
+			reader.ReadInt(demStorage);
+			dems.push_back(demID);
+			storage[demID] = demStorage;
+		}
+	}
+
 	if (inApts)
 	if (container.GetNthAtomOfID(kAptID, 0, aptAtom))
 	{
@@ -133,7 +175,8 @@ void	ReadXESFile(
 			demAtom.GetContents(demAtomData);
 			MemFileReader	reader(demAtomData.begin, demAtomData.end);
 			DEMGeo	aDem;
-			ReadDEM(aDem, &reader);
+			map<int, int>::iterator s = storage.find(dems[i]);
+			ReadDEM(aDem, &reader, s == storage.end() ? dem_Storage_Float32 : s->second);
 			int demID = conversionMap[dems[i]];
 			if (demID == dem_LandUse || demID == dem_Climate)	// || demID == dem_NudeColor)
 				RemapEnumDEM(aDem, conversionMap);
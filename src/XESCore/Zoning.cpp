@@ -44,6 +44,8 @@
 #include "BlockFill.h"
 #include "BlockAlgs.h"
 #include "MathUtils.h"
+#include "PerfUtils.h"
+#include "ParallelUtils.h"
 
 // NOTE: all that this does is propegate parks, forestparks, cemetaries and golf courses to the feature type if
 // it isn't assigned.
@@ -587,55 +589,51 @@ void kill_antennas(Pmwx& io_map, Pmwx::Face_handle f, float max_len)
 	} while (++circ != stop);
 }
 
-static void ZoneOneFace(
-				Pmwx& 				ioMap,
-				const DEMGeo&		inElev,
+/*
+	ZONING A FACE - TWO PHASES
+
+	Zoning a face reads its own boundary, its neighbors' terrain, its point features and the rasters under it, and
+	writes only its own params.  So ZoneManMadeAreas does it in phases over the whole map:
+
+	1. Sample the rasters under every face (parallel).
+	2. Remove short road antennas from urban blocks (serial - this is the only step that edits the map).  Antennas are
+	   interior to one face, so they never change what another face sees, and they rasterize to nothing.
+	3. Analyze every face against the now-frozen map into a side array (parallel), then commit the results (serial).
+
+	This matches doing it one face at a time because no step reads anything another face's commit writes: neighbor
+	faces are only checked for water, and zoning never makes a face water.
+ */
+
+// Land use samples under one face.
+struct	zone_raster_t {
+	float			count;
+	float			total_forest;
+	float			total_urban;
+	float			total_park;
+	map<int, int>	histo;
+};
+
+// Everything zoning decided for one face, to be written into it.
+struct	zone_face_result_t {
+	GISParamMap		params;
+	int				zone;
+	bool			complete;			// False if the block outline could not be built - then only the categories are written.
+};
+
+static void SampleZoneRasters(
 				const DEMGeo& 		inLanduse,
 				const DEMGeo&		inForest,
 				const DEMGeo&		inPark,
-				const DEMGeo& 		inSlope,
-				const AptVector&	inApts,
 				const DEMGeo&		urban_density_from_lu,
-				Pmwx::Face_handle	face)
+				Pmwx::Face_handle	face,
+				zone_raster_t&		out)
 {
-	//--------------------------------------------------------------------------------------------------------------------------------
-	// BASIC BLOCK INFO - AREA, RASTER FEATURES
-	//--------------------------------------------------------------------------------------------------------------------------------
-
-	double mfam = GetMapFaceAreaMeters(face);
-	double	max_height = 0.0;
-	set<int>	my_pt_features;
-
-	if (mfam < MAX_OBJ_SPREAD)
-	for (GISPointFeatureVector::iterator feat = face->data().mPointFeatures.begin(); feat != face->data().mPointFeatures.end(); ++feat)
-	{
-		my_pt_features.insert(feat->mFeatType);
-		if (feat->mFeatType == feat_Building)
-		{
-			if (feat->mParams.count(pf_Height))
-			{
-				max_height = max(max_height, feat->mParams[pf_Height]);
-			}
-		} else {
-			printf("Has other feature: %s\n", FetchTokenString(feat->mFeatType));
-		}
-	}
-
-	int has_water = 0;
-	int has_non_water = 0;
-	int has_train = 0;
-	int has_prim = 0;
-	int	has_non_train = 0;
-	int has_local = 0;
-	int has_non_local = 0;
-	Bbox2 face_extent;
-
 	PolyRasterizer<double>	r;
 	int x, y, x1, x2;
 	y = SetupRasterizerForDEM(face, inLanduse, r);
 	r.StartScanline(y);
 	float count = 0, total_forest = 0, total_urban = 0, total_park = 0;
-	map<int, int>		histo;
+	map<int, int>&		histo(out.histo);
 
 	while (!r.DoneScan())
 	{
@@ -654,9 +652,10 @@ static void ZoneOneFace(
 
 				total_urban += d;
 
-				if(gLandClassInfo.count(e))
+				LandClassInfoTable::const_iterator lu = gLandClassInfo.find(e);
+				if(lu != gLandClassInfo.end())
 				{
-					LandClassInfo_t& i(gLandClassInfo[e]);
+					const LandClassInfo_t& i(lu->second);
 					histo[i.category]++;
 					total_forest += i.veg_density;
 
@@ -691,9 +690,10 @@ static void ZoneOneFace(
 		count++;
 
 		total_urban += d;
-		if(gLandClassInfo.count(e))
+		LandClassInfoTable::const_iterator lu = gLandClassInfo.find(e);
+		if(lu != gLandClassInfo.end())
 		{
-			LandClassInfo_t& i(gLandClassInfo[e]);
+			const LandClassInfo_t& i(lu->second);
 			histo[i.category]++;
 			total_forest += i.veg_density;
 			if(p != NO_VALUE)
@@ -708,37 +708,99 @@ static void ZoneOneFace(
 
 	}
 
-	if(count)
-	if((total_urban / count) > 0.5)
+	out.count = count;
+	out.total_forest = total_forest;
+	out.total_urban = total_urban;
+	out.total_park = total_park;
+}
+
+// Antennas are only trimmed from hole-free urban blocks; returns the longest antenna to remove, or 0.
+static float ZoneAntennaLength(const zone_raster_t& lu, Pmwx::Face_handle face)
+{
+	if(lu.count)
+	if((lu.total_urban / lu.count) > 0.5)
 	if(face->number_of_holes() == 0)
-		kill_antennas(ioMap,face,  ((total_urban / count) > 0.75) ? 35.0 : 20.0);
+		return ((lu.total_urban / lu.count) > 0.75) ? 35.0 : 20.0;
+	return 0.0;
+}
+
+static void ZoneOneFace(
+				const DEMGeo& 		inLanduse,
+				const DEMGeo& 		inSlope,
+				const zone_raster_t&	lu,
+				const MapSnapshot&	snap,
+				int					snap_face,
+				Pmwx::Face_handle	face,
+				zone_face_result_t&	out)
+{
+	//--------------------------------------------------------------------------------------------------------------------------------
+	// BASIC BLOCK INFO - AREA, RASTER FEATURES
+	//--------------------------------------------------------------------------------------------------------------------------------
+
+	out.zone = NO_VALUE;
+	out.complete = false;
+	GISParamMap& params(out.params);
+
+	// Area and outer bounds come from the snapshot - plain doubles, nothing lazy to build on this thread.
+	Bbox2 face_extent;
+	double mfam = MapSnapshotFaceAreaMeters(snap, snap_face, &face_extent);
+	double	max_height = 0.0;
+	set<int>	my_pt_features;
+
+	if (mfam < MAX_OBJ_SPREAD)
+	for (GISPointFeatureVector::iterator feat = face->data().mPointFeatures.begin(); feat != face->data().mPointFeatures.end(); ++feat)
+	{
+		my_pt_features.insert(feat->mFeatType);
+		if (feat->mFeatType == feat_Building)
+		{
+			if (feat->mParams.count(pf_Height))
+			{
+				max_height = max(max_height, feat->mParams[pf_Height]);
+			}
+		} else {
+			printf("Has other feature: %s\n", FetchTokenString(feat->mFeatType));
+		}
+	}
+
+	int has_water = 0;
+	int has_non_water = 0;
+	int has_train = 0;
+	int has_prim = 0;
+	int	has_non_train = 0;
+	int has_local = 0;
+	int has_non_local = 0;
+
+	int x, y, x1, x2;
+	float count = lu.count, total_forest = lu.total_forest, total_urban = lu.total_urban, total_park = lu.total_park;
+	const map<int, int>&	histo(lu.histo);
 
 	multimap<int, int, greater<int> > histo2;
-	for(map<int,int>::iterator i = histo.begin(); i != histo.end(); ++i)
+	for(map<int,int>::const_iterator i = histo.begin(); i != histo.end(); ++i)
 		histo2.insert(multimap<int,int, greater<int> >::value_type(i->second,i->first));
 
 	multimap<int, int, greater<int> >::iterator i = histo2.begin();
 	if(histo2.size() > 0)
 	{
-		face->data().mParams[af_Cat1] = i->second;
-		face->data().mParams[af_Cat1Rat] = (float) i->first / (float) count;
+		params[af_Cat1] = i->second;
+		params[af_Cat1Rat] = (float) i->first / (float) count;
 		++i;
 
 		if(histo2.size() > 1)
 		{
-			face->data().mParams[af_Cat2] = i->second;
-			face->data().mParams[af_Cat2Rat] = (float) i->first / (float) count;
+			params[af_Cat2] = i->second;
+			params[af_Cat2Rat] = (float) i->first / (float) count;
 			++i;
 
 			if(histo2.size() > 2)
 			{
-				face->data().mParams[af_Cat3] = i->second;
-				face->data().mParams[af_Cat3Rat] = (float) i->first / (float) count;
+				params[af_Cat3] = i->second;
+				params[af_Cat3Rat] = (float) i->first / (float) count;
 				++i;
 			}
 		}
 	}
 
+
 	//--------------------------------------------------------------------------------------------------------------------------------
 	// ROAD ANALYSIS
 	//--------------------------------------------------------------------------------------------------------------------------------
@@ -746,7 +808,6 @@ static void ZoneOneFace(
 	Pmwx::Ccb_halfedge_circulator circ, stop;
 	circ = stop = face->outer_ccb();
 	do {
-		face_extent += cgal2ben(circ->source()->point());
 		if(evaluate_he<Road_IsTrain>(circ))
 			has_train = 1;
 		else
@@ -994,12 +1055,23 @@ static void ZoneOneFace(
 		}
 	}
 
-	face->data().mParams[af_AGSides] = num_sides;
+	out.complete = true;
+	params[af_AGSides] = num_sides;
 
 	//--------------------------------------------------------------------------------------------------------------------------------
 	// LET US MAKE A FREAKING DECISION!!!
 	//--------------------------------------------------------------------------------------------------------------------------------
 
+	// The rule pick reads the first two categories whether we set them or not - an old value, or 0.  That read used
+	// to add them to the face, so carry them along to be written too.
+	const int cat_keys[4] = { af_Cat1, af_Cat1Rat, af_Cat2, af_Cat2Rat };
+	for(int k = 0; k < 4; ++k)
+	if(params.count(cat_keys[k]) == 0)
+	{
+		GISParamMap::const_iterator old_val = face->data().mParams.find(cat_keys[k]);
+		params[cat_keys[k]] = (old_val == face->data().mParams.end()) ? 0.0 : old_val->second;
+	}
+
 	int zone = PickZoningRule(
 					face->data().mTerrainType,
 					mfam,
@@ -1009,10 +1081,10 @@ static void ZoneOneFace(
 					max_height,
 					min_angle,
 					max_angle,
-					face->data().mParams[af_Cat1],
-					face->data().mParams[af_Cat1Rat],
-					face->data().mParams[af_Cat2],
-					face->data().mParams[af_Cat1Rat] + face->data().mParams[af_Cat2Rat],	// Really?  Yes.  This is the "high water mark" of BOTH cat 1 + cat 2.  That way
+					params[af_Cat1],
+					params[af_Cat1Rat],
+					params[af_Cat2],
+					params[af_Cat1Rat] + params[af_Cat2Rat],	// Really?  Yes.  This is the "high water mark" of BOTH cat 1 + cat 2.  That way
 					has_water,																// We can say "80% industrial, 90% urban, and we cover 80I+10U and 90I+0U.  In other
 					has_train,																// words when we can accept a mix, this lets the DOMINANT type crowd out the secondary.
 					has_local,
@@ -1029,54 +1101,64 @@ static void ZoneOneFace(
 
 					my_pt_features);
 
-	if(zone != NO_VALUE)
-	{
-		face->data().SetZoning(zone);
-		int wanted_terrain = gZoningInfo[zone].terrain_type;
-		if(wanted_terrain != NO_VALUE)
-			face->data().mTerrainType = wanted_terrain;
-	}
-	face->data().mParams[af_HeightObjs] = max_height;
-
-	face->data().mParams[af_UrbanAverage] = total_urban / (float) count;
-	face->data().mParams[af_ForestAverage] = total_forest / (float) count;
-	face->data().mParams[af_ParkAverage] = total_park / (float) count;
-	face->data().mParams[af_SlopeMax] = max_slope;
-	face->data().mParams[af_AreaMeters] = mfam;
-
+	out.zone = zone;
+	params[af_HeightObjs] = max_height;
 
-	face->data().mParams[af_ShortestSide]		= short_side;
-	face->data().mParams[af_LongestSide]		= long_side;
-	face->data().mParams[af_ShortAxisLength]	= short_axis_length;
-	face->data().mParams[af_LongAxisLength]		= long_axis_length;
-	face->data().mParams[af_BlockErr]			= max_err;
+	params[af_UrbanAverage] = total_urban / (float) count;
+	params[af_ForestAverage] = total_forest / (float) count;
+	params[af_ParkAverage] = total_park / (float) count;
+	params[af_SlopeMax] = max_slope;
+	params[af_AreaMeters] = mfam;
 
-	face->data().mParams[af_MinAngle]			= min_angle;
-	face->data().mParams[af_MaxAngle]			= max_angle;
 
-	face->data().mParams[af_WaterEdge]	=	has_water;
-	face->data().mParams[af_RoadEdge]	=	has_local;
-	face->data().mParams[af_RailEdge]	=	has_train;
-	face->data().mParams[af_PrimaryEdge]=	has_prim;
+	params[af_ShortestSide]		= short_side;
+	params[af_LongestSide]		= long_side;
+	params[af_ShortAxisLength]	= short_axis_length;
+	params[af_LongAxisLength]		= long_axis_length;
+	params[af_BlockErr]			= max_err;
 
-	face->data().mParams[af_LocalPercent] = len_local / len_total;
-	face->data().mParams[af_RailPercent] = len_train / len_total;
+	params[af_MinAngle]			= min_angle;
+	params[af_MaxAngle]			= max_angle;
 
-	// FEATURE ASSIGNMENT - first go and assign any features we might have.
-	face->data().mTemp1 = NO_VALUE;
-	face->data().mTemp2 = 0;
+	params[af_WaterEdge]	=	has_water;
+	params[af_RoadEdge]	=	has_local;
+	params[af_RailEdge]	=	has_train;
+	params[af_PrimaryEdge]=	has_prim;
 
+	params[af_LocalPercent] = len_local / len_total;
+	params[af_RailPercent] = len_train / len_total;
 
 	if(((len_local / len_total) < 0.1 && mfam < 10000.0) ||
 		(short_axis_length > 0.0 && short_axis_length < 20.0) ||
 		mfam < 900.0)
 	{
-		face->data().mParams[af_Median] = 2;
+		params[af_Median] = 2;
 	}
 
 }
 
 
+static void CommitZoneResult(Pmwx::Face_handle face, const zone_face_result_t& r)
+{
+	for(GISParamMap::const_iterator p = r.params.begin(); p != r.params.end(); ++p)
+		face->data().mParams[p->first] = p->second;
+
+	if(!r.complete)
+		return;
+
+	if(r.zone != NO_VALUE)
+	{
+		face->data().SetZoning(r.zone);
+		int wanted_terrain = gZoningInfo[r.zone].terrain_type;
+		if(wanted_terrain != NO_VALUE)
+			face->data().mTerrainType = wanted_terrain;
+	}
+
+	// FEATURE ASSIGNMENT - first go and assign any features we might have.
+	face->data().mTemp1 = NO_VALUE;
+	face->data().mTemp2 = 0;
+}
+
 void	ZoneManMadeAreas(
 				Pmwx& 				ioMap,
 				const DEMGeo&		inElev,
@@ -1088,6 +1170,7 @@ void	ZoneManMadeAreas(
 				Pmwx::Face_handle	inDebug,
 				ProgressFunc		inProg)
 {
+	StPerfScope	profile("ZoneManMadeAreas");
 		Pmwx::Face_iterator face;
 
 	PROGRESS_START(inProg, 0, 3, "Zoning terrain...")
@@ -1116,23 +1199,52 @@ void	ZoneManMadeAreas(
 	/*****************************************************************************
 	 * PASS 1 - ZONING ASSIGNMENT VIA LAD USE DATA + FEATURES
 	 *****************************************************************************/
-	for (face = ioMap.faces_begin(); face != ioMap.faces_end(); ++face, ++ctr)
+	vector<Pmwx::Face_handle>	work;
+	for (face = ioMap.faces_begin(); face != ioMap.faces_end(); ++face)
 	if (!face->is_unbounded())
 	if(!face->data().IsWater())
 	if(inDebug == Pmwx::Face_handle() || face == inDebug)
+		work.push_back(face);
+
+	// Lazy exact coordinates cache their value the first time they are read - do that now while we are single threaded.
+	for(Pmwx::Vertex_iterator v = ioMap.vertices_begin(); v != ioMap.vertices_end(); ++v)
 	{
-		PROGRESS_CHECK(inProg, 0, 3, "Zoning terrain...", ctr, total, check)
-		ZoneOneFace(
-					ioMap,
-					inElev,
-					inLanduse,
-					inForest,
-					inPark,
-					inSlope,
-					inApts,
-					urban_density_from_lu,
-		
-			face);
+		CGAL::to_double(v->point().x());
+		CGAL::to_double(v->point().y());
+	}
+
+	vector<zone_raster_t>	samples(work.size());
+	parallel_for(0, work.size(), 16, [&](int n, int) {
+		SampleZoneRasters(inLanduse, inForest, inPark, urban_density_from_lu, work[n], samples[n]);
+	});
+
+	for(int n = 0; n < work.size(); ++n)
+	{
+		PROGRESS_CHECK(inProg, 0, 3, "Zoning terrain...", n, total, check)
+		float antenna_len = ZoneAntennaLength(samples[n], work[n]);
+		if(antenna_len > 0.0)
+			kill_antennas(ioMap, work[n], antenna_len);
+	}
+
+	// The antennas are gone, so the map holds still until the results are committed.
+	MapSnapshot					snap;
+	SnapshotMap(ioMap, snap);
+	hash_map<const void *, int>	snap_index;
+	for(int n = 0; n < snap.faces.size(); ++n)
+		snap_index[&*snap.faces[n]] = n;
+	vector<int>					snap_faces(work.size());
+	for(int n = 0; n < work.size(); ++n)
+		snap_faces[n] = snap_index[&*work[n]];
+
+	vector<zone_face_result_t>	results(work.size());
+	parallel_for(0, work.size(), 16, [&](int n, int) {
+		ZoneOneFace(inLanduse, inSlope, samples[n], snap, snap_faces[n], work[n], results[n]);
+	});
+
+	for(int n = 0; n < work.size(); ++n)
+	{
+		PROGRESS_CHECK(inProg, 0, 3, "Zoning terrain...", n + work.size(), total, check)
+		CommitZoneResult(work[n], results[n]);
 	}
 
 #define HEIGHT_SPREAD_FACTOR 0.5
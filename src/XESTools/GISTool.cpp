@@ -22,6 +22,7 @@
  */
 #include "ParamDefs.h"
 #include "PerfUtils.h"
+#include "ParallelUtils.h"
 #include "ProgressUtils.h"
 #include "AssertUtils.h"
 #include "XESInit.h"
@@ -81,8 +82,37 @@ static int DoVerbose(const vector<const char *>& args)		{	gVerbose = 1;	return 0
 static int DoQuiet(const vector<const char *>& args)		{	gVerbose = 0;	return 0;	}
 static int DoTiming(const vector<const char *>& args)		{	gTiming = 1;	return 0;	}
 static int DoNoTiming(const vector<const char *>& args)		{	gTiming = 0;	return 0;	}
+static int DoThreads(const vector<const char *>& args)		{	parallel_thread_override() = atoi(args[0]); return 0; }
 static int DoProgress(const vector<const char *>& args)		{	gProgress = ConsoleProgressFunc;	return 0;	}
 static int DoNoProgress(const vector<const char *>& args)	{	gProgress = NULL;					return 0;	}
+static int DoCache(const vector<const char *>& args)		{	GISTool_SetCacheDir(args[0]);		return 0;	}
+static int DoCacheDepend(const vector<const char *>& args)	{	return 0;	}	// Only hashed - see GISTool_Utils.cpp
+static string sProfilePath;
+static int DoProfile(const vector<const char *>& args)		{	sProfilePath = args[0]; perf_profile_enable(true);	return 0;	}
+static int DoPrefetch(const vector<const char *>& args)
+{
+	for (int n = 0; n < args.size(); ++n)
+		GISTool_Prefetch(args[n]);
+	return 0;
+}
+
+#define DoCache_HELP \
+"Usage: -cache <dir>\n"\
+"Saves the state after each expensive stage into dir, named by a hash of the commands, files and settings\n"\
+"that produced it.  Later runs skip to the last stage whose checkpoint is already there.\n"
+#define DoCacheDepend_HELP \
+"Usage: -cache_depend <file> [<file>...]\n"\
+"Does nothing, but makes stage checkpoints depend on these files - use for config files stages read\n"\
+"on their own.\n"
+#define DoProfile_HELP \
+"Usage: -profile <file>\n"\
+"Records the time and memory use of every following command and of the major phases inside them\n"\
+"(TriangulateMesh, BuildDSF...), plus counters like mesh vertices.  Written to file when the tool exits:\n"\
+"a name ending in .trace gets Chrome trace format (chrome://tracing), anything else plain JSON.\n"
+#define DoPrefetch_HELP \
+"Usage: -prefetch <file> [<file>...]\n"\
+"Reads files on a background thread so a later command (or the next tile's run) finds them in the\n"\
+"OS file cache.\n"
 
 static	GISTool_RegCmd_t		sUtilCmds[] = {
 { "-help",			0, 1, DoHelp, "Prints help info for a command.", "" },
@@ -90,8 +120,13 @@ static	GISTool_RegCmd_t		sUtilCmds[] = {
 { "-quiet",			0, 0, DoQuiet, "Disables logging messages.", "" },
 { "-timing",		0, 0, DoTiming, "Enables performance timing.", "" },
 { "-notiming",		0, 0, DoNoTiming, "Disables performance timing.", "" },
+{ "-threads",		1, 1, DoThreads, "Sets number of worker threads (0 = one per core).", "" },
 { "-progress",		0, 0, DoProgress, "Shows progress bars", "" },
 { "-noprogress",	0, 0, DoNoProgress, "Disables progress bars", "" },
+{ "-profile",		1, 1, DoProfile, "Writes a timing and memory profile.", DoProfile_HELP },
+{ "-cache",			1, 1, DoCache, "Checkpoints expensive stages in a directory.", DoCache_HELP },
+{ "-cache_depend",	1, -1, DoCacheDepend, "Makes checkpoints depend on extra files.", DoCacheDepend_HELP },
+{ "-prefetch",		1, -1, DoPrefetch, "Reads files in the background.", DoPrefetch_HELP },
 { "-selftest",		0, 0, DoSelfTest, "Self test internal algorithms.", "" },
 #if USE_CHUD
 { "-chud_start",	1, 1, DoChudStart, "Start profiling", "" },
@@ -186,6 +221,9 @@ int	main(int argc, char * argv[])
 //			printf("%d) '%s'\n", n,args[n]);
 		result = GISTool_ParseCommands(args);
 
+		if (!sProfilePath.empty() && !perf_profile_write(sProfilePath.c_str(), "GISTool"))
+			fprintf(stderr, "Could not write profile %s\n", sProfilePath.c_str());
+
 #if USE_CHUD
 		if (can_profile)	chudReleaseRemoteAccess();
 		if (can_profile)	chudCleanup();
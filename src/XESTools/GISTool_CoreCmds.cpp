@@ -339,6 +339,136 @@ static int DoOverlay(const vector<const char *>& args)
 	return 0;
 }
 
+#define DoOverlayGrid_HELP \
+"Usage: -overlay_grid <cells>\n" \
+"Cuts later -overlay and -merge operations into a grid of <cells> x <cells> pieces that are overlaid\n" \
+"on all threads and stitched back together.  0 or 1 (the default) overlays in one sweep.  Worth it\n" \
+"for dense vector imports; 2-4 cells per side is usually plenty.\n"
+
+static int DoOverlayGrid(const vector<const char *>& args)
+{
+	gMapOverlayGrid = atoi(args[0]);
+	if(gMapOverlayGrid < 0)
+	{
+		fprintf(stderr,"Overlay grid must not be negative.\n");
+		return 1;
+	}
+	if (gVerbose) printf("Overlay grid is %d cells per side.\n", gMapOverlayGrid);
+	return 0;
+}
+
+static bool overlay_check_edge_less(Halfedge_handle a, Halfedge_handle b)
+{
+	CGAL::Comparison_result r = CGAL::compare_xy(a->source()->point(), b->source()->point());
+	if(r == CGAL::EQUAL)
+		r = CGAL::compare_xy(a->target()->point(), b->target()->point());
+	return r == CGAL::SMALLER;
+}
+
+static bool overlay_check_same_face(Face_handle a, Face_handle b)
+{
+	return a->is_unbounded() == b->is_unbounded() &&
+		   a->contained() == b->contained() &&
+		   a->data().AreaMatch(b->data()) &&
+		   a->data().mParams == b->data().mParams &&
+		   a->data().mPointFeatures.size() == b->data().mPointFeatures.size() &&
+		   a->data().mPolygonFeatures.size() == b->data().mPolygonFeatures.size();
+}
+
+// Returns true if both maps have the same vertices and edges, with the same edge data and face data on each side.
+static bool overlay_check_same_map(Pmwx& one, Pmwx& grid, const char * what)
+{
+	if(one.number_of_vertices() != grid.number_of_vertices() ||
+	   one.number_of_halfedges() != grid.number_of_halfedges() ||
+	   one.number_of_faces() != grid.number_of_faces())
+	{
+		printf("%s: one sweep has %llu faces, %llu half edges, %llu vertices; the grid has %llu faces, %llu half edges, %llu vertices.\n", what,
+			(unsigned long long)one.number_of_faces(), (unsigned long long)one.number_of_halfedges(), (unsigned long long)one.number_of_vertices(),
+			(unsigned long long)grid.number_of_faces(), (unsigned long long)grid.number_of_halfedges(), (unsigned long long)grid.number_of_vertices());
+		return false;
+	}
+
+	vector<Halfedge_handle>	ho, hg;
+	for(Pmwx::Halfedge_iterator h = one.halfedges_begin(); h != one.halfedges_end(); ++h)	ho.push_back(h);
+	for(Pmwx::Halfedge_iterator h = grid.halfedges_begin(); h != grid.halfedges_end(); ++h)	hg.push_back(h);
+	sort(ho.begin(), ho.end(), overlay_check_edge_less);
+	sort(hg.begin(), hg.end(), overlay_check_edge_less);
+
+	for(int n = 0; n < ho.size(); ++n)
+	{
+		bool same_place = ho[n]->source()->point() == hg[n]->source()->point() && ho[n]->target()->point() == hg[n]->target()->point();
+		if(!same_place || !(ho[n]->data() == hg[n]->data()) || !overlay_check_same_face(ho[n]->face(), hg[n]->face()))
+		{
+			printf("%s: the maps differ at the half edge %lf,%lf -> %lf,%lf.\n", what,
+				CGAL::to_double(ho[n]->source()->point().x()), CGAL::to_double(ho[n]->source()->point().y()),
+				CGAL::to_double(ho[n]->target()->point().x()), CGAL::to_double(ho[n]->target()->point().y()));
+			return false;
+		}
+	}
+	printf("%s: the grid matches one sweep (%llu faces, %llu half edges, %llu vertices).\n", what,
+		(unsigned long long)one.number_of_faces(), (unsigned long long)one.number_of_halfedges(), (unsigned long long)one.number_of_vertices());
+	return true;
+}
+
+// Runs one overlay or merge with the given grid and prints its time and memory.  The peak is per process and never
+// goes down, so a run only raises it if it needs more than every run before it.
+static void overlay_check_run(const char * what, int grid, bool merge, Pmwx& a, Pmwx& b, Pmwx& out)
+{
+	unsigned long long	rss1, peak1, rss2, peak2;
+	perf_memory_kb(rss1, peak1);
+	unsigned long long	t1 = query_hpc();
+	gMapOverlayGrid = grid;
+	if(merge)	MapMerge(a, b, out);
+	else		MapOverlay(a, b, out);
+	unsigned long long	t2 = query_hpc();
+	perf_memory_kb(rss2, peak2);
+	printf("%s: %.3lf seconds, resident %llu -> %llu KB, peak %llu -> %llu KB.\n", what,
+		hpc_to_microseconds(t2 - t1) / 1000000.0, rss1, rss2, peak1, peak2);
+}
+
+#define DoOverlayGridCheck_HELP \
+"Usage: -overlay_grid_check <file> <cells>\n" \
+"Overlays and merges <file> onto the current map twice - once in a grid of <cells> x <cells> and once in one sweep -\n" \
+"and checks that both ways give the same map.  The current map is not changed.  Fails if the maps differ.\n" \
+"Prints the time and memory of each run.  The grid runs first, so its peak is measured from a clean start; the\n" \
+"one-sweep peak only shows where it goes above the grid's.\n"
+
+static int DoOverlayGridCheck(const vector<const char *>& args)
+{
+	int cells = atoi(args[1]);
+	if(cells < 2)
+	{
+		fprintf(stderr,"The grid check needs at least 2 cells per side.\n" DoOverlayGridCheck_HELP);
+		return 1;
+	}
+	MFMemFile * load = MemFile_Open(args[0]);
+	Pmwx		theMap;
+	if (load)
+	{
+		ReadXESFile(load, &theMap, NULL, NULL, NULL, gProgress);
+		MemFile_Close(load);
+
+	} else {
+		fprintf(stderr,"Could not load file.\n");
+		return 1;
+	}
+
+	int old_grid = gMapOverlayGrid;
+	Pmwx	overlay_one, overlay_grid, merge_one, merge_grid;
+	bool	ok = true;
+
+	overlay_check_run("Overlay, grid",		cells,	false,	gMap, theMap, overlay_grid);
+	overlay_check_run("Overlay, one sweep",	0,		false,	gMap, theMap, overlay_one);
+	ok = overlay_check_same_map(overlay_one, overlay_grid, "Overlay") && ok;
+
+	overlay_check_run("Merge, grid",		cells,	true,	gMap, theMap, merge_grid);
+	overlay_check_run("Merge, one sweep",	0,		true,	gMap, theMap, merge_one);
+	ok = overlay_check_same_map(merge_one, merge_grid, "Merge") && ok;
+
+	gMapOverlayGrid = old_grid;
+	return ok ? 0 : 1;
+}
+
 static int DoMerge(const vector<const char *>& args)
 {
 	if (gVerbose) printf("Merging file %s...\n", args[0]);
@@ -3061,6 +3191,8 @@ static	GISTool_RegCmd_t		sCoreCmds[] = {
 { "-cropsave", 		1, 1, DoCropSave, 		"Save only extent as an XES file.", "" },
 { "-overlay", 		1, 1, DoOverlay, 		"Superimpose/replace a second vector map.", "" },
 { "-merge", 		1, 1, DoMerge,			"Superimpose/merge a second vector map.", "" },
+{ "-overlay_grid",	1, 1, DoOverlayGrid,	"Overlay and merge maps in a grid of cells on all threads.", DoOverlayGrid_HELP },
+{ "-overlay_grid_check",	2, 2, DoOverlayGridCheck,	"Check that a grid overlay matches one sweep.", DoOverlayGridCheck_HELP },
 { "-simplify",		0, 0, DoSimplify,		"Remove unneeded vectors.", "" },
 { "-tag_origin",	1, 1, DoTagOrigin,		"Apply origin code X to this map.", "" },
 { "-clear_debug",	0, 0, DoClearDebug,		"Clear all debug marks.", "" },
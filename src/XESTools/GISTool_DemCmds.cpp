@@ -31,6 +31,7 @@
 #include "PlatformUtils.h"
 #include "FileUtils.h"
 #include "MemFileUtils.h"
+#include "ParallelUtils.h"
 
 #if OPENGL_MAP
 #include "RF_Notify.h"
@@ -39,7 +40,7 @@
 
 
 #define DoRasterImport_HELP \
-"USAGE: raster_import <flags> <format> <file> <layer> [<null>] [<fill>] [<translation>]\n"\
+"USAGE: raster_import <flags> <format> <file> <layer> [<samples>] [<null>] [<fill>] [<translation>]\n"\
 "Imports a single raster file.  The file must be in geographic projection\n"\
 "and have an axis-aligned bounding box.\n"\
 "Flagged special ops (done in this order):\n"\
@@ -55,6 +56,8 @@
 " a GeoTiff only - allow DEM to be area data if file contains area data.\n"\
 " a bil/hgt only - force area-style DEM.  Otherwise area/point comes from the particular .hdr file.\n"\
 " l force DEM location to current bounding box.\n"\
+" w GeoTiff only - read only the part of the file inside the current bounding box.\n"\
+" r GeoTiff only - like w, but resample to <samples> x <samples> posts covering the bounding box.\n"\
 "Format can be one of: \n"\
 "tiff\n"\
 "hgt\n"\
@@ -91,6 +94,8 @@ static int DoRasterImport(const vector<const char *>& args)
 		dem = &gDem[layer];
 	}
 	
+	int var_param = 4;
+
 	if(strcmp(args[1],"ascii") == 0)
 	{
 		if(!ReadARCASCII(*dem,args[2]))
@@ -100,6 +105,27 @@ static int DoRasterImport(const vector<const char *>& args)
 			return 1;
 		}
 	}
+	else if(strcmp(args[1],"tiff") == 0 && (strstr(args[0],"w") || strstr(args[0],"r")))
+	{
+		int samples = 0;
+		if(strstr(args[0],"r"))
+		{
+			if(args.size() <= var_param)
+			{
+				fprintf(stderr,"The r flag needs a <samples> argument.\n" DoRasterImport_HELP);
+				if(kill) delete kill;
+				return 1;
+			}
+			samples = atoi(args[var_param]);
+			++var_param;
+		}
+		if(!ExtractGeoTiffWindow(*dem, args[2], mode, gMapWest, gMapSouth, gMapEast, gMapNorth, samples, samples))
+		{
+			if(strstr(args[0],"i")) return 0;
+			fprintf(stderr,"Unable to read GeoTiff file %s\n", args[2]);
+			return 1;
+		}
+	}
 	else if(strcmp(args[1],"tiff") == 0)
 	{
 		if(!ExtractGeoTiff(*dem, args[2], mode, strstr(args[0],"l") != NULL))
@@ -190,8 +216,6 @@ static int DoRasterImport(const vector<const char *>& args)
 		dem->mSouth=round(dem->mSouth);
 	}
 
-	int var_param = 4;
-
 	if(strstr(args[0],"n"))
 	{
 		float n = atof(args[var_param]); 
@@ -745,6 +769,195 @@ static int DoRasterWatershed(const vector<const char *>& args)
 
 }
 
+#define DoRasterStorage_HELP \
+"Usage: -raster_storage <layer> <type>\n" \
+"Sets how a raster layer is stored in XES files.  Type is one of:\n" \
+"float32 - the default, lossless.\n" \
+"float16 - half precision, for coarse climate data.  Values over 65504 won't fit.\n" \
+"uint16  - whole numbers from 0 to 65534.\n" \
+"uint8   - whole numbers from 0 to 254, e.g. land use enums.\n" \
+"auto    - the smallest of uint8, uint16, float32 that holds the layer exactly.\n" \
+"A layer that does not fit its storage type is saved as float32.  Tools that predate packed\n" \
+"layers skip packed layers when they load the file.\n"
+static int DoRasterStorage(const vector<const char *>& args)
+{
+	int layer = LookupToken(args[0]);
+	if (layer == -1 || gDem.count(layer) == 0)
+	{
+		fprintf(stderr,"Layer %s unknown or not initialized.\n", args[0]);
+		return 1;
+	}
+	DEMGeo& dem = gDem[layer];
+	int storage;
+	if      (!strcmp(args[1],"float32"))	storage = dem_Storage_Float32;
+	else if (!strcmp(args[1],"float16"))	storage = dem_Storage_Float16;
+	else if (!strcmp(args[1],"uint16"))		storage = dem_Storage_UInt16;
+	else if (!strcmp(args[1],"uint8"))		storage = dem_Storage_UInt8;
+	else if (!strcmp(args[1],"auto"))		storage = DEMGeo_MinimalStorage(dem);
+	else
+	{
+		fprintf(stderr,"Unknown storage type %s.\n", args[1]);
+		return 1;
+	}
+	if (!DEMGeo_StorageFits(dem, storage))
+	{
+		fprintf(stderr,"Layer %s does not fit in %s.\n", args[0], args[1]);
+		return 1;
+	}
+	dem.mStorage = storage;
+	if (gVerbose)
+		printf("Layer %s: %d bytes per post.\n", args[0], dem_storage_bytes(storage));
+	return 0;
+}
+
+#define DoDemScratch_HELP \
+"Usage: -dem_scratch <dir> [<min_mb>] [<resident_mb>]\n" \
+"Allocates raster layers of at least <min_mb> (default 16) from memory-mapped\n" \
+"scratch files in <dir> instead of RAM, so that cold layers can be paged out.\n" \
+"<resident_mb> caps memory used by blocks visited by the block-wise algorithms\n" \
+"(default 0 = no cap, leave it to the OS).  Only affects layers created after\n" \
+"this command.  Use 'none' for <dir> to go back to RAM."
+static int DoDemScratch(const vector<const char *>& args)
+{
+	const char * dir = strcmp(args[0],"none") ? args[0] : NULL;
+	size_t min_mb = args.size() > 1 ? atoi(args[1]) : 16;
+	size_t res_mb = args.size() > 2 ? atoi(args[2]) : 0;
+	if (!DEMGeo_SetScratchStore(dir, min_mb * 1024 * 1024, res_mb * 1024 * 1024))
+	{
+		fprintf(stderr,"Unable to use %s as DEM scratch store.\n", args[0]);
+		return 1;
+	}
+	return 0;
+}
+
+#define DoRasterBenchKernels_HELP \
+"Usage: -raster_bench_kernels [<layer>]\n" \
+"Times the DEM blur/resample kernels single-threaded and on all threads, and checks\n" \
+"them against the per-pixel reference versions.  Runs on <layer> if given, otherwise\n" \
+"on a synthetic 3601x3601 (1 arc-second SRTM) tile with some voids in it.  Use\n" \
+"-threads first to pick the thread count of the parallel run."
+
+static float bench_ref_blur_sample(const DEMGeo& src, int x, int y, int dx, int dy, const vector<float>& k, int width)
+{
+	float s = 0.0f, wt = 0.0f;
+	for(int w = -width; w <= width; ++w)
+	{
+		float e = src.get(x+w*dx,y+w*dy);
+		if(e != DEM_NO_DATA)
+		{
+			wt += k[w+width];
+			s += e * k[w+width];
+		}
+	}
+	return (wt == 0.0f) ? DEM_NO_DATA : s / wt;
+}
+
+static float bench_max_err(const DEMGeo& a, const DEMGeo& b)
+{
+	if(a.mWidth != b.mWidth || a.mHeight != b.mHeight) return 9.9e9;
+	float err = 0.0f;
+	for(int n = 0; n < a.pixel_area(); ++n)
+	{
+		if((a.mData[n] == DEM_NO_DATA) != (b.mData[n] == DEM_NO_DATA)) return 9.9e9;
+		if(a.mData[n] != DEM_NO_DATA)
+			err = max(err, fabsf(a.mData[n] - b.mData[n]));
+	}
+	return err;
+}
+
+static int DoRasterBenchKernels(const vector<const char *>& args)
+{
+	DEMGeo	src;
+	if(!args.empty())
+	{
+		int layer = LookupToken(args[0]);
+		if(layer == -1 || gDem.count(layer) == 0)
+		{
+			fprintf(stderr,"Layer %s unknown or not initialized.\n", args[0]);
+			return 1;
+		}
+		src = gDem[layer];
+	}
+	else
+	{
+		src.resize(3601,3601);
+		src.mWest = gMapWest;	src.mEast = gMapWest + 1;
+		src.mSouth = gMapSouth;	src.mNorth = gMapSouth + 1;
+		src.mPost = 1;
+		for(int y = 0; y < src.mHeight; ++y)
+		for(int x = 0; x < src.mWidth; ++x)
+			src(x,y) = 500.0f + 300.0f * sinf(x * 0.013f) * cosf(y * 0.007f) + (float) ((x * 7919 + y * 104729) % 97);
+		for(int y = 1000; y < 1200; ++y)
+		for(int x = 2000; x < 2400; ++x)
+			src(x,y) = DEM_NO_DATA;
+	}
+
+	const float sigma = 2.0f;
+	const int	radius = 2;
+	const int	ratio = 4;
+	int threads = parallel_thread_count();
+
+	DEMGeo	resamp;
+	resamp.copy_geo_from(src);
+	resamp.mPost = 0;
+	resamp.set_rez(src.x_res() / 1.5, src.y_res() / 1.5);
+	DEMGeo	coarse(resamp);
+	coarse.set_rez(src.x_res() / 4.0, src.y_res() / 4.0);
+
+	struct bench_t { const char * name; DEMGeo out[2]; double secs[2]; };
+	bench_t	b[5] = { { "GaussianBlurDEM" }, { "DownsampleDEM" }, { "UpsampleDEM" }, { "ResampleDEM" }, { "ResampleDEMmedian" } };
+
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		int saved = parallel_thread_override();
+		parallel_thread_override() = pass == 0 ? 1 : threads;
+		unsigned long long t;
+
+		// In-place kernels get their input (and resample targets their geometry) before the clock starts.
+		b[0].out[pass] = src;
+		b[3].out[pass] = resamp;
+		b[4].out[pass] = coarse;
+
+		t = query_hpc(); GaussianBlurDEM(b[0].out[pass], sigma);					b[0].secs[pass] = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+		t = query_hpc(); DownsampleDEM(src, b[1].out[pass], ratio);					b[1].secs[pass] = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+		t = query_hpc(); UpsampleDEM(b[1].out[pass], b[2].out[pass], ratio);		b[2].secs[pass] = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+		t = query_hpc(); ResampleDEM(src, b[3].out[pass]);							b[3].secs[pass] = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+		t = query_hpc(); ResampleDEMmedian(src, b[4].out[pass], radius);			b[4].secs[pass] = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+
+		parallel_thread_override() = saved;
+	}
+
+	// Per-pixel references - this is how the kernels were written before they went row-parallel.
+	DEMGeo	ref_blur(src), ref_tmp(src), ref_median(coarse);
+	int width = ceilf(sigma * 3.0f);
+	vector<float> k;
+	for(int w = -width; w <= width; ++w)
+		k.push_back((1.0 / sqrt(2.0 * M_PI * sigma * sigma)) * exp(-(double) (w * w) / (2.0 * sigma * sigma)));
+	float ksum = 0.0f;
+	for(int i = 0; i < k.size(); ++i) ksum += k[i];
+	for(int i = 0; i < k.size(); ++i) k[i] *= 1.0f / ksum;
+	for(int y = 0; y < src.mHeight; ++y)
+	for(int x = 0; x < src.mWidth; ++x)
+		ref_tmp(x,y) = bench_ref_blur_sample(src,x,y,0,1,k,width);
+	for(int y = 0; y < src.mHeight; ++y)
+	for(int x = 0; x < src.mWidth; ++x)
+		ref_blur(x,y) = bench_ref_blur_sample(ref_tmp,x,y,1,0,k,width);
+
+	double xstep = (coarse.mEast - coarse.mWest) / coarse.x_res();
+	double ystep = (coarse.mNorth - coarse.mSouth) / coarse.y_res();
+	for(int y = 0; y < coarse.mHeight; ++y)
+	for(int x = 0; x < coarse.mWidth; ++x)
+		ref_median(x,y) = src.get_median(coarse.x_to_lon(x), coarse.y_to_lat(y), xstep, ystep, radius);
+
+	printf("DEM kernel benchmark on %dx%d, %d threads.\n", src.mWidth, src.mHeight, threads);
+	for(int i = 0; i < 5; ++i)
+		printf("  %-20s %8.3lf s  %8.3lf s  (%.1fx)  max diff vs 1 thread: %g\n", b[i].name, b[i].secs[0], b[i].secs[1],
+			b[i].secs[1] > 0.0 ? b[i].secs[0] / b[i].secs[1] : 0.0, bench_max_err(b[i].out[0], b[i].out[1]));
+	printf("  GaussianBlurDEM max diff vs reference: %g\n", bench_max_err(b[0].out[1], ref_blur));
+	printf("  ResampleDEMmedian max diff vs reference: %g\n", bench_max_err(b[4].out[1], ref_median));
+	return 0;
+}
+
 #define CalcWaterSurface_HELP \
 "Usage: -calc_water_surface\n" \
 "Calculates the smooth water surface within the exfent from the raw water surface"
@@ -1040,7 +1253,7 @@ static	GISTool_RegCmd_t		sDemCmds[] = {
 { "-bulksrtm",		4, 4, DoBulkConvertSRTM,	"Bulk convert SRTM data.", "" },
 { "-markoverlay",	0, 0, DoRemember,			"Remember the current elevation as overlay.", "" },
 { "-readmask",		1, 1, DoMaskRemember,		"Remember the current elevation as overlay.", "" },
-{ "-raster_import",	4, 7, DoRasterImport,		"Import one raster DEM file.", DoRasterImport_HELP },
+{ "-raster_import",	4, 8, DoRasterImport,		"Import one raster DEM file.", DoRasterImport_HELP },
 { "-raster_export", 4, 5, DoRasterExport,		"Export one raster DEM file.", DoRasterExport_HELP }, 
 { "-raster_init",	4, 5, DoRasterInit,			"Create new empty raster layer.", DoRasterInit_HELP }, 
 { "-raster_scale",	2, 2, DoRasterScale,		"Resize a raster layer.", DoRasterScale_HELP },
@@ -1050,6 +1263,9 @@ static	GISTool_RegCmd_t		sDemCmds[] = {
 { "-raster_merge", 4, 4, DoRasterMerge,			"Merge two raster layers.", DoRasterMerge_HELP },
 { "-raster_clear", 6, 6, DoRasterClear,			"Clear a section of a raster layer", DoRasterClear_HELP },
 { "-raster_watershed", 3, 3, DoRasterWatershed,	"Calculate watersheds from one layer, dump in another", DoRasterWatershed_HELP },
+{ "-raster_storage", 2, 2, DoRasterStorage,		"Set XES storage type of a raster layer.", DoRasterStorage_HELP },
+{ "-dem_scratch",	1, 3, DoDemScratch,			"Put large raster layers in memory-mapped scratch files.", DoDemScratch_HELP },
+{ "-raster_bench_kernels", 0, 1, DoRasterBenchKernels, "Benchmark DEM blur/resample kernels.", DoRasterBenchKernels_HELP },
 { "-calc_water_surface", 0, 0, CalcWaterSurface, "Calculate water surface from raw DEM cutout of water", CalcWaterSurface_HELP },
 { "-save_normals", 1, 1, DoSaveNormals, "", "" },
 { "-applyoverlay",	0, 0, DoApply	,			"Use overlay.", "" },
@@ -24,6 +24,7 @@
 #include "GISTool_MiscCmds.h"
 #include "GISTool_Utils.h"
 #include "GISTool_Globals.h"
+#include "ParallelUtils.h"
 #include "RF_Selection.h"
 #include "DSFLib.h"
 #include "FileUtils.h"
@@ -612,15 +613,101 @@ static int DoHackTestrasterizer(const vector<const char *>& args)
 	return 0;
 }
 
+#define DoMeshErrStats_HELP \
+"Usage: -mesh_err_stats [<layer>]\n" \
+"Prints the error of the mesh against the elevation DEM.  If a layer is given (e.g. dem_Wizard)\n" \
+"the signed error of every post is stored in it for inspection.  Runs on all threads; see -threads."
+
 static int DoMeshErrStats(const vector<const char *>& s)
 {
+	DEMGeo * errs = NULL;
+	if(!s.empty())
+	{
+		int layer = LookupToken(s[0]);
+		if(layer == -1)
+		{
+			fprintf(stderr,"Unknown layer: %s\n", s[0]);
+			return 1;
+		}
+		errs = &gDem[layer];
+	}
+
 	float minv, maxv, mean, devsq;
-	int n = CalcMeshError(gTriangulationHi, gDem[dem_Elevation], minv, maxv,mean,devsq, ConsoleProgressFunc);
+	int n = CalcMeshError(gTriangulationHi, gDem[dem_Elevation], minv, maxv,mean,devsq, ConsoleProgressFunc, errs);
 
 	printf("mean=%f min=%f max=%f std dev = %f", mean, minv, maxv, devsq);
 	return 0;
 }
 
+#define DoMeshBenchDrape_HELP \
+"Usage: -mesh_bench_drape [<count>]\n" \
+"Drapes <count> (default 1000000) scattered points over the current mesh, one at a time with\n" \
+"MeshHeightAtPoint and then as one batch with MeshHeightAtPoints, and prints both timings and\n" \
+"the largest height difference.  Use -threads first to pick the thread count of the batch."
+
+static int DoMeshBenchDrape(const vector<const char *>& args)
+{
+	int count = args.empty() ? 1000000 : atoi(args[0]);
+	if(gTriangulationHi.number_of_faces() < 1 || count < 1)
+	{
+		fprintf(stderr,"Need a mesh and a positive point count.\n");
+		return 1;
+	}
+
+	Bbox2	bounds;
+	bool	first = true;
+	for(CDT::Finite_vertices_iterator v = gTriangulationHi.finite_vertices_begin(); v != gTriangulationHi.finite_vertices_end(); ++v)
+	{
+		Point2 p(cgal2ben(v->point()));
+		if(first)	bounds = Bbox2(p);
+		else		bounds += p;
+		first = false;
+	}
+
+	// Scattered points in a fixed pseudo-random order - the worst case for hint-based locates.
+	vector<Point2>	pts(count);
+	unsigned int	r = 12345;
+	for(int i = 0; i < count; ++i)
+	{
+		r = r * 1664525 + 1013904223;	double fx = (double) (r >> 8) / 16777216.0;
+		r = r * 1664525 + 1013904223;	double fy = (double) (r >> 8) / 16777216.0;
+		pts[i] = Point2(bounds.xmin() + fx * bounds.xspan(), bounds.ymin() + fy * bounds.yspan());
+	}
+
+	vector<double>	one(count), batch(count);
+	static int		hint_id = CDT::gen_cache_key();
+
+	unsigned long long t = query_hpc();
+	for(int i = 0; i < count; ++i)
+		one[i] = MeshHeightAtPoint(gTriangulationHi, pts[i].x(), pts[i].y(), hint_id);
+	double one_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+
+	t = query_hpc();
+	MeshSnapshot	snap;
+	SnapshotMesh(gTriangulationHi, snap);
+	MeshFaceGrid	grid;
+	grid.build(snap);
+	double grid_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+
+	t = query_hpc();
+	MeshHeightAtPoints(gTriangulationHi, snap, &grid, count, &*pts.begin(), &*batch.begin(), NULL, NULL);
+	double batch_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+
+	double err = 0.0;
+	for(int i = 0; i < count; ++i)
+	if(one[i] != DEM_NO_DATA && batch[i] != DEM_NO_DATA)
+		err = max(err, fabs(one[i] - batch[i]));
+	else if(one[i] != batch[i])
+		err = 9.9e9;
+
+	printf("%d points, %d faces, %d threads.\n", count, (int) gTriangulationHi.number_of_faces(), parallel_thread_count());
+	printf("  one at a time: %.3lf secs (%.0lf pts/sec)\n", one_secs, count / max(one_secs, 1.0e-6));
+	printf("  snapshot+grid: %.3lf secs\n", grid_secs);
+	printf("  batched:       %.3lf secs (%.0lf pts/sec)\n", batch_secs, count / max(batch_secs, 1.0e-6));
+	printf("  max height difference: %lf meters\n", err);
+	return 0;
+}
+
 static	GISTool_RegCmd_t		sMiscCmds[] = {
 { "-kill_bad_dsf", 1, 1, KillBadDSF,				"Delete a DSF file if its checksum fails.", "" },
 { "-showcoverage", 1, 2, DoShowCoverage,			"Show coverage of a file as text", "Given a raw 360x180 file, this prints the lat-lon of every none-black point.\n" },
@@ -637,7 +724,8 @@ static	GISTool_RegCmd_t		sMiscCmds[] = {
 { "-forest_types",	0,	1, DoDumpForests,			"Output types of forests from the spreadsaheet.", dump_forests_HELP },
 { "-make_terrain_package", 1, 1, DoMakeTerrainPackage, "Create or update a terrain package based on the spreadsheets.", make_terrain_package_HELP },
 { "-test_terrain_package", 1, 1, DoTestTerrainPackage, "Check a terrain package based on the spreadsheets.", test_terrain_package_HELP },
-{ "-mesh_err_stats", 0, 0, DoMeshErrStats,			"Print statistics about mesh error.", "" },
+{ "-mesh_err_stats", 0, 1, DoMeshErrStats,			"Print statistics about mesh error.", DoMeshErrStats_HELP },
+{ "-mesh_bench_drape", 0, 1, DoMeshBenchDrape,		"Benchmark batched mesh draping.", DoMeshBenchDrape_HELP },
 #if OPENGL_MAP
 { "-clear_block",		   0, 0, DoClear, "", "" },
 #endif
@@ -37,6 +37,15 @@
 #include "GISUtils.h"
 #include "AptIO.h"
 #include "MapCreate.h"
+#include "ParallelUtils.h"
+
+// Airports are processed one per thread; the DEV map build draws debug geometry from the airport code, which
+// is not thread safe, so it runs them in order.
+#if DEV && OPENGL_MAP
+#define APT_THREADED 0
+#else
+#define APT_THREADED 1
+#endif
 
 
 /*
@@ -132,6 +141,20 @@ static int DoAptImport(const vector<const char *>& args)
 	return 0;
 }
 
+static int DoAptStoreImport(const vector<const char *>& args)
+{
+	gApts.clear();
+	gAptIndex.clear();
+
+	Bbox2	tile(gMapWest, gMapSouth, gMapEast, gMapNorth);
+	string err = ReadAptStore(args[0], tile, gApts);
+	if (!err.empty()) { fprintf(stderr,"Error importing %s: %s\n", args[0], err.c_str()); return 1; }
+	if (gVerbose)
+		printf("Loaded %llu airports for %d,%d -> %d,%d from %s\n", (unsigned long long) gApts.size(), gMapWest, gMapSouth, gMapEast, gMapNorth, args[0]);
+
+	IndexAirports(gApts,gAptIndex);
+	return 0;
+}
 
 static int DoAptExport(const vector<const char *>& args)
 {
@@ -203,6 +226,14 @@ static int DoAptBulkExport(const vector<const char *>& args)
 		if (gProgress)	gProgress(0, 1, "Indexing apt.dat", (double) (y+90) / 180.0);
 	}
 	if (gProgress)		gProgress(0, 1, "Indexing apt.dat", 1.0);
+
+	char	path[1024];
+	sprintf(path, "%sapt.idx", args[0]);
+	if (!WriteAptStore(path, gApts, LATEST_APT_VERSION))
+	{
+		fprintf(stderr,"Could not write airport store %s.\n", path);
+		return 1;
+	}
 	return 0;
 }
 
@@ -262,16 +293,18 @@ static int DoAptInfo(const vector<const char *>& args)
 
 static int DoAptGenBounds(const vector<const char *>& args)
 {
-	for(int n = 0; n < gApts.size(); ++n)
-	{
-		if(gProgress)
-		if ((n % 100) == 0)
-			gProgress(0, 1, "Processing airports", (float) n / (float) gApts.size());
+	int total = gApts.size();
+	atomic<int>	done(0);
+	parallel_for(0, total, APT_THREADED ? 1 : max(total, 1), [&](int n, int worker) {
+		int d = done++;
+		if(gProgress && worker == 0)
+		if ((d % 100) == 0)
+			gProgress(0, 1, "Processing airports", (float) d / (float) total);
 		GenBoundary(&gApts[n]);
 		#if OPENGL_MAP
 			GenerateOGL(&gApts[n]);
 		#endif
-	}
+	});
 	if(gProgress)
 			gProgress(0, 1, "Processing airports", 1.0);
 	return 0;
@@ -345,11 +378,18 @@ static int DoAptTest(const vector<const char *>& args)
 	int ok = 0;
 	int bad = 0;
 	set<int>	bad_idx;
-	for (int a = 0; a < gApts.size(); ++a)
-	{
+
+	// Each airport is cut into its own empty map, so they are tested on all threads.  Failures are
+	// noted per airport and reported in airport order once everyone is done.
+	int total = gApts.size();
+	vector<char>	failed(total, 0);
+	vector<string>	why(total);
+	atomic<int>		done(0);
+	parallel_for(0, total, APT_THREADED ? 1 : max(total, 1), [&](int a, int worker) {
+		int d = done++;
 		try {
-			if ((a % 100) == 0)
-				gProgress(0, 1, "Processing airports", (float) a / (float) gApts.size());
+			if (worker == 0 && (d % 100) == 0)
+				gProgress(0, 1, "Processing airports", (float) d / (float) total);
 			Pmwx		victim;
 			AptVector	one;
 			DEMGeo		foo(4,4);
@@ -376,36 +416,33 @@ static int DoAptTest(const vector<const char *>& args)
 			ProcessAirports(one, victim, foo, bar, false, false, false, NULL);
 //			if (gVerbose) printf("OK '%s' %s\n",
 //				gApts[a].icao.c_str(), gApts[a].name.c_str());
-			++ok;
 		} catch (const char * msg) {
-			if (gVerbose)
-				printf("Assertion failure stopped airport: %s\n", msg);
-			++bad;
-			bad_idx.insert(a);
-			if (gVerbose)
-				printf("There was a problem with the airport '%s' %s\n",
-					gApts[a].icao.c_str(), gApts[a].name.c_str());
-
+			failed[a] = 1;
+			why[a] = string("Assertion failure stopped airport: ") + msg;
 		} catch (exception& e) {
-			if (gVerbose)
-				printf("Exception stopped airport: %s\n", e.what());
-			++bad;
-			bad_idx.insert(a);
-			if (gVerbose)
-				printf("There was a problem with the airport '%s' %s\n",
-					gApts[a].icao.c_str(), gApts[a].name.c_str());
-
-
+			failed[a] = 1;
+			why[a] = string("Exception stopped airport: ") + e.what();
 		} catch (...) {
-			if (gVerbose)
-				printf("Unknown Exception stopped airport.\n");
-			++bad;
-			bad_idx.insert(a);
-			if (gVerbose)
-				printf("There was a problem with the airport '%s' %s\n",
-					gApts[a].icao.c_str(), gApts[a].name.c_str());
+			failed[a] = 1;
+			why[a] = "Unknown Exception stopped airport.";
+		}
+	});
+
+	for (int a = 0; a < total; ++a)
+	if (failed[a])
+	{
+		++bad;
+		bad_idx.insert(a);
+		if (gVerbose)
+		{
+			printf("%s\n", why[a].c_str());
+			printf("There was a problem with the airport '%s' %s\n",
+				gApts[a].icao.c_str(), gApts[a].name.c_str());
 		}
 	}
+	else
+		++ok;
+
 	printf("%d OK, %d bad.\n", ok, bad);
 
 	if (!bad_idx.empty())
@@ -456,7 +493,8 @@ static	GISTool_RegCmd_t		sObsCmds[] = {
 			"arsr   Import an FAA ARSR file from the digital aero chart suplement (DAC) - pull out the arsr data from asr.dat.\n" },
 { "-apt", 			1, -1, DoAptImport, 			"Import airport data.", "-apt <file>\nClear loaded airports and load from this file." },
 { "-aptwrite", 		1, 1, DoAptExport, 			"Export airport data.", "-aptwrite <file>\nExports all loaded airports to one apt.dat file." },
-{ "-aptindex", 		1, 2, DoAptBulkExport, 		"Export airport data.", "-aptindex <export_dir> <grid>/\nExport all loaded airports to a directory as individual tiled apt.dat files." },
+{ "-aptindex", 		1, 2, DoAptBulkExport, 		"Export airport data.", "-aptindex <export_dir> <grid>/\nExport all loaded airports to a directory as individual tiled apt.dat files, plus an airport store (apt.idx) for -aptstore." },
+{ "-aptstore", 		1, 1, DoAptStoreImport, 	"Import airports for this tile.", "-aptstore <export_dir>/apt.idx\nClear loaded airports and load only the airports that overlap the current map extent from an airport store written by -aptindex." },
 { "-apttest", 		0, 0, DoAptTest, 			"Test airport procesing code.", "-apttest\nThis command processes each loaded airport against an empty DSF to confirm that the polygon cutting logic works.  While this isn't a perfect proxy for the real render, it can identify airport boundaries that have sliver problems (since this is done before the airport is cut into the DSF." },
 { "-aptinfo", 		0, 0, DoAptInfo, 			"Test airport procesing code.", "-apttest\nThis command prints out diagnostics about all airports." },
 { "-aptfilter",		2, 2, DoAptFilter,			"Filter airports.", "-aptfilter <810|850> <yes|no>\nFilters airports to only take ones with taxiways of a certain version and boundaries (or not).\n" },
@@ -27,6 +27,7 @@
 #include "DEMAlgs.h"
 #include "PolyRasterUtils.h"
 #include "MeshAlgs.h"
+#include "MeshSimplify.h"
 #include "ParamDefs.h"
 #include "Airports.h"
 #include "NetAlgs.h"
@@ -51,6 +52,7 @@
 #include "MapHelpers.h"
 #include "ForestTables.h"
 #include "GISUtils.h"
+#include "ParallelUtils.h"
 
 // Hack to avoid forest pre-processing - to be used to speed up --instobjs for testing AG algos when
 // we don't NEED good forest fill.
@@ -239,6 +241,25 @@ static int DoSetMeshLevel(const vector<const char *>& args)
 	return 0;
 }
 
+#define MESH_SIMPLIFY_HELP \
+"Usage: -mesh_simplify <serial|rounds|rounds_fast>\n" \
+"serial removes one vertex at a time from a global queue (the default).  rounds removes\n" \
+"independent sets of vertices, evaluated on all threads, and gives the same mesh on any\n" \
+"number of threads.  rounds_fast breaks ties by address and may vary from run to run.\n"
+static int DoSetMeshSimplify(const vector<const char *>& args)
+{
+	if(gVerbose) printf("Setting mesh simplify mode to %s\n", args[0]);
+	if(strcmp(args[0], "serial") == 0)				gMeshPrefs.simplify_mode = simplify_Serial;
+	else if(strcmp(args[0], "rounds") == 0)			gMeshPrefs.simplify_mode = simplify_Rounds;
+	else if(strcmp(args[0], "rounds_fast") == 0)	gMeshPrefs.simplify_mode = simplify_RoundsFast;
+	else
+	{
+		fprintf(stderr, "Unknown mesh simplify mode: %s\n", args[0]);
+		return 1;
+	}
+	return 0;
+}
+
 /*
 static int DoRoads(const vector<const char *>& args)
 {
@@ -424,10 +445,6 @@ static int DoInstantiateObjs(const vector<const char *>& args)
 	
 	PROGRESS_START(gProgress, 0, 2, "Creating 3-d.")
 	trim_map(gMap);
-	int idx = 0;
-	int t = gMap.number_of_faces();
-	int step = t / 100;
-	if(step < 1) step = 1;
 
 	#if OPENGL_MAP
 		bool no_sel = gFaceSelection.empty();
@@ -452,25 +469,18 @@ static int DoInstantiateObjs(const vector<const char *>& args)
 	// want it all? slow?  to test?  ok...
 	//ag_ok=1;
 
-	for(Pmwx::Face_handle f = gMap.faces_begin(); f != gMap.faces_end(); ++f, ++idx)
+	vector<Pmwx::Face_handle>	blocks;
+	for(Pmwx::Face_handle f = gMap.faces_begin(); f != gMap.faces_end(); ++f)
 	if(!f->is_unbounded())
 	if(!f->data().IsWater())
 	#if OPENGL_MAP
 	if(gFaceSelection.count(f) || no_sel)
 	#endif
-	{
-//		unsigned long long before, after;
-//		Microseconds((UnsignedWide *)&before);
-		PROGRESS_CHECK(gProgress, 0, 1, "Creating 3-d.", idx, t, step);
-		process_block(f,gTriangulationHi, ag_ok, forests, forest_index);
-//		Microseconds((UnsignedWide *)&after);
-//		double elapsed = (double) (after - before) / 1000000.0;
-//		by_zone[f->data().GetZoning()] += elapsed;
-//		int ns = count_circulator(f->outer_ccb());
-//		by_sides[ns] += elapsed;
-	}
+		blocks.push_back(f);
 
-	printf("Blocks: %d.  Split: %d. Forests: %d.  Parts: %d\n",  num_block_processed, num_blocks_with_split, num_forest_split, num_line_integ);
+	process_blocks(gMap, blocks, gTriangulationHi, ag_ok, forests, forest_index, gProgress);
+
+	printf("Blocks: %d.  Split: %d. Forests: %d.  Parts: %d\n",  num_block_processed.load(), num_blocks_with_split.load(), num_forest_split.load(), num_line_integ.load());
 	
 //	multimap<double, int> r_zone, r_sides;
 //	reverse_histo(by_zone,r_zone);
@@ -594,10 +604,165 @@ static int DoMapStats(const vector<const char*>& args)
 	return 0;
 }
 
+#define DoMapBenchSnapshot_HELP \
+"Usage: -map_bench_snapshot\n" \
+"Measures the area and perimeter of every ring of every face of the current map twice: straight off\n" \
+"the map with the exact kernel, and from a double-precision MapSnapshot.  Prints the time and the\n" \
+"growth in resident and peak memory of each path, and the largest relative area difference.  Run it\n" \
+"on a freshly loaded, dense tile - the exact path goes first so its peak is not hidden by the snapshot."
+
+static int DoMapBenchSnapshot(const vector<const char*>& args)
+{
+	unsigned long long	rss0, peak0, rss1, peak1, rss2, peak2;
+	vector<double>		exact_area, snap_area;
+	double				exact_len = 0.0, snap_len = 0.0;
+
+	perf_memory_kb(rss0, peak0);
+	unsigned long long t = query_hpc();
+	for(Pmwx::Face_iterator f = gMap.faces_begin(); f != gMap.faces_end(); ++f)
+	if(!f->is_unbounded())
+	{
+		vector<Pmwx::Ccb_halfedge_circulator>	rings;
+		rings.push_back(f->outer_ccb());
+		for(Pmwx::Hole_iterator h = f->holes_begin(); h != f->holes_end(); ++h)
+			rings.push_back(*h);
+		for(int r = 0; r < rings.size(); ++r)
+		{
+			Polygon_2	poly;
+			Pmwx::Ccb_halfedge_circulator circ(rings[r]), stop(rings[r]);
+			do {
+				poly.push_back(circ->source()->point());
+				exact_len += sqrt(CGAL::to_double(CGAL::squared_distance(circ->source()->point(), circ->target()->point())));
+			} while(++circ != stop);
+			exact_area.push_back(CGAL::to_double(poly.area()));
+		}
+	}
+	double exact_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+	perf_memory_kb(rss1, peak1);
+
+	t = query_hpc();
+	MapSnapshot	snap;
+	SnapshotMap(gMap, snap);
+	double build_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+	snap_area.resize(snap.ring_start.size() - 1);
+	for(int r = 0; r < snap_area.size(); ++r)
+	{
+		snap_area[r] = MapSnapshotRingArea(snap, r);
+		snap_len += MapSnapshotRingLength(snap, r);
+	}
+	double snap_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+	perf_memory_kb(rss2, peak2);
+
+	double err = 0.0;
+	if(exact_area.size() != snap_area.size())
+		err = 9.9e9;
+	else for(int r = 0; r < snap_area.size(); ++r)
+		err = max(err, fabs(exact_area[r] - snap_area[r]) / max(fabs(exact_area[r]), 1.0e-12));
+
+	printf("%d faces, %d rings, %d vertices.\n", (int) snap.faces.size(), (int) snap_area.size(), (int) snap.verts.size());
+	printf("  exact kernel: %.3lf secs, rss +%llu KB, peak +%llu KB\n", exact_secs, rss1 > rss0 ? rss1 - rss0 : 0ULL, peak1 - peak0);
+	printf("  snapshot:     %.3lf secs (%.3lf to build), rss +%llu KB, peak +%llu KB\n", snap_secs, build_secs, rss2 > rss1 ? rss2 - rss1 : 0ULL, peak2 - peak1);
+	printf("  max relative area difference: %g, perimeter %.9lf vs %.9lf\n", err, exact_len, snap_len);
+	return 0;
+}
+
+#define DoHydroFloodTile_HELP \
+"Usage: -hydro_flood_tile <posts>\n" \
+"Makes the river builder fill sinks in tiles of <posts> x <posts> DEM posts on all threads.  0 (the default)\n" \
+"floods the whole DEM in one pass.  Either way the result is the same; 256 is a good size.\n"
+
+static int DoHydroFloodTile(const vector<const char *>& args)
+{
+	gHydroFloodTile = atoi(args[0]);
+	if(gHydroFloodTile < 0)
+	{
+		fprintf(stderr,"Flood tile size must not be negative.\n");
+		return 1;
+	}
+	if (gVerbose) printf("Hydro flood tile is %d posts.\n", gHydroFloodTile);
+	return 0;
+}
+
+#define DoHydroBenchFlood_HELP \
+"Usage: -hydro_bench_flood [<size> [<tile>]]\n" \
+"Times sink filling and drainage on a synthetic flat river delta of <size> x <size> posts (default 1201):\n" \
+"the old FixSink pass (only up to 1201 posts - it gets very slow on flats), the priority-flood in one pass\n" \
+"on one thread, and the tiled priority-flood with <tile> posts per tile (default 256) on all threads.  Checks\n" \
+"that the two floods agree exactly.  Use -threads first to pick the thread count of the tiled run."
+
+static int DoHydroBenchFlood(const vector<const char *>& args)
+{
+	int size = args.size() > 0 ? atoi(args[0]) : 1201;
+	int tile = args.size() > 1 ? atoi(args[1]) : 256;
+	if(size < 3 || tile < 1)
+	{
+		fprintf(stderr,"Bad size or tile.\n");
+		return 1;
+	}
+
+	// A delta: a few cm of fall per post toward the sea on the south edge, gentle swells, and SRTM-style whole meters,
+	// so most of it is flats and shallow pits.
+	DEMGeo	elev(size, size), dirs(size, size);
+	elev.mWest = dirs.mWest = gMapWest;		elev.mEast = dirs.mEast = gMapWest + 1;
+	elev.mSouth = dirs.mSouth = gMapSouth;	elev.mNorth = dirs.mNorth = gMapSouth + 1;
+	for(int y = 0; y < size; ++y)
+	for(int x = 0; x < size; ++x)
+	{
+		elev(x,y) = floorf(y * 0.02f + 2.0f * sinf(x * 0.011f) * sinf(y * 0.017f) + (float) ((x * 7919 + y * 104729) % 7) * 0.15f);
+		dirs(x,y) = y < 3 ? sink_Known : sink_Unresolved;
+	}
+
+	int threads = parallel_thread_count();
+	int saved = parallel_thread_override();
+	unsigned long long t;
+
+	DEMGeo	legacy_elev(elev), legacy_dirs(dirs);
+	double	legacy_secs = 0.0;
+	int		legacy_pts = 0;
+	if(size <= 1201)
+	{
+		t = query_hpc();
+		legacy_pts = HydroFillSinks_Legacy(legacy_elev, legacy_dirs);
+		legacy_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+	}
+
+	DEMGeo	one_elev(elev), one_dirs(dirs);
+	parallel_thread_override() = 1;
+	t = query_hpc();
+	int one_pts = HydroFillSinks(one_elev, one_dirs, 0);
+	double one_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+
+	DEMGeo	tiled_elev(elev), tiled_dirs(dirs);
+	parallel_thread_override() = threads;
+	t = query_hpc();
+	int tiled_pts = HydroFillSinks(tiled_elev, tiled_dirs, tile);
+	double tiled_secs = hpc_to_microseconds(query_hpc() - t) / 1000000.0;
+	parallel_thread_override() = saved;
+
+	int diffs = 0, legacy_invalid = 0, invalid = 0;
+	for(int n = 0; n < elev.pixel_area(); ++n)
+	{
+		if(one_elev.mData[n] != tiled_elev.mData[n] || one_dirs.mData[n] != tiled_dirs.mData[n])	++diffs;
+		if(legacy_dirs.mData[n] == sink_Invalid)	++legacy_invalid;
+		if(one_dirs.mData[n] == sink_Invalid)		++invalid;
+	}
+
+	printf("Sink fill benchmark on a %dx%d flat delta, %d threads.\n", size, size, threads);
+	if(size <= 1201)
+		printf("  FixSink (old)       %8.3lf s  %d search steps, %d points left sink_Invalid\n", legacy_secs, legacy_pts, legacy_invalid);
+	else
+		printf("  FixSink (old)       skipped\n");
+	printf("  priority-flood      %8.3lf s  %d points raised, %d points left sink_Invalid\n", one_secs, one_pts, invalid);
+	printf("  tiled (%4d posts)  %8.3lf s  (%.1fx)  %d points raised, %d points differ from one pass\n", tile, tiled_secs,
+		tiled_secs > 0.0 ? one_secs / tiled_secs : 0.0, tiled_pts, diffs);
+	return diffs ? 1 : 0;
+}
+
 static	GISTool_RegCmd_t		sProcessCmds[] = {
 //{ "-roads",			0, 0, DoRoads,			"Generate Fake Roads.",				  "" },
 { "-spreadsheet",	1, 2, DoSpreadsheet,	"Set the spreadsheet file.",		  "" },
 { "-mesh_level",	1, 1, DoSetMeshLevel,	"Set mesh complexity.",				  "" },
+{ "-mesh_simplify",	1, 1, DoSetMeshSimplify,	"Set constraint simplify mode.",	  MESH_SIMPLIFY_HELP },
 { "-upsample", 		0, 0, DoUpsample, 		"Upsample environmental parameters.", "" },
 { "-calcslope", 	0, 1, DoCalcSlope, 		"Calculate slope derivatives.", 	  "" },
 { "-calcmesh", 		1, 1, DoCalcMesh, 		"Calculate Terrain Mesh.", 	 		  "" },
@@ -614,6 +779,9 @@ static	GISTool_RegCmd_t		sProcessCmds[] = {
 { "-assignterrain", 1, 1, DoAssignLandUse, 	"Assign Terrain to Mesh.", 	 		 "" },
 { "-exportdsf", 	2, 2, DoBuildDSF, 		"Build DSF file.", 					  "" },
 { "-mapstats", 	0, 0, DoMapStats, 	"Dump Map statistics.", 				  "" },
+{ "-map_bench_snapshot", 0, 0, DoMapBenchSnapshot, "Benchmark map reads with and without a snapshot.", DoMapBenchSnapshot_HELP },
+{ "-hydro_flood_tile", 1, 1, DoHydroFloodTile, "Fill hydro sinks in tiles on all threads.", DoHydroFloodTile_HELP },
+{ "-hydro_bench_flood", 0, 2, DoHydroBenchFlood, "Benchmark hydro sink filling on a flat delta.", DoHydroBenchFlood_HELP },
 
 
 
@@ -23,8 +23,15 @@
 
 #include "GISTool_Utils.h"
 #include <map>
+#include <thread>
+#include <sys/stat.h>
 #include "PerfUtils.h"
 #include "GISTool_Globals.h"
+#include "XESIO.h"
+#include "AptAlgs.h"
+#include "MemFileUtils.h"
+#include "md5.h"
+#include "PlatformUtils.h"
 
 struct	GISTool_CmdInfo_t {
 	int						min_params;
@@ -124,6 +131,299 @@ int	GISTool_PrintHelpCommand(const char * inCommand)
 	return 0;
 }
 
+/*
+	STAGE CHECKPOINT CACHE - THEORY OF OPERATION
+
+	With -cache <dir>, expensive stages (the "stage" commands in the table below) save the whole tool state
+	(map, mesh, DEMs, airports - i.e. an XES file) into dir after they run, named by a hash of everything
+	that went into them:
+
+	- The hash of the previous state-changing command (so a stage's hash covers the whole chain before it).
+	- The command and its arguments, plus size and date of any argument that names a file.
+	- The settings the stage reads.  Settings commands (-extent, -spreadsheet...) don't change the state
+	  themselves; their hash is kept by name and only folded into the stages that list them.  Changing the
+	  spreadsheet therefore re-runs the first stage that reads it and everything after, but nothing before.
+	- GISTOOL_CHECKPOINT_VERSION, bumped by hand whenever a stage's output or the XES layout changes, so
+	  a changed binary never trusts old checkpoints (but a rebuild of the same code still does).
+
+	The whole command line is hashed before anything runs.  When we reach a run of stages (and "loader"
+	commands like -load, whose only effect is on the state) we look for the LAST command in that run whose
+	checkpoint exists and skip straight to it.  The checkpoint isn't even read until some command actually
+	needs the state, so a fully cached build only reads one XES file.
+
+	Config files a stage reads on its own aren't seen; list them with -cache_depend to fold them in.  -ifempty
+	(or anything else that skips commands) makes the hashes unpredictable, so caching stops after it.
+
+	I/O overlap: -prefetch <files> reads files on a background thread so the OS has them cached by the time a
+	later command (or the next tile's tool run, if the build script passes the next tile's inputs) opens them.
+*/
+
+enum {
+	cmd_Opaque = 0,		// Anything we know nothing about: needs the state, can't be skipped.
+	cmd_Neutral,		// Doesn't touch the state or the results (-threads, -verbose...).  Not hashed.
+	cmd_Setting,		// Sets a global input for later stages.  Hashed by name, runs even when skipping.
+	cmd_Loader,			// Only changes the state; skippable but not worth a checkpoint of its own.
+	cmd_Stage			// Only changes the state; expensive, so checkpointed.
+};
+
+struct	GISTool_CacheRule_t {
+	const char *	cmdname;
+	int				kind;
+	const char *	settings;	// For stages: space separated settings read, or NULL for all of them.
+};
+
+static GISTool_CacheRule_t	sCacheRules[] = {
+{ "-help",			cmd_Neutral,	NULL },
+{ "-verbose",		cmd_Neutral,	NULL },
+{ "-quiet",			cmd_Neutral,	NULL },
+{ "-timing",		cmd_Neutral,	NULL },
+{ "-notiming",		cmd_Neutral,	NULL },
+{ "-threads",		cmd_Neutral,	NULL },
+{ "-progress",		cmd_Neutral,	NULL },
+{ "-noprogress",	cmd_Neutral,	NULL },
+{ "-cache",			cmd_Neutral,	NULL },
+{ "-prefetch",		cmd_Neutral,	NULL },
+{ "-profile",		cmd_Neutral,	NULL },
+{ "-extent",		cmd_Setting,	NULL },
+{ "-spreadsheet",	cmd_Setting,	NULL },
+{ "-mesh_level",	cmd_Setting,	NULL },
+{ "-mesh_simplify",	cmd_Setting,	NULL },
+{ "-overlay_grid",	cmd_Setting,	NULL },
+{ "-cache_depend",	cmd_Setting,	NULL },
+{ "-load",			cmd_Loader,		NULL },
+{ "-crop",			cmd_Loader,		NULL },
+{ "-overlay",		cmd_Loader,		NULL },
+{ "-merge",			cmd_Loader,		NULL },
+{ "-simplify",		cmd_Loader,		NULL },
+{ "-calcslope",		cmd_Stage,		"-extent" },
+{ "-upsample",		cmd_Stage,		"-extent" },
+{ "-calcmesh",		cmd_Stage,		NULL },
+{ "-burnapts",		cmd_Stage,		NULL },
+{ "-protectapts",	cmd_Stage,		NULL },
+{ "-zoning",		cmd_Stage,		NULL },
+{ "-derivedems",	cmd_Stage,		NULL },
+{ "-removedupes",	cmd_Stage,		NULL },
+{ "-instobjs",		cmd_Stage,		NULL },
+{ "-buildroads",	cmd_Stage,		NULL },
+{ "-assignterrain",	cmd_Stage,		NULL },
+{ 0, 0, 0 }
+};
+
+static const GISTool_CacheRule_t * cache_rule(const char * cmdname)
+{
+	for (int n = 0; sCacheRules[n].cmdname; ++n)
+	if (strcmp(sCacheRules[n].cmdname, cmdname) == 0)
+		return sCacheRules + n;
+	return NULL;
+}
+
+// Bump this when any checkpointed stage produces different results or the XES format changes.
+#define GISTOOL_CHECKPOINT_VERSION	1
+
+static string						sCacheDir;
+static vector<std::thread>			sPrefetches;
+
+// Prefetches are joined at exit - whether main returns or a command calls exit() - since a joinable
+// std::thread must never be destroyed.  Registered after sPrefetches exists, so it runs first.
+static void	join_prefetches(void)
+{
+	for (vector<std::thread>::iterator t = sPrefetches.begin(); t != sPrefetches.end(); ++t)
+		t->join();
+	sPrefetches.clear();
+}
+
+void	GISTool_SetCacheDir(const char * inDir)
+{
+	sCacheDir = inDir;
+	if (!sCacheDir.empty() && sCacheDir[sCacheDir.size()-1] != '/' && sCacheDir[sCacheDir.size()-1] != '\\')
+		sCacheDir += DIR_STR;
+	if (gVerbose) printf("Caching stage checkpoints in %s\n", sCacheDir.c_str());
+}
+
+void	GISTool_Prefetch(const char * inPath)
+{
+	string path(inPath);
+	static bool registered = false;
+	if (!registered)
+		atexit(join_prefetches);
+	registered = true;
+	sPrefetches.push_back(std::thread([path]() {
+		FILE * fi = fopen(path.c_str(), "rb");
+		if (fi == NULL) return;
+		vector<char>	buf(1024 * 1024);
+		while (fread(&buf[0], 1, buf.size(), fi) == buf.size()) { }
+		fclose(fi);
+	}));
+}
+
+static void	md5_add(MD5_CTX& ctx, const string& s)
+{
+	// MD5Update takes at most 64k at a time; the terminating null keeps "ab","c" apart from "a","bc".
+	const char * p = s.c_str();
+	size_t		 left = s.size() + 1;
+	while (left > 0)
+	{
+		unsigned short chunk = left > 32768 ? 32768 : left;
+		MD5Update(&ctx, (unsigned char *) p, chunk);
+		p += chunk;
+		left -= chunk;
+	}
+}
+
+static string	md5_hex(MD5_CTX& ctx)
+{
+	MD5Final(&ctx);
+	char hex[33];
+	for (int n = 0; n < 16; ++n)
+		sprintf(hex + n * 2, "%02x", ctx.digest[n]);
+	return string(hex, 32);
+}
+
+// Command, args, and size/date of any arg that is a file.
+static void	md5_add_command(MD5_CTX& ctx, const char * cname, const vector<const char *>& args)
+{
+	md5_add(ctx, cname);
+	for (int n = 0; n < args.size(); ++n)
+	{
+		md5_add(ctx, args[n]);
+		struct stat ss;
+		if (stat(args[n], &ss) == 0 && S_ISREG(ss.st_mode))
+		{
+			char sig[64];
+			sprintf(sig, "%llu/%llu", (unsigned long long) ss.st_size, (unsigned long long) ss.st_mtime);
+			md5_add(ctx, sig);
+		}
+	}
+}
+
+static string	cache_path(const string& hash)
+{
+	return sCacheDir + hash + ".xes";
+}
+
+static bool	cache_has(const string& hash)
+{
+	struct stat ss;
+	return stat(cache_path(hash).c_str(), &ss) == 0;
+}
+
+static void	cache_save(const string& hash, const char * cname)
+{
+	string path = cache_path(hash);
+	string temp = path + ".tmp";
+	if (gVerbose) printf("Checkpointing %s as %s\n", cname, path.c_str());
+	WriteXESFile(temp.c_str(), gMap, gTriangulationHi, gDem, gApts, gProgress);
+	if (rename(temp.c_str(), path.c_str()) != 0)
+		fprintf(stderr, "Could not write checkpoint %s\n", path.c_str());
+}
+
+static bool	cache_load(const string& hash)
+{
+	string path = cache_path(hash);
+	MFMemFile * load = MemFile_Open(path.c_str());
+	if (load == NULL)
+	{
+		fprintf(stderr, "Could not load checkpoint %s.\n", path.c_str());
+		return false;
+	}
+	if (gVerbose) printf("Loading checkpoint %s\n", path.c_str());
+	gMap.clear();
+	gDem.clear();
+	gApts.clear();
+	gTriangulationHi.clear();
+	ReadXESFile(load, &gMap, &gTriangulationHi, &gDem, &gApts, gProgress);
+	IndexAirports(gApts, gAptIndex);
+	MemFile_Close(load);
+	return true;
+}
+
+struct	GISTool_ParsedCmd_t {
+	const char *			cname;
+	GISTool_Command_f		cmd;
+	vector<const char *>	args;
+	int						kind;
+	string					hash;		// Hash of the state after this command, if it is a loader or stage.
+};
+
+static int	run_command(GISTool_ParsedCmd_t& c)
+{
+	printf("Doing: %s ",c.cname);
+	for (int n = 0; n < c.args.size(); ++n)
+		printf("%s ",c.args[n]);
+	printf("\n");
+
+	try {
+		StPerfScope		profile(c.cname);
+		StElapsedTime * timer = (gTiming ? new StElapsedTime(c.cname) : NULL);
+		int result = c.cmd(c.args);
+		delete timer;
+		return result;
+	} catch(const char * msg) {
+		printf("Caught: %s\n", msg);
+		return 1;
+	} catch(exception& x) {
+		printf("%s\n",x.what());
+		return 1;
+	}
+}
+
+static int	run_commands(vector<GISTool_ParsedCmd_t>& cmds)
+{
+	bool	have_state = true;		// False while the state lives only in the checkpoint 'pending'.
+	string	pending;
+	bool	cache_ok = true;		// Cleared once anything skips commands behind our back.
+
+	for (int i = 0; i < cmds.size(); ++i)
+	{
+		if (sSkip > 0)
+		{
+			--sSkip;
+			cache_ok = false;
+			continue;
+		}
+
+		int kind = cmds[i].kind;
+		if (!sCacheDir.empty() && cache_ok && (kind == cmd_Loader || kind == cmd_Stage))
+		{
+			int last = -1;
+			for (int j = i; j < cmds.size() && cmds[j].kind != cmd_Opaque; ++j)
+			if (cmds[j].kind == cmd_Stage && cache_has(cmds[j].hash))
+				last = j;
+
+			if (last != -1)
+			{
+				for (int j = i; j <= last; ++j)
+				if (cmds[j].kind == cmd_Neutral || cmds[j].kind == cmd_Setting)
+				{
+					int result = run_command(cmds[j]);
+					if (result != 0) return result;
+				}
+				else
+					printf("Cached: %s\n", cmds[j].cname);
+
+				pending = cmds[last].hash;
+				have_state = false;
+				i = last;
+				continue;
+			}
+		}
+
+		if (!have_state && kind != cmd_Neutral && kind != cmd_Setting)
+		{
+			if (!cache_load(pending))
+				return 1;
+			have_state = true;
+		}
+
+		int result = run_command(cmds[i]);
+		if (result != 0) return result;
+
+		if (!sCacheDir.empty() && cache_ok && sSkip == 0 && kind == cmd_Stage)
+			cache_save(cmds[i].hash, cmds[i].cname);
+	}
+	return 0;
+}
+
 int	GISTool_ParseCommands(const vector<const char *>& args)
 {
 	int n = 0;
@@ -131,6 +431,9 @@ int	GISTool_ParseCommands(const vector<const char *>& args)
 	int					minp;
 	int					maxp;
 	const char *		cname;
+
+	vector<GISTool_ParsedCmd_t>	cmds;
+
 	while (n < args.size())
 	{
 		cname = args[n];
@@ -139,44 +442,63 @@ int	GISTool_ParseCommands(const vector<const char *>& args)
 			fprintf(stderr, "Command %s not known.\n", cname);
 			return 1;
 		} else {
-			printf("Doing: %s ",cname);
 			++n;
-			vector<const char *> cmdargs;
-			while (n < args.size() && !GISTool_IsCommand(args[n]) && (maxp == -1 || cmdargs.size() < maxp))
+			GISTool_ParsedCmd_t	c;
+			c.cname = cname;
+			c.cmd = cmd;
+			while (n < args.size() && !GISTool_IsCommand(args[n]) && (maxp == -1 || c.args.size() < maxp))
 			{
-				printf("%s ",args[n]);
-				cmdargs.push_back(args[n]);
+				c.args.push_back(args[n]);
 				++n;
 			}
-			printf("\n");
 
-			if (cmdargs.size() < minp || cmdargs.size() > maxp)
+			if (c.args.size() < minp || c.args.size() > maxp)
 			{
 				fprintf(stderr, "%s - needs %d-%d args, got %llu args.\n",
-					cname, minp, maxp, (unsigned long long)cmdargs.size());
+					cname, minp, maxp, (unsigned long long)c.args.size());
 				return 1;
-			} else {
-				if(sSkip > 0)
-				{
-					--sSkip;
-				}
-				else
-				{
-					try {
-						StElapsedTime * timer = (gTiming ? new StElapsedTime(cname) : NULL);
-						int result = cmd(cmdargs);
-						delete timer;
-						if (result != 0) return result;
-					} catch(const char * msg) {
-						printf("Caught: %s\n", msg);
-						return 1;
-					} catch(exception& x) {
-						printf("%s\n",x.what());
-						return 1;
-					}	
-				}
 			}
+			const GISTool_CacheRule_t * rule = cache_rule(cname);
+			c.kind = rule ? rule->kind : cmd_Opaque;
+			cmds.push_back(c);
 		}
 	}
-	return 0;
+
+	// Hash the whole chain up front so we can look ahead for checkpoints.
+	MD5_CTX			ctx;
+	MD5Init(&ctx);
+	char			version[64];
+	snprintf(version, sizeof(version), "GISTool checkpoint %d", GISTOOL_CHECKPOINT_VERSION);
+	md5_add(ctx, version);
+	string			chain = md5_hex(ctx);
+	map<string, string>	settings;
+
+	for (int i = 0; i < cmds.size(); ++i)
+	{
+		if (cmds[i].kind == cmd_Neutral)
+			continue;
+
+		MD5Init(&ctx);
+		md5_add_command(ctx, cmds[i].cname, cmds[i].args);
+		if (cmds[i].kind == cmd_Setting)
+		{
+			// -cache_depend accumulates; other settings replace their last value.
+			string h = md5_hex(ctx);
+			string& slot(settings[cmds[i].cname]);
+			slot = (strcmp(cmds[i].cname, "-cache_depend") == 0) ? slot + h : h;
+			continue;
+		}
+
+		md5_add(ctx, chain);
+		const GISTool_CacheRule_t * rule = cache_rule(cmds[i].cname);
+		for (map<string, string>::iterator s = settings.begin(); s != settings.end(); ++s)
+		if (rule == NULL || rule->settings == NULL || strstr(rule->settings, s->first.c_str()))
+		{
+			md5_add(ctx, s->first);
+			md5_add(ctx, s->second);
+		}
+		chain = cmds[i].hash = md5_hex(ctx);
+	}
+
+	return run_commands(cmds);
 }
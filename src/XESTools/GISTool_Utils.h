@@ -70,4 +70,8 @@ int		GISTool_ParseCommands(const vector<const char *>& inArgs);
 
 void	GISTool_SetSkip(int n);
 
+// Stage checkpoint cache and background file reads - see GISTool_Utils.cpp.
+void	GISTool_SetCacheDir(const char * inDir);
+void	GISTool_Prefetch(const char * inPath);
+
 #endif /* GISTOOL_UTILS_H */